@@ -0,0 +1,427 @@
+/** -*-c++-*-
+ *  \file   swgAnimation.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgAnimation.hpp"
+#include "swgIFFReader.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <map>
+
+namespace
+{
+// Bits of the translation mask of an XFIN record telling which axes have
+// animated channels rather than static values.
+const unsigned int translationAnimated[3] = {0x08, 0x10, 0x20};
+
+// One XFIN record: where the channels of a bone live.
+struct transformInfo {
+    std::string name;
+    bool        animatedRotation;
+    int         rotationIndex;
+    int         translationMask;
+    int         translationIndex[3];
+};
+
+// Index of the first of keys after frame.
+template <class key>
+unsigned int findKey(const std::vector<key>& keys, float frame)
+{
+    return std::upper_bound(keys.begin(),
+                            keys.end(),
+                            frame,
+                            [](float f, const key& k) { return f < k.frame; }) -
+           keys.begin();
+}
+
+// Interval a packed rotation component is spread over. Format bytes index
+// a table built per precision p from 0 to 6: intervals 2 / 2^p wide whose
+// starts step from -1 in half widths, 2 * 2^p - 1 of them, so a narrow
+// interval can sit anywhere in [-1, 1].
+struct componentRange {
+    float base;
+    float width;
+};
+
+const std::vector<componentRange>& getComponentRanges()
+{
+    static const std::vector<componentRange> ranges = []() {
+        std::vector<componentRange> table;
+        for (unsigned int p = 0; p < 7; ++p) {
+            float width = 2.0f / (1 << p);
+            for (unsigned int j = 0; j + 1 < 2u << p; ++j) {
+                componentRange range = {-1.0f + j * width * 0.5f, width};
+                table.push_back(range);
+            }
+        }
+        return table;
+    }();
+    return ranges;
+}
+
+// Rotation of a CKAT file: x in the top 11 bits, y in the next 11 and z in
+// the low 10, each a fraction of the interval its format selects. w is the
+// non-negative value completing a unit quaternion.
+osg::Quat expandRotation(unsigned int packed, const unsigned int formats[3])
+{
+    const unsigned int bits[3]  = {11, 11, 10};
+    const unsigned int shift[3] = {21, 10, 0};
+
+    const std::vector<componentRange>& ranges = getComponentRanges();
+
+    float value[3];
+    float lengthSquared = 0.0f;
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        unsigned int          maxRaw = (1u << bits[axis]) - 1;
+        unsigned int          raw    = (packed >> shift[axis]) & maxRaw;
+        const componentRange& range  = ranges[std::min<size_t>(formats[axis], ranges.size() - 1)];
+
+        value[axis] = range.base + range.width * raw / maxRaw;
+        lengthSquared += value[axis] * value[axis];
+    }
+
+    float w = (lengthSquared < 1.0f) ? std::sqrt(1.0f - lengthSquared) : 0.0f;
+    return osg::Quat(value[0], value[1], value[2], w);
+}
+} // namespace
+
+swgAnimation::swgAnimation()
+    : framesPerSecond(30.0f)
+    , numFrames(1)
+{
+}
+
+/**
+ * KFAT version 0003 holds an INFO chunk with the frame rate and the number
+ * of frames, transforms and channels, an XFIN record per bone in XFRM, the
+ * animated rotation channels as QCHN chunks in AROT and the animated
+ * translation channels as CHNL chunks in ATRN. Values that never change
+ * are stored once in SROT and STRN. Locomotion and message blocks are not
+ * needed for posing and skipped.
+ *
+ * CKAT version 0001 has the same blocks with 16 bit counts, indices and
+ * frame numbers, and rotations packed into 32 bits. Each QCHN chunk and
+ * each SROT entry gives the formats of the x, y and z components ahead of
+ * the packed values, see expandRotation.
+ */
+bool swgAnimation::read(std::istream& file)
+{
+    std::string  data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    swgIFFReader iff(data);
+
+    tracks.clear();
+
+    std::string type       = iff.peek();
+    bool        compressed = ("CKAT" == type);
+    if ((!compressed && "KFAT" != type) || !iff.enterForm(type)) {
+        std::cout << "Not a KFAT or CKAT animation." << std::endl;
+        return false;
+    }
+
+    std::string version = compressed ? "0001" : "0003";
+    if (version != iff.peek()) {
+        std::cout << "Unsupported " << type << " version: " << iff.peek() << std::endl;
+        return false;
+    }
+    iff.enterForm(version);
+
+    // Counts, channel indices and frames shrink to 16 bits in CKAT.
+    auto readIndex = [&]() { return compressed ? iff.readInt16() : iff.readInt32(); };
+    auto readFrame = [&]() { return compressed ? (float)iff.readInt16() : iff.readFloat(); };
+    auto readRotation = [&](const unsigned int formats[3]) {
+        if (compressed) {
+            return expandRotation(iff.readUInt32(), formats);
+        }
+        float w = iff.readFloat();
+        float x = iff.readFloat();
+        float y = iff.readFloat();
+        float z = iff.readFloat();
+        return osg::Quat(x, y, z, w);
+    };
+
+    std::vector<transformInfo>               transforms;
+    std::vector<std::vector<rotationKey>>    rotationChannels;
+    std::vector<osg::Quat>                   staticRotations;
+    std::vector<std::vector<translationKey>> translationChannels;
+    std::vector<float>                       staticTranslations;
+    unsigned int                             formats[3] = {0, 0, 0};
+
+    while (iff.isValid() && !iff.atEnd()) {
+        std::string tag = iff.peek();
+        if ("INFO" == tag) {
+            iff.enterChunk("INFO");
+            float fps    = iff.readFloat();
+            int   frames = readIndex();
+            setFrames(fps, std::max(1, frames));
+            iff.exit();
+        }
+        else if ("XFRM" == tag) {
+            iff.enterForm("XFRM");
+            while (iff.isValid() && !iff.atEnd() && iff.enterChunk("XFIN")) {
+                transformInfo info;
+                info.name             = iff.readString();
+                info.animatedRotation = 0 != iff.readInt8();
+                info.rotationIndex    = readIndex();
+                info.translationMask  = iff.readInt8();
+                for (unsigned int axis = 0; axis < 3; ++axis) {
+                    info.translationIndex[axis] = readIndex();
+                }
+                transforms.push_back(info);
+                iff.exit();
+            }
+            iff.exit();
+        }
+        else if ("AROT" == tag) {
+            iff.enterForm("AROT");
+            while (iff.isValid() && !iff.atEnd() && iff.enterChunk("QCHN")) {
+                rotationChannels.push_back(std::vector<rotationKey>());
+                int numKeys = readIndex();
+                if (compressed) {
+                    for (unsigned int axis = 0; axis < 3; ++axis) {
+                        formats[axis] = iff.readUInt8();
+                    }
+                }
+                for (int k = 0; k < numKeys && iff.isValid(); ++k) {
+                    rotationKey key;
+                    key.frame    = readFrame();
+                    key.rotation = readRotation(formats);
+                    rotationChannels.back().push_back(key);
+                }
+                iff.exit();
+            }
+            iff.exit();
+        }
+        else if ("SROT" == tag) {
+            iff.enterChunk("SROT");
+            while (iff.isValid() && !iff.atEnd()) {
+                if (compressed) {
+                    for (unsigned int axis = 0; axis < 3; ++axis) {
+                        formats[axis] = iff.readUInt8();
+                    }
+                }
+                staticRotations.push_back(readRotation(formats));
+            }
+            iff.exit();
+        }
+        else if ("ATRN" == tag) {
+            iff.enterForm("ATRN");
+            while (iff.isValid() && !iff.atEnd() && iff.enterChunk("CHNL")) {
+                translationChannels.push_back(std::vector<translationKey>());
+                int numKeys = readIndex();
+                for (int k = 0; k < numKeys && iff.isValid(); ++k) {
+                    translationKey key;
+                    key.frame  = readFrame();
+                    key.offset = iff.readFloat();
+                    translationChannels.back().push_back(key);
+                }
+                iff.exit();
+            }
+            iff.exit();
+        }
+        else if ("STRN" == tag) {
+            iff.enterChunk("STRN");
+            while (iff.isValid() && !iff.atEnd()) {
+                staticTranslations.push_back(iff.readFloat());
+            }
+            iff.exit();
+        }
+        else {
+            iff.skip();
+        }
+    }
+
+    if (!iff.isValid()) {
+        std::cout << "Corrupt " << type << " animation." << std::endl;
+        tracks.clear();
+        return false;
+    }
+
+    for (unsigned int i = 0; i < transforms.size(); ++i) {
+        const transformInfo& info  = transforms[i];
+        unsigned int         added = addTrack(info.name);
+
+        if (info.animatedRotation && 0 <= info.rotationIndex &&
+            info.rotationIndex < (int)rotationChannels.size()) {
+            tracks[added].rotations = rotationChannels[info.rotationIndex];
+        }
+        else if (!info.animatedRotation && 0 <= info.rotationIndex &&
+                 info.rotationIndex < (int)staticRotations.size()) {
+            addRotationKey(added, 0.0f, staticRotations[info.rotationIndex]);
+        }
+
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            int index = info.translationIndex[axis];
+            if (0 != (info.translationMask & translationAnimated[axis])) {
+                if (0 <= index && index < (int)translationChannels.size()) {
+                    tracks[added].translations[axis] = translationChannels[index];
+                }
+            }
+            else if (0 <= index && index < (int)staticTranslations.size()) {
+                addTranslationKey(added, axis, 0.0f, staticTranslations[index]);
+            }
+        }
+    }
+
+    return true;
+}
+
+void swgAnimation::setFrames(float fps, unsigned int frames)
+{
+    framesPerSecond = fps;
+    numFrames       = frames;
+}
+
+double swgAnimation::getDuration() const
+{
+    if (0.0f >= framesPerSecond) {
+        return 0.0;
+    }
+    return numFrames / (double)framesPerSecond;
+}
+
+float swgAnimation::getFrame(double time) const
+{
+    double duration = getDuration();
+    if (0.0 >= duration) {
+        return 0.0f;
+    }
+
+    double looped = std::fmod(time, duration);
+    if (0.0 > looped) {
+        looped += duration;
+    }
+    return looped * framesPerSecond;
+}
+
+unsigned int swgAnimation::addTrack(const std::string& boneName)
+{
+    tracks.push_back(track());
+    tracks.back().name = boneName;
+    return tracks.size() - 1;
+}
+
+void swgAnimation::addRotationKey(unsigned int t, float frame, const osg::Quat& rotation)
+{
+    std::vector<rotationKey>& keys = tracks[t].rotations;
+
+    rotationKey key = {frame, rotation};
+    keys.insert(keys.begin() + findKey(keys, frame), key);
+}
+
+void swgAnimation::addTranslationKey(unsigned int t, unsigned int axis, float frame, float offset)
+{
+    std::vector<translationKey>& keys = tracks[t].translations[axis];
+
+    translationKey key = {frame, offset};
+    keys.insert(keys.begin() + findKey(keys, frame), key);
+}
+
+void swgAnimation::evaluate(unsigned int t,
+                            float        frame,
+                            osg::Quat&   rotation,
+                            osg::Vec3&   translation) const
+{
+    const track& current = tracks[t];
+
+    rotation = osg::Quat();
+    if (!current.rotations.empty()) {
+        const std::vector<rotationKey>& keys = current.rotations;
+
+        unsigned int next = findKey(keys, frame);
+        if (0 == next) {
+            rotation = keys.front().rotation;
+        }
+        else if (keys.size() == next) {
+            rotation = keys.back().rotation;
+        }
+        else {
+            const rotationKey& a = keys[next - 1];
+            const rotationKey& b = keys[next];
+            rotation.slerp((frame - a.frame) / (b.frame - a.frame), a.rotation, b.rotation);
+        }
+    }
+
+    translation.set(0.0f, 0.0f, 0.0f);
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        const std::vector<translationKey>& keys = current.translations[axis];
+        if (keys.empty()) {
+            continue;
+        }
+
+        unsigned int next = findKey(keys, frame);
+        if (0 == next) {
+            translation[axis] = keys.front().offset;
+        }
+        else if (keys.size() == next) {
+            translation[axis] = keys.back().offset;
+        }
+        else {
+            const translationKey& a = keys[next - 1];
+            const translationKey& b = keys[next];
+            float                 s = (frame - a.frame) / (b.frame - a.frame);
+            translation[axis]       = a.offset + (b.offset - a.offset) * s;
+        }
+    }
+}
+
+std::vector<int> swgAnimation::bind(const swgSkeleton& skeleton) const
+{
+    std::map<std::string, int> trackIndex;
+    for (unsigned int t = 0; t < tracks.size(); ++t) {
+        trackIndex[tracks[t].name] = t;
+    }
+
+    std::vector<int> binding(skeleton.getNumBones(), -1);
+    for (unsigned int bone = 0; bone < skeleton.getNumBones(); ++bone) {
+        std::map<std::string, int>::const_iterator found =
+            trackIndex.find(skeleton.getBoneNames()[bone]);
+        if (trackIndex.end() != found) {
+            binding[bone] = found->second;
+        }
+    }
+
+    return binding;
+}
+
+void swgAnimation::evaluatePose(const swgSkeleton&        skeleton,
+                                const std::vector<int>&   binding,
+                                float                     frame,
+                                std::vector<osg::Matrix>& local) const
+{
+    local.resize(skeleton.getNumBones());
+
+    osg::Quat rotation;
+    osg::Vec3 translation;
+    for (unsigned int bone = 0; bone < skeleton.getNumBones(); ++bone) {
+        if (0 > binding[bone]) {
+            local[bone] = skeleton.getBindLocal(bone);
+            continue;
+        }
+
+        evaluate(binding[bone], frame, rotation, translation);
+        local[bone] = skeleton.computeLocal(bone, rotation, translation);
+    }
+}
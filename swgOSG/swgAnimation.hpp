@@ -0,0 +1,107 @@
+/** -*-c++-*-
+ *  \file   swgAnimation.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <osg/Matrix>
+#include <osg/Quat>
+#include <osg/Vec3>
+
+#include "swgSkeleton.hpp"
+
+#ifndef SWGANIMATION_HPP
+#define SWGANIMATION_HPP
+
+/**
+ * Keyframed bone animation of a KFAT or CKAT file. Every track names the
+ * bone it moves and holds rotation keys and, per axis, translation keys,
+ * sorted by frame. A track with a single key holds that value for the
+ * whole clip.
+ */
+class swgAnimation {
+public:
+    swgAnimation();
+
+    // Read a KFAT or compressed CKAT file, replacing any tracks added so far.
+    bool read(std::istream& file);
+
+    void         setFrames(float framesPerSecond, unsigned int numFrames);
+    float        getFramesPerSecond() const { return framesPerSecond; }
+    unsigned int getNumFrames() const { return numFrames; }
+
+    // Seconds the clip takes to play once.
+    double getDuration() const;
+
+    // Frame shown time seconds into the clip, playing it in a loop.
+    float getFrame(double time) const;
+
+    unsigned int       addTrack(const std::string& boneName);
+    unsigned int       getNumTracks() const { return tracks.size(); }
+    const std::string& getTrackName(unsigned int track) const { return tracks[track].name; }
+
+    void addRotationKey(unsigned int track, float frame, const osg::Quat& rotation);
+    void addTranslationKey(unsigned int track, unsigned int axis, float frame, float offset);
+
+    // Rotation and offset from the bind position of track at frame.
+    void evaluate(unsigned int track,
+                  float        frame,
+                  osg::Quat&   rotation,
+                  osg::Vec3&   translation) const;
+
+    // Track moving each bone of skeleton, -1 for bones left in bind pose.
+    std::vector<int> bind(const swgSkeleton& skeleton) const;
+
+    // Parent relative transforms of every bone of skeleton at frame, in a
+    // single pass over the bones, given the result of bind.
+    void evaluatePose(const swgSkeleton&        skeleton,
+                      const std::vector<int>&   binding,
+                      float                     frame,
+                      std::vector<osg::Matrix>& local) const;
+
+protected:
+    struct rotationKey {
+        float     frame;
+        osg::Quat rotation;
+    };
+
+    struct translationKey {
+        float frame;
+        float offset;
+    };
+
+    struct track {
+        std::string                 name;
+        std::vector<rotationKey>    rotations;
+        std::vector<translationKey> translations[3];
+    };
+
+    float              framesPerSecond;
+    unsigned int       numFrames;
+    std::vector<track> tracks;
+};
+
+#endif
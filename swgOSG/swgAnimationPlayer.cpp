@@ -0,0 +1,188 @@
+/** -*-c++-*-
+ *  \file   swgAnimationPlayer.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgAnimationPlayer.hpp"
+#include "swgSkinningKernels.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+double getSeconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+swgAnimationPlayer::swgAnimationPlayer(swgThreadPool* threadPool, swgSkinningEngine* engine)
+    : threadPool(threadPool)
+    , engine(engine)
+    , numUpdates(0)
+    , posingSeconds(0.0)
+    , skinningSeconds(0.0)
+{
+}
+
+unsigned int swgAnimationPlayer::addCharacter(std::shared_ptr<const swgSkeleton>  skeleton,
+                                              std::shared_ptr<const swgAnimation> animation,
+                                              double                              time,
+                                              int                                 skinningInstance)
+{
+    character added;
+    added.skeleton         = skeleton;
+    added.animation        = animation;
+    added.time             = time;
+    added.speed            = 1.0f;
+    added.skinningInstance = skinningInstance;
+    characters.push_back(added);
+
+    return characters.size() - 1;
+}
+
+void swgAnimationPlayer::play(unsigned int                        c,
+                              std::shared_ptr<const swgAnimation> animation,
+                              double                              time)
+{
+    characters[c].animation = animation;
+    characters[c].time      = time;
+}
+
+void swgAnimationPlayer::update(double seconds)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Characters only share poses through the cache, so they pose in any
+    // order; the first to ask for a pose evaluates it.
+    auto poseCharacter = [this, seconds](unsigned int c) {
+        character& current = characters[c];
+        current.time += seconds * current.speed;
+        current.pose = poseCache.getPose(current.animation, current.skeleton, current.time);
+
+        if (NULL != engine && 0 <= current.skinningInstance) {
+            unsigned int instance = current.skinningInstance;
+            size_t       size     = std::min<size_t>(
+                current.pose->size(),
+                engine->getMesh(instance).getNumBones() * swgSkinningKernels::matrixSize);
+            std::copy(current.pose->begin(),
+                      current.pose->begin() + size,
+                      engine->getMatrices(instance));
+        }
+    };
+
+    if (NULL != threadPool) {
+        threadPool->parallelFor(0, characters.size(), poseCharacter);
+    }
+    else {
+        for (unsigned int c = 0; c < characters.size(); ++c) {
+            poseCharacter(c);
+        }
+    }
+    poseCache.endFrame();
+
+    posingSeconds += getSeconds(start);
+    ++numUpdates;
+
+    if (NULL != engine) {
+        start = std::chrono::steady_clock::now();
+        engine->update();
+        skinningSeconds += getSeconds(start);
+    }
+}
+
+void swgAnimationPlayer::report(std::ostream& out) const
+{
+    out << "Animation: " << characters.size() << " characters, " << numUpdates << " updates";
+    if (0 < numUpdates) {
+        out << ", " << (posingSeconds / numUpdates * 1000.0) << " ms posing and "
+            << (skinningSeconds / numUpdates * 1000.0) << " ms skinning per update";
+    }
+    out << std::endl;
+
+    poseCache.report(out);
+}
+
+void swgAnimationPlayer::benchmark(std::ostream&                      out,
+                                   swgThreadPool*                     threadPool,
+                                   std::shared_ptr<const swgSkeleton> skeleton,
+                                   const animationList&               animations,
+                                   const swgSkinningEngine::meshList& meshes,
+                                   unsigned int                       numCharacters)
+{
+    const unsigned int numFrames = 60;
+    const double       frameTime = 1.0 / 30.0;
+
+    if (NULL == skeleton.get() || animations.empty()) {
+        return;
+    }
+
+    // Extras in a crowd play a handful of clips, a few of them started
+    // together, so each clip is seen at four different times.
+    swgSkinningEngine  engine(threadPool);
+    swgAnimationPlayer player(threadPool, &engine);
+    for (unsigned int i = 0; i < numCharacters; ++i) {
+        int instance = -1;
+        if (!meshes.empty()) {
+            instance = engine.addInstance(meshes[i % meshes.size()]);
+        }
+        double start = (i / animations.size()) % 4 * 0.25;
+        player.addCharacter(skeleton, animations[i % animations.size()], start, instance);
+    }
+
+    // The first frame fills the cache and touches the skinned arrays.
+    player.update(0.0);
+    player.numUpdates      = 0;
+    player.posingSeconds   = 0.0;
+    player.skinningSeconds = 0.0;
+
+    for (unsigned int frame = 0; frame < numFrames; ++frame) {
+        player.update(frameTime);
+    }
+
+    // What posing every character on its own would cost.
+    const swgAnimation&      animation = *animations[0];
+    std::vector<int>         binding   = animation.bind(*skeleton);
+    unsigned int             numBones  = std::max(1u, skeleton->getNumBones());
+    std::vector<osg::Matrix> local;
+    std::vector<osg::Matrix> world;
+    std::vector<float>       matrices(numBones * swgSkinningKernels::matrixSize);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < numCharacters; ++i) {
+        animation.evaluatePose(*skeleton, binding, animation.getFrame(i * frameTime), local);
+        skeleton->computeWorld(local, world);
+        skeleton->computeSkinMatrices(world, &matrices[0]);
+    }
+    double unshared = getSeconds(start);
+
+    out << "Animating " << numCharacters << " characters with " << animations.size() << " clips of "
+        << skeleton->getNumBones() << " bones on "
+        << (NULL != threadPool ? threadPool->getNumThreads() : 0) << " worker threads: "
+        << (player.posingSeconds / numFrames * 1000.0) << " ms posing, "
+        << (player.skinningSeconds / numFrames * 1000.0) << " ms skinning per frame, "
+        << (unshared * 1000.0) << " ms per frame posing every character on one thread"
+        << std::endl;
+    player.report(out);
+}
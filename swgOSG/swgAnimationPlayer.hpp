@@ -0,0 +1,116 @@
+/** -*-c++-*-
+ *  \file   swgAnimationPlayer.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "swgAnimation.hpp"
+#include "swgPoseCache.hpp"
+#include "swgSkeleton.hpp"
+#include "swgSkinningEngine.hpp"
+#include "swgThreadPool.hpp"
+
+#ifndef SWGANIMATIONPLAYER_HPP
+#define SWGANIMATIONPLAYER_HPP
+
+/**
+ * Plays animations on a crowd of characters. An update advances the clip
+ * of every character and fetches its pose from a shared swgPoseCache, the
+ * characters spread over the thread pool, then skins those drawn by the
+ * skinning engine with their new poses.
+ */
+class swgAnimationPlayer {
+public:
+    typedef std::vector<std::shared_ptr<const swgAnimation>> animationList;
+
+    // threadPool may be NULL to pose on the calling thread, engine may be
+    // NULL when nothing is skinned.
+    swgAnimationPlayer(swgThreadPool* threadPool, swgSkinningEngine* engine);
+
+    /**
+     * Add a character posing skeleton with animation, time seconds into the
+     * clip, returns its index. skinningInstance is the engine instance the
+     * pose drives, -1 for none; its mesh has to be bound to skeleton.
+     */
+    unsigned int addCharacter(std::shared_ptr<const swgSkeleton>  skeleton,
+                              std::shared_ptr<const swgAnimation> animation,
+                              double                              time,
+                              int                                 skinningInstance = -1);
+    unsigned int getNumCharacters() const { return characters.size(); }
+
+    // Switch a character to another clip, time seconds into it.
+    void play(unsigned int character, std::shared_ptr<const swgAnimation> animation, double time);
+
+    // Rate the clip of a character plays at, 1 by default.
+    void setSpeed(unsigned int character, float speed) { characters[character].speed = speed; }
+
+    // Skinning matrices of a character, valid after an update.
+    std::shared_ptr<const swgPoseCache::pose> getPose(unsigned int character) const
+    {
+        return characters[character].pose;
+    }
+
+    swgPoseCache& getPoseCache() { return poseCache; }
+
+    // Advance every character by seconds, pose and skin them.
+    void update(double seconds);
+
+    void report(std::ostream& out) const;
+
+    /**
+     * Animate numCharacters characters sharing skeleton, taking turns at
+     * playing each of animations and drawing each of meshes, for a number
+     * of frames and print the time spent posing and skinning per frame.
+     * The meshes have to be bound to skeleton.
+     */
+    static void benchmark(std::ostream&                      out,
+                          swgThreadPool*                     threadPool,
+                          std::shared_ptr<const swgSkeleton> skeleton,
+                          const animationList&               animations,
+                          const swgSkinningEngine::meshList& meshes,
+                          unsigned int                       numCharacters);
+
+protected:
+    struct character {
+        std::shared_ptr<const swgSkeleton>        skeleton;
+        std::shared_ptr<const swgAnimation>       animation;
+        double                                    time;
+        float                                     speed;
+        int                                       skinningInstance;
+        std::shared_ptr<const swgPoseCache::pose> pose;
+    };
+
+    swgThreadPool*         threadPool;
+    swgSkinningEngine*     engine;
+    swgPoseCache           poseCache;
+    std::vector<character> characters;
+
+    unsigned long long numUpdates;
+    double             posingSeconds;
+    double             skinningSeconds;
+};
+
+#endif
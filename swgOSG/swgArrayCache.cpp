@@ -0,0 +1,108 @@
+/** -*-c++-*-
+ *  \file   swgArrayCache.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgArrayCache.hpp"
+#include "swgHash.hpp"
+
+#include <cstring>
+#include <string>
+
+#include <osg/PrimitiveSet>
+
+namespace
+{
+bool sameLayout(const osg::BufferData* a, const osg::BufferData* b)
+{
+    if (0 != strcmp(a->className(), b->className())) {
+        return false;
+    }
+
+    const osg::PrimitiveSet* primitivesA = dynamic_cast<const osg::PrimitiveSet*>(a);
+    const osg::PrimitiveSet* primitivesB = dynamic_cast<const osg::PrimitiveSet*>(b);
+    if (NULL != primitivesA && NULL != primitivesB) {
+        return primitivesA->getMode() == primitivesB->getMode();
+    }
+
+    return true;
+}
+} // namespace
+
+swgArrayCache::swgArrayCache()
+    : numRequests(0)
+    , numShared(0)
+    , bytesStored(0)
+    , bytesSaved(0)
+{
+}
+
+swgArrayCache::~swgArrayCache() {}
+
+osg::BufferData* swgArrayCache::shareData(osg::BufferData* data)
+{
+    // Hold a reference so a duplicate is released when we return the
+    // cached copy instead.
+    osg::ref_ptr<osg::BufferData> incoming(data);
+    if (NULL == data) {
+        return NULL;
+    }
+
+    ++numRequests;
+
+    unsigned int size = data->getTotalDataSize();
+
+    swgHash hash;
+    hash.add(std::string(data->className()));
+    const osg::PrimitiveSet* primitives = dynamic_cast<const osg::PrimitiveSet*>(data);
+    if (NULL != primitives) {
+        hash.add(primitives->getMode());
+    }
+    hash.add(size);
+    if (0 < size) {
+        hash.add(data->getDataPointer(), size);
+    }
+
+    std::vector<osg::ref_ptr<osg::BufferData>>& candidates = dataMap[hash.get()];
+    for (unsigned int i = 0; i < candidates.size(); ++i) {
+        osg::BufferData* candidate = candidates[i].get();
+        if (candidate->getTotalDataSize() == size && sameLayout(candidate, data)
+            && (0 == size
+                || 0 == memcmp(candidate->getDataPointer(), data->getDataPointer(), size))) {
+            ++numShared;
+            bytesSaved += size;
+            return candidate;
+        }
+    }
+
+    candidates.push_back(incoming);
+    bytesStored += size;
+
+    return data;
+}
+
+void swgArrayCache::report(std::ostream& out) const
+{
+    out << "Shared arrays: " << numShared << " of " << numRequests << " requests, "
+        << bytesStored << " bytes stored, " << bytesSaved << " bytes saved" << std::endl;
+}
@@ -0,0 +1,69 @@
+/** -*-c++-*-
+ *  \file   swgArrayCache.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <osg/BufferObject>
+#include <osg/ref_ptr>
+
+#ifndef SWGARRAYCACHE_HPP
+#define SWGARRAYCACHE_HPP
+
+/**
+ * Content addressed store for converted vertex attribute arrays and index
+ * lists. Meshes that carry byte identical data end up sharing one array.
+ */
+class swgArrayCache {
+public:
+    swgArrayCache();
+    ~swgArrayCache();
+
+    /**
+     * Returns the cached copy of data if an identical one was stored before,
+     * otherwise stores and returns data itself. An unreferenced duplicate is
+     * deleted, so callers must only use the returned pointer.
+     */
+    template<class T>
+    T* share(T* data)
+    {
+        return static_cast<T*>(shareData(data));
+    }
+
+    void report(std::ostream& out) const;
+
+protected:
+    osg::BufferData* shareData(osg::BufferData* data);
+
+    std::map<unsigned long long, std::vector<osg::ref_ptr<osg::BufferData>>> dataMap;
+
+    unsigned int       numRequests;
+    unsigned int       numShared;
+    unsigned long long bytesStored;
+    unsigned long long bytesSaved;
+};
+
+#endif
@@ -0,0 +1,152 @@
+/** -*-c++-*-
+ *  \file   swgBufferPool.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "swgBufferPool.hpp"
+
+swgBufferPool::swgBufferPool(unsigned int bufferSize)
+    : bufferSize(bufferSize)
+{
+}
+
+swgBufferPool::~swgBufferPool() {}
+
+void swgBufferPool::addGeometry(osg::Geometry* geometry)
+{
+    if (NULL == geometry) {
+        return;
+    }
+
+    // Gather every vertex attribute array that is not already in a buffer.
+    // Arrays shared between geometries keep the buffer they were given first.
+    std::vector<osg::Array*> arrays;
+    arrays.push_back(geometry->getVertexArray());
+    arrays.push_back(geometry->getNormalArray());
+    arrays.push_back(geometry->getColorArray());
+    for (unsigned int i = 0; i < geometry->getNumTexCoordArrays(); ++i) {
+        arrays.push_back(geometry->getTexCoordArray(i));
+    }
+
+    unsigned int vertexSize = 0;
+    for (unsigned int i = 0; i < arrays.size(); ++i) {
+        if (NULL != arrays[i] && NULL == arrays[i]->getVertexBufferObject()) {
+            vertexSize += arrays[i]->getTotalDataSize();
+        }
+    }
+
+    // Keep all arrays of one geometry in the same buffer so drawing it
+    // needs a single bind.
+    if (0 < vertexSize) {
+        osg::VertexBufferObject* vbo = allocate(vertexBuffers, vertexSize);
+        for (unsigned int i = 0; i < arrays.size(); ++i) {
+            if (NULL != arrays[i] && NULL == arrays[i]->getVertexBufferObject()) {
+                arrays[i]->setVertexBufferObject(vbo);
+            }
+        }
+    }
+
+    std::vector<osg::DrawElements*> elements;
+    unsigned int                    elementSize = 0;
+    for (unsigned int i = 0; i < geometry->getNumPrimitiveSets(); ++i) {
+        osg::DrawElements* drawElements = geometry->getPrimitiveSet(i)->getDrawElements();
+        if (NULL != drawElements && NULL == drawElements->getElementBufferObject()) {
+            elements.push_back(drawElements);
+            elementSize += drawElements->getTotalDataSize();
+        }
+    }
+
+    if (0 < elementSize) {
+        osg::ElementBufferObject* ebo = allocate(elementBuffers, elementSize);
+        for (unsigned int i = 0; i < elements.size(); ++i) {
+            elements[i]->setElementBufferObject(ebo);
+        }
+    }
+
+    geometry->setUseDisplayList(false);
+    geometry->setUseVertexBufferObjects(true);
+}
+
+template<class BufferType>
+BufferType* swgBufferPool::allocate(std::vector<pooledBuffer<BufferType>>& buffers,
+                                    unsigned int                             size)
+{
+    // Data bigger than a pool buffer gets a buffer of its own.
+    if (size > bufferSize) {
+        pooledBuffer<BufferType> dedicated;
+        dedicated.buffer   = new BufferType;
+        dedicated.used     = size;
+        dedicated.capacity = size;
+        buffers.push_back(dedicated);
+        return dedicated.buffer.get();
+    }
+
+    // Otherwise fill the most recent shared buffer until it runs out of room.
+    for (unsigned int i = buffers.size(); i > 0; --i) {
+        pooledBuffer<BufferType>& current = buffers[i - 1];
+        if (current.capacity != bufferSize) {
+            continue;
+        }
+
+        if ((current.used + size) <= current.capacity) {
+            current.used += size;
+            return current.buffer.get();
+        }
+        break;
+    }
+
+    pooledBuffer<BufferType> shared;
+    shared.buffer   = new BufferType;
+    shared.used     = size;
+    shared.capacity = bufferSize;
+    buffers.push_back(shared);
+
+    return shared.buffer.get();
+}
+
+template<class BufferType>
+void swgBufferPool::reportBuffers(std::ostream&                                 out,
+                                  const char*                                   name,
+                                  const std::vector<pooledBuffer<BufferType>>& buffers) const
+{
+    unsigned long long used      = 0;
+    unsigned long long capacity  = 0;
+    unsigned int       numArrays = 0;
+    for (unsigned int i = 0; i < buffers.size(); ++i) {
+        used += buffers[i].used;
+        capacity += buffers[i].capacity;
+        numArrays += buffers[i].buffer->getNumBufferData();
+    }
+
+    out << name << " buffers: " << buffers.size() << " holding " << numArrays << " arrays, "
+        << used << " of " << capacity << " bytes used";
+    if (0 < capacity) {
+        out << " (" << (100.0 * used / capacity) << "% full)";
+    }
+    out << std::endl;
+}
+
+void swgBufferPool::report(std::ostream& out) const
+{
+    reportBuffers(out, "Vertex", vertexBuffers);
+    reportBuffers(out, "Element", elementBuffers);
+}
@@ -0,0 +1,74 @@
+/** -*-c++-*-
+ *  \file   swgBufferPool.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <iostream>
+#include <vector>
+
+#include <osg/BufferObject>
+#include <osg/Geometry>
+
+#ifndef SWGBUFFERPOOL_HPP
+#define SWGBUFFERPOOL_HPP
+
+/**
+ * Hands out a small number of large vertex and element buffer objects and
+ * suballocates the arrays of many geometries from them. OSG packs every
+ * array attached to a buffer object into one GL buffer and draws each with
+ * its own offset, so indices stay local to their geometry.
+ */
+class swgBufferPool {
+public:
+    swgBufferPool(unsigned int bufferSize = 4 * 1024 * 1024);
+    ~swgBufferPool();
+
+    // Attach all arrays and element lists of geometry to pooled buffers.
+    void addGeometry(osg::Geometry* geometry);
+
+    unsigned int getNumVertexBuffers() const { return vertexBuffers.size(); }
+    unsigned int getNumElementBuffers() const { return elementBuffers.size(); }
+
+    void report(std::ostream& out) const;
+
+protected:
+    template<class BufferType>
+    struct pooledBuffer {
+        osg::ref_ptr<BufferType> buffer;
+        unsigned int             used;
+        unsigned int             capacity;
+    };
+
+    template<class BufferType>
+    BufferType* allocate(std::vector<pooledBuffer<BufferType>>& buffers, unsigned int size);
+
+    template<class BufferType>
+    void reportBuffers(std::ostream&                                 out,
+                       const char*                                   name,
+                       const std::vector<pooledBuffer<BufferType>>& buffers) const;
+
+    unsigned int                                        bufferSize;
+    std::vector<pooledBuffer<osg::VertexBufferObject>>  vertexBuffers;
+    std::vector<pooledBuffer<osg::ElementBufferObject>> elementBuffers;
+};
+
+#endif
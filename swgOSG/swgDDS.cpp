@@ -0,0 +1,195 @@
+/** -*-c++-*-
+ *  \file   swgDDS.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgDDS.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+namespace
+{
+// Word indices into header::words, counted after the magic.
+const unsigned int DDS_FLAGS       = 1;
+const unsigned int DDS_HEIGHT      = 2;
+const unsigned int DDS_WIDTH       = 3;
+const unsigned int DDS_PITCH       = 4;
+const unsigned int DDS_MIPMAPCOUNT = 6;
+const unsigned int DDS_PF_FLAGS    = 19;
+const unsigned int DDS_PF_FOURCC   = 20;
+const unsigned int DDS_PF_BITCOUNT = 21;
+const unsigned int DDS_CAPS2       = 27;
+const unsigned int DDS_NUM_WORDS   = 31;
+
+const unsigned int DDSD_PITCH       = 0x00000008;
+const unsigned int DDSD_MIPMAPCOUNT = 0x00020000;
+const unsigned int DDSD_LINEARSIZE  = 0x00080000;
+const unsigned int DDPF_FOURCC      = 0x00000004;
+const unsigned int DDSCAPS2_CUBEMAP = 0x00000200;
+const unsigned int DDSCAPS2_VOLUME  = 0x00200000;
+
+unsigned int makeFourCC(char a, char b, char c, char d)
+{
+    return (unsigned char)a | ((unsigned char)b << 8) | ((unsigned char)c << 16)
+           | ((unsigned int)(unsigned char)d << 24);
+}
+
+unsigned int readWord(const unsigned char* bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+}
+
+void writeWord(unsigned char* bytes, unsigned int word)
+{
+    bytes[0] = word & 0xff;
+    bytes[1] = (word >> 8) & 0xff;
+    bytes[2] = (word >> 16) & 0xff;
+    bytes[3] = (word >> 24) & 0xff;
+}
+} // namespace
+
+bool swgDDS::readHeader(std::istream& in, header& ddsHeader)
+{
+    unsigned char bytes[headerSize];
+    in.read(reinterpret_cast<char*>(bytes), headerSize);
+    if (headerSize != (unsigned int)in.gcount()) {
+        return false;
+    }
+
+    if (makeFourCC('D', 'D', 'S', ' ') != readWord(bytes)) {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < DDS_NUM_WORDS; ++i) {
+        ddsHeader.words[i] = readWord(bytes + 4 * (i + 1));
+    }
+
+    const unsigned int* words = ddsHeader.words;
+    if (0 != (words[DDS_CAPS2] & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME))) {
+        return false;
+    }
+
+    ddsHeader.width        = words[DDS_WIDTH];
+    ddsHeader.height       = words[DDS_HEIGHT];
+    ddsHeader.numMipLevels = 1;
+    if (0 != (words[DDS_FLAGS] & DDSD_MIPMAPCOUNT) && 1 < words[DDS_MIPMAPCOUNT]) {
+        ddsHeader.numMipLevels = words[DDS_MIPMAPCOUNT];
+    }
+
+    ddsHeader.blockBytes   = 0;
+    ddsHeader.bitsPerPixel = 0;
+    if (0 != (words[DDS_PF_FLAGS] & DDPF_FOURCC)) {
+        unsigned int fourCC = words[DDS_PF_FOURCC];
+        if (makeFourCC('D', 'X', 'T', '1') == fourCC) {
+            ddsHeader.blockBytes = 8;
+        }
+        else if (makeFourCC('D', 'X', 'T', '2') == fourCC
+                 || makeFourCC('D', 'X', 'T', '3') == fourCC
+                 || makeFourCC('D', 'X', 'T', '4') == fourCC
+                 || makeFourCC('D', 'X', 'T', '5') == fourCC) {
+            ddsHeader.blockBytes = 16;
+        }
+        else {
+            // DX10 headers and other compressed formats are left alone.
+            return false;
+        }
+    }
+    else {
+        ddsHeader.bitsPerPixel = words[DDS_PF_BITCOUNT];
+        if (0 == ddsHeader.bitsPerPixel || 0 != (ddsHeader.bitsPerPixel % 8)) {
+            return false;
+        }
+    }
+
+    return 0 < ddsHeader.width && 0 < ddsHeader.height;
+}
+
+unsigned int swgDDS::getLevelSize(const header& ddsHeader, unsigned int level)
+{
+    unsigned int width  = std::max(1u, ddsHeader.width >> level);
+    unsigned int height = std::max(1u, ddsHeader.height >> level);
+
+    if (0 < ddsHeader.blockBytes) {
+        return ((width + 3) / 4) * ((height + 3) / 4) * ddsHeader.blockBytes;
+    }
+
+    return width * height * (ddsHeader.bitsPerPixel / 8);
+}
+
+std::shared_ptr<std::istream> swgDDS::skipMipLevels(std::istream& in, unsigned int numLevels)
+{
+    std::streampos start = in.tellg();
+
+    header ddsHeader;
+    if (!readHeader(in, ddsHeader) || 1 >= ddsHeader.numMipLevels) {
+        in.clear();
+        in.seekg(start);
+        return std::shared_ptr<std::istream>();
+    }
+
+    // Always keep the smallest level.
+    numLevels = std::min(numLevels, ddsHeader.numMipLevels - 1);
+
+    // Seek past the skipped levels, everything after them is kept as is.
+    unsigned long long skippedBytes = 0;
+    unsigned long long keptBytes    = 0;
+    for (unsigned int i = 0; i < ddsHeader.numMipLevels; ++i) {
+        if (i < numLevels) {
+            skippedBytes += getLevelSize(ddsHeader, i);
+        }
+        else {
+            keptBytes += getLevelSize(ddsHeader, i);
+        }
+    }
+
+    in.seekg(skippedBytes, std::ios::cur);
+
+    std::string data(headerSize + keptBytes, '\0');
+    in.read(&data[headerSize], keptBytes);
+    if (keptBytes != (unsigned long long)in.gcount()) {
+        in.clear();
+        in.seekg(start);
+        return std::shared_ptr<std::istream>();
+    }
+
+    unsigned int* words    = ddsHeader.words;
+    words[DDS_WIDTH]       = std::max(1u, ddsHeader.width >> numLevels);
+    words[DDS_HEIGHT]      = std::max(1u, ddsHeader.height >> numLevels);
+    words[DDS_MIPMAPCOUNT] = ddsHeader.numMipLevels - numLevels;
+    if (0 != (words[DDS_FLAGS] & DDSD_LINEARSIZE)) {
+        words[DDS_PITCH] = getLevelSize(ddsHeader, numLevels);
+    }
+    else if (0 != (words[DDS_FLAGS] & DDSD_PITCH)) {
+        words[DDS_PITCH] = words[DDS_WIDTH] * (ddsHeader.bitsPerPixel / 8);
+    }
+
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(&data[0]);
+    writeWord(bytes, makeFourCC('D', 'D', 'S', ' '));
+    for (unsigned int i = 0; i < DDS_NUM_WORDS; ++i) {
+        writeWord(bytes + 4 * (i + 1), words[i]);
+    }
+
+    return std::shared_ptr<std::istream>(new std::istringstream(data));
+}
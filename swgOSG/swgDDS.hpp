@@ -0,0 +1,71 @@
+/** -*-c++-*-
+ *  \file   swgDDS.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <iostream>
+#include <memory>
+
+#ifndef SWGDDS_HPP
+#define SWGDDS_HPP
+
+/**
+ * Minimal DDS header handling for working on texture files before they
+ * reach the OSG plugin. Compressed data is never decoded.
+ */
+class swgDDS {
+public:
+    struct header {
+        unsigned int width;
+        unsigned int height;
+        unsigned int numMipLevels;
+
+        // Bytes per 4x4 block for DXT data, zero for uncompressed data.
+        unsigned int blockBytes;
+
+        // Bits per pixel for uncompressed data.
+        unsigned int bitsPerPixel;
+
+        // Raw header words following the magic, little endian decoded.
+        unsigned int words[31];
+    };
+
+    static const unsigned int headerSize = 128;
+
+    // Read and check the header at the current stream position. Returns
+    // false for files this class cannot handle, such as cube maps and
+    // volumes.
+    static bool readHeader(std::istream& in, header& ddsHeader);
+
+    static unsigned int getLevelSize(const header& ddsHeader, unsigned int level);
+
+    /**
+     * Return a copy of the dds file in, without its numLevels largest mip
+     * levels. Only the retained levels are read and the header is rewritten
+     * to match. Returns NULL when in has no mip chain or an unsupported
+     * format, leaving in at its original position.
+     */
+    static std::shared_ptr<std::istream> skipMipLevels(std::istream& in, unsigned int numLevels);
+};
+
+#endif
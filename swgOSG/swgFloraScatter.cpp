@@ -0,0 +1,271 @@
+/** -*-c++-*-
+ *  \file   swgFloraScatter.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgFloraScatter.hpp"
+#include "swgTerrainKernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// SplitMix64 finalizer, a strong mix of one 64 bit word.
+unsigned long long mix(unsigned long long value)
+{
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+/**
+ * Random numbers for one cell and kind of flora. The n-th number depends
+ * only on the key and n, not on what was drawn before elsewhere.
+ */
+class cellRandom {
+public:
+    cellRandom(unsigned long long seed, int cellX, int cellY, unsigned int kind)
+        : key(mix(mix(mix(seed) ^ (unsigned int)cellX) ^ ((unsigned long long)cellY << 32)
+                  ^ kind))
+        , counter(0)
+    {
+    }
+
+    // Uniform in [0, 1).
+    float next()
+    {
+        unsigned long long bits = mix(key + 0x9e3779b97f4a7c15ULL * ++counter);
+        return (bits >> 40) * (1.0f / 16777216.0f);
+    }
+
+protected:
+    unsigned long long key;
+    unsigned long long counter;
+};
+
+// Index of the sample nearest position, in samples, along count samples.
+unsigned int getNearestSample(float position, unsigned int count)
+{
+    return std::min((unsigned int)std::max(position + 0.5f, 0.0f), count - 1);
+}
+} // namespace
+
+swgFloraScatter::swgFloraScatter(const swgTerrainLayers& layers,
+                                 unsigned long long      seed,
+                                 float                   terrainSize,
+                                 float                   waterHeight,
+                                 float                   cellSize)
+    : layers(layers)
+    , seed(seed)
+    , terrainOrigin(-terrainSize / 2.0f)
+    , waterHeight(waterHeight)
+    , cellSize(cellSize)
+{
+    for (unsigned int r = 0; r < 2; ++r) {
+        const std::vector<swgTerrainLayers::floraFamily>& families =
+            (0 == r) ? layers.getFloraFamilies() : layers.getRadialFamilies();
+        familyVariants[r].resize(families.size());
+
+        for (unsigned int f = 0; f < families.size(); ++f) {
+            for (unsigned int c = 0; c < families[f].children.size(); ++c) {
+                const swgTerrainLayers::floraChild& child = families[f].children[c];
+
+                variant current;
+                current.name   = child.name;
+                current.radial = 1 == r;
+                current.family = f;
+                current.weight = std::max(child.weight, 0.0f);
+                if (current.radial) {
+                    current.minScale  = child.minWidth;
+                    current.maxScale  = child.maxWidth;
+                    current.minHeight = child.minHeight;
+                    current.maxHeight = child.maxHeight;
+                    current.uniform   = false;
+                } else {
+                    current.minScale  = current.minHeight = child.minScale;
+                    current.maxScale  = current.maxHeight = child.maxScale;
+                    current.uniform   = true;
+                }
+
+                familyVariants[r][f].push_back(variants.size());
+                variants.push_back(current);
+            }
+        }
+    }
+}
+
+void swgFloraScatter::scatter(float                                 originX,
+                              float                                 originY,
+                              float                                 size,
+                              const swgHeightGrid&                  grid,
+                              std::vector<std::vector<placement>>& placements) const
+{
+    placements.assign(variants.size(), std::vector<placement>());
+
+    unsigned int numRows    = grid.getNumRows();
+    unsigned int numColumns = grid.getNumColumns();
+    const float* heights    = grid.getHeights();
+    if (2 > numRows || 2 > numColumns || variants.empty()) {
+        return;
+    }
+
+    float spacingX = size / (numColumns - 1);
+    float spacingY = size / (numRows - 1);
+
+    // Flora families and densities of every sample of the finished tile.
+    const unsigned int numSamples = numRows * numColumns;
+    std::vector<float> normals(3 * numSamples);
+    std::vector<int>   families(swgTerrainLayers::numFloraKinds * numSamples);
+    std::vector<float> densities(swgTerrainLayers::numFloraKinds * numSamples);
+    swgTerrainKernels::computeNormals(heights, numRows, numColumns, spacingX, &normals[0]);
+    layers.applyFlora(originX,
+                      originY,
+                      spacingX,
+                      spacingY,
+                      numRows,
+                      numColumns,
+                      heights,
+                      &normals[0],
+                      &families[0],
+                      &densities[0]);
+
+    for (unsigned int kind = 0; kind < swgTerrainLayers::numFloraKinds; ++kind) {
+        const swgTerrainLayers::floraSettings& settings = layers.getFloraSettings(kind);
+        const std::vector<std::vector<unsigned int>>& kindVariants =
+            familyVariants[(swgTerrainLayers::floraRadialNear <= kind) ? 1 : 0];
+
+        float tileSize = (0.0f < settings.tileSize) ? settings.tileSize : cellSize;
+        float border   = (0.0f < settings.tileSize) ? settings.tileBorder : 0.0f;
+        float spread   = tileSize - 2.0f * border;
+
+        // Cells are numbered from the terrain origin, so a cell has the
+        // same number whichever tile it is scattered with.
+        int firstX = (int)std::ceil((originX - terrainOrigin) / tileSize);
+        int firstY = (int)std::ceil((originY - terrainOrigin) / tileSize);
+        int endX   = (int)std::ceil((originX + size - terrainOrigin) / tileSize);
+        int endY   = (int)std::ceil((originY + size - terrainOrigin) / tileSize);
+
+        for (int cellY = firstY; cellY < endY; ++cellY) {
+            for (int cellX = firstX; cellX < endX; ++cellX) {
+                // The family and density of the sample nearest the center.
+                float        centerX = terrainOrigin + (cellX + 0.5f) * tileSize;
+                float        centerY = terrainOrigin + (cellY + 0.5f) * tileSize;
+                unsigned int column  = getNearestSample((centerX - originX) / spacingX, numColumns);
+                unsigned int row     = getNearestSample((centerY - originY) / spacingY, numRows);
+                unsigned int sample  = kind * numSamples + row * numColumns + column;
+
+                int family = families[sample];
+                if (0 > family || kindVariants.size() <= (unsigned int)family
+                    || kindVariants[family].empty()) {
+                    continue;
+                }
+                const std::vector<unsigned int>& choices = kindVariants[family];
+
+                float totalWeight = 0.0f;
+                for (unsigned int i = 0; i < choices.size(); ++i) {
+                    totalWeight += variants[choices[i]].weight;
+                }
+
+                cellRandom random(seed ^ settings.seed, cellX, cellY, kind);
+
+                // Whole part always, the fraction as a chance of one more.
+                float        expected = densities[sample];
+                unsigned int count    = (unsigned int)expected;
+                if (random.next() < expected - count) {
+                    ++count;
+                }
+
+                float cellOriginX = terrainOrigin + cellX * tileSize + border;
+                float cellOriginY = terrainOrigin + cellY * tileSize + border;
+                for (unsigned int i = 0; i < count; ++i) {
+                    // Draw everything first so rejecting one placement does
+                    // not shift the numbers of the next.
+                    float x        = cellOriginX + random.next() * spread;
+                    float y        = cellOriginY + random.next() * spread;
+                    float rotation = random.next() * 6.2831853f;
+                    float scale    = random.next();
+                    float height   = random.next();
+                    float pick     = random.next();
+
+                    // Variants by weight, evenly when none has any.
+                    unsigned int choice =
+                        std::min<unsigned int>(pick * choices.size(), choices.size() - 1);
+                    if (0.0f < totalWeight) {
+                        float share = pick * totalWeight;
+                        for (choice = 0; choice + 1 < choices.size(); ++choice) {
+                            share -= variants[choices[choice]].weight;
+                            if (0.0f > share) {
+                                break;
+                            }
+                        }
+                    }
+                    const variant& current = variants[choices[choice]];
+
+                    // Bilinear height, clamped to the tile for the cells
+                    // reaching over its far edge.
+                    float fx = std::min(std::max((x - originX) / spacingX, 0.0f),
+                                        (float)(numColumns - 1));
+                    float fy = std::min(std::max((y - originY) / spacingY, 0.0f),
+                                        (float)(numRows - 1));
+
+                    unsigned int left   = std::min((unsigned int)fx, numColumns - 2);
+                    unsigned int bottom = std::min((unsigned int)fy, numRows - 2);
+                    float        u      = fx - left;
+                    float        v      = fy - bottom;
+
+                    const float* cell = heights + bottom * numColumns + left;
+                    float        h00  = cell[0];
+                    float        h10  = cell[1];
+                    float        h01  = cell[numColumns];
+                    float        h11  = cell[numColumns + 1];
+
+                    float low  = h00 + (h10 - h00) * u;
+                    float high = h01 + (h11 - h01) * u;
+                    float z    = low + (high - low) * v;
+
+                    // Nothing grows under the water table.
+                    if (z < waterHeight) {
+                        continue;
+                    }
+
+                    float scaleRange  = current.maxScale - current.minScale;
+                    float heightRange = current.maxHeight - current.minHeight;
+
+                    placement result;
+                    result.x        = x;
+                    result.y        = y;
+                    result.z        = z;
+                    result.rotation = rotation;
+                    result.scale    = current.minScale + scaleRange * scale;
+                    result.height   = current.uniform ? result.scale
+                                                      : current.minHeight + heightRange * height;
+                    placements[choices[choice]].push_back(result);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,114 @@
+/** -*-c++-*-
+ *  \file   swgFloraScatter.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <string>
+#include <vector>
+
+#include "swgHeightmapCache.hpp"
+#include "swgTerrainLayers.hpp"
+
+#ifndef SWGFLORASCATTER_HPP
+#define SWGFLORASCATTER_HPP
+
+/**
+ * Scatters the flora of a terrain's layers over its tiles. Each kind of
+ * flora divides the terrain into square cells of its flora tile size on a
+ * grid anchored at the terrain origin. The flora layers pick the family of
+ * a cell and its density at the cell center, and the placements in a cell
+ * come from a counter based random generator keyed on the seed, the cell
+ * and the kind alone. Any tile, generated on any thread in any order,
+ * therefore gets the same placements for the cells it covers.
+ */
+class swgFloraScatter {
+public:
+    // One child of a flora or radial family, drawn with one prototype.
+    struct variant {
+        // Appearance of static flora, shader of radial flora.
+        std::string name;
+
+        // Index of the family among the flora or radial families, and the
+        // relative share of the family's placements drawn as this variant.
+        bool         radial;
+        unsigned int family;
+        float        weight;
+
+        // Horizontal and vertical scale ranges, radial sizes in meters.
+        // Static flora scales uniformly.
+        float minScale;
+        float maxScale;
+        float minHeight;
+        float maxHeight;
+        bool  uniform;
+    };
+
+    struct placement {
+        float x;
+        float y;
+        float z;
+
+        // Radians about the up axis.
+        float rotation;
+        float scale;
+        float height;
+    };
+
+    /**
+     * Scatter the families of layers, which has to outlive the scatter.
+     * cellSize should divide the size of the tiles scattered over, and is
+     * used for the kinds of flora whose tile size the file does not give.
+     */
+    swgFloraScatter(const swgTerrainLayers& layers,
+                    unsigned long long      seed,
+                    float                   terrainSize,
+                    float                   waterHeight,
+                    float                   cellSize = 8.0f);
+
+    unsigned int   getNumVariants() const { return variants.size(); }
+    const variant& getVariant(unsigned int i) const { return variants[i]; }
+
+    /**
+     * Add the placements of every cell whose corner lies in the tile at
+     * originX, originY of the given size to placements, one list per
+     * variant. grid holds the tile's heights, spanning the tile edge to edge.
+     */
+    void scatter(float                                 originX,
+                 float                                 originY,
+                 float                                 size,
+                 const swgHeightGrid&                  grid,
+                 std::vector<std::vector<placement>>& placements) const;
+
+protected:
+    const swgTerrainLayers& layers;
+    unsigned long long      seed;
+    float                   terrainOrigin;
+    float                   waterHeight;
+    float                   cellSize;
+    std::vector<variant>    variants;
+
+    // Indices into variants of each flora family, then of each radial one.
+    std::vector<std::vector<unsigned int>> familyVariants[2];
+};
+
+#endif
@@ -0,0 +1,65 @@
+/** -*-c++-*-
+ *  \file   swgHash.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <cstddef>
+#include <string>
+
+#ifndef SWGHASH_HPP
+#define SWGHASH_HPP
+
+/**
+ * Incremental 64 bit FNV-1a hash used to key content addressed caches.
+ */
+class swgHash {
+public:
+    swgHash()
+        : value(14695981039346656037ULL)
+    {
+    }
+
+    void add(const void* data, std::size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            value ^= bytes[i];
+            value *= 1099511628211ULL;
+        }
+    }
+
+    template<class T>
+    void add(const T& data)
+    {
+        add(&data, sizeof(T));
+    }
+
+    void add(const std::string& data) { add(data.data(), data.size()); }
+
+    unsigned long long get() const { return value; }
+
+protected:
+    unsigned long long value;
+};
+
+#endif
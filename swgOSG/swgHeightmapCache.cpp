@@ -0,0 +1,477 @@
+/** -*-c++-*-
+ *  \file   swgHeightmapCache.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgHeightmapCache.hpp"
+#include "swgHash.hpp"
+#include "swgTerrainKernels.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+const unsigned int cacheVersion = 2;
+
+unsigned int getSampleBytes(unsigned int format)
+{
+    return (swgHeightmapCache::FLOAT32 == format) ? 4 : 2;
+}
+} // namespace
+
+swgHeightGrid::swgHeightGrid(unsigned int numRows, unsigned int numColumns)
+    : numRows(numRows)
+    , numColumns(numColumns)
+    , heights(NULL)
+    , mapping(NULL)
+    , mappingSize(0)
+{
+}
+
+swgHeightGrid::~swgHeightGrid()
+{
+#ifndef _WIN32
+    if (NULL != mapping) {
+        munmap(mapping, mappingSize);
+    }
+#endif
+}
+
+void swgHeightGrid::setHeights(std::vector<float>& values)
+{
+    decoded.swap(values);
+    heights = &decoded[0];
+}
+
+swgHeightmapCache::swgHeightmapCache(const std::string& directory, storageFormat format)
+    : directory(directory)
+    , format(format)
+    , numHits(0)
+    , numMisses(0)
+    , numColorHits(0)
+    , numColorMisses(0)
+    , bytesWritten(0)
+{
+    if (!this->directory.empty() && '/' != *(this->directory.rbegin())) {
+        this->directory.push_back('/');
+    }
+}
+
+swgHeightmapCache::~swgHeightmapCache() {}
+
+std::string swgHeightmapCache::getFilename(unsigned long long trnHash,
+                                           unsigned int       evaluator,
+                                           unsigned int       evaluatorVersion,
+                                           float              originX,
+                                           float              originY,
+                                           float              spacingX,
+                                           float              spacingY,
+                                           unsigned int       numRows,
+                                           unsigned int       numColumns,
+                                           unsigned int       variant,
+                                           const char*        extension) const
+{
+    swgHash hash;
+    hash.add(trnHash);
+    hash.add(evaluator);
+    hash.add(evaluatorVersion);
+    hash.add(originX);
+    hash.add(originY);
+    hash.add(spacingX);
+    hash.add(spacingY);
+    hash.add(numRows);
+    hash.add(numColumns);
+    hash.add(variant);
+
+    std::ostringstream filename;
+    filename << directory << std::hex << hash.get() << extension;
+    return filename.str();
+}
+
+std::shared_ptr<swgHeightGrid> swgHeightmapCache::load(unsigned long long trnHash,
+                                                       unsigned int       evaluator,
+                                                       unsigned int       evaluatorVersion,
+                                                       float              originX,
+                                                       float              originY,
+                                                       float              spacingX,
+                                                       float              spacingY,
+                                                       unsigned int       numRows,
+                                                       unsigned int       numColumns)
+{
+    fileHeader expected;
+    memset(&expected, 0, sizeof(expected));
+    memcpy(expected.magic, "SWGH", 4);
+    expected.version          = cacheVersion;
+    expected.format           = format;
+    expected.numRows          = numRows;
+    expected.numColumns       = numColumns;
+    expected.originX          = originX;
+    expected.originY          = originY;
+    expected.spacingX         = spacingX;
+    expected.spacingY         = spacingY;
+    expected.evaluator        = evaluator;
+    expected.trnHash          = trnHash;
+    expected.evaluatorVersion = evaluatorVersion;
+
+    std::shared_ptr<swgHeightGrid> grid = mapFile(getFilename(trnHash,
+                                                              evaluator,
+                                                              evaluatorVersion,
+                                                              originX,
+                                                              originY,
+                                                              spacingX,
+                                                              spacingY,
+                                                              numRows,
+                                                              numColumns,
+                                                              format,
+                                                              ".hgt"),
+                                                  expected);
+
+    if (NULL == grid) {
+        ++numMisses;
+    }
+    else {
+        ++numHits;
+    }
+
+    return grid;
+}
+
+std::shared_ptr<swgHeightGrid> swgHeightmapCache::mapFile(const std::string& filename,
+                                                          const fileHeader&  expected)
+{
+    std::size_t numSamples = (std::size_t)expected.numRows * expected.numColumns;
+    std::size_t fileSize   = sizeof(fileHeader) + numSamples * getSampleBytes(expected.format);
+
+    std::shared_ptr<swgHeightGrid> grid(new swgHeightGrid(expected.numRows, expected.numColumns));
+    const unsigned char*           data = NULL;
+
+#ifndef _WIN32
+    int file = open(filename.c_str(), O_RDONLY);
+    if (0 > file) {
+        return std::shared_ptr<swgHeightGrid>();
+    }
+
+    struct stat status;
+    if (0 == fstat(file, &status) && fileSize == (std::size_t)status.st_size) {
+        void* mapping = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, file, 0);
+        if (MAP_FAILED != mapping) {
+            grid->mapping     = mapping;
+            grid->mappingSize = fileSize;
+            data              = static_cast<const unsigned char*>(mapping);
+        }
+    }
+    close(file);
+#else
+    // No mapping here, read the file once instead.
+    std::vector<unsigned char> contents;
+    std::ifstream              file(filename.c_str(), std::ios::binary);
+    if (file) {
+        contents.resize(fileSize);
+        file.read(reinterpret_cast<char*>(&contents[0]), fileSize);
+        if (fileSize == (std::size_t)file.gcount() && file.get() == EOF) {
+            data = &contents[0];
+        }
+    }
+#endif
+
+    if (NULL == data) {
+        return std::shared_ptr<swgHeightGrid>();
+    }
+
+    // Everything up to the height range must match what was asked for.
+    fileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (0 != memcmp(&header, &expected, offsetof(fileHeader, minHeight))
+        || header.evaluator != expected.evaluator || header.trnHash != expected.trnHash
+        || header.evaluatorVersion != expected.evaluatorVersion) {
+        return std::shared_ptr<swgHeightGrid>();
+    }
+
+    const unsigned char* samples = data + sizeof(fileHeader);
+    if (FLOAT32 == header.format && grid->isMapped()) {
+        grid->heights = reinterpret_cast<const float*>(samples);
+        return grid;
+    }
+
+    grid->decoded.resize(numSamples);
+    if (FLOAT32 == header.format) {
+        memcpy(&grid->decoded[0], samples, numSamples * sizeof(float));
+    }
+    else if (FLOAT16 == header.format) {
+        swgTerrainKernels::halfToFloat(
+            reinterpret_cast<const unsigned short*>(samples), &grid->decoded[0], numSamples);
+    }
+    else {
+        swgTerrainKernels::dequantize(reinterpret_cast<const unsigned short*>(samples),
+                                      &grid->decoded[0],
+                                      numSamples,
+                                      header.minHeight,
+                                      header.heightScale);
+    }
+    grid->heights = &grid->decoded[0];
+
+    return grid;
+}
+
+std::shared_ptr<swgHeightGrid> swgHeightmapCache::store(unsigned long long trnHash,
+                                                        unsigned int       evaluator,
+                                                        unsigned int       evaluatorVersion,
+                                                        float              originX,
+                                                        float              originY,
+                                                        float              spacingX,
+                                                        float              spacingY,
+                                                        unsigned int       numRows,
+                                                        unsigned int       numColumns,
+                                                        const float*       heights)
+{
+    std::size_t numSamples = (std::size_t)numRows * numColumns;
+
+    fileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SWGH", 4);
+    header.version          = cacheVersion;
+    header.format           = format;
+    header.numRows          = numRows;
+    header.numColumns       = numColumns;
+    header.originX          = originX;
+    header.originY          = originY;
+    header.spacingX         = spacingX;
+    header.spacingY         = spacingY;
+    header.minHeight        = 0.0f;
+    header.heightScale      = 0.0f;
+    header.evaluator        = evaluator;
+    header.trnHash          = trnHash;
+    header.evaluatorVersion = evaluatorVersion;
+
+    std::vector<unsigned short> packed;
+    if (FLOAT16 == format) {
+        packed.resize(numSamples);
+        swgTerrainKernels::floatToHalf(heights, &packed[0], numSamples);
+    }
+    else if (QUANTIZED16 == format) {
+        float minHeight;
+        float maxHeight;
+        swgTerrainKernels::getRange(heights, numSamples, minHeight, maxHeight);
+
+        header.minHeight = minHeight;
+        header.heightScale = (maxHeight - minHeight) / 65535.0f;
+
+        packed.resize(numSamples);
+        swgTerrainKernels::quantize(
+            heights, &packed[0], numSamples, header.minHeight, header.heightScale);
+    }
+
+    std::string filename = getFilename(trnHash,
+                                       evaluator,
+                                       evaluatorVersion,
+                                       originX,
+                                       originY,
+                                       spacingX,
+                                       spacingY,
+                                       numRows,
+                                       numColumns,
+                                       format,
+                                       ".hgt");
+
+    const void* samples = (FLOAT32 == format) ? (const void*)heights : (const void*)&packed[0];
+
+    std::shared_ptr<swgHeightGrid> grid;
+    if (writeFile(filename, header, samples, numSamples * getSampleBytes(format))) {
+        grid = mapFile(filename, header);
+    }
+
+    // Fall back to the heights as generated.
+    if (NULL == grid) {
+        std::vector<float> values(heights, heights + numSamples);
+        grid.reset(new swgHeightGrid(numRows, numColumns));
+        grid->setHeights(values);
+    }
+
+    return grid;
+}
+
+bool swgHeightmapCache::loadColors(unsigned long long          trnHash,
+                                   unsigned int                evaluator,
+                                   unsigned int                evaluatorVersion,
+                                   float                       originX,
+                                   float                       originY,
+                                   float                       spacingX,
+                                   float                       spacingY,
+                                   unsigned int                numRows,
+                                   unsigned int                numColumns,
+                                   unsigned int                version,
+                                   std::vector<unsigned char>& colors)
+{
+    fileHeader expected;
+    makeColorHeader(trnHash,
+                    evaluator,
+                    evaluatorVersion,
+                    originX,
+                    originY,
+                    spacingX,
+                    spacingY,
+                    numRows,
+                    numColumns,
+                    version,
+                    expected);
+
+    std::string filename = getFilename(trnHash,
+                                       evaluator,
+                                       evaluatorVersion,
+                                       originX,
+                                       originY,
+                                       spacingX,
+                                       spacingY,
+                                       numRows,
+                                       numColumns,
+                                       version,
+                                       ".clr");
+
+    // Color maps are small and uploaded right away, so a plain read does.
+    std::size_t   numBytes = (std::size_t)numRows * numColumns * 3;
+    fileHeader    header;
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        && 0 == memcmp(&header, &expected, sizeof(header))) {
+        colors.resize(numBytes);
+        file.read(reinterpret_cast<char*>(&colors[0]), numBytes);
+        if (numBytes == (std::size_t)file.gcount() && file.get() == EOF) {
+            ++numColorHits;
+            return true;
+        }
+    }
+
+    ++numColorMisses;
+    return false;
+}
+
+void swgHeightmapCache::storeColors(unsigned long long   trnHash,
+                                    unsigned int         evaluator,
+                                    unsigned int         evaluatorVersion,
+                                    float                originX,
+                                    float                originY,
+                                    float                spacingX,
+                                    float                spacingY,
+                                    unsigned int         numRows,
+                                    unsigned int         numColumns,
+                                    unsigned int         version,
+                                    const unsigned char* colors)
+{
+    fileHeader header;
+    makeColorHeader(trnHash,
+                    evaluator,
+                    evaluatorVersion,
+                    originX,
+                    originY,
+                    spacingX,
+                    spacingY,
+                    numRows,
+                    numColumns,
+                    version,
+                    header);
+
+    std::string filename = getFilename(trnHash,
+                                       evaluator,
+                                       evaluatorVersion,
+                                       originX,
+                                       originY,
+                                       spacingX,
+                                       spacingY,
+                                       numRows,
+                                       numColumns,
+                                       version,
+                                       ".clr");
+    writeFile(filename, header, colors, (std::size_t)numRows * numColumns * 3);
+}
+
+void swgHeightmapCache::makeColorHeader(unsigned long long trnHash,
+                                        unsigned int       evaluator,
+                                        unsigned int       evaluatorVersion,
+                                        float              originX,
+                                        float              originY,
+                                        float              spacingX,
+                                        float              spacingY,
+                                        unsigned int       numRows,
+                                        unsigned int       numColumns,
+                                        unsigned int       version,
+                                        fileHeader&        header) const
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SWGC", 4);
+    header.version          = cacheVersion;
+    header.format           = version;
+    header.numRows          = numRows;
+    header.numColumns       = numColumns;
+    header.originX          = originX;
+    header.originY          = originY;
+    header.spacingX         = spacingX;
+    header.spacingY         = spacingY;
+    header.evaluator        = evaluator;
+    header.trnHash          = trnHash;
+    header.evaluatorVersion = evaluatorVersion;
+}
+
+bool swgHeightmapCache::writeFile(const std::string& filename,
+                                  const fileHeader&  header,
+                                  const void*        data,
+                                  std::size_t        size)
+{
+    // Write under a name of our own and rename into place, so a reader or a
+    // second writer never sees a partial file.
+    std::ostringstream temporary;
+    temporary << filename << "." << std::hash<std::thread::id>()(std::this_thread::get_id())
+              << ".tmp";
+
+    std::ofstream file(temporary.str().c_str(), std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(static_cast<const char*>(data), size);
+    file.close();
+
+    if (file && 0 == rename(temporary.str().c_str(), filename.c_str())) {
+        bytesWritten += sizeof(header) + size;
+        return true;
+    }
+
+    std::cout << "Unable to write heightmap cache file: " << filename << std::endl;
+    remove(temporary.str().c_str());
+    return false;
+}
+
+void swgHeightmapCache::report(std::ostream& out) const
+{
+    out << "Heightmap cache: " << numHits << " hits, " << numMisses << " misses, "
+        << numColorHits << " color hits, " << numColorMisses << " color misses, "
+        << bytesWritten << " bytes written" << std::endl;
+}
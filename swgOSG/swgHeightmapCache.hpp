@@ -0,0 +1,203 @@
+/** -*-c++-*-
+ *  \file   swgHeightmapCache.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef SWGHEIGHTMAPCACHE_HPP
+#define SWGHEIGHTMAPCACHE_HPP
+
+/**
+ * Row major grid of terrain heights, either mapped from a cache file or
+ * held in memory.
+ */
+class swgHeightGrid {
+public:
+    swgHeightGrid(unsigned int numRows, unsigned int numColumns);
+    ~swgHeightGrid();
+
+    unsigned int getNumRows() const { return numRows; }
+    unsigned int getNumColumns() const { return numColumns; }
+
+    // Points straight into the mapped file when it stores floats.
+    const float* getHeights() const { return heights; }
+
+    // Take over heights held in memory.
+    void setHeights(std::vector<float>& values);
+
+    bool isMapped() const { return NULL != mapping; }
+
+protected:
+    friend class swgHeightmapCache;
+
+    unsigned int       numRows;
+    unsigned int       numColumns;
+    const float*       heights;
+    std::vector<float> decoded;
+
+    void*       mapping;
+    std::size_t mappingSize;
+};
+
+/**
+ * On disk cache of generated height grids. Each grid is one file named
+ * after the TRN content hash, the evaluator that produced it and the
+ * sampling parameters, holding a small header followed by the samples.
+ * Float grids are memory mapped and used in place; half float and
+ * quantized grids take a half or a quarter of the space and are expanded
+ * when loaded. Color maps baked from the grids are kept next to them.
+ */
+class swgHeightmapCache {
+public:
+    enum storageFormat { FLOAT32 = 0, FLOAT16 = 1, QUANTIZED16 = 2 };
+
+    // Code the heights were generated with. Grids of one evaluator, or of
+    // another version of it, are never served for another.
+    enum heightEvaluator { MESHLIB = 0, TERRAIN_LAYERS = 1 };
+
+    swgHeightmapCache(const std::string& directory, storageFormat format = FLOAT32);
+    ~swgHeightmapCache();
+
+    storageFormat getFormat() const { return format; }
+
+    // The cached grid, or NULL when none has been stored yet.
+    std::shared_ptr<swgHeightGrid> load(unsigned long long trnHash,
+                                        unsigned int       evaluator,
+                                        unsigned int       evaluatorVersion,
+                                        float              originX,
+                                        float              originY,
+                                        float              spacingX,
+                                        float              spacingY,
+                                        unsigned int       numRows,
+                                        unsigned int       numColumns);
+
+    // Store heights and return the grid as a later load would see it.
+    std::shared_ptr<swgHeightGrid> store(unsigned long long trnHash,
+                                         unsigned int       evaluator,
+                                         unsigned int       evaluatorVersion,
+                                         float              originX,
+                                         float              originY,
+                                         float              spacingX,
+                                         float              spacingY,
+                                         unsigned int       numRows,
+                                         unsigned int       numColumns,
+                                         const float*       heights);
+
+    /**
+     * Color maps baked from a grid, three bytes per sample. version names
+     * the baking rules so changing them invalidates older maps. Returns
+     * false when no matching map has been stored.
+     */
+    bool loadColors(unsigned long long          trnHash,
+                    unsigned int                evaluator,
+                    unsigned int                evaluatorVersion,
+                    float                       originX,
+                    float                       originY,
+                    float                       spacingX,
+                    float                       spacingY,
+                    unsigned int                numRows,
+                    unsigned int                numColumns,
+                    unsigned int                version,
+                    std::vector<unsigned char>& colors);
+    void storeColors(unsigned long long   trnHash,
+                     unsigned int         evaluator,
+                     unsigned int         evaluatorVersion,
+                     float                originX,
+                     float                originY,
+                     float                spacingX,
+                     float                spacingY,
+                     unsigned int         numRows,
+                     unsigned int         numColumns,
+                     unsigned int         version,
+                     const unsigned char* colors);
+
+    void report(std::ostream& out) const;
+
+protected:
+    struct fileHeader {
+        char               magic[4];
+        unsigned int       version;
+        unsigned int       format;
+        unsigned int       numRows;
+        unsigned int       numColumns;
+        float              originX;
+        float              originY;
+        float              spacingX;
+        float              spacingY;
+        float              minHeight;
+        float              heightScale;
+        unsigned int       evaluator;
+        unsigned long long trnHash;
+        unsigned int       evaluatorVersion;
+        unsigned char      padding[4];
+    };
+
+    std::string getFilename(unsigned long long trnHash,
+                            unsigned int       evaluator,
+                            unsigned int       evaluatorVersion,
+                            float              originX,
+                            float              originY,
+                            float              spacingX,
+                            float              spacingY,
+                            unsigned int       numRows,
+                            unsigned int       numColumns,
+                            unsigned int       variant,
+                            const char*        extension) const;
+
+    void makeColorHeader(unsigned long long trnHash,
+                         unsigned int       evaluator,
+                         unsigned int       evaluatorVersion,
+                         float              originX,
+                         float              originY,
+                         float              spacingX,
+                         float              spacingY,
+                         unsigned int       numRows,
+                         unsigned int       numColumns,
+                         unsigned int       version,
+                         fileHeader&        header) const;
+
+    std::shared_ptr<swgHeightGrid> mapFile(const std::string& filename, const fileHeader& expected);
+
+    // Write header and data to filename atomically.
+    bool writeFile(const std::string& filename,
+                   const fileHeader&  header,
+                   const void*        data,
+                   std::size_t        size);
+
+    std::string   directory;
+    storageFormat format;
+
+    std::atomic<unsigned int>       numHits;
+    std::atomic<unsigned int>       numMisses;
+    std::atomic<unsigned int>       numColorHits;
+    std::atomic<unsigned int>       numColorMisses;
+    std::atomic<unsigned long long> bytesWritten;
+};
+
+#endif
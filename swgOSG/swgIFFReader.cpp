@@ -0,0 +1,137 @@
+/** -*-c++-*-
+ *  \file   swgIFFReader.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgIFFReader.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+swgIFFReader::swgIFFReader(const std::string& data)
+    : data(data)
+    , position(0)
+    , failed(false)
+{
+    ends.push_back(data.size());
+}
+
+std::string swgIFFReader::peek() const
+{
+    if (isForm()) {
+        return data.substr(position + 8, 4);
+    }
+    if (position + 8 <= ends.back()) {
+        return data.substr(position, 4);
+    }
+    return std::string();
+}
+
+bool swgIFFReader::isForm() const
+{
+    return position + 12 <= ends.back() && 0 == data.compare(position, 4, "FORM");
+}
+
+void swgIFFReader::exit()
+{
+    position = ends.back();
+    ends.pop_back();
+}
+
+void swgIFFReader::skip()
+{
+    if (position + 8 > ends.back()) {
+        position = ends.back();
+        return;
+    }
+    position = std::min<size_t>(ends.back(), position + 8 + readBigEndian(position + 4));
+}
+
+float swgIFFReader::readFloat()
+{
+    unsigned int bits = read(4);
+    float        value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+std::string swgIFFReader::readString()
+{
+    size_t end = data.find('\0', position);
+    if (std::string::npos == end || end >= ends.back()) {
+        failed   = true;
+        position = ends.back();
+        return std::string();
+    }
+    std::string value = data.substr(position, end - position);
+    position          = end + 1;
+    return value;
+}
+
+unsigned int swgIFFReader::readBigEndian(size_t offset) const
+{
+    unsigned int value = 0;
+    for (unsigned int i = 0; i < 4; ++i) {
+        value = (value << 8) | (unsigned char)data[offset + i];
+    }
+    return value;
+}
+
+bool swgIFFReader::enter(bool form, const std::string& name)
+{
+    size_t headerSize = form ? 12 : 8;
+    if (position + headerSize > ends.back()) {
+        failed = true;
+        return false;
+    }
+
+    size_t end     = position + 8 + readBigEndian(position + 4);
+    bool   matches = 0 == data.compare(position, 4, form ? "FORM" : name);
+    if (form) {
+        matches = matches && 0 == data.compare(position + 8, 4, name);
+    }
+    if (!matches || end > ends.back() || position + headerSize > end) {
+        failed = true;
+        return false;
+    }
+
+    position += headerSize;
+    ends.push_back(end);
+    return true;
+}
+
+unsigned int swgIFFReader::read(unsigned int size)
+{
+    if (position + size > ends.back()) {
+        failed   = true;
+        position = ends.back();
+        return 0;
+    }
+
+    unsigned int value = 0;
+    for (unsigned int i = size; i > 0; --i) {
+        value = (value << 8) | (unsigned char)data[position + i - 1];
+    }
+    position += size;
+    return value;
+}
@@ -0,0 +1,90 @@
+/** -*-c++-*-
+ *  \file   swgIFFReader.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#ifndef SWGIFFREADER_HPP
+#define SWGIFFREADER_HPP
+
+/**
+ * Walks the nested FORMs and chunks of an IFF file held in memory. Block
+ * sizes are big endian, chunk contents little endian. Reading past the end
+ * of the current block yields zeros and marks the reader as failed.
+ *
+ * Used for the parts of the SWG formats meshLib does not expose.
+ */
+class swgIFFReader {
+public:
+    swgIFFReader(const std::string& data);
+
+    bool isValid() const { return !failed; }
+    bool atEnd() const { return position >= ends.back(); }
+
+    // Tag of the next block, the form type for a FORM.
+    std::string peek() const;
+
+    // True if the next block is a FORM.
+    bool isForm() const;
+
+    // Step into the next block, which has to be a FORM of type.
+    bool enterForm(const std::string& type) { return enter(true, type); }
+
+    // Step into the next block, which has to be a chunk with tag.
+    bool enterChunk(const std::string& tag) { return enter(false, tag); }
+
+    // Continue after the block entered last.
+    void exit();
+
+    // Pass over the next block.
+    void skip();
+
+    // Bytes left in the block entered last.
+    size_t getRemaining() const { return ends.back() - position; }
+
+    int          readInt8() { return (signed char)read(1); }
+    unsigned int readUInt8() { return read(1); }
+    int          readInt16() { return (short)read(2); }
+    unsigned int readUInt16() { return read(2); }
+    int          readInt32() { return (int)read(4); }
+    unsigned int readUInt32() { return read(4); }
+    float        readFloat();
+    std::string  readString();
+
+protected:
+    unsigned int readBigEndian(size_t offset) const;
+    bool         enter(bool form, const std::string& name);
+
+    // Little endian value of size bytes.
+    unsigned int read(unsigned int size);
+
+    const std::string&  data;
+    size_t              position;
+    std::vector<size_t> ends;
+    bool                failed;
+};
+
+#endif
@@ -0,0 +1,422 @@
+/** -*-c++-*-
+ *  \file   swgInstancing.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgInstancing.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Group>
+#include <osg/Image>
+#include <osg/LOD>
+#include <osg/MatrixTransform>
+#include <osg/Program>
+#include <osg/Shader>
+#include <osg/Texture2D>
+#include <osg/Uniform>
+
+namespace
+{
+// Instances per row of the transform texture, each takes four texels.
+const unsigned int instanceRowLength = 1024;
+
+// Texture unit the vertex shader reads transforms from, clear of the
+// units used by SWG shaders.
+const unsigned int instanceTextureUnit = 7;
+
+// Instances drawn by one batch, and the largest extent of a batch in
+// meters. Batches are culled and switch detail on their own.
+const unsigned int maxInstancesPerBatch = 256;
+const float        maxBatchSize         = 128.0f;
+
+// Instancing programs by the texture unit of the diffuse map they sample.
+typedef std::map<unsigned int, osg::ref_ptr<osg::Program>> programMap;
+
+const char* instanceVertexShader =
+    "#version 120\n"
+    "#extension GL_EXT_gpu_shader4 : enable\n"
+    "uniform sampler2D instanceTransforms;\n"
+    "uniform vec2 instanceTextureSize;\n"
+    "varying vec3 normal;\n"
+    "mat4 instanceMatrix()\n"
+    "{\n"
+    "    float id = float(gl_InstanceID);\n"
+    "    float row = floor(id / 1024.0);\n"
+    "    float column = (id - row * 1024.0) * 4.0;\n"
+    "    vec2 texel = vec2(1.0) / instanceTextureSize;\n"
+    "    float v = (row + 0.5) * texel.y;\n"
+    "    return mat4(texture2DLod(instanceTransforms, vec2((column + 0.5) * texel.x, v), 0.0),\n"
+    "                texture2DLod(instanceTransforms, vec2((column + 1.5) * texel.x, v), 0.0),\n"
+    "                texture2DLod(instanceTransforms, vec2((column + 2.5) * texel.x, v), 0.0),\n"
+    "                texture2DLod(instanceTransforms, vec2((column + 3.5) * texel.x, v), 0.0));\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "    mat4 instance = instanceMatrix();\n"
+    "    mat3 rotation = mat3(instance[0].xyz, instance[1].xyz, instance[2].xyz);\n"
+    "    normal = normalize(gl_NormalMatrix * (rotation * gl_Normal));\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * (instance * gl_Vertex);\n"
+    "}\n";
+
+const char* instanceFragmentShader =
+    "#version 120\n"
+    "uniform sampler2D diffuseMap;\n"
+    "varying vec3 normal;\n"
+    "void main()\n"
+    "{\n"
+    "    vec3 light = normalize(gl_LightSource[0].position.xyz);\n"
+    "    float diffuse = max(dot(normalize(normal), light), 0.0);\n"
+    "    vec4 color = texture2D(diffuseMap, gl_TexCoord[0].st) * gl_Color;\n"
+    "    gl_FragColor = vec4(color.rgb * (0.4 + 0.6 * diffuse), color.a);\n"
+    "}\n";
+
+osg::BoundingBox computeVertexBound(const osg::Geometry& geometry)
+{
+    osg::BoundingBox bound;
+
+    const osg::Vec3Array* vertices =
+        dynamic_cast<const osg::Vec3Array*>(geometry.getVertexArray());
+    if (NULL != vertices) {
+        for (unsigned int i = 0; i < vertices->size(); ++i) {
+            bound.expandBy((*vertices)[i]);
+        }
+    }
+
+    return bound;
+}
+
+osg::BoundingBox transformBound(const osg::BoundingBox& bound, const osg::Matrix& matrix)
+{
+    osg::BoundingBox result;
+    if (bound.valid()) {
+        for (unsigned int i = 0; i < 8; ++i) {
+            result.expandBy(bound.corner(i) * matrix);
+        }
+    }
+    return result;
+}
+
+// Lowest unit stateSet binds a texture to, which is where loadShader puts
+// the main texture of a shader. -1 when there is none.
+int findTextureUnit(const osg::StateSet* stateSet)
+{
+    if (NULL == stateSet) {
+        return -1;
+    }
+
+    unsigned int numUnits = stateSet->getTextureAttributeList().size();
+    for (unsigned int unit = 0; unit < numUnits; ++unit) {
+        if (NULL != stateSet->getTextureAttribute(unit, osg::StateAttribute::TEXTURE)) {
+            return unit;
+        }
+    }
+    return -1;
+}
+
+// Program sampling the diffuse map on unit with that unit's coordinates.
+osg::ref_ptr<osg::Program> getInstanceProgram(unsigned int unit, programMap& programs)
+{
+    osg::ref_ptr<osg::Program>& program = programs[unit];
+    if (NULL == program) {
+        std::ostringstream texCoord;
+        texCoord << "gl_MultiTexCoord" << unit;
+
+        std::string vertexShader(instanceVertexShader);
+        std::string defaultTexCoord("gl_MultiTexCoord0");
+        vertexShader.replace(
+            vertexShader.find(defaultTexCoord), defaultTexCoord.size(), texCoord.str());
+
+        program = new osg::Program;
+        program->addShader(new osg::Shader(osg::Shader::VERTEX, vertexShader));
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, instanceFragmentShader));
+    }
+    return program;
+}
+
+float getMaxScale(const osg::Matrix& matrix)
+{
+    osg::Vec3d scale = matrix.getScale();
+    return std::max(scale.x(), std::max(scale.y(), scale.z()));
+}
+
+/**
+ * Split the instances order[first, first + count) refers to into batches
+ * of nearby instances, halving along the longest axis of their centers
+ * until a batch is both small enough and close enough together.
+ */
+void splitBatches(const std::vector<osg::Vec3>&          centers,
+                  const std::vector<osg::Matrix>&        transforms,
+                  std::vector<unsigned int>&             order,
+                  unsigned int                           first,
+                  unsigned int                           count,
+                  std::vector<std::vector<osg::Matrix>>& batches)
+{
+    osg::BoundingBox extent;
+    for (unsigned int i = first; i < first + count; ++i) {
+        extent.expandBy(centers[order[i]]);
+    }
+
+    unsigned int axis = 0;
+    for (unsigned int i = 1; i < 3; ++i) {
+        if (extent._max[i] - extent._min[i] > extent._max[axis] - extent._min[axis]) {
+            axis = i;
+        }
+    }
+
+    float size = extent._max[axis] - extent._min[axis];
+    if (count <= maxInstancesPerBatch && (1 == count || size <= maxBatchSize)) {
+        batches.push_back(std::vector<osg::Matrix>());
+        for (unsigned int i = first; i < first + count; ++i) {
+            batches.back().push_back(transforms[order[i]]);
+        }
+        return;
+    }
+
+    unsigned int half = count / 2;
+    std::nth_element(order.begin() + first,
+                     order.begin() + first + half,
+                     order.begin() + first + count,
+                     [&](unsigned int a, unsigned int b) {
+                         return centers[a][axis] < centers[b][axis];
+                     });
+
+    splitBatches(centers, transforms, order, first, half, batches);
+    splitBatches(centers, transforms, order, first + half, count - half, batches);
+}
+
+osg::ref_ptr<osg::Geode> createInstancedGeode(const osg::Geometry&            geometry,
+                                              const osg::StateSet*            geodeStateSet,
+                                              const std::vector<osg::Matrix>& transforms,
+                                              programMap&                     programs)
+{
+    osg::ref_ptr<swgInstanceSet> instances = new swgInstanceSet;
+
+    osg::BoundingBox localBound = computeVertexBound(geometry);
+    for (unsigned int i = 0; i < transforms.size(); ++i) {
+        osg::BoundingBox instanceBound = transformBound(localBound, transforms[i]);
+        instances->transforms.push_back(osg::Matrixf(transforms[i]));
+        instances->bounds.push_back(instanceBound);
+        instances->bound.expandBy(instanceBound);
+    }
+
+    // Pack the matrices into a float texture, one instance per four texels.
+    unsigned int numInstances = transforms.size();
+    unsigned int width        = 4 * std::min(numInstances, instanceRowLength);
+    unsigned int height       = (numInstances + instanceRowLength - 1) / instanceRowLength;
+
+    osg::ref_ptr<osg::Image> image = new osg::Image;
+    image->allocateImage(width, height, 1, GL_RGBA, GL_FLOAT);
+    image->setInternalTextureFormat(GL_RGBA32F_ARB);
+
+    float* texels = reinterpret_cast<float*>(image->data());
+    memset(texels, 0, width * height * 4 * sizeof(float));
+    for (unsigned int i = 0; i < numInstances; ++i) {
+        unsigned int row    = i / instanceRowLength;
+        unsigned int column = (i % instanceRowLength) * 4;
+        memcpy(texels + (row * width + column) * 4,
+               instances->transforms[i].ptr(),
+               16 * sizeof(float));
+    }
+
+    osg::ref_ptr<osg::Texture2D> transformTexture = new osg::Texture2D(image.get());
+    transformTexture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+    transformTexture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    transformTexture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+    transformTexture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+    transformTexture->setResizeNonPowerOfTwoHint(false);
+
+    // Copy the primitive sets so the instance count does not leak into the
+    // shared, non-instanced mesh. Vertex arrays stay shared.
+    osg::ref_ptr<osg::Geometry> instanced =
+        new osg::Geometry(geometry, osg::CopyOp::DEEP_COPY_PRIMITIVES);
+    for (unsigned int i = 0; i < instanced->getNumPrimitiveSets(); ++i) {
+        instanced->getPrimitiveSet(i)->setNumInstances(numInstances);
+    }
+    instanced->setUseDisplayList(false);
+    instanced->setUseVertexBufferObjects(true);
+    instanced->setInitialBound(instances->bound);
+    instanced->setUserData(instances.get());
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(instanced.get());
+
+    // Sample the main texture where the mesh's shader bound it.
+    int diffuseUnit = findTextureUnit(geometry.getStateSet());
+    if (0 > diffuseUnit) {
+        diffuseUnit = std::max(0, findTextureUnit(geodeStateSet));
+    }
+
+    osg::StateSet* stateSet = geode->getOrCreateStateSet();
+    stateSet->setAttributeAndModes(getInstanceProgram(diffuseUnit, programs).get());
+    stateSet->addUniform(new osg::Uniform("diffuseMap", diffuseUnit));
+    stateSet->setTextureAttribute(instanceTextureUnit, transformTexture.get());
+    stateSet->addUniform(new osg::Uniform("instanceTextureSize", osg::Vec2(width, height)));
+
+    return geode;
+}
+
+osg::ref_ptr<osg::Node> instanceNode(osg::Node&                      node,
+                                     const osg::Matrix&              local,
+                                     const std::vector<osg::Matrix>& transforms,
+                                     programMap&                     programs)
+{
+    osg::Geode* geode = dynamic_cast<osg::Geode*>(&node);
+    if (NULL != geode) {
+        // Fold the transform inside the prototype into the instance matrices.
+        std::vector<osg::Matrix> instanceTransforms;
+        instanceTransforms.reserve(transforms.size());
+        for (unsigned int i = 0; i < transforms.size(); ++i) {
+            instanceTransforms.push_back(local * transforms[i]);
+        }
+
+        osg::ref_ptr<osg::Group> group = new osg::Group;
+        for (unsigned int i = 0; i < geode->getNumDrawables(); ++i) {
+            osg::Geometry* geometry = geode->getDrawable(i)->asGeometry();
+            if (NULL != geometry) {
+                group->addChild(createInstancedGeode(
+                                    *geometry, geode->getStateSet(), instanceTransforms, programs)
+                                    .get());
+            }
+        }
+        return group;
+    }
+
+    osg::LOD* lod = dynamic_cast<osg::LOD*>(&node);
+    if (NULL != lod) {
+        // Screen sizes are measured on the bound of the whole batch, which
+        // is larger than that of one instance by the ratio of their radii.
+        // Scaling pixel ranges by it switches levels at the size of one.
+        float rangeScale = 1.0f;
+        if (osg::LOD::PIXEL_SIZE_ON_SCREEN == lod->getRangeMode() && lod->getBound().valid()) {
+            const osg::BoundingSphere& bound = lod->getBound();
+
+            osg::BoundingSphere batchBound;
+            float               instanceRadius = 0.0f;
+            for (unsigned int i = 0; i < transforms.size(); ++i) {
+                osg::Matrix matrix = local * transforms[i];
+                float       radius = bound.radius() * getMaxScale(matrix);
+                batchBound.expandBy(osg::BoundingSphere(bound.center() * matrix, radius));
+                instanceRadius = std::max(instanceRadius, radius);
+            }
+
+            if (0.0f < instanceRadius) {
+                rangeScale = batchBound.radius() / instanceRadius;
+            }
+        }
+
+        osg::ref_ptr<osg::LOD> instancedLOD = new osg::LOD;
+        instancedLOD->setRangeMode(lod->getRangeMode());
+        for (unsigned int i = 0; i < lod->getNumChildren(); ++i) {
+            osg::ref_ptr<osg::Node> child =
+                instanceNode(*lod->getChild(i), local, transforms, programs);
+            if (NULL != child) {
+                float minRange = lod->getMinRange(i);
+                float maxRange = lod->getMaxRange(i);
+                if (osg::LOD::PIXEL_SIZE_ON_SCREEN == lod->getRangeMode()) {
+                    minRange *= rangeScale;
+                    maxRange *= rangeScale;
+                }
+                instancedLOD->addChild(child.get(), minRange, maxRange);
+            }
+        }
+        return instancedLOD;
+    }
+
+    osg::Group* group = node.asGroup();
+    if (NULL != group) {
+        osg::Matrix           childLocal(local);
+        osg::MatrixTransform* transform = dynamic_cast<osg::MatrixTransform*>(&node);
+        if (NULL != transform) {
+            childLocal = transform->getMatrix() * local;
+        }
+
+        osg::ref_ptr<osg::Group> instancedGroup = new osg::Group;
+        for (unsigned int i = 0; i < group->getNumChildren(); ++i) {
+            osg::ref_ptr<osg::Node> child =
+                instanceNode(*group->getChild(i), childLocal, transforms, programs);
+            if (NULL != child) {
+                instancedGroup->addChild(child.get());
+            }
+        }
+        return instancedGroup;
+    }
+
+    return NULL;
+}
+} // namespace
+
+osg::ref_ptr<osg::Node> createInstancedNode(osg::Node*                      prototype,
+                                            const std::vector<osg::Matrix>& transforms)
+{
+    if (NULL == prototype || transforms.empty()) {
+        return NULL;
+    }
+
+    // Batches of nearby instances are culled by the union of their instance
+    // bounds, and LOD nodes switch on the distance to their own batch.
+    const osg::BoundingSphere& bound = prototype->getBound();
+
+    std::vector<osg::Vec3>    centers(transforms.size());
+    std::vector<unsigned int> order(transforms.size());
+    for (unsigned int i = 0; i < transforms.size(); ++i) {
+        centers[i] = bound.center() * transforms[i];
+        order[i]   = i;
+    }
+
+    std::vector<std::vector<osg::Matrix>> batches;
+    splitBatches(centers, transforms, order, 0, transforms.size(), batches);
+
+    programMap               programs;
+    osg::ref_ptr<osg::Group> instanced = new osg::Group;
+    for (unsigned int i = 0; i < batches.size(); ++i) {
+        osg::ref_ptr<osg::Node> batch =
+            instanceNode(*prototype, osg::Matrix::identity(), batches[i], programs);
+        if (NULL != batch) {
+            instanced->addChild(batch.get());
+        }
+    }
+
+    if (0 == instanced->getNumChildren()) {
+        return NULL;
+    }
+
+    // Untextured meshes sample this instead of an unbound unit.
+    osg::ref_ptr<osg::Image> white = new osg::Image;
+    white->allocateImage(1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    memset(white->data(), 255, 4);
+
+    osg::StateSet* stateSet = instanced->getOrCreateStateSet();
+    stateSet->setTextureAttributeAndModes(0, new osg::Texture2D(white.get()));
+    stateSet->addUniform(
+        new osg::Uniform("instanceTransforms", static_cast<int>(instanceTextureUnit)));
+
+    return instanced;
+}
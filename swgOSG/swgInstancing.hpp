@@ -0,0 +1,71 @@
+/** -*-c++-*-
+ *  \file   swgInstancing.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <vector>
+
+#include <osg/BoundingBox>
+#include <osg/Matrix>
+#include <osg/Node>
+#include <osg/Referenced>
+
+#ifndef SWGINSTANCING_HPP
+#define SWGINSTANCING_HPP
+
+/**
+ * Per-instance data attached as user data to every instanced drawable.
+ * Transforms place the drawable's vertices directly in the space of the
+ * node returned by createInstancedNode, bounds are in that same space.
+ */
+class swgInstanceSet : public osg::Referenced {
+public:
+    unsigned int getNumInstances() const { return transforms.size(); }
+
+    const osg::Matrixf&     getTransform(unsigned int i) const { return transforms[i]; }
+    const osg::BoundingBox& getInstanceBound(unsigned int i) const { return bounds[i]; }
+
+    // Union of all instance bounds.
+    const osg::BoundingBox& getBound() const { return bound; }
+
+    std::vector<osg::Matrixf>     transforms;
+    std::vector<osg::BoundingBox> bounds;
+    osg::BoundingBox              bound;
+
+protected:
+    virtual ~swgInstanceSet() {}
+};
+
+/**
+ * Build a subgraph drawing prototype once at each of the given transforms.
+ * Instances are split into spatial batches, and every geometry of the
+ * prototype becomes one hardware instanced drawable per batch reading its
+ * per-instance matrices from a float texture. A batch is culled by the
+ * union of its instance bounds, and LOD nodes inside the prototype are
+ * kept per batch so nearby instances switch detail independently of far
+ * away ones.
+ */
+osg::ref_ptr<osg::Node> createInstancedNode(osg::Node*                      prototype,
+                                            const std::vector<osg::Matrix>& transforms);
+
+#endif
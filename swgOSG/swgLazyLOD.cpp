@@ -0,0 +1,198 @@
+/** -*-c++-*-
+ *  \file   swgLazyLOD.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgLazyLOD.hpp"
+
+#include <algorithm>
+
+#include <osg/CullStack>
+#include <osg/NodeVisitor>
+
+namespace {
+class loadAllVisitor : public osg::NodeVisitor {
+public:
+    loadAllVisitor()
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+    {
+    }
+
+    virtual void apply(osg::LOD& node)
+    {
+        // Levels are loaded before descending, so lazy nodes inside them
+        // are reached as well.
+        swgLazyLOD* lazy = dynamic_cast<swgLazyLOD*>(&node);
+        if (NULL != lazy) {
+            lazy->loadAll();
+        }
+        traverse(node);
+    }
+};
+} // namespace
+
+swgLazyLOD::swgLazyLOD(const loader& reader)
+    : reader(reader)
+    , coarsest(-1)
+{
+    setUpdateCallback(new swgLazyLODUpdateCallback);
+}
+
+void swgLazyLOD::addLazyChild(const std::string& filename, float min, float max)
+{
+    addChild(new osg::Group, min, max);
+    filenames.push_back(filename);
+    loaded.push_back(false);
+}
+
+void swgLazyLOD::loadCoarsest()
+{
+    if (0 == getNumChildren()) {
+        return;
+    }
+
+    // The coarsest level is drawn farthest away, or at the fewest pixels.
+    coarsest = 0;
+    for (unsigned int i = 1; i < getNumChildren(); ++i) {
+        if (DISTANCE_FROM_EYE_POINT == getRangeMode()
+                ? getMinRange(i) > getMinRange(coarsest)
+                : getMinRange(i) < getMinRange(coarsest)) {
+            coarsest = i;
+        }
+    }
+
+    load(coarsest);
+
+    const osg::BoundingSphere& bound = getChild(coarsest)->getBound();
+    if (!bound.valid()) {
+        coarsest = -1;
+        loadAll();
+        return;
+    }
+
+    setCenterMode(USER_DEFINED_CENTER);
+    setCenter(bound.center());
+    setRadius(bound.radius());
+}
+
+void swgLazyLOD::loadRequested()
+{
+    std::vector<unsigned int> toLoad;
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        toLoad.swap(requested);
+    }
+
+    for (unsigned int i = 0; i < toLoad.size(); ++i) {
+        load(toLoad[i]);
+    }
+}
+
+void swgLazyLOD::loadAll()
+{
+    for (unsigned int i = 0; i < getNumChildren(); ++i) {
+        load(i);
+    }
+}
+
+void swgLazyLOD::loadAll(osg::Node& node)
+{
+    loadAllVisitor visitor;
+    node.accept(visitor);
+}
+
+unsigned int swgLazyLOD::getNumLoaded() const
+{
+    return std::count(loaded.begin(), loaded.end(), true);
+}
+
+void swgLazyLOD::load(unsigned int i)
+{
+    if (i >= loaded.size() || loaded[i]) {
+        return;
+    }
+
+    // A level that fails to load keeps its placeholder.
+    loaded[i] = true;
+
+    osg::ref_ptr<osg::Node> child = reader(filenames[i]);
+    if (NULL != child) {
+        setChild(i, child.get());
+    }
+}
+
+void swgLazyLOD::traverse(osg::NodeVisitor& nv)
+{
+    osg::CullStack* cullStack = dynamic_cast<osg::CullStack*>(&nv);
+    if (osg::NodeVisitor::CULL_VISITOR != nv.getVisitorType() || NULL == cullStack) {
+        osg::LOD::traverse(nv);
+        return;
+    }
+
+    // Same range test as osg::LOD.
+    float required = 0.0f;
+    if (DISTANCE_FROM_EYE_POINT == getRangeMode()) {
+        required = nv.getDistanceToViewPoint(getCenter(), true);
+    }
+    else {
+        required = cullStack->clampedPixelSize(getBound()) / cullStack->getLODScale();
+    }
+
+    bool         missing  = false;
+    unsigned int numRange = std::min<unsigned int>(getNumChildren(), getNumRanges());
+    for (unsigned int i = 0; i < numRange; ++i) {
+        if (getMinRange(i) > required || required >= getMaxRange(i)) {
+            continue;
+        }
+
+        if (loaded[i]) {
+            getChild(i)->accept(nv);
+            continue;
+        }
+
+        missing = true;
+
+        std::lock_guard<std::mutex> lock(requestMutex);
+        if (requested.end() == std::find(requested.begin(), requested.end(), i)) {
+            requested.push_back(i);
+        }
+    }
+
+    // Keep something on screen until the missing levels arrive.
+    if (missing && 0 <= coarsest && loaded[coarsest]) {
+        bool drawn = getMinRange(coarsest) <= required && required < getMaxRange(coarsest);
+        if (!drawn) {
+            getChild(coarsest)->accept(nv);
+        }
+    }
+}
+
+void swgLazyLODUpdateCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+{
+    swgLazyLOD* lod = dynamic_cast<swgLazyLOD*>(node);
+    if (NULL != lod) {
+        lod->loadRequested();
+    }
+
+    traverse(node, nv);
+}
@@ -0,0 +1,96 @@
+/** -*-c++-*-
+ *  \file   swgLazyLOD.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <osg/LOD>
+#include <osg/NodeCallback>
+
+#ifndef SWGLAZYLOD_HPP
+#define SWGLAZYLOD_HPP
+
+/**
+ * Level of detail node whose levels are read the first time the cull
+ * traversal finds them in range. Until then each level is an empty
+ * placeholder child, so the ranges stay attached to the right children.
+ * Levels asked for during cull are loaded by the next update traversal,
+ * the coarsest loaded level standing in meanwhile.
+ */
+class swgLazyLOD : public osg::LOD {
+public:
+    typedef std::function<osg::ref_ptr<osg::Node>(const std::string&)> loader;
+
+    swgLazyLOD(const loader& reader);
+
+    // Add a level read from filename once it is in range.
+    void addLazyChild(const std::string& filename, float min, float max);
+
+    /**
+     * Load the coarsest level now and take the center and radius of the
+     * node from it, so culling and range checks work before the other
+     * levels exist. Everything is loaded if the coarsest level fails.
+     */
+    void loadCoarsest();
+
+    // Load the levels asked for by the cull traversal. Main thread only.
+    void loadRequested();
+
+    // Load every level. Main thread only.
+    void loadAll();
+
+    // Load every level of every lazy node below node.
+    static void loadAll(osg::Node& node);
+
+    unsigned int getNumLoaded() const;
+
+    virtual void traverse(osg::NodeVisitor& nv);
+
+protected:
+    virtual ~swgLazyLOD() {}
+
+    void load(unsigned int i);
+
+    loader                   reader;
+    std::vector<std::string> filenames;
+    std::vector<bool>        loaded;
+    int                      coarsest;
+
+    // Written by the cull threads, read by the update thread.
+    std::mutex                requestMutex;
+    std::vector<unsigned int> requested;
+};
+
+/**
+ * Update callback loading the levels a lazy node was asked for.
+ */
+class swgLazyLODUpdateCallback : public osg::NodeCallback {
+public:
+    virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+};
+
+#endif
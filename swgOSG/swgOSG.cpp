@@ -20,12 +20,29 @@
  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#include "swgAnimation.hpp"
+#include "swgAnimationPlayer.hpp"
+#include "swgLazyLOD.hpp"
 #include "swgRepository.hpp"
-
+#include "swgSceneTriangles.hpp"
+#include "swgSkeleton.hpp"
+#include "swgSkinnedMesh.hpp"
+#include "swgSkinningCallback.hpp"
+#include "swgSkinningEngine.hpp"
+#include "swgSkinningKernels.hpp"
+#include "swgTerrainGenerator.hpp"
+#include "swgTerrainKernels.hpp"
+#include "swgTerrainQuery.hpp"
+#include "swgTriangleBVH.hpp"
+#include "swgZonedElements.hpp"
+
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <map>
+#include <random>
 #include <string>
+#include <vector>
 
 #include <osg/Geode>
 #include <osg/Geometry>
@@ -35,6 +52,8 @@
 #include <osg/MatrixTransform>
 #include <osg/Node>
 #include <osg/Texture2D>
+#include <osg/ApplicationUsage>
+#include <osg/ArgumentParser>
 
 #include <osgViewer/Viewer>
 #include <osgViewer/ViewerEventHandlers>
@@ -89,17 +108,350 @@ osg::ref_ptr<osg::Node> buildTerrain()
     return geode;
 }
 
+// Time random height and normal queries spread over a whole terrain, once
+// with the tiles still to be generated and once with them in memory.
+void benchmarkTerrainQuery(swgRepository& repo, const std::string& filename, unsigned int count)
+{
+    std::shared_ptr<swgTerrainQuery> query = repo.loadTerrainQuery(filename);
+    if (NULL == query.get()) {
+        return;
+    }
+
+    float halfSize = query->getTerrainSize() / 2.0f;
+
+    std::mt19937                          random(1);
+    std::uniform_real_distribution<float> position(-halfSize, halfSize);
+
+    std::vector<float> xs(count);
+    std::vector<float> ys(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        xs[i] = position(random);
+        ys[i] = position(random);
+    }
+
+    std::vector<float> heights(count);
+    std::vector<float> normals(3 * count);
+
+    const char* passes[2] = {"cold", "warm"};
+    for (unsigned int pass = 0; pass < 2; ++pass) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        query->heights(&xs[0], &ys[0], &heights[0], count);
+        std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+        query->normals(&xs[0], &ys[0], &normals[0], count);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        double heightSeconds = std::chrono::duration<double>(middle - start).count();
+        double normalSeconds = std::chrono::duration<double>(end - middle).count();
+        std::cout << filename << " " << passes[pass] << ": "
+                  << (count / heightSeconds / 1.0e6) << " M heights/s, "
+                  << (count / normalSeconds / 1.0e6) << " M normals/s" << std::endl;
+    }
+
+    query->report(std::cout);
+}
+
+// Check and time the skinning kernels, then skin a crowd of the given meshes, or
+// generated ones when there are none.
+void benchmarkSkinning(swgSkinningEngine::meshList meshes, unsigned int numInstances)
+{
+    swgSkinningKernels::check(std::cout);
+    swgSkinningKernels::benchmark(std::cout, 1024 * 1024);
+
+    if (meshes.empty()) {
+        for (unsigned int i = 0; i < 8; ++i) {
+            std::shared_ptr<swgSkinnedMesh> mesh(new swgSkinnedMesh);
+            std::vector<float>              pose;
+            swgSkinningKernels::createTestMesh(6000, 64, i + 1, *mesh, pose);
+            meshes.push_back(mesh);
+        }
+    }
+
+    swgThreadPool threadPool;
+    swgSkinningEngine::benchmark(std::cout, &threadPool, meshes, numInstances);
+}
+
+// Pose a crowd playing animations on skeleton and skin it with meshes,
+// generating whichever of them were not given.
+void benchmarkAnimation(std::shared_ptr<swgSkeleton>                 skeleton,
+                        swgAnimationPlayer::animationList            animations,
+                        std::vector<std::shared_ptr<swgSkinnedMesh>> meshes,
+                        unsigned int                                 numCharacters)
+{
+    std::mt19937                          random(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    if (NULL == skeleton.get()) {
+        skeleton.reset(new swgSkeleton);
+        for (int bone = 0; bone < 64; ++bone) {
+            skeleton->addBone("bone" + std::to_string(bone),
+                              0 == bone ? -1 : (bone - 1) / 2,
+                              osg::Quat(),
+                              osg::Quat(),
+                              osg::Vec3(0.0f, 0.1f, 0.0f));
+        }
+    }
+
+    if (animations.empty()) {
+        for (unsigned int clip = 0; clip < 8; ++clip) {
+            std::shared_ptr<swgAnimation> animation(new swgAnimation);
+            animation->setFrames(30.0f, 60);
+            for (unsigned int bone = 0; bone < skeleton->getNumBones(); ++bone) {
+                unsigned int track = animation->addTrack(skeleton->getBoneNames()[bone]);
+                for (unsigned int frame = 0; frame <= 60; frame += 10) {
+                    osg::Vec3 axis(unit(random), unit(random), unit(random));
+                    axis.normalize();
+                    animation->addRotationKey(track, frame, osg::Quat(0.3f * unit(random), axis));
+                }
+            }
+            animations.push_back(animation);
+        }
+    }
+
+    if (meshes.empty()) {
+        for (unsigned int i = 0; i < 8; ++i) {
+            std::shared_ptr<swgSkinnedMesh> mesh(new swgSkinnedMesh);
+            std::vector<float>              pose;
+            swgSkinningKernels::createTestMesh(6000, skeleton->getNumBones(), i + 1, *mesh, pose);
+            meshes.push_back(mesh);
+        }
+    }
+
+    swgSkinningEngine::meshList boundMeshes;
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+        if (!meshes[i]->getBoneNames().empty()) {
+            unsigned int numMissing = meshes[i]->bind(skeleton->getBoneNames());
+            if (0 < numMissing) {
+                std::cout << "Mesh " << i << " uses " << numMissing << " bones not in the skeleton"
+                          << std::endl;
+            }
+        }
+        boundMeshes.push_back(meshes[i]);
+    }
+
+    swgThreadPool threadPool;
+    swgAnimationPlayer::benchmark(
+        std::cout, &threadPool, skeleton, animations, boundMeshes, numCharacters);
+}
+
+// Copy of node, loaded from the .mgn file filename, drawn by a new instance
+// of the skinning engine, or node itself when it can not be skinned. With a
+// skeleton and animations the mesh is bound to the skeleton and plays the
+// animations in turn, one per character added to player.
+osg::ref_ptr<osg::Node> createSkinnedNode(swgRepository&                           repo,
+                                          swgSkinningCallback&                     callback,
+                                          swgAnimationPlayer&                      player,
+                                          std::shared_ptr<swgSkeleton>             skeleton,
+                                          const swgAnimationPlayer::animationList& animations,
+                                          const std::string&                       filename,
+                                          osg::ref_ptr<osg::Node>                  node)
+{
+    osg::Geode*                     geode = node->asGeode();
+    std::shared_ptr<swgSkinnedMesh> mesh  = repo.loadSkinnedMesh(filename);
+    if (NULL == geode || NULL == mesh.get()) {
+        std::cout << "Unable to skin " << filename << std::endl;
+        return node;
+    }
+
+    bool animated = NULL != skeleton.get() && !animations.empty();
+    if (animated && !mesh->getBoneNames().empty()) {
+        unsigned int numMissing = mesh->bind(skeleton->getBoneNames());
+        if (0 < numMissing) {
+            std::cout << filename << " uses " << numMissing << " bones not in the skeleton"
+                      << std::endl;
+        }
+    }
+
+    osg::ref_ptr<osg::Geode> skinned;
+    int                      instance = callback.addInstance(*geode, mesh, skinned);
+    if (0 > instance) {
+        std::cout << "Unable to skin " << filename << std::endl;
+        return node;
+    }
+
+    if (animated) {
+        unsigned int clip = player.getNumCharacters() % animations.size();
+        player.addCharacter(skeleton, animations[clip], 0.0, instance);
+    }
+
+    return skinned;
+}
+
+// True when filename ends in extension.
+bool hasExtension(const std::string& filename, const std::string& extension)
+{
+    return filename.size() >= extension.size() &&
+           0 == filename.compare(filename.size() - extension.size(), extension.size(), extension);
+}
+
 int main(int argc, char** argv)
 {
     std::cout << "argc: " << argc << std::endl;
 
-    if (3 > argc) {
-        std::cout << "Usage: " << argv[0] << " <directory containing .tre files> "
-                  << " <path/to/file/in/tre/archive> " << std::endl;
+    osg::ArgumentParser arguments(&argc, argv);
+
+    osg::ApplicationUsage* usage = arguments.getApplicationUsage();
+    usage->setCommandLineUsage(arguments.getApplicationName()
+                               + " [options] <directory containing .tre files>"
+                               + " <path/to/file/in/tre/archive> ...");
+    usage->addCommandLineOption("--stats", "Print repository statistics after loading.");
+    usage->addCommandLineOption("--headless", "Load files without opening a viewer.");
+    usage->addCommandLineOption("--instancing", "Instance repeated world snapshot objects.");
+    usage->addCommandLineOption("--eager-lod", "Load every LOD level up front.");
+    usage->addCommandLineOption("--lod-pixels <n>", "Screen size where MLOD detail drops.");
+    usage->addCommandLineOption("--lod-scale <f>", "Scale LOD switch distances.");
+    usage->addCommandLineOption("--simplify", "Generate LOD levels for plain meshes.");
+    usage->addCommandLineOption("--texture-budget <MB>", "CPU texture memory budget.");
+    usage->addCommandLineOption("--gpu-texture-budget <MB>", "GPU texture memory budget.");
+    usage->addCommandLineOption("--unref-images", "Release texture images after upload.");
+    usage->addCommandLineOption("--atlas", "Pack small static mesh textures into atlases.");
+    usage->addCommandLineOption("--skip-mips <n>", "Drop the n largest mip levels of textures.");
+    usage->addCommandLineOption("--terrain-spacing <m>", "Finest terrain sample spacing.");
+    usage->addCommandLineOption("--vector-terrain", "Evaluate terrain heights without meshLib.");
+    usage->addCommandLineOption("--terrain-cache <dir>", "Cache terrain heights in dir.");
+    usage->addCommandLineOption("--terrain-cache-format <f>", "Cache as f32, f16 or q16.");
+    usage->addCommandLineOption("--bake-terrain", "Bake all terrain tiles into the cache.");
+    usage->addCommandLineOption("--flora-range <m>", "Distance flora is drawn within.");
+    usage->addCommandLineOption("--region <x> <y> <z> <r>",
+                                "Load only the .ws objects within r of x, y, z.");
+    usage->addCommandLineOption("--occlude <zone>", "Hide a body zone as worn items do.");
+    usage->addCommandLineOption("--skin",
+                                "Draw .mgn files with CPU skinning, posed by .skt and .ans files.");
+    usage->addCommandLineOption("--benchmark-kernels", "Check and time the terrain kernels.");
+    usage->addCommandLineOption("--check-scene-rays", "Check rays against a scene with water.");
+    usage->addCommandLineOption("--check-terrain-layers", "Compare terrain layers to meshLib.");
+    usage->addCommandLineOption("--benchmark-animation <n>",
+                                "Animate n characters with the .skt, .ans and .mgn files.");
+    usage->addCommandLineOption("--benchmark-rays <n>",
+                                "Time n ray and line of sight queries on the loaded files.");
+    usage->addCommandLineOption("--benchmark-skinning <n>",
+                                "Skin n instances of each .mgn file, or generated meshes.");
+    usage->addCommandLineOption("--benchmark-terrain-query <n>",
+                                "Time n height queries on each terrain file.");
+
+    // Print repository statistics once all files are loaded.
+    bool printStatistics = arguments.read("--stats");
+
+    // Load the files without opening a viewer.
+    bool headless = arguments.read("--headless");
+
+    // Draw repeated world snapshot objects with hardware instancing.
+    bool instancing = arguments.read("--instancing");
+
+    // Read all LOD levels while loading rather than once they are in range.
+    bool eagerLOD = arguments.read("--eager-lod");
+
+    // Level of detail switching for MLOD and LOD files.
+    float lodPixelSize = 300.0f;
+    float lodScale     = 1.0f;
+    arguments.read("--lod-pixels", lodPixelSize);
+    arguments.read("--lod-scale", lodScale);
+
+    // World snapshots are loaded only around this point.
+    float regionX      = 0.0f;
+    float regionY      = 0.0f;
+    float regionZ      = 0.0f;
+    float regionRadius = 0.0f;
+    bool  region       = arguments.read("--region", regionX, regionY, regionZ, regionRadius);
+
+    // Simplified levels for meshes without LOD files.
+    bool simplify = arguments.read("--simplify");
+
+    // Texture memory budgets in megabytes, zero means unlimited.
+    unsigned int cpuTextureBudget = 0;
+    unsigned int gpuTextureBudget = 0;
+    arguments.read("--texture-budget", cpuTextureBudget);
+    arguments.read("--gpu-texture-budget", gpuTextureBudget);
+
+    // Drop image data once textures are uploaded.
+    bool unrefImages = arguments.read("--unref-images");
+
+    // Pack small textures into atlases after loading.
+    bool atlas = arguments.read("--atlas");
+
+    // Texture quality tier.
+    unsigned int skipMipLevels = 0;
+    arguments.read("--skip-mips", skipMipLevels);
+
+    float terrainSpacing = 50.0f;
+    arguments.read("--terrain-spacing", terrainSpacing);
+
+    bool vectorTerrain = arguments.read("--vector-terrain");
+
+    std::string terrainCache;
+    std::string terrainCacheFormat("f32");
+    arguments.read("--terrain-cache", terrainCache);
+    arguments.read("--terrain-cache-format", terrainCacheFormat);
+
+    // Bake every terrain tile and color map into the cache after loading.
+    bool bakeTerrain = arguments.read("--bake-terrain");
+
+    // Occlusion zones of skinned meshes hidden under worn items.
+    std::vector<std::string> occludedZones;
+    std::string              occludedZone;
+    while (arguments.read("--occlude", occludedZone)) {
+        occludedZones.push_back(occludedZone);
+    }
+
+    // Draw skinned meshes from the CPU skinning engine.
+    bool skinning = arguments.read("--skin");
+
+    // Terrain flora is drawn within this many meters of the viewer.
+    float floraRange = 400.0f;
+    arguments.read("--flora-range", floraRange);
+
+    // Check the vectorized terrain kernels against their scalar versions
+    // and time both, without loading anything.
+    if (arguments.read("--benchmark-kernels")) {
+        bool passed = swgTerrainKernels::check(std::cout);
+        swgTerrainKernels::benchmark(std::cout, 1024 * 1024);
+        return passed ? 0 : 1;
+    }
+
+    // Compare both terrain height evaluators on a terrain per layer type.
+    if (arguments.read("--check-terrain-layers")) {
+        return swgTerrainGenerator::check(std::cout) ? 0 : 1;
+    }
+
+    // Check that water and other helpers are left out of ray queries.
+    if (arguments.read("--check-scene-rays")) {
+        return checkSceneTriangles(std::cout) ? 0 : 1;
+    }
+
+    // Random terrain height queries per file instead of loading the files.
+    unsigned int numTerrainQueries = 0;
+    arguments.read("--benchmark-terrain-query", numTerrainQueries);
+
+    // CPU skinning throughput for a crowd of n characters.
+    unsigned int numSkinnedInstances = 0;
+    arguments.read("--benchmark-skinning", numSkinnedInstances);
+
+    // Posing and skinning cost of a crowd of n animated characters.
+    unsigned int numAnimatedCharacters = 0;
+    arguments.read("--benchmark-animation", numAnimatedCharacters);
+
+    // Ray and line of sight queries against the triangles of the files.
+    unsigned int numRays = 0;
+    arguments.read("--benchmark-rays", numRays);
+
+    if (0 < numAnimatedCharacters && 3 > arguments.argc()) {
+        benchmarkAnimation(std::shared_ptr<swgSkeleton>(),
+                           swgAnimationPlayer::animationList(),
+                           std::vector<std::shared_ptr<swgSkinnedMesh>>(),
+                           numAnimatedCharacters);
         return 0;
     }
 
-    std::string treDirectory(argv[1]);
+    if (0 < numSkinnedInstances && 3 > arguments.argc()) {
+        benchmarkSkinning(swgSkinningEngine::meshList(), numSkinnedInstances);
+        return 0;
+    }
+
+    if (3 > arguments.argc()) {
+        usage->write(std::cout);
+        return 0;
+    }
+
+    std::string treDirectory(arguments[1]);
     for (unsigned int i = 0; i < treDirectory.size(); ++i) {
         if (treDirectory[i] == '\\') {
             treDirectory[i] = '/';
@@ -111,15 +463,177 @@ int main(int argc, char** argv)
     }
 
     swgRepository repo(treDirectory);
+    repo.setInstancing(instancing);
+    repo.setLazyLOD(!eagerLOD);
+    repo.setLODPixelSize(lodPixelSize);
+    repo.setLODScale(lodScale);
+    repo.setSimplify(simplify);
+    repo.setSkipMipLevels(skipMipLevels);
+    repo.setAtlasing(atlas);
+    repo.setTerrainSpacing(terrainSpacing);
+    repo.setVectorTerrain(vectorTerrain);
+    repo.setFloraRange(floraRange);
+
+    if (!terrainCache.empty()) {
+        swgHeightmapCache::storageFormat format = swgHeightmapCache::FLOAT32;
+        if ("f16" == terrainCacheFormat) {
+            format = swgHeightmapCache::FLOAT16;
+        }
+        else if ("q16" == terrainCacheFormat) {
+            format = swgHeightmapCache::QUANTIZED16;
+        }
+        repo.setHeightmapCache(
+            std::shared_ptr<swgHeightmapCache>(new swgHeightmapCache(terrainCache, format)));
+    }
+
+    if (0 < numAnimatedCharacters) {
+        std::shared_ptr<swgSkeleton>                 skeleton;
+        swgAnimationPlayer::animationList            animations;
+        std::vector<std::shared_ptr<swgSkinnedMesh>> meshes;
+        for (int i = 2; i < arguments.argc(); ++i) {
+            std::string filename(arguments[i]);
+            if (hasExtension(filename, ".skt")) {
+                skeleton = repo.loadSkeleton(filename);
+            }
+            else if (hasExtension(filename, ".ans")) {
+                std::shared_ptr<swgAnimation> animation = repo.loadAnimation(filename);
+                if (NULL != animation.get()) {
+                    animations.push_back(animation);
+                }
+            }
+            else if (hasExtension(filename, ".mgn")) {
+                std::shared_ptr<swgSkinnedMesh> mesh = repo.loadSkinnedMesh(filename);
+                if (NULL != mesh.get()) {
+                    meshes.push_back(mesh);
+                }
+            }
+        }
+        benchmarkAnimation(skeleton, animations, meshes, numAnimatedCharacters);
+        return 0;
+    }
+
+    if (0 < numSkinnedInstances) {
+        swgSkinningEngine::meshList meshes;
+        for (int i = 2; i < arguments.argc(); ++i) {
+            std::shared_ptr<swgSkinnedMesh> mesh = repo.loadSkinnedMesh(arguments[i]);
+            if (NULL != mesh.get()) {
+                meshes.push_back(mesh);
+            }
+        }
+        benchmarkSkinning(meshes, numSkinnedInstances);
+        return 0;
+    }
+
+    if (0 < numTerrainQueries) {
+        for (int i = 2; i < arguments.argc(); ++i) {
+            benchmarkTerrainQuery(repo, arguments[i], numTerrainQueries);
+        }
+        return 0;
+    }
+
+    swgTextureManager& textureManager = repo.getTextureManager();
+    textureManager.setCPUBudget(cpuTextureBudget * 1024ULL * 1024ULL);
+    textureManager.setGPUBudget(gpuTextureBudget * 1024ULL * 1024ULL);
+    textureManager.setUnRefImageDataAfterApply(unrefImages);
 
     osg::ref_ptr<osg::MatrixTransform> rootNode(new osg::MatrixTransform);
 
     rootNode->setMatrix(osg::Matrix::rotate(osg::DegreesToRadians(90.0), 1.0, 0.0, 0.0));
+    rootNode->addUpdateCallback(new swgTextureUpdateCallback(&textureManager));
+
+    // Poses and skins every .mgn file once per frame, before it is drawn.
+    std::unique_ptr<swgThreadPool>      skinningThreads;
+    std::unique_ptr<swgSkinningEngine>  skinningEngine;
+    std::unique_ptr<swgAnimationPlayer> animationPlayer;
+    osg::ref_ptr<swgSkinningCallback>   skinningCallback;
+    std::shared_ptr<swgSkeleton>        skeleton;
+    swgAnimationPlayer::animationList   animations;
+    if (skinning) {
+        skinningThreads.reset(new swgThreadPool);
+        skinningEngine.reset(new swgSkinningEngine(skinningThreads.get()));
+        animationPlayer.reset(new swgAnimationPlayer(skinningThreads.get(), skinningEngine.get()));
+        skinningCallback = new swgSkinningCallback(skinningEngine.get());
+        skinningCallback->setPlayer(animationPlayer.get());
+        rootNode->addUpdateCallback(skinningCallback.get());
+
+        // The skeleton and animations have to be known before the meshes.
+        for (int i = 2; i < arguments.argc(); ++i) {
+            std::string filename(arguments[i]);
+            if (hasExtension(filename, ".skt")) {
+                skeleton = repo.loadSkeleton(filename);
+            }
+            else if (hasExtension(filename, ".ans")) {
+                std::shared_ptr<swgAnimation> animation = repo.loadAnimation(filename);
+                if (NULL != animation.get()) {
+                    animations.push_back(animation);
+                }
+            }
+        }
+    }
 
-    unsigned int numFiles = (argc - 2);
+    unsigned int numFiles = (arguments.argc() - 2);
     for (unsigned int i = 0; i < numFiles; ++i) {
-        std::string filename(argv[2 + i]);
-        rootNode->addChild(repo.loadFile(filename));
+        std::string             filename(arguments[2 + i]);
+        osg::ref_ptr<osg::Node> node;
+        if (region && hasExtension(filename, ".ws")) {
+            osg::BoundingSphere sphere(osg::Vec3(regionX, regionY, regionZ), regionRadius);
+            node = repo.loadWSNPRegion(filename, sphere);
+        }
+        else {
+            node = repo.loadFile(filename);
+        }
+
+        // Occlude zones on a copy of its own, not on the meshes the
+        // repository hands to every later load of the same files.
+        if (NULL != node && !occludedZones.empty()) {
+            swgLazyLOD::loadAll(*node);
+            node = swgZonedElements::cloneZones(*node);
+        }
+
+        if (NULL != node && skinning && hasExtension(filename, ".mgn")) {
+            node = createSkinnedNode(
+                repo, *skinningCallback, *animationPlayer, skeleton, animations, filename, node);
+        }
+        rootNode->addChild(node);
+    }
+
+    for (unsigned int i = 0; i < occludedZones.size(); ++i) {
+        unsigned int numChanged =
+            swgZonedElements::setZoneOccluded(*rootNode, occludedZones[i], true);
+        std::cout << "Occluded zone " << occludedZones[i] << " in " << numChanged
+                  << " index lists" << std::endl;
+    }
+
+    if (0 < numRays) {
+        std::shared_ptr<swgTriangleBVH> bvh = repo.buildTriangleBVH(*rootNode);
+        bvh->report(std::cout);
+        bvh->check(std::cout, 64);
+
+        swgThreadPool threadPool;
+        bvh->benchmark(std::cout, &threadPool, numRays);
+        bvh->report(std::cout);
+        return 0;
+    }
+
+    if (atlas) {
+        repo.buildTextureAtlases();
+    }
+
+    if (bakeTerrain) {
+        repo.bakeTerrains(std::cout);
+    }
+
+    // Without a viewer nothing swaps in the decoded textures.
+    if (printStatistics || headless) {
+        textureManager.flush();
+    }
+
+    if (printStatistics) {
+        repo.printStatistics(std::cout);
+    }
+
+    if (headless) {
+        return 0;
     }
 
     // construct the viewer.
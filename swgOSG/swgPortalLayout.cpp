@@ -0,0 +1,207 @@
+/** -*-c++-*-
+ *  \file   swgPortalLayout.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgPortalLayout.hpp"
+
+#include <cmath>
+
+#include <osg/ComputeBoundsVisitor>
+#include <osg/CullStack>
+#include <osg/NodeVisitor>
+
+namespace {
+// Walking more portals than this in one frame means a layout too tangled
+// to be worth it, all cells are drawn instead.
+const unsigned int maxSteps = 1024;
+
+// Closer than this to a portal the view may pass through it at any angle.
+const float portalClearance = 0.5f;
+} // namespace
+
+swgPortalLayout::swgPortalLayout() {}
+
+void swgPortalLayout::addCell(osg::Node* model)
+{
+    // An empty group keeps the child and cell numbers the same.
+    addChild(NULL != model ? model : new osg::Group);
+    cellPortals.push_back(std::vector<unsigned int>());
+}
+
+void swgPortalLayout::addPortal(const std::vector<osg::Vec3>& vertices,
+                                unsigned int                  cellA,
+                                unsigned int                  cellB)
+{
+    if (3 > vertices.size() || cellA >= getNumCells() || cellB >= getNumCells()
+        || cellA == cellB) {
+        return;
+    }
+
+    portal newPortal;
+    newPortal.vertices = vertices;
+    newPortal.cells[0] = cellA;
+    newPortal.cells[1] = cellB;
+
+    // Newell's method copes with slightly bent and degenerate polygons.
+    osg::Vec3 normal;
+    for (unsigned int i = 0; i < vertices.size(); ++i) {
+        const osg::Vec3& current = vertices[i];
+        const osg::Vec3& next    = vertices[(i + 1) % vertices.size()];
+
+        normal.x() += (current.y() - next.y()) * (current.z() + next.z());
+        normal.y() += (current.z() - next.z()) * (current.x() + next.x());
+        normal.z() += (current.x() - next.x()) * (current.y() + next.y());
+        newPortal.center += current;
+    }
+    newPortal.center /= vertices.size();
+
+    newPortal.planar = 0.0f < normal.normalize();
+    if (newPortal.planar) {
+        newPortal.plane = osg::Plane(normal, newPortal.center);
+    }
+
+    cellPortals[cellA].push_back(portals.size());
+    cellPortals[cellB].push_back(portals.size());
+    portals.push_back(newPortal);
+}
+
+void swgPortalLayout::computeCellBounds()
+{
+    cellBounds.resize(getNumCells());
+    for (unsigned int i = 0; i < getNumCells() && i < getNumChildren(); ++i) {
+        osg::ComputeBoundsVisitor visitor;
+        getChild(i)->accept(visitor);
+        cellBounds[i] = visitor.getBoundingBox();
+    }
+}
+
+unsigned int swgPortalLayout::findCell(const osg::Vec3& point) const
+{
+    unsigned int found  = 0;
+    float        volume = 0.0f;
+    for (unsigned int i = 1; i < cellBounds.size(); ++i) {
+        const osg::BoundingBox& bound = cellBounds[i];
+        if (!bound.valid() || !bound.contains(point)) {
+            continue;
+        }
+
+        float cellVolume = (bound.xMax() - bound.xMin()) * (bound.yMax() - bound.yMin())
+                           * (bound.zMax() - bound.zMin());
+        if (0 == found || cellVolume < volume) {
+            found  = i;
+            volume = cellVolume;
+        }
+    }
+
+    return found;
+}
+
+void swgPortalLayout::traverse(osg::NodeVisitor& nv)
+{
+    osg::CullStack* cullStack = dynamic_cast<osg::CullStack*>(&nv);
+    if (osg::NodeVisitor::CULL_VISITOR != nv.getVisitorType() || NULL == cullStack
+        || portals.empty()) {
+        osg::Group::traverse(nv);
+        return;
+    }
+
+    // The frustum and eye are both in the space of this node.
+    const osg::Vec3 eye = cullStack->getEyeLocal();
+
+    std::vector<bool> onPath(getNumCells(), false);
+    std::vector<bool> visible(getNumCells(), false);
+    unsigned int      numSteps = 0;
+    if (!visitCell(findCell(eye),
+                   cullStack->getCurrentCullingSet().getFrustum(),
+                   eye,
+                   onPath,
+                   visible,
+                   numSteps)) {
+        osg::Group::traverse(nv);
+        return;
+    }
+
+    for (unsigned int i = 0; i < getNumCells() && i < getNumChildren(); ++i) {
+        if (visible[i]) {
+            getChild(i)->accept(nv);
+        }
+    }
+}
+
+bool swgPortalLayout::visitCell(unsigned int         cell,
+                                const osg::Polytope& frustum,
+                                const osg::Vec3&     eye,
+                                std::vector<bool>&   onPath,
+                                std::vector<bool>&   visible,
+                                unsigned int&        numSteps) const
+{
+    visible[cell] = true;
+    onPath[cell]  = true;
+
+    const std::vector<unsigned int>& cellPortal = cellPortals[cell];
+    for (unsigned int i = 0; i < cellPortal.size(); ++i) {
+        const portal& current = portals[cellPortal[i]];
+        unsigned int  next    = cell == current.cells[0] ? current.cells[1] : current.cells[0];
+        if (onPath[next]) {
+            continue;
+        }
+
+        // Polytope tests update its plane mask, so test a copy.
+        osg::Polytope narrowed(frustum);
+        if (!narrowed.contains(current.vertices)) {
+            continue;
+        }
+
+        if (maxSteps < ++numSteps) {
+            return false;
+        }
+
+        // Cut the frustum down to the planes through the eye and each edge
+        // of the portal, facing its center.
+        if (current.planar && portalClearance < std::fabs(current.plane.distance(eye))) {
+            for (unsigned int j = 0; j < current.vertices.size(); ++j) {
+                osg::Vec3 from = current.vertices[j] - eye;
+                osg::Vec3 to   = current.vertices[(j + 1) % current.vertices.size()] - eye;
+
+                osg::Vec3 normal = from ^ to;
+                if (0.0f >= normal.normalize()) {
+                    continue;
+                }
+
+                osg::Plane edge(normal, eye);
+                if (0.0f > edge.distance(current.center)) {
+                    edge.flip();
+                }
+                narrowed.add(edge);
+            }
+        }
+
+        if (!visitCell(next, narrowed, eye, onPath, visible, numSteps)) {
+            return false;
+        }
+    }
+
+    onPath[cell] = false;
+    return true;
+}
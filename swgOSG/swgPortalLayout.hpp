@@ -0,0 +1,92 @@
+/** -*-c++-*-
+ *  \file   swgPortalLayout.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <vector>
+
+#include <osg/BoundingBox>
+#include <osg/Group>
+#include <osg/Plane>
+#include <osg/Polytope>
+#include <osg/Vec3>
+
+#ifndef SWGPORTALLAYOUT_HPP
+#define SWGPORTALLAYOUT_HPP
+
+/**
+ * Cells of a building joined by portals. Child i is the model of cell i,
+ * cell 0 being the outside. The cull traversal starts in the cell holding
+ * the eye and only enters the cells seen through a chain of portals, each
+ * portal narrowing the view to the part of the frustum passing through it.
+ */
+class swgPortalLayout : public osg::Group {
+public:
+    swgPortalLayout();
+
+    // Append a cell, model may be NULL.
+    void addCell(osg::Node* model);
+
+    // Join two cells through a polygon with its vertices in order around it.
+    void addPortal(const std::vector<osg::Vec3>& vertices, unsigned int cellA, unsigned int cellB);
+
+    unsigned int getNumCells() const { return cellPortals.size(); }
+    unsigned int getNumPortals() const { return portals.size(); }
+
+    // Measure the cell models once all cells have been added.
+    void computeCellBounds();
+
+    // Smallest cell other than the outside holding point, else zero.
+    unsigned int findCell(const osg::Vec3& point) const;
+
+    virtual void traverse(osg::NodeVisitor& nv);
+
+protected:
+    virtual ~swgPortalLayout() {}
+
+    struct portal {
+        std::vector<osg::Vec3> vertices;
+        osg::Vec3              center;
+        osg::Plane             plane;
+        bool                   planar;
+        unsigned int           cells[2];
+    };
+
+    /**
+     * Mark cell visible and walk on through each of its portals that lies
+     * in frustum and leads to a cell not already on the path. Returns false
+     * once more than maxSteps portals have been walked through.
+     */
+    bool visitCell(unsigned int         cell,
+                   const osg::Polytope& frustum,
+                   const osg::Vec3&     eye,
+                   std::vector<bool>&   onPath,
+                   std::vector<bool>&   visible,
+                   unsigned int&        numSteps) const;
+
+    std::vector<portal>                    portals;
+    std::vector<std::vector<unsigned int>> cellPortals;
+    std::vector<osg::BoundingBox>          cellBounds;
+};
+
+#endif
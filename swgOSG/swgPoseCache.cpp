@@ -0,0 +1,153 @@
+/** -*-c++-*-
+ *  \file   swgPoseCache.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgPoseCache.hpp"
+#include "swgSkinningKernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+swgPoseCache::swgPoseCache(float samplesPerSecond)
+    : samplesPerSecond(samplesPerSecond)
+    , frame(0)
+    , numRequests(0)
+    , numEvaluations(0)
+    , numFrames(0)
+    , maxPoses(0)
+{
+}
+
+bool swgPoseCache::key::operator<(const key& other) const
+{
+    if (animation != other.animation) {
+        return std::less<const swgAnimation*>()(animation, other.animation);
+    }
+    if (skeleton != other.skeleton) {
+        return std::less<const swgSkeleton*>()(skeleton, other.skeleton);
+    }
+    return sample < other.sample;
+}
+
+std::shared_ptr<const swgPoseCache::pose> swgPoseCache::getPose(
+    std::shared_ptr<const swgAnimation> animation,
+    std::shared_ptr<const swgSkeleton>  skeleton,
+    double                              time)
+{
+    // Samples of a single pass through the clip, so every loop shares them.
+    double    duration   = animation->getDuration();
+    long long numSamples = std::max(1LL, std::llround(duration * samplesPerSecond));
+    long long sample     = 0;
+    if (0.0 < duration) {
+        double looped = animation->getFrame(time) / animation->getFramesPerSecond();
+        sample        = std::llround(looped * samplesPerSecond) % numSamples;
+    }
+
+    std::promise<std::shared_ptr<const pose>>       promise;
+    std::shared_future<std::shared_ptr<const pose>> result;
+    const binding*                                  bound      = NULL;
+    bool                                            evaluating = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++numRequests;
+
+        binding& pair = bindings[std::make_pair(animation.get(), skeleton.get())];
+        if (NULL == pair.animation.get()) {
+            pair.animation = animation;
+            pair.skeleton  = skeleton;
+            pair.tracks    = animation->bind(*skeleton);
+        }
+        bound = &pair;
+
+        key                            posed = {animation.get(), skeleton.get(), sample};
+        std::map<key, entry>::iterator found = poses.find(posed);
+        if (poses.end() != found) {
+            found->second.lastUsed = frame;
+            result                 = found->second.result;
+        }
+        else {
+            entry added;
+            added.result   = promise.get_future().share();
+            added.lastUsed = frame;
+            poses[posed]   = added;
+            result         = added.result;
+            evaluating     = true;
+            ++numEvaluations;
+        }
+    }
+
+    if (evaluating) {
+        promise.set_value(evaluate(*bound, sample));
+    }
+
+    return result.get();
+}
+
+std::shared_ptr<const swgPoseCache::pose> swgPoseCache::evaluate(const binding& bound,
+                                                                 long long      sample) const
+{
+    float frameNumber = bound.animation->getFrame(sample / (double)samplesPerSecond);
+
+    std::vector<osg::Matrix> local;
+    std::vector<osg::Matrix> world;
+    bound.animation->evaluatePose(*bound.skeleton, bound.tracks, frameNumber, local);
+    bound.skeleton->computeWorld(local, world);
+
+    unsigned int          numBones = std::max(1u, bound.skeleton->getNumBones());
+    std::shared_ptr<pose> matrices(new pose(numBones * swgSkinningKernels::matrixSize, 0.0f));
+    bound.skeleton->computeSkinMatrices(world, &(*matrices)[0]);
+
+    return matrices;
+}
+
+void swgPoseCache::endFrame()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    maxPoses = std::max(maxPoses, poses.size());
+    for (std::map<key, entry>::iterator i = poses.begin(); i != poses.end();) {
+        if (frame != i->second.lastUsed) {
+            poses.erase(i++);
+        }
+        else {
+            ++i;
+        }
+    }
+
+    ++frame;
+    ++numFrames;
+}
+
+void swgPoseCache::report(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    out << "Poses: " << numRequests << " requests, " << numEvaluations << " evaluations over "
+        << numFrames << " frames, " << maxPoses << " cached at most";
+    if (0 < numFrames) {
+        out << ", " << (numEvaluations / (double)numFrames) << " evaluations per frame";
+    }
+    out << std::endl;
+}
@@ -0,0 +1,105 @@
+/** -*-c++-*-
+ *  \file   swgPoseCache.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "swgAnimation.hpp"
+#include "swgSkeleton.hpp"
+
+#ifndef SWGPOSECACHE_HPP
+#define SWGPOSECACHE_HPP
+
+/**
+ * Skinning matrices of skeletons posed by animations, shared between every
+ * character playing the same clip at the same time. Times are rounded to a
+ * fixed sample rate, so a crowd costs one pose evaluation per distinct clip
+ * and sample each frame. Safe to call from several threads at once; a pose
+ * asked for by several threads is evaluated by the first of them while the
+ * others wait for it.
+ */
+class swgPoseCache {
+public:
+    // Matrices of every bone in the layout of swgSkinningKernels.
+    typedef std::vector<float> pose;
+
+    swgPoseCache(float samplesPerSecond = 30.0f);
+
+    float getSamplesPerSecond() const { return samplesPerSecond; }
+
+    // Pose of skeleton time seconds into animation, played in a loop.
+    std::shared_ptr<const pose> getPose(std::shared_ptr<const swgAnimation> animation,
+                                        std::shared_ptr<const swgSkeleton>  skeleton,
+                                        double                              time);
+
+    // Forget poses not asked for since the previous call. Call once per
+    // frame, after all getPose calls of the frame have returned.
+    void endFrame();
+
+    void report(std::ostream& out) const;
+
+protected:
+    struct key {
+        const swgAnimation* animation;
+        const swgSkeleton*  skeleton;
+        long long           sample;
+
+        bool operator<(const key& other) const;
+    };
+
+    // Tracks of an animation moving each bone of a skeleton. Kept for the
+    // life of the cache, holding on to the pair so their addresses are not
+    // reused by other clips or skeletons.
+    struct binding {
+        std::shared_ptr<const swgAnimation> animation;
+        std::shared_ptr<const swgSkeleton>  skeleton;
+        std::vector<int>                    tracks;
+    };
+
+    struct entry {
+        std::shared_future<std::shared_ptr<const pose>> result;
+        unsigned int                                    lastUsed;
+    };
+
+    std::shared_ptr<const pose> evaluate(const binding& bound, long long sample) const;
+
+    float samplesPerSecond;
+
+    mutable std::mutex                                                   mutex;
+    std::map<key, entry>                                                 poses;
+    std::map<std::pair<const swgAnimation*, const swgSkeleton*>, binding> bindings;
+
+    unsigned int       frame;
+    unsigned long long numRequests;
+    unsigned long long numEvaluations;
+    unsigned long long numFrames;
+    size_t             maxPoses;
+};
+
+#endif
@@ -23,6 +23,25 @@
 */
 
 #include "swgRepository.hpp"
+#include "swgAnimation.hpp"
+#include "swgDDS.hpp"
+#include "swgFloraScatter.hpp"
+#include "swgHash.hpp"
+#include "swgIFFReader.hpp"
+#include "swgInstancing.hpp"
+#include "swgLazyLOD.hpp"
+#include "swgPortalLayout.hpp"
+#include "swgSceneTriangles.hpp"
+#include "swgSimplifier.hpp"
+#include "swgSkeleton.hpp"
+#include "swgSkinnedMesh.hpp"
+#include "swgSpatialIndex.hpp"
+#include "swgTerrainGenerator.hpp"
+#include "swgTerrainQuery.hpp"
+#include "swgTerrainTile.hpp"
+#include "swgTriangleBVH.hpp"
+#include "swgWorldTable.hpp"
+#include "swgZonedElements.hpp"
 #include <meshLib/apt.hpp>
 #include <meshLib/cmp.hpp>
 #include <meshLib/cshd.hpp>
@@ -41,9 +60,15 @@
 #include <meshLib/trn.hpp>
 #include <meshLib/ws.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <sstream>
 
 #include <osgDB/Registry>
+#include <osg/AlphaFunc>
 #include <osg/Point>
 #include <osg/ShapeDrawable>
 #include <osg/AutoTransform>
@@ -51,14 +76,43 @@
 #include <osgText/Text>
 
 swgRepository::swgRepository(const std::string& archiveFilePath)
+    : instancing(false)
+    , atlasing(false)
+    , lazyLOD(true)
+    , lodPixelSize(300.0f)
+    , lodScale(1.0f)
+    , simplifying(false)
+    , lodDepth(0)
+    , skipMipLevels(0)
+    , terrainSpacing(50.0f)
+    , vectorTerrain(false)
+    , floraRange(400.0f)
+    , numLazyLevels(0)
+    , numLazyLoads(0)
+    , numSimplifiedMeshes(0)
 {
     createArchive(archiveFilePath);
 
     // Get pointer to ddsplugin.
     ddsPlugin = osgDB::Registry::instance()->getReaderWriterForExtension("dds");
+
+    // Textures are read and decoded on the thread pool while geometry
+    // conversion carries on.
+    textureManager.setImageReader(
+        [this](const std::string& filename) { return readTextureImage(filename); });
+    textureManager.setThreadPool(&threadPool);
+}
+
+swgRepository::~swgRepository()
+{
+    // Outstanding texture reads use the archive and the manager.
+    threadPool.wait();
 }
 
-swgRepository::~swgRepository() {}
+void swgRepository::setInstancing(bool enable)
+{
+    instancing = enable;
+}
 
 osg::ref_ptr<osg::Node> swgRepository::loadFile(const std::string& filename)
 {
@@ -81,7 +135,7 @@ osg::ref_ptr<osg::Node> swgRepository::loadFile(const std::string& filename)
     std::cout << "Reading file from archive: " << filename << std::endl;
 
     // Read file data into a stream
-    std::shared_ptr<std::istream> iffFile(archive.getFileStream(filename));
+    std::shared_ptr<std::istream> iffFile(openArchiveFile(filename));
 
     if (NULL == iffFile.get()) {
         std::cout << "Unable to find file in archive!" << std::endl;
@@ -98,6 +152,9 @@ osg::ref_ptr<osg::Node> swgRepository::loadFile(const std::string& filename)
     else if ("CCLT" == type) {
         ; // Do nothing
     }
+    else if ("CKAT" == type || "KFAT" == type) {
+        ; // Animations have no nodes, they are read by loadAnimation.
+    }
     else if ("CMPA" == type) {
         newNode = loadCMP(iffFile);
     }
@@ -166,11 +223,66 @@ osg::ref_ptr<osg::Texture2D> swgRepository::loadTextureFile(const std::string& f
         return currentTexture->second;
     }
 
-    // Otherwise we need to read the file from the archive.
-    std::cout << "Reading file from archive: " << filename << std::endl;
+    // A missing file gets no texture, so the shader is left without one
+    // rather than drawing the placeholder forever. The stream opened to
+    // find out is the one decoded later.
+    std::shared_ptr<std::istream> textureFile(openArchiveFile(filename));
+    if (NULL == textureFile.get()) {
+        std::cout << "Unable to find texture in archive: " << filename << std::endl;
+        return NULL;
+    }
+    {
+        std::unique_lock<std::mutex> lock(archiveMutex);
+        openedTextures[filename] = textureFile;
+    }
+
+    // Return the texture right away with a placeholder image. The dds file
+    // is decoded on the thread pool and swapped in by the texture manager,
+    // which may also drop the image later and read it back through
+    // readTextureImage.
+    std::cout << "Queued texture: " << filename << std::endl;
+    osg::ref_ptr<swgManagedTexture> texture = new swgManagedTexture(filename);
+    textureManager.addTextureAsync(texture.get());
+
+    textureMap[filename] = texture;
+
+    return texture;
+}
+
+osg::ref_ptr<osg::Image> swgRepository::readTextureImage(const std::string& filename)
+{
+    // Take the file loadTextureFile opened, or read it from the archive
+    // again after an eviction. This runs on the texture manager's worker
+    // threads.
+    std::shared_ptr<std::istream> textureFile;
+    {
+        std::unique_lock<std::mutex> lock(archiveMutex);
+        std::map<std::string, std::shared_ptr<std::istream>>::iterator opened =
+            openedTextures.find(filename);
+        if (openedTextures.end() != opened) {
+            textureFile = opened->second;
+            openedTextures.erase(opened);
+        }
+    }
+
+    if (NULL == textureFile.get()) {
+        std::cout << "Reading file from archive: " << filename << std::endl;
+        textureFile = openArchiveFile(filename);
+    }
+
+    if (NULL == textureFile.get()) {
+        std::cout << "Unable to find file in archive!" << std::endl;
+        return NULL;
+    }
 
-    // Setup an auto_ptr to handle the istream.
-    std::shared_ptr<std::istream> textureFile(archive.getFileStream(filename));
+    // Lower quality tiers never read the largest mip levels.
+    if (0 < skipMipLevels) {
+        std::shared_ptr<std::istream> reducedFile =
+            swgDDS::skipMipLevels(*textureFile, skipMipLevels);
+        if (NULL != reducedFile.get()) {
+            textureFile = reducedFile;
+        }
+    }
 
     // Call DDS plugin directly to read from istream.
     if (!ddsPlugin) {
@@ -180,20 +292,19 @@ osg::ref_ptr<osg::Texture2D> swgRepository::loadTextureFile(const std::string& f
 
     osgDB::ReaderWriter::ReadResult result = ddsPlugin->readImage(*textureFile);
 
-    // If plugin was successful, then create new texture with
-    // dds file.
-    osg::ref_ptr<osg::Texture2D> texture(NULL);
-    if (result.status() == osgDB::ReaderWriter::ReadResult::FILE_LOADED) {
-        std::cout << "Loaded texture: " << filename << std::endl;
-        texture = new osg::Texture2D;
-        texture->setImage(result.getImage());
+    if (result.status() != osgDB::ReaderWriter::ReadResult::FILE_LOADED) {
+        return NULL;
     }
 
-    if (NULL != texture) {
-        textureMap[filename] = texture;
-    }
+    return result.getImage();
+}
 
-    return texture;
+std::shared_ptr<std::istream> swgRepository::openArchiveFile(const std::string& filename)
+{
+    // The archive hands back an independent in-memory stream, so only the
+    // lookup and read need the lock.
+    std::unique_lock<std::mutex> lock(archiveMutex);
+    return std::shared_ptr<std::istream>(archive.getFileStream(filename));
 }
 
 osg::ref_ptr<osg::StateSet> swgRepository::loadShader(const std::string& shaderFilename)
@@ -216,7 +327,7 @@ osg::ref_ptr<osg::StateSet> swgRepository::loadShader(const std::string& shaderF
     std::cout << "Reading shader from archive: " << shaderFilename << std::endl;
 
     // Read file data into a stream
-    std::shared_ptr<std::istream> shaderFile(archive.getFileStream(shaderFilename));
+    std::shared_ptr<std::istream> shaderFile(openArchiveFile(shaderFilename));
 
     // Figure out what type this generic .iff actually is.
     std::string type = ml::base::getType(*shaderFile);
@@ -363,18 +474,325 @@ osg::ref_ptr<osg::StateSet> swgRepository::loadShader(const std::string& shaderF
 
     } // if NULL != shaderFile
 
+    // Different shader files often describe the same material and texture,
+    // share one state between them so OSG can sort and batch by it.
+    osg::ref_ptr<osg::Material> sharedMat = shareMaterial(mat);
+    if (sharedMat != mat) {
+        stateSet->setAttributeAndModes(sharedMat.get());
+    }
+    stateSet = shareStateSet(stateSet);
+
     stateMap[shaderFilename] = stateSet;
 
     return stateSet;
 }
 
+osg::ref_ptr<osg::Material> swgRepository::shareMaterial(osg::ref_ptr<osg::Material> material)
+{
+    const osg::Material::Face face = osg::Material::FRONT;
+
+    swgHash hash;
+    hash.add(material->getColorMode());
+    hash.add(material->getAmbient(face));
+    hash.add(material->getDiffuse(face));
+    hash.add(material->getSpecular(face));
+    hash.add(material->getEmission(face));
+    hash.add(material->getShininess(face));
+
+    std::vector<osg::ref_ptr<osg::Material>>& candidates = uniqueMaterialMap[hash.get()];
+    for (unsigned int i = 0; i < candidates.size(); ++i) {
+        if (0 == candidates[i]->compare(*material)) {
+            return candidates[i];
+        }
+    }
+
+    candidates.push_back(material);
+    return material;
+}
+
+osg::ref_ptr<osg::StateSet> swgRepository::shareStateSet(osg::ref_ptr<osg::StateSet> stateSet)
+{
+    swgHash hash;
+
+    // Materials and textures are already shared by content and filename, so
+    // their pointers identify them. Texture parameters are hashed as well
+    // since the same texture object may be reconfigured by a later shader.
+    const osg::StateSet::AttributeList& attributes = stateSet->getAttributeList();
+    for (osg::StateSet::AttributeList::const_iterator attribute = attributes.begin();
+         attribute != attributes.end();
+         ++attribute) {
+        hash.add(attribute->first);
+        hash.add(attribute->second.first.get());
+        hash.add(attribute->second.second);
+    }
+
+    const osg::StateSet::ModeList& modes = stateSet->getModeList();
+    for (osg::StateSet::ModeList::const_iterator mode = modes.begin(); mode != modes.end();
+         ++mode) {
+        hash.add(mode->first);
+        hash.add(mode->second);
+    }
+
+    const osg::StateSet::TextureAttributeList& textureAttributes =
+        stateSet->getTextureAttributeList();
+    for (unsigned int unit = 0; unit < textureAttributes.size(); ++unit) {
+        const osg::StateSet::AttributeList& unitAttributes = textureAttributes[unit];
+        for (osg::StateSet::AttributeList::const_iterator attribute = unitAttributes.begin();
+             attribute != unitAttributes.end();
+             ++attribute) {
+            hash.add(unit);
+            hash.add(attribute->first);
+            hash.add(attribute->second.first.get());
+            hash.add(attribute->second.second);
+
+            const osg::Texture* texture = attribute->second.first->asTexture();
+            if (NULL != texture) {
+                hash.add(texture->getWrap(osg::Texture::WRAP_S));
+                hash.add(texture->getWrap(osg::Texture::WRAP_T));
+            }
+        }
+    }
+
+    const osg::StateSet::TextureModeList& textureModes = stateSet->getTextureModeList();
+    for (unsigned int unit = 0; unit < textureModes.size(); ++unit) {
+        const osg::StateSet::ModeList& unitModes = textureModes[unit];
+        for (osg::StateSet::ModeList::const_iterator mode = unitModes.begin();
+             mode != unitModes.end();
+             ++mode) {
+            hash.add(unit);
+            hash.add(mode->first);
+            hash.add(mode->second);
+        }
+    }
+
+    std::vector<osg::ref_ptr<osg::StateSet>>& candidates = uniqueStateMap[hash.get()];
+    for (unsigned int i = 0; i < candidates.size(); ++i) {
+        if (0 == candidates[i]->compare(*stateSet, true)) {
+            return candidates[i];
+        }
+    }
+
+    candidates.push_back(stateSet);
+    return stateSet;
+}
+
+namespace
+{
+// Polygon around the triangles of an indexed portal, following the edges
+// used by a single triangle. Falls back to the vertex order if the edges do
+// not form one loop.
+std::vector<osg::Vec3> outlinePortal(const std::vector<osg::Vec3>& vertices,
+                                     const std::vector<int>&       indices)
+{
+    std::map<std::pair<int, int>, int> edgeCount;
+    for (unsigned int i = 0; i + 2 < indices.size(); i += 3) {
+        for (unsigned int j = 0; j < 3; ++j) {
+            int a = indices[i + j];
+            int b = indices[i + (j + 1) % 3];
+            ++edgeCount[std::make_pair(std::min(a, b), std::max(a, b))];
+        }
+    }
+
+    std::map<int, int> next;
+    for (unsigned int i = 0; i + 2 < indices.size(); i += 3) {
+        for (unsigned int j = 0; j < 3; ++j) {
+            int a = indices[i + j];
+            int b = indices[i + (j + 1) % 3];
+            if (1 == edgeCount[std::make_pair(std::min(a, b), std::max(a, b))]) {
+                next[a] = b;
+            }
+        }
+    }
+
+    std::vector<osg::Vec3> polygon;
+    if (!next.empty()) {
+        int current = next.begin()->first;
+        do {
+            if (current < 0 || current >= (int)vertices.size()) {
+                break;
+            }
+            polygon.push_back(vertices[current]);
+
+            std::map<int, int>::const_iterator found = next.find(current);
+            current = (next.end() == found) ? -1 : found->second;
+        } while (current != next.begin()->first && polygon.size() <= next.size());
+    }
+
+    if (polygon.size() != next.size() || polygon.size() < 3) {
+        polygon = vertices;
+    }
+
+    return polygon;
+}
+
+// Portal polygons of a PRTS form. Version 0003 stores each as a PRTL chunk
+// with a vertex count and the vertices in order, version 0004 as an IDTL
+// form with a VERT and an INDX chunk.
+void readPortalPolygons(swgIFFReader& iff, std::vector<std::vector<osg::Vec3>>& polygons)
+{
+    iff.enterForm("PRTS");
+    while (iff.isValid() && !iff.atEnd()) {
+        std::vector<osg::Vec3> vertices;
+        std::vector<int>       indices;
+
+        if ("PRTL" == iff.peek() && !iff.isForm()) {
+            iff.enterChunk("PRTL");
+            int numVertices = iff.readInt32();
+            for (int i = 0; i < numVertices && iff.isValid(); ++i) {
+                float x = iff.readFloat();
+                float y = iff.readFloat();
+                float z = iff.readFloat();
+                vertices.push_back(osg::Vec3(x, y, z));
+            }
+            iff.exit();
+            polygons.push_back(vertices);
+        }
+        else if ("IDTL" == iff.peek()) {
+            iff.enterForm("IDTL");
+            iff.enterForm(iff.peek());
+            while (iff.isValid() && !iff.atEnd()) {
+                if ("VERT" == iff.peek()) {
+                    iff.enterChunk("VERT");
+                    while (iff.isValid() && iff.getRemaining() >= 12) {
+                        float x = iff.readFloat();
+                        float y = iff.readFloat();
+                        float z = iff.readFloat();
+                        vertices.push_back(osg::Vec3(x, y, z));
+                    }
+                    iff.exit();
+                }
+                else if ("INDX" == iff.peek()) {
+                    iff.enterChunk("INDX");
+                    while (iff.isValid() && iff.getRemaining() >= 4) {
+                        indices.push_back(iff.readInt32());
+                    }
+                    iff.exit();
+                }
+                else {
+                    iff.skip();
+                }
+            }
+            iff.exit();
+            iff.exit();
+            polygons.push_back(outlinePortal(vertices, indices));
+        }
+        else {
+            iff.skip();
+        }
+    }
+    iff.exit();
+}
+
+// One portal of a cell: the polygon it uses and the cell on its other
+// side. Older files store a bare PRTL chunk, newer ones a PRTL form with a
+// chunk named after its version, 0005 adding a disabled flag up front.
+bool readCellPortal(swgIFFReader& iff, int& polygon, int& connectingCell)
+{
+    if (!iff.isForm()) {
+        iff.enterChunk("PRTL");
+        polygon = iff.readInt32();
+        iff.readUInt8(); // clockwise
+        connectingCell = iff.readInt32();
+        iff.exit();
+        return iff.isValid();
+    }
+
+    iff.enterForm("PRTL");
+    std::string version = iff.peek();
+    iff.enterChunk(version);
+    if ("0005" == version) {
+        iff.readUInt8(); // disabled
+    }
+    iff.readUInt8(); // passable
+    polygon = iff.readInt32();
+    iff.readUInt8(); // clockwise
+    connectingCell = iff.readInt32();
+    iff.exit();
+    iff.exit();
+
+    return iff.isValid();
+}
+
+// Copy the portals of a PRTO file into layout. meshLib only exposes the
+// cell models, so the PRTS polygons and the PRTL records of every CELL are
+// read straight from the file.
+bool readPortals(const std::string& data, swgPortalLayout& layout)
+{
+    swgIFFReader iff(data);
+    if (!iff.enterForm("PRTO") || !iff.enterForm(iff.peek())) {
+        return false;
+    }
+
+    std::vector<std::vector<osg::Vec3>> polygons;
+    std::vector<bool>                   added;
+    unsigned int                        cell = 0;
+
+    while (iff.isValid() && !iff.atEnd()) {
+        if ("PRTS" == iff.peek() && iff.isForm()) {
+            readPortalPolygons(iff, polygons);
+
+            // Swapped like mesh vertices.
+            for (unsigned int i = 0; i < polygons.size(); ++i) {
+                for (unsigned int j = 0; j < polygons[i].size(); ++j) {
+                    osg::Vec3& vertex = polygons[i][j];
+                    vertex.set(vertex.z(), vertex.y(), vertex.x());
+                }
+            }
+            added.assign(polygons.size(), false);
+        }
+        else if ("CELS" == iff.peek() && iff.isForm()) {
+            iff.enterForm("CELS");
+            while (iff.isValid() && !iff.atEnd()) {
+                if ("CELL" != iff.peek() || !iff.isForm()) {
+                    iff.skip();
+                    continue;
+                }
+
+                iff.enterForm("CELL");
+                iff.enterForm(iff.peek());
+                while (iff.isValid() && !iff.atEnd()) {
+                    if ("PRTL" != iff.peek()) {
+                        iff.skip();
+                        continue;
+                    }
+
+                    // Both cells list a shared portal, it is added once.
+                    int polygon, connectingCell;
+                    if (readCellPortal(iff, polygon, connectingCell) && 0 <= polygon
+                        && polygon < (int)polygons.size() && !added[polygon]
+                        && 0 <= connectingCell) {
+                        layout.addPortal(polygons[polygon], cell, connectingCell);
+                        added[polygon] = true;
+                    }
+                }
+                iff.exit();
+                iff.exit();
+                ++cell;
+            }
+            iff.exit();
+        }
+        else {
+            iff.skip();
+        }
+    }
+
+    return iff.isValid();
+}
+
+} // namespace
+
 osg::ref_ptr<osg::Node> swgRepository::loadPRTO(std::shared_ptr<std::istream> prtoFile)
 {
-    // Read from stream into prto record
-    ml::prto swgPRTO;
-    swgPRTO.readPRTO(*prtoFile);
+    // Read from stream into prto record. The portals are read from the
+    // same bytes afterwards.
+    std::string        data((std::istreambuf_iterator<char>(*prtoFile)),
+                     std::istreambuf_iterator<char>());
+    std::istringstream prtoStream(data);
+    ml::prto           swgPRTO;
+    swgPRTO.readPRTO(prtoStream);
 
-    osg::ref_ptr<osg::Group> prtoMesh(new osg::Group);
+    // Cells are drawn only when seen through the portals leading to them.
+    osg::ref_ptr<swgPortalLayout> prtoMesh(new swgPortalLayout);
 
     unsigned int numCells = swgPRTO.getNumCells();
     for (unsigned int i = 0; i < numCells; ++i) {
@@ -382,11 +800,17 @@ osg::ref_ptr<osg::Node> swgRepository::loadPRTO(std::shared_ptr<std::istream> pr
 
         osg::ref_ptr<osg::Node> cellModel = loadFile(currentCell.getModelFilename());
 
-        if (NULL != cellModel) {
-            prtoMesh->addChild(cellModel.get());
-        }
+        prtoMesh->addCell(cellModel.get());
     }
 
+    if (!readPortals(data, *prtoMesh)) {
+        std::cout << "Unable to read portals." << std::endl;
+    }
+    prtoMesh->computeCellBounds();
+
+    std::cout << "Num cells: " << prtoMesh->getNumCells()
+              << ", portals: " << prtoMesh->getNumPortals() << std::endl;
+
     return prtoMesh;
 }
 
@@ -452,19 +876,20 @@ osg::ref_ptr<osg::Node> swgRepository::loadMSH(std::shared_ptr<std::istream> mes
         }
 
         // Create new geometry node list of vertex attributes.
+        // Arrays identical to ones already loaded are shared.
         osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
 
-        geometry->setVertexArray(vertices);
+        geometry->setVertexArray(arrayCache.share(vertices));
 
-        geometry->setColorArray(colors);
+        geometry->setColorArray(arrayCache.share(colors));
         geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
 
-        geometry->setNormalArray(normals);
+        geometry->setNormalArray(arrayCache.share(normals));
         geometry->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
 
         for (unsigned int j = 0; j < ml::MAX_TEXTURES; ++j) {
             if (!(texCoordVec[j]->empty())) {
-                geometry->setTexCoordArray(j, texCoordVec[j].get());
+                geometry->setTexCoordArray(j, arrayCache.share(texCoordVec[j].get()));
             }
         }
 
@@ -485,31 +910,86 @@ osg::ref_ptr<osg::Node> swgRepository::loadMSH(std::shared_ptr<std::istream> mes
         }
 
         // Add primitive set to this geometry node.
-        geometry->addPrimitiveSet(drawElements);
+        geometry->addPrimitiveSet(arrayCache.share(drawElements));
 
         // Load shader and attach to this geometry node.
         std::string shaderFilename = swgMesh.getShader(iData->getShaderIndex());
         geometry->setStateSet(loadShader(shaderFilename));
 
-        osg::VertexBufferObject* vbo = new osg::VertexBufferObject;
-        vertices->setVertexBufferObject(vbo);
-
-        osg::ElementBufferObject* ebo = new osg::ElementBufferObject;
-        drawElements->setElementBufferObject(ebo);
+        // Suballocate vertex and index data from the shared buffers.
+        bufferPool.addGeometry(geometry.get());
 
-        geometry->setUseVertexBufferObjects((NULL != vbo));
+        if (atlasing) {
+            textureAtlas.addGeometry(geometry.get());
+        }
 
         geode->addDrawable(geometry.get());
     }
 
+    // Meshes that are not a level of an LOD file get levels of their own.
+    if (simplifying && 0 == lodDepth) {
+        return createSimplifiedLOD(geode);
+    }
+
     return geode;
 }
 
+namespace
+{
+// Name the occlusion zones of an SKMG file and list the zones covering
+// each group of occludable triangles. meshLib does not expose them, so the
+// zone names of the OZN chunk and the zone combinations of the OZC chunk,
+// which the groups of the OITL triangle lists refer to, are read straight
+// from the file. Each combination is a 16 bit count followed by as many
+// 16 bit zone indices.
+bool readOcclusionZones(const std::string&                      data,
+                        std::vector<std::string>&               zoneNames,
+                        std::vector<std::vector<unsigned int>>& groupZones)
+{
+    swgIFFReader iff(data);
+    if (!iff.enterForm("SKMG") || !iff.enterForm(iff.peek())) {
+        return false;
+    }
+
+    while (iff.isValid() && !iff.atEnd()) {
+        std::string tag = iff.peek();
+        if ("OZN " == tag && !iff.isForm()) {
+            iff.enterChunk("OZN ");
+            while (iff.isValid() && !iff.atEnd()) {
+                zoneNames.push_back(iff.readString());
+            }
+            iff.exit();
+        }
+        else if ("OZC " == tag && !iff.isForm()) {
+            iff.enterChunk("OZC ");
+            while (iff.isValid() && iff.getRemaining() >= 2) {
+                int numZones = iff.readInt16();
+                groupZones.push_back(std::vector<unsigned int>());
+                for (int i = 0; i < numZones && iff.isValid(); ++i) {
+                    groupZones.back().push_back(iff.readUInt16());
+                }
+            }
+            iff.exit();
+        }
+        else {
+            iff.skip();
+        }
+    }
+
+    return iff.isValid();
+}
+
+} // namespace
+
 osg::ref_ptr<osg::Node> swgRepository::loadSKMG(std::shared_ptr<std::istream> meshFile)
 {
-    // Read from stream into skmg record
-    ml::skmg     swgSKMG;
-    unsigned int size = swgSKMG.readSKMG(*meshFile);
+    // Read from stream into skmg record. The occlusion zones are read from
+    // the same bytes afterwards.
+    std::string        data((std::istreambuf_iterator<char>(*meshFile)),
+                     std::istreambuf_iterator<char>());
+    std::istringstream skmgStream(data);
+    ml::skmg           swgSKMG;
+    unsigned int       size = swgSKMG.readSKMG(skmgStream);
     if (0 == size) {
         return NULL;
     }
@@ -518,6 +998,14 @@ osg::ref_ptr<osg::Node> swgRepository::loadSKMG(std::shared_ptr<std::istream> me
     osg::ref_ptr<osg::Geode> geode(new osg::Geode());
 
 
+    std::vector<std::string>               zoneNames;
+    std::vector<std::vector<unsigned int>> groupZones;
+    if (!readOcclusionZones(data, zoneNames, groupZones)) {
+        std::cout << "Unable to read occlusion zones." << std::endl;
+        zoneNames.clear();
+        groupZones.clear();
+    }
+
     unsigned int numPsdt = swgSKMG.getNumPsdt();
 
     for (unsigned int j = 0; j < numPsdt; ++j) {
@@ -550,65 +1038,60 @@ osg::ref_ptr<osg::Node> swgRepository::loadSKMG(std::shared_ptr<std::istream> me
         }
 
         // Create new geometry node list of vertex attributes.
+        // Arrays identical to ones already loaded are shared.
         osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
 
-        geometry->setVertexArray(vertices);
+        geometry->setVertexArray(arrayCache.share(vertices));
 
-        geometry->setColorArray(colors);
+        geometry->setColorArray(arrayCache.share(colors));
         geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
 
-        geometry->setNormalArray(normals);
+        geometry->setNormalArray(arrayCache.share(normals));
         geometry->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
 
-        geometry->setTexCoordArray(0, texCoords);
+        geometry->setTexCoordArray(0, arrayCache.share(texCoords));
+
+        // All triangles go into one index list, the ones that are never
+        // occluded first, then a range per occlusion group. The list holds
+        // its own occlusion state, so it is not shared with other meshes.
+        osg::ref_ptr<swgZonedElements> drawElements = new swgZonedElements;
+        for (unsigned int i = 0; i < zoneNames.size(); ++i) {
+            drawElements->addZone(zoneNames[i]);
+        }
+
+        drawElements->addRange(newPsdt.getTriangles(), std::vector<unsigned int>());
 
         std::cout << "Num groups: " << swgSKMG.getNumGroups() << std::endl;
-        osg::ElementBufferObject* ebo = new osg::ElementBufferObject;
         for (unsigned short int i = 0; i <= swgSKMG.getNumGroups(); ++i) {
-            // Create new primitive set to hold this list.
-            osg::DrawElementsUShort* drawElements =
-                new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES);
+            int group = i - 1;
 
-            const std::vector<unsigned int>& oitl = newPsdt.getOTriangles(i - 1);
-            std::cout << "Group " << (i - 1) << ": Num triangles: " << (oitl.size() / 3)
+            const std::vector<unsigned int>& oitl = newPsdt.getOTriangles(group);
+            std::cout << "Group " << group << ": Num triangles: " << (oitl.size() / 3)
                       << std::endl;
-            // Populate primitive set with indices.
-            for (unsigned int j = 0; j < oitl.size(); ++j) {
-                drawElements->push_back(oitl[j]);
-            }
 
-            // Add primitive set to this geometry node.
-            drawElements->setElementBufferObject(ebo);
-            geometry->addPrimitiveSet(drawElements);
-        }
-
-        {
-            // Create new primitive set to hold this list.
-            osg::DrawElementsUShort* drawElements =
-                new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES);
-
-            const std::vector<unsigned int>& itl = newPsdt.getTriangles();
-            // Populate primitive set with indices.
-            for (unsigned int j = 0; j < itl.size(); ++j) {
-                drawElements->push_back(itl[j]);
+            std::vector<unsigned int> zones;
+            if (0 <= group && group < (int)groupZones.size()) {
+                zones = groupZones[group];
             }
-
-            // Add primitive set to this geometry node.
-            drawElements->setElementBufferObject(ebo);
-            geometry->addPrimitiveSet(drawElements);
+            drawElements->addRange(oitl, zones);
         }
 
+        geometry->addPrimitiveSet(drawElements.get());
+
         // Load shader and attach to this geometry node.
         std::string shaderFilename = newPsdt.getShader();
         geometry->setStateSet(loadShader(shaderFilename));
 
-        osg::VertexBufferObject* vbo = new osg::VertexBufferObject;
-        vertices->setVertexBufferObject(vbo);
-
-        geometry->setUseVertexBufferObjects((NULL != vbo));
+        // Suballocate vertex and index data from the shared buffers.
+        bufferPool.addGeometry(geometry.get());
 
         geode->addDrawable(geometry.get());
     }
+
+    if (simplifying && 0 == lodDepth) {
+        return createSimplifiedLOD(geode);
+    }
+
     return geode;
 }
 
@@ -618,25 +1101,206 @@ osg::ref_ptr<osg::Node> swgRepository::loadLOD(std::shared_ptr<std::istream> lod
     ml::lod swgLOD;
     swgLOD.readLOD(*lodFile);
 
-    osg::ref_ptr<osg::LOD> lodMesh = new osg::LOD;
-
     unsigned int numLODs = swgLOD.getNumLODs();
     std::cout << "Num LODs: " << numLODs << std::endl;
     std::string childFilename;
     float       near, far;
+
+    if (lazyLOD) {
+        osg::ref_ptr<swgLazyLOD> lazyMesh = createLazyLOD();
+        for (unsigned int i = 0; i < numLODs; ++i) {
+            swgLOD.getChild(i, childFilename, near, far);
+            lazyMesh->addLazyChild(childFilename, near * lodScale, far * lodScale);
+        }
+        lazyMesh->loadCoarsest();
+        numLazyLevels += numLODs;
+        return lazyMesh;
+    }
+
+    osg::ref_ptr<osg::LOD> lodMesh = new osg::LOD;
     for (unsigned int i = 0; i < numLODs; ++i) {
         swgLOD.getChild(i, childFilename, near, far);
 
-        osg::ref_ptr<osg::Node> childMesh = loadFile(childFilename);
+        osg::ref_ptr<osg::Node> childMesh = loadLevel(childFilename);
 
         if (NULL != childMesh) {
-            lodMesh->addChild(childMesh, near, far);
+            lodMesh->addChild(childMesh, near * lodScale, far * lodScale);
         }
     }
 
     return lodMesh;
 }
 
+osg::ref_ptr<swgLazyLOD> swgRepository::createLazyLOD()
+{
+    return new swgLazyLOD([this](const std::string& filename) {
+        ++numLazyLoads;
+        return loadLevel(filename);
+    });
+}
+
+osg::ref_ptr<osg::Node> swgRepository::loadLevel(const std::string& filename)
+{
+    ++lodDepth;
+    osg::ref_ptr<osg::Node> level = loadFile(filename);
+    --lodDepth;
+
+    return level;
+}
+
+osg::ref_ptr<osg::Node> swgRepository::createSimplifiedLOD(osg::ref_ptr<osg::Geode> geode)
+{
+    static const unsigned int numLevels    = 3;
+    static const unsigned int minTriangles = 64;
+
+    // Each level keeps at most this share of the triangles of the last.
+    static const float maxLevelShare = 0.75f;
+
+    std::vector<osg::Geometry*> geometries;
+    for (unsigned int i = 0; i < geode->getNumDrawables(); ++i) {
+        osg::Geometry* geometry = geode->getDrawable(i)->asGeometry();
+        if (NULL != geometry) {
+            geometries.push_back(geometry);
+        }
+    }
+
+    // Simplify the geometries side by side, building the nodes afterwards
+    // on this thread.
+    std::vector<std::vector<std::vector<unsigned int>>> remaps(geometries.size());
+    std::vector<std::vector<unsigned int>>              levelTriangles(geometries.size());
+    std::vector<unsigned int>                           fullTriangles(geometries.size(), 0);
+    threadPool.parallelFor(0, geometries.size(), [&](unsigned int g) {
+        const osg::Vec3Array* vertices =
+            dynamic_cast<const osg::Vec3Array*>(geometries[g]->getVertexArray());
+        if (NULL == vertices || vertices->empty()) {
+            return;
+        }
+
+        swgSimplifier simplifier(&(*vertices)[0][0], vertices->size());
+        for (unsigned int i = 0; i < geometries[g]->getNumPrimitiveSets(); ++i) {
+            const osg::DrawElementsUShort* elements =
+                dynamic_cast<const osg::DrawElementsUShort*>(geometries[g]->getPrimitiveSet(i));
+            if (NULL == elements || osg::PrimitiveSet::TRIANGLES != elements->getMode()) {
+                continue;
+            }
+            for (unsigned int j = 0; j + 2 < elements->size(); j += 3) {
+                simplifier.addTriangle((*elements)[j], (*elements)[j + 1], (*elements)[j + 2]);
+            }
+        }
+
+        fullTriangles[g] = simplifier.getNumTriangles();
+        if (minTriangles > fullTriangles[g]) {
+            return;
+        }
+
+        std::vector<unsigned int> targets;
+        for (unsigned int level = 1; level <= numLevels; ++level) {
+            targets.push_back(fullTriangles[g] >> level);
+        }
+        simplifier.simplify(targets, remaps[g], levelTriangles[g]);
+    });
+
+    // Stop at the first level that no longer pays for itself.
+    unsigned int previous = 0;
+    for (unsigned int g = 0; g < geometries.size(); ++g) {
+        previous += fullTriangles[g];
+    }
+
+    unsigned int numUseful = 0;
+    for (unsigned int level = 0; level < numLevels; ++level) {
+        unsigned int total = 0;
+        for (unsigned int g = 0; g < geometries.size(); ++g) {
+            total += remaps[g].empty() ? fullTriangles[g] : levelTriangles[g][level];
+        }
+        if (total > previous * maxLevelShare) {
+            break;
+        }
+        previous = total;
+        ++numUseful;
+    }
+
+    if (0 == numUseful) {
+        return geode;
+    }
+
+    osg::ref_ptr<osg::LOD> lod = new osg::LOD;
+    lod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+
+    float minPixels, maxPixels;
+    getMLODRange(0, numUseful + 1, minPixels, maxPixels);
+    lod->addChild(geode.get(), minPixels, maxPixels);
+
+    for (unsigned int level = 0; level < numUseful; ++level) {
+        osg::ref_ptr<osg::Geode> levelGeode = new osg::Geode;
+
+        for (unsigned int g = 0; g < geometries.size(); ++g) {
+            if (remaps[g].empty()) {
+                levelGeode->addDrawable(geometries[g]);
+                continue;
+            }
+
+            // The reduced geometry draws the same arrays with fewer indices.
+            const std::vector<unsigned int>& remap    = remaps[g][level];
+            osg::ref_ptr<osg::Geometry>      geometry =
+                new osg::Geometry(*geometries[g], osg::CopyOp::SHALLOW_COPY);
+            geometry->removePrimitiveSet(0, geometry->getNumPrimitiveSets());
+
+            for (unsigned int i = 0; i < geometries[g]->getNumPrimitiveSets(); ++i) {
+                osg::PrimitiveSet*       primitiveSet = geometries[g]->getPrimitiveSet(i);
+                osg::DrawElementsUShort* elements =
+                    dynamic_cast<osg::DrawElementsUShort*>(primitiveSet);
+                if (NULL == elements || osg::PrimitiveSet::TRIANGLES != elements->getMode()) {
+                    geometry->addPrimitiveSet(primitiveSet);
+                    continue;
+                }
+
+                // Coarser levels of a skinned mesh hide the same zones.
+                swgZonedElements* zoned = dynamic_cast<swgZonedElements*>(primitiveSet);
+                if (NULL != zoned) {
+                    geometry->addPrimitiveSet(zoned->reduce(remap).get());
+                    continue;
+                }
+
+                osg::ref_ptr<osg::DrawElementsUShort> reduced =
+                    new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES);
+                for (unsigned int j = 0; j + 2 < elements->size(); j += 3) {
+                    unsigned int a = (*elements)[j];
+                    unsigned int b = (*elements)[j + 1];
+                    unsigned int c = (*elements)[j + 2];
+                    if (a < remap.size() && b < remap.size() && c < remap.size()) {
+                        a = remap[a];
+                        b = remap[b];
+                        c = remap[c];
+                    }
+                    if (a != b && b != c && a != c) {
+                        reduced->push_back(a);
+                        reduced->push_back(b);
+                        reduced->push_back(c);
+                    }
+                }
+
+                if (!reduced->empty()) {
+                    geometry->addPrimitiveSet(arrayCache.share(reduced.get()));
+                }
+            }
+
+            bufferPool.addGeometry(geometry.get());
+
+            if (atlasing) {
+                textureAtlas.addGeometry(geometry.get());
+            }
+
+            levelGeode->addDrawable(geometry.get());
+        }
+
+        getMLODRange(level + 1, numUseful + 1, minPixels, maxPixels);
+        lod->addChild(levelGeode.get(), minPixels, maxPixels);
+    }
+
+    ++numSimplifiedMeshes;
+    return lod;
+}
+
 osg::ref_ptr<osg::Node> swgRepository::loadCMP(std::shared_ptr<std::istream> cmpFile)
 {
     // Read from stream into cmp record
@@ -839,103 +1503,409 @@ osg::ref_ptr<osg::Node> swgRepository::loadINLY(std::shared_ptr<std::istream> in
     return inlyMesh;
 }
 
-osg::ref_ptr<osg::Node> swgRepository::loadWSNP(std::shared_ptr<std::istream> wsnpFile)
+// Matrix placing an object relative to the snapshot root, taken from the
+// transforms resolved by the table.
+osg::Matrix getWSNodeMatrix(const swgWorldTable& worldTable, unsigned int index)
 {
-    // Read from stream into wsnp record
-    ml::ws swgWSNP;
-    swgWSNP.readWS(*wsnpFile);
+    float x, y, z, w;
+    worldTable.getWorldRotation(index, x, y, z, w);
+    osg::Matrix rotMat(osg::Matrix::rotate(osg::Quat(x, y, z, w)));
 
-    osg::ref_ptr<osg::MatrixTransform> wsnpMesh = new osg::MatrixTransform;
-    wsnpMesh->setMatrix(osg::Matrix::rotate(-osg::PI, 1, 0, 0));
+    worldTable.getWorldPosition(index, x, y, z);
+    return rotMat * osg::Matrix::translate(x, y, z);
+}
 
+void buildWorldTable(ml::ws& swgWSNP, swgWorldTable& worldTable)
+{
     unsigned int numObjects = swgWSNP.getNumObjectNodes();
-    std::cout << "Number of object nodes: " << numObjects << std::endl;
+    worldTable.reserve(numObjects);
 
-    std::map<unsigned int, osg::ref_ptr<osg::MatrixTransform>> wsNodeMap;
-
-    for (unsigned int i = 0; i < numObjects; ++i)
-    // for( unsigned int i = 0; i < 1000; ++i )
-    {
+    for (unsigned int i = 0; i < numObjects; ++i) {
         ml::wsNode& node = swgWSNP.getObjectNode(i);
-        std::string objectFilename(node.getObjectFilename());
 
-        std::cout << "Loading object node: " << objectFilename << std::endl;
+        float position[3];
+        position[0] = node.getX();
+        position[1] = node.getY();
+        position[2] = node.getZ();
 
-        osg::ref_ptr<osg::Node> objectMesh = loadFile(objectFilename);
+        float rotation[4];
+        rotation[0] = node.getQuatX();
+        rotation[1] = node.getQuatY();
+        rotation[2] = node.getQuatZ();
+        rotation[3] = node.getQuatW();
 
-        osg::Quat nodeQuat(node.getQuatX(), node.getQuatY(), node.getQuatZ(), node.getQuatW());
-        osg::ref_ptr<osg::MatrixTransform> transform = new osg::MatrixTransform;
-        osg::Matrix                        rotMat(osg::Matrix::rotate(nodeQuat));
-
-        osg::Matrix trotMat(rotMat(0, 0),
-                            rotMat(1, 0),
-                            -rotMat(2, 0),
-                            rotMat(3, 0),
-                            rotMat(0, 1),
-                            rotMat(1, 1),
-                            -rotMat(2, 1),
-                            rotMat(3, 1),
-                            -rotMat(0, 2),
-                            -rotMat(1, 2),
-                            rotMat(2, 2),
-                            -rotMat(3, 2),
-                            rotMat(0, 3),
-                            rotMat(1, 3),
-                            -rotMat(2, 3),
-                            rotMat(3, 3));
-
-        osg::Matrix matrix(trotMat * osg::Matrix::rotate(-osg::PI_2, 0, 1, 0)
-                           * osg::Matrix::translate(node.getX(), node.getY(), node.getZ()));
-        transform->setMatrix(matrix);
-        transform->addChild(objectMesh);
+        worldTable.addObject(
+            node.getID(), node.getParentID(), node.getObjectFilename(), position, rotation);
+    }
 
-        wsNodeMap[node.getID()] = transform;
+    worldTable.resolve();
 
-        if (0 == node.getParentID()) {
-            wsnpMesh->addChild(transform);
-        }
-        else {
-            wsNodeMap[node.getParentID()]->addChild(transform);
-        }
+    if (0 < worldTable.getNumOrphans()) {
+        std::cout << "Objects with missing parents: " << worldTable.getNumOrphans() << std::endl;
     }
-
-    return wsnpMesh;
 }
 
-osg::Geode* createAxis()
+std::shared_ptr<swgWorldTable> swgRepository::loadWorldTable(const std::string& filename)
 {
-    osg::Geode*    geode(new osg::Geode());
-    osg::Geometry* geometry(new osg::Geometry());
+    std::shared_ptr<std::istream> wsnpFile(openArchiveFile(filename));
+    if (NULL == wsnpFile.get()) {
+        std::cout << "Unable to find file in archive!" << std::endl;
+        return std::shared_ptr<swgWorldTable>();
+    }
 
-    osg::Vec3Array* vertices(new osg::Vec3Array());
-    vertices->push_back(osg::Vec3(0.0, 0.0, 0.0));
-    vertices->push_back(osg::Vec3(1.0, 0.0, 0.0));
-    vertices->push_back(osg::Vec3(0.0, 0.0, 0.0));
-    vertices->push_back(osg::Vec3(0.0, 1.0, 0.0));
-    vertices->push_back(osg::Vec3(0.0, 0.0, 0.0));
-    vertices->push_back(osg::Vec3(0.0, 0.0, 1.0));
-    geometry->setVertexArray(vertices);
+    std::string type = ml::base::getType(*wsnpFile);
+    if ("WSNP" != type) {
+        std::cout << "Not a world snapshot. File is type: " << type << std::endl;
+        return std::shared_ptr<swgWorldTable>();
+    }
 
-    osg::Vec4Array* colors(new osg::Vec4Array());
-    colors->push_back(osg::Vec4(1.0f, 0.0f, 0.0f, 1.0f));
-    colors->push_back(osg::Vec4(1.0f, 0.0f, 0.0f, 1.0f));
-    colors->push_back(osg::Vec4(0.0f, 1.0f, 0.0f, 1.0f));
-    colors->push_back(osg::Vec4(0.0f, 1.0f, 0.0f, 1.0f));
-    colors->push_back(osg::Vec4(0.0f, 0.0f, 1.0f, 1.0f));
-    colors->push_back(osg::Vec4(0.0f, 0.0f, 1.0f, 1.0f));
-    geometry->setColorArray(colors);
+    ml::ws swgWSNP;
+    swgWSNP.readWS(*wsnpFile);
 
-    geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
-    geometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::LINES, 0, 6));
-    geode->getOrCreateStateSet()->setMode(GL_LIGHTING, false);
+    std::shared_ptr<swgWorldTable> worldTable(new swgWorldTable);
+    buildWorldTable(swgWSNP, *worldTable);
 
-    geode->addDrawable(geometry);
-    return geode;
+    return worldTable;
 }
 
-osg::Geode* createLine(const osg::Vec3& xyz)
+struct swgRepository::worldSnapshot {
+    std::shared_ptr<swgWorldTable> table;
+    swgSpatialIndex                index;
+    std::vector<unsigned int>      roots;
+};
+
+// Index the root objects of a snapshot by the world bound of their meshes
+// and the meshes of everything attached to them. meshBounds holds the
+// bound of each path of the table.
+void buildRootIndex(const swgWorldTable&                    worldTable,
+                    const std::vector<osg::BoundingSphere>& meshBounds,
+                    swgSpatialIndex&                        index,
+                    std::vector<unsigned int>&              roots)
 {
-    osg::Geode*    geode(new osg::Geode());
+    // Parents come before their children, so the root of each object is
+    // known by the time it is reached.
+    std::vector<unsigned int>        rootOf(worldTable.size());
+    std::vector<osg::BoundingSphere> bounds;
+    for (unsigned int i = 0; i < worldTable.size(); ++i) {
+        int parent = worldTable.getParent(i);
+        if (parent < 0) {
+            rootOf[i] = bounds.size();
+            bounds.push_back(osg::BoundingSphere());
+            roots.push_back(i);
+        }
+        else {
+            rootOf[i] = rootOf[parent];
+        }
+
+        // Objects without a mesh still count as the point they stand on.
+        const osg::BoundingSphere& mesh = meshBounds[worldTable.getPathId(i)];
+        osg::Matrix                world = getWSNodeMatrix(worldTable, i);
+        if (mesh.valid()) {
+            bounds[rootOf[i]].expandBy(osg::BoundingSphere(mesh.center() * world, mesh.radius()));
+        }
+        else {
+            bounds[rootOf[i]].expandBy(world.getTrans());
+        }
+    }
+
+    std::vector<float> x, y, z, radius;
+    for (unsigned int i = 0; i < bounds.size(); ++i) {
+        x.push_back(bounds[i].center().x());
+        y.push_back(bounds[i].center().y());
+        z.push_back(bounds[i].center().z());
+        radius.push_back(std::max(bounds[i].radius(), 0.0f));
+    }
+    if (!roots.empty()) {
+        index.build(&x[0], &y[0], &z[0], &radius[0], roots.size());
+    }
+}
+
+std::shared_ptr<swgRepository::worldSnapshot>
+swgRepository::loadWorldSnapshot(const std::string& filename)
+{
+    std::map<std::string, std::shared_ptr<worldSnapshot>>::iterator cached =
+        worldSnapshots.find(filename);
+    if (worldSnapshots.end() != cached) {
+        return cached->second;
+    }
+
+    std::shared_ptr<worldSnapshot> snapshot(new worldSnapshot);
+    snapshot->table = loadWorldTable(filename);
+    if (NULL == snapshot->table.get()) {
+        return std::shared_ptr<worldSnapshot>();
+    }
+
+    // The meshes are needed for their bounds; they stay in the node map
+    // for the objects the queries then load.
+    const swgWorldTable&             worldTable = *snapshot->table;
+    std::vector<osg::BoundingSphere> meshBounds(worldTable.getNumPaths());
+    for (unsigned int pathId = 0; pathId < worldTable.getNumPaths(); ++pathId) {
+        osg::ref_ptr<osg::Node> objectMesh = loadFile(worldTable.getPath(pathId));
+        if (NULL != objectMesh) {
+            meshBounds[pathId] = objectMesh->getBound();
+        }
+    }
+
+    buildRootIndex(worldTable, meshBounds, snapshot->index, snapshot->roots);
+    worldSnapshots[filename] = snapshot;
+
+    return snapshot;
+}
+
+// Select the found root objects and everything attached to them.
+std::vector<bool> selectRoots(const swgWorldTable&             worldTable,
+                              const std::vector<unsigned int>& roots,
+                              const std::vector<unsigned int>& found)
+{
+    std::vector<bool> selected(worldTable.size(), false);
+    for (unsigned int i = 0; i < found.size(); ++i) {
+        selected[roots[found[i]]] = true;
+    }
+
+    // Parents come before their children in the table.
+    for (unsigned int i = 0; i < worldTable.size(); ++i) {
+        int parent = worldTable.getParent(i);
+        if (parent >= 0 && selected[parent]) {
+            selected[i] = true;
+        }
+    }
+
+    return selected;
+}
+
+// Regroup nodes under a hierarchy of groups following spatial index cells
+// so whole areas can be culled at once.
+osg::ref_ptr<osg::Group> createSpatialGroup(const swgSpatialIndex&                      index,
+                                            unsigned int                                cellIndex,
+                                            const std::vector<osg::ref_ptr<osg::Node>>& nodes)
+{
+    const swgSpatialIndex::cell& cell = index.getCell(cellIndex);
+
+    osg::ref_ptr<osg::Group> group = new osg::Group;
+    if (cell.leaf) {
+        const unsigned int* objects = index.getCellObjects(cellIndex);
+        for (unsigned int i = 0; i < cell.numObjects; ++i) {
+            group->addChild(nodes[objects[i]].get());
+        }
+    }
+    else {
+        for (unsigned int i = 0; i < 4; ++i) {
+            if (0 <= cell.children[i]) {
+                group->addChild(createSpatialGroup(index, cell.children[i], nodes).get());
+            }
+        }
+    }
+
+    return group;
+}
+
+osg::ref_ptr<osg::Group> createSpatialGroups(const std::vector<osg::ref_ptr<osg::Node>>& nodes)
+{
+    if (nodes.empty()) {
+        return new osg::Group;
+    }
+
+    std::vector<float> x, y, z, radius;
+    for (unsigned int i = 0; i < nodes.size(); ++i) {
+        const osg::BoundingSphere& bound = nodes[i]->getBound();
+        x.push_back(bound.center().x());
+        y.push_back(bound.center().y());
+        z.push_back(bound.center().z());
+        radius.push_back(bound.valid() ? bound.radius() : 0.0f);
+    }
+
+    swgSpatialIndex index;
+    index.build(&x[0], &y[0], &z[0], &radius[0], nodes.size());
+
+    return createSpatialGroup(index, 0, nodes);
+}
+
+osg::ref_ptr<osg::Node> swgRepository::loadWSNP(std::shared_ptr<std::istream> wsnpFile)
+{
+    // Read from stream into wsnp record
+    ml::ws swgWSNP;
+    swgWSNP.readWS(*wsnpFile);
+
+    unsigned int numObjects = swgWSNP.getNumObjectNodes();
+    std::cout << "Number of object nodes: " << numObjects << std::endl;
+
+    // The table lists every parent before its children.
+    swgWorldTable worldTable;
+    buildWorldTable(swgWSNP, worldTable);
+
+    return createWSNP(worldTable, std::vector<bool>(worldTable.size(), true));
+}
+
+osg::ref_ptr<osg::Node> swgRepository::loadWSNPRegion(const std::string&      filename,
+                                                      const osg::BoundingBox& region)
+{
+    std::shared_ptr<worldSnapshot> snapshot = loadWorldSnapshot(filename);
+    if (NULL == snapshot.get()) {
+        return NULL;
+    }
+
+    float min[3] = {region.xMin(), region.yMin(), region.zMin()};
+    float max[3] = {region.xMax(), region.yMax(), region.zMax()};
+
+    std::vector<unsigned int> found;
+    snapshot->index.queryBox(min, max, found);
+    std::cout << "Objects in region: " << found.size() << std::endl;
+
+    return createWSNP(*snapshot->table, selectRoots(*snapshot->table, snapshot->roots, found));
+}
+
+osg::ref_ptr<osg::Node> swgRepository::loadWSNPRegion(const std::string&         filename,
+                                                      const osg::BoundingSphere& region)
+{
+    std::shared_ptr<worldSnapshot> snapshot = loadWorldSnapshot(filename);
+    if (NULL == snapshot.get()) {
+        return NULL;
+    }
+
+    float center[3] = {region.center().x(), region.center().y(), region.center().z()};
+
+    std::vector<unsigned int> found;
+    snapshot->index.querySphere(center, region.radius(), found);
+    std::cout << "Objects in region: " << found.size() << std::endl;
+
+    return createWSNP(*snapshot->table, selectRoots(*snapshot->table, snapshot->roots, found));
+}
+
+osg::ref_ptr<osg::Node> swgRepository::createWSNP(const swgWorldTable&     worldTable,
+                                                  const std::vector<bool>& selected)
+{
+    osg::ref_ptr<osg::MatrixTransform> wsnpMesh = new osg::MatrixTransform;
+    wsnpMesh->setMatrix(osg::Matrix::rotate(-osg::PI, 1, 0, 0));
+
+    if (instancing) {
+        return loadInstancedWSNP(worldTable, selected, wsnpMesh);
+    }
+
+    // Every object is placed by its resolved matrix. Attached objects are
+    // kept in a group with their root so spatial grouping still moves them
+    // together.
+    std::vector<osg::ref_ptr<osg::Group>> rootGroups(worldTable.size());
+    std::vector<osg::ref_ptr<osg::Node>>  rootNodes;
+
+    for (unsigned int i = 0; i < worldTable.size(); ++i) {
+        if (!selected[i]) {
+            continue;
+        }
+
+        const std::string& objectFilename = worldTable.getObjectFilename(i);
+
+        std::cout << "Loading object node: " << objectFilename << std::endl;
+
+        osg::ref_ptr<osg::Node> objectMesh = loadFile(objectFilename);
+
+        osg::ref_ptr<osg::MatrixTransform> transform = new osg::MatrixTransform;
+        transform->setMatrix(getWSNodeMatrix(worldTable, i));
+        transform->addChild(objectMesh);
+
+        // Parents come before their children in the table.
+        int parent = worldTable.getParent(i);
+        if (parent < 0 || NULL == rootGroups[parent]) {
+            rootGroups[i] = new osg::Group;
+            rootNodes.push_back(rootGroups[i].get());
+        }
+        else {
+            rootGroups[i] = rootGroups[parent];
+        }
+        rootGroups[i]->addChild(transform);
+    }
+
+    wsnpMesh->addChild(createSpatialGroups(rootNodes).get());
+
+    return wsnpMesh;
+}
+
+osg::ref_ptr<osg::Node>
+swgRepository::loadInstancedWSNP(const swgWorldTable&               worldTable,
+                                 const std::vector<bool>&           selected,
+                                 osg::ref_ptr<osg::MatrixTransform> wsnpMesh)
+{
+    // Group the resolved placements by the object they place.
+    std::vector<std::vector<osg::Matrix>> objectMatrices(worldTable.getNumPaths());
+
+    for (unsigned int i = 0; i < worldTable.size(); ++i) {
+        if (selected[i]) {
+            objectMatrices[worldTable.getPathId(i)].push_back(getWSNodeMatrix(worldTable, i));
+        }
+    }
+
+    std::cout << "Number of distinct objects: " << objectMatrices.size() << std::endl;
+
+    for (unsigned int pathId = 0; pathId < objectMatrices.size(); ++pathId) {
+        const std::string&              objectFilename = worldTable.getPath(pathId);
+        const std::vector<osg::Matrix>& matrices       = objectMatrices[pathId];
+        if (matrices.empty()) {
+            continue;
+        }
+
+        osg::ref_ptr<osg::Node> objectMesh = loadFile(objectFilename);
+        if (NULL == objectMesh) {
+            continue;
+        }
+
+        // A single placement is cheaper as a plain transform.
+        if (1 == matrices.size()) {
+            osg::ref_ptr<osg::MatrixTransform> transform = new osg::MatrixTransform;
+            transform->setMatrix(matrices.front());
+            transform->addChild(objectMesh);
+            wsnpMesh->addChild(transform);
+            continue;
+        }
+
+        std::cout << "Instancing " << matrices.size() << " copies of " << objectFilename
+                  << std::endl;
+
+        // Instanced copies are built from the levels present now.
+        swgLazyLOD::loadAll(*objectMesh);
+
+        osg::ref_ptr<osg::Node> instanced = createInstancedNode(objectMesh.get(), matrices);
+        if (NULL != instanced) {
+            wsnpMesh->addChild(instanced);
+        }
+    }
+
+    return wsnpMesh;
+}
+
+osg::Geode* createAxis()
+{
+    osg::Geode*    geode(new osg::Geode());
+    osg::Geometry* geometry(new osg::Geometry());
+
+    osg::Vec3Array* vertices(new osg::Vec3Array());
+    vertices->push_back(osg::Vec3(0.0, 0.0, 0.0));
+    vertices->push_back(osg::Vec3(1.0, 0.0, 0.0));
+    vertices->push_back(osg::Vec3(0.0, 0.0, 0.0));
+    vertices->push_back(osg::Vec3(0.0, 1.0, 0.0));
+    vertices->push_back(osg::Vec3(0.0, 0.0, 0.0));
+    vertices->push_back(osg::Vec3(0.0, 0.0, 1.0));
+    geometry->setVertexArray(vertices);
+
+    osg::Vec4Array* colors(new osg::Vec4Array());
+    colors->push_back(osg::Vec4(1.0f, 0.0f, 0.0f, 1.0f));
+    colors->push_back(osg::Vec4(1.0f, 0.0f, 0.0f, 1.0f));
+    colors->push_back(osg::Vec4(0.0f, 1.0f, 0.0f, 1.0f));
+    colors->push_back(osg::Vec4(0.0f, 1.0f, 0.0f, 1.0f));
+    colors->push_back(osg::Vec4(0.0f, 0.0f, 1.0f, 1.0f));
+    colors->push_back(osg::Vec4(0.0f, 0.0f, 1.0f, 1.0f));
+    geometry->setColorArray(colors);
+
+    geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+    geometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::LINES, 0, 6));
+    geode->getOrCreateStateSet()->setMode(GL_LIGHTING, false);
+
+    geode->addDrawable(geometry);
+    setSceneHelper(*geode);
+    return geode;
+}
+
+osg::Geode* createLine(const osg::Vec3& xyz)
+{
+    osg::Geode*    geode(new osg::Geode());
     osg::Geometry* geometry(new osg::Geometry());
 
     osg::Vec3Array* vertices(new osg::Vec3Array());
@@ -953,6 +1923,7 @@ osg::Geode* createLine(const osg::Vec3& xyz)
     geode->getOrCreateStateSet()->setMode(GL_LIGHTING, false);
 
     geode->addDrawable(geometry);
+    setSceneHelper(*geode);
     return geode;
 }
 
@@ -994,6 +1965,7 @@ osg::ref_ptr<osgAnimation::Skeleton> swgRepository::loadSKTM(std::shared_ptr<std
 
         osg::Geode* geode = new osg::Geode;
         geode->addDrawable(text);
+        setSceneHelper(*geode);
         newBone->addChild(geode);
 
         boneList.push_back(newBone);
@@ -1015,29 +1987,293 @@ osg::ref_ptr<osgAnimation::Skeleton> swgRepository::loadSKTM(std::shared_ptr<std
     return skeleton;
 }
 
+std::shared_ptr<swgSkeleton> swgRepository::loadSkeleton(const std::string& filename)
+{
+    std::shared_ptr<std::istream> sktmFile(openArchiveFile(filename));
+    if (NULL == sktmFile.get()) {
+        std::cout << "Unable to find file in archive!" << std::endl;
+        return std::shared_ptr<swgSkeleton>();
+    }
+
+    std::string type = ml::base::getType(*sktmFile);
+    if ("SKTM" != type) {
+        std::cout << "Not a skeleton. File is type: " << type << std::endl;
+        return std::shared_ptr<swgSkeleton>();
+    }
+
+    ml::sktm swgSKTM;
+    swgSKTM.readSKTM(*sktmFile);
+
+    // Same bind pose as loadSKTM.
+    std::shared_ptr<swgSkeleton> skeleton(new swgSkeleton);
+    for (unsigned int i = 0; i < swgSKTM.getNumBones(); ++i) {
+        osg::Quat postQuat(swgSKTM.getBonePostQuatX(i),
+                           swgSKTM.getBonePostQuatY(i),
+                           swgSKTM.getBonePostQuatZ(i),
+                           swgSKTM.getBonePostQuatW(i));
+
+        osg::Quat preQuat(swgSKTM.getBonePreQuatX(i),
+                          swgSKTM.getBonePreQuatY(i),
+                          swgSKTM.getBonePreQuatZ(i),
+                          swgSKTM.getBonePreQuatW(i));
+
+        osg::Vec3 offset(
+            swgSKTM.getBoneXOffset(i), swgSKTM.getBoneYOffset(i), swgSKTM.getBoneZOffset(i));
+
+        if (!skeleton->addBone(
+                swgSKTM.getBoneName(i), swgSKTM.getBoneParent(i), preQuat, postQuat, offset)) {
+            std::cout << "Bone listed before its parent: " << swgSKTM.getBoneName(i) << std::endl;
+            return std::shared_ptr<swgSkeleton>();
+        }
+    }
+
+    return skeleton;
+}
+
+std::shared_ptr<swgAnimation> swgRepository::loadAnimation(const std::string& filename)
+{
+    std::shared_ptr<std::istream> animationFile(openArchiveFile(filename));
+    if (NULL == animationFile.get()) {
+        std::cout << "Unable to find file in archive!" << std::endl;
+        return std::shared_ptr<swgAnimation>();
+    }
+
+    std::string type = ml::base::getType(*animationFile);
+    if ("KFAT" != type && "CKAT" != type) {
+        std::cout << "Not an animation. File is type: " << type << std::endl;
+        return std::shared_ptr<swgAnimation>();
+    }
+
+    std::shared_ptr<swgAnimation> animation(new swgAnimation);
+    if (!animation->read(*animationFile)) {
+        return std::shared_ptr<swgAnimation>();
+    }
+
+    return animation;
+}
+
+namespace
+{
+// Bone influences of an SKMG file: the transform names of XFNM, for every
+// position its TWHD weight count and TWDT (transform, weight) pairs, and
+// per shader set the PIDX position of each vertex. meshLib does not expose
+// these, so they are read straight from the file.
+struct skinnedInfluences {
+    std::vector<std::string>      transformNames;
+    std::vector<unsigned int>     weightStart;
+    std::vector<unsigned int>     weightCount;
+    std::vector<unsigned int>     bones;
+    std::vector<float>            weights;
+    std::vector<std::vector<int>> positionIndices;
+};
+
+bool readSkinnedInfluences(const std::string& data, skinnedInfluences& influences)
+{
+    swgIFFReader iff(data);
+    if (!iff.enterForm("SKMG") || !iff.enterForm(iff.peek())) {
+        return false;
+    }
+
+    while (iff.isValid() && !iff.atEnd()) {
+        std::string tag = iff.peek();
+        if ("XFNM" == tag && !iff.isForm()) {
+            iff.enterChunk("XFNM");
+            while (iff.isValid() && !iff.atEnd()) {
+                influences.transformNames.push_back(iff.readString());
+            }
+            iff.exit();
+        }
+        else if ("TWHD" == tag && !iff.isForm()) {
+            iff.enterChunk("TWHD");
+            unsigned int start = 0;
+            while (iff.isValid() && iff.getRemaining() >= 4) {
+                unsigned int count = iff.readUInt32();
+                influences.weightStart.push_back(start);
+                influences.weightCount.push_back(count);
+                start += count;
+            }
+            iff.exit();
+        }
+        else if ("TWDT" == tag && !iff.isForm()) {
+            iff.enterChunk("TWDT");
+            while (iff.isValid() && iff.getRemaining() >= 8) {
+                influences.bones.push_back(iff.readUInt32());
+                influences.weights.push_back(iff.readFloat());
+            }
+            iff.exit();
+        }
+        else if ("PSDT" == tag && iff.isForm()) {
+            iff.enterForm("PSDT");
+            influences.positionIndices.push_back(std::vector<int>());
+            while (iff.isValid() && !iff.atEnd()) {
+                if ("PIDX" != iff.peek() || iff.isForm()) {
+                    iff.skip();
+                    continue;
+                }
+
+                iff.enterChunk("PIDX");
+                int numVertices = iff.readInt32();
+                for (int i = 0; i < numVertices && iff.isValid(); ++i) {
+                    influences.positionIndices.back().push_back(iff.readInt32());
+                }
+                iff.exit();
+            }
+            iff.exit();
+        }
+        else {
+            iff.skip();
+        }
+    }
+
+    return iff.isValid();
+}
+
+// Copy the vertices of every shader set of an SKMG file with their bone
+// influences into mesh, in file coordinates. Vertices come from meshLib so
+// they are in the order loadSKMG draws them, influences from the file.
+bool readSkinnedMesh(ml::skmg& swgSKMG, const std::string& data, swgSkinnedMesh& mesh)
+{
+    skinnedInfluences influences;
+    if (!readSkinnedInfluences(data, influences)
+        || influences.positionIndices.size() != swgSKMG.getNumPsdt()) {
+        return false;
+    }
+
+    mesh.setBoneNames(influences.transformNames);
+
+    std::vector<unsigned int> bones;
+    std::vector<float>        weights;
+    for (unsigned int j = 0; j < swgSKMG.getNumPsdt(); ++j) {
+        const ml::skmg::psdt&   currentPsdt     = swgSKMG.getPsdt(j);
+        const std::vector<int>& positionIndices = influences.positionIndices[j];
+        if (positionIndices.size() != currentPsdt.getNumVertex()) {
+            return false;
+        }
+
+        for (unsigned int i = 0; i < currentPsdt.getNumVertex(); ++i) {
+            float position[3], normal[3];
+            currentPsdt.getVertex(i, position[0], position[1], position[2]);
+            currentPsdt.getNormal(i, normal[0], normal[1], normal[2]);
+
+            // Positions without weights, or weights past the end of TWDT,
+            // leave the vertex on bone 0.
+            bones.clear();
+            weights.clear();
+            int positionIndex = positionIndices[i];
+            if (0 <= positionIndex && positionIndex < (int)influences.weightCount.size()) {
+                unsigned int start = influences.weightStart[positionIndex];
+                unsigned int end   = start + influences.weightCount[positionIndex];
+                for (unsigned int k = start; k < end && k < influences.bones.size(); ++k) {
+                    bones.push_back(influences.bones[k]);
+                    weights.push_back(influences.weights[k]);
+                }
+            }
+
+            unsigned int numWeights = bones.size();
+            mesh.addVertex(position,
+                           normal,
+                           numWeights,
+                           numWeights > 0 ? &bones[0] : NULL,
+                           numWeights > 0 ? &weights[0] : NULL);
+        }
+    }
+
+    return true;
+}
+
+} // namespace
+
+std::shared_ptr<swgSkinnedMesh> swgRepository::loadSkinnedMesh(const std::string& filename)
+{
+    std::shared_ptr<std::istream> skmgFile(openArchiveFile(filename));
+    if (NULL == skmgFile.get()) {
+        std::cout << "Unable to find file in archive!" << std::endl;
+        return std::shared_ptr<swgSkinnedMesh>();
+    }
+
+    // The influences are read from the same bytes as the mesh.
+    std::string        data((std::istreambuf_iterator<char>(*skmgFile)),
+                     std::istreambuf_iterator<char>());
+    std::istringstream skmgStream(data);
+
+    std::string type = ml::base::getType(skmgStream);
+    if ("SKMG" != type) {
+        std::cout << "Not a skinned mesh. File is type: " << type << std::endl;
+        return std::shared_ptr<swgSkinnedMesh>();
+    }
+
+    ml::skmg swgSKMG;
+    if (0 == swgSKMG.readSKMG(skmgStream)) {
+        return std::shared_ptr<swgSkinnedMesh>();
+    }
+
+    std::shared_ptr<swgSkinnedMesh> mesh(new swgSkinnedMesh);
+    if (!readSkinnedMesh(swgSKMG, data, *mesh)) {
+        std::cout << "Unable to read bone influences." << std::endl;
+        return std::shared_ptr<swgSkinnedMesh>();
+    }
+
+    return mesh;
+}
+
 osg::ref_ptr<osg::Node> swgRepository::loadMLOD(std::shared_ptr<std::istream> mlodFile)
 {
     // Read from stream into mlod record
     ml::mlod swgMLOD;
     swgMLOD.readMLOD(*mlodFile);
 
-    osg::ref_ptr<osg::LOD> mlodMesh = new osg::LOD;
-
     unsigned int numMLODs = swgMLOD.getNumMesh();
     std::cout << "Num MLODs: " << numMLODs << std::endl;
-    std::string childFilename;
-    // float near, far;
+
+    // Levels carry no switch distances, so they are picked by the size of
+    // the object on screen, finest first.
+    float minPixels, maxPixels;
+
+    if (lazyLOD) {
+        osg::ref_ptr<swgLazyLOD> lazyMesh = createLazyLOD();
+        lazyMesh->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+        for (unsigned int i = 0; i < numMLODs; ++i) {
+            getMLODRange(i, numMLODs, minPixels, maxPixels);
+            lazyMesh->addLazyChild(swgMLOD.getMeshFilename(i), minPixels, maxPixels);
+        }
+        lazyMesh->loadCoarsest();
+        numLazyLevels += numMLODs;
+        return lazyMesh;
+    }
+
+    osg::ref_ptr<osg::LOD> mlodMesh = new osg::LOD;
+    mlodMesh->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+
     for (unsigned int i = 0; i < numMLODs; ++i) {
-        osg::ref_ptr<osg::Node> childMesh = loadFile(swgMLOD.getMeshFilename(i));
+        osg::ref_ptr<osg::Node> childMesh = loadLevel(swgMLOD.getMeshFilename(i));
 
         if (NULL != childMesh) {
-            mlodMesh->addChild(childMesh, i * 100.0, (i + 1) * 100.0);
+            getMLODRange(i, numMLODs, minPixels, maxPixels);
+            mlodMesh->addChild(childMesh, minPixels, maxPixels);
         }
     }
 
     return mlodMesh;
 }
 
+void swgRepository::getMLODRange(unsigned int level,
+                                 unsigned int numLevels,
+                                 float&       minPixels,
+                                 float&       maxPixels) const
+{
+    // Each coarser level takes over at half the size of the previous one,
+    // the coarsest level is kept down to nothing.
+    minPixels = std::ldexp(lodPixelSize, -static_cast<int>(level));
+    maxPixels = minPixels * 2.0f;
+
+    if (0 == level) {
+        maxPixels = std::numeric_limits<float>::max();
+    }
+    if (level + 1 >= numLevels) {
+        minPixels = 0.0f;
+    }
+}
+
 #if 0
 osg::Geode* createPolygon( const ml::trn::bpol &polygon, float alt )
 {
@@ -1189,6 +2425,19 @@ swgRepository::loadTRN( std::shared_ptr<std::istream> trnFile )
 }
 #endif
 
+// Terrain files may name shaders without directory and extension.
+std::string getShaderFilename(const std::string& shaderName)
+{
+    std::string filename = shaderName;
+    if (std::string::npos == filename.find('/')) {
+        filename = "shader/" + filename;
+    }
+    if (4 > filename.size() || ".sht" != filename.substr(filename.size() - 4)) {
+        filename += ".sht";
+    }
+    return filename;
+}
+
 osg::Geode* createWater(const float& terrainHalfSize, const float& height)
 {
     osg::Geode*    geode(new osg::Geode());
@@ -1212,63 +2461,81 @@ osg::Geode* createWater(const float& terrainHalfSize, const float& height)
     geode->getOrCreateStateSet()->setMode(GL_LIGHTING, false);
     geode->getOrCreateStateSet()->setMode(GL_BLEND, osg::StateAttribute::ON);
 
+    // Rays pass through the water to the ground below.
+    geode->setName("water");
     geode->addDrawable(geometry);
+    setSceneHelper(*geode);
     return geode;
 }
 
 osg::ref_ptr<osg::Node> swgRepository::loadTRN(std::shared_ptr<std::istream> trnFile)
 {
-    // Read from stream into trn record
-    ml::trn swgTRN;
-    swgTRN.readTRN(*trnFile);
-
-    float terrainSize = swgTRN.getTerrainSize();
-    float waterLevel  = swgTRN.getWaterTableHeight();
+    // Keep the file bytes so each worker can parse its own trn record.
+    std::string trnData((std::istreambuf_iterator<char>(*trnFile)),
+                        std::istreambuf_iterator<char>());
+    std::shared_ptr<swgTerrainGenerator> generator(
+        new swgTerrainGenerator(trnData, &threadPool, vectorTerrain));
+    generator->setCache(heightmapCache);
 
-    float originX = -terrainSize / 2.0;
-    float originY = -terrainSize / 2.0;
-
-    float spacing = 50.0;
-
-    unsigned int numRows    = static_cast<unsigned int>(terrainSize / spacing);
-    unsigned int numColumns = numRows;
+    float terrainSize = generator->getTerrainSize();
+    float waterLevel  = generator->getWaterTableHeight();
 
     std::cout << "Height: " << terrainSize << std::endl;
     std::cout << "Width: " << terrainSize << std::endl;
 
-    std::cout << "Num rows: " << numRows << std::endl;
-    std::cout << "Num cols: " << numRows << std::endl;
+    osg::ref_ptr<osg::Group> trnMesh(new osg::Group);
 
-    // Need to build a heightmap.
-    float* data = new float[numRows * numColumns];
-    for (unsigned int i = 0; i < (numRows * numColumns); ++i) {
-        data[i] = waterLevel;
+    // Paint the ground from the shader families and color layers of the
+    // file, with the fixed palette when they cannot be read.
+    swgTerrainSplat         splat(waterLevel);
+    const swgTerrainLayers* layers = generator->getLayers();
+    if (NULL != layers && layers->isValid() && !layers->getShaderFamilies().empty()) {
+        splat.setLayers(layers, loadShaderFamilyColors(*layers), loadColorRamps(*layers));
+    } else {
+        std::cout << "Unable to read terrain shader families, using the palette." << std::endl;
     }
-    swgTRN.applyLayers(originX, originY, spacing, spacing, numRows, numColumns, data);
-
-    osg::ref_ptr<osg::Group> trnMesh(new osg::Group);
 
-    osg::HeightField* grid = new osg::HeightField;
-    grid->allocate(numColumns, numRows);
-    grid->setOrigin(osg::Vec3(originX, originY, 0.0));
-    grid->setXInterval(spacing);
-    grid->setYInterval(spacing);
+    // Tiles down to terrainSpacing are generated around the viewer as it
+    // moves, starting from a single coarse tile.
+    osg::ref_ptr<swgTerrain> terrain =
+        new swgTerrain(generator, splat, &threadPool, terrainSpacing);
+    terrains.push_back(terrain);
+
+    std::cout << "Terrain levels: " << (terrain->getMaxLevel() + 1) << std::endl;
+
+    // Flora families and layers come from the file as well. Prototypes
+    // are loaded here, the scatter and instancing of each finest tile then
+    // happen on the thread pool along with its mesh.
+    if (NULL != layers && layers->isValid()) {
+        std::shared_ptr<swgFloraScatter> scatter(
+            new swgFloraScatter(*layers, generator->getHash(), terrainSize, waterLevel));
+        std::vector<osg::ref_ptr<osg::Node>> prototypes;
+        bool                                 anyPrototype = false;
+
+        for (unsigned int i = 0; i < scatter->getNumVariants(); ++i) {
+            const swgFloraScatter::variant& current = scatter->getVariant(i);
+
+            osg::ref_ptr<osg::Node> prototype =
+                current.radial ? createRadialFlora(current.name) : loadFile(current.name);
+            if (NULL == prototype) {
+                std::cout << "Unable to load flora: " << current.name << std::endl;
+            } else {
+                // Instanced on the thread pool, which must not load anything.
+                swgLazyLOD::loadAll(*prototype);
+                anyPrototype = true;
+            }
+            prototypes.push_back(prototype);
+        }
 
-    for (unsigned int row = 0; row < numRows; ++row) {
-        unsigned int offset = row * numColumns;
-        for (unsigned int col = 0; col < numColumns; ++col) {
-            grid->setHeight(col, row, data[offset + col]);
+        std::cout << "Flora variants: " << scatter->getNumVariants() << std::endl;
+        if (anyPrototype) {
+            terrain->setFlora(scatter, prototypes, floraRange);
         }
     }
 
-    delete[] data;
-
-    osg::Geode* geode = new osg::Geode();
-    geode->addDrawable(new osg::ShapeDrawable(grid));
-
     osg::MatrixTransform* matTrans = new osg::MatrixTransform();
     matTrans->setMatrix(osg::Matrix::rotate(osg::DegreesToRadians(-90.0), 1.0, 0.0, 0.0));
-    matTrans->addChild(geode);
+    matTrans->addChild(terrain.get());
 
     matTrans->addChild(createWater(terrainSize / 2.0, waterLevel));
 
@@ -1278,6 +2545,288 @@ osg::ref_ptr<osg::Node> swgRepository::loadTRN(std::shared_ptr<std::istream> trn
     return trnMesh;
 }
 
+bool swgRepository::getShaderColor(const std::string& shaderName, float color[3])
+{
+    std::shared_ptr<std::istream> shaderFile(openArchiveFile(getShaderFilename(shaderName)));
+    if (NULL == shaderFile.get()) {
+        return false;
+    }
+
+    std::string textureName;
+    ml::sht     shader;
+    ml::cshd    cshader;
+    if (shader.isRightType(*shaderFile)) {
+        shader.readSHT(*shaderFile);
+        textureName = shader.getMainTextureName();
+    } else if (cshader.isRightType(*shaderFile)) {
+        cshader.readCSHD(*shaderFile);
+        textureName = cshader.getMainTextureName();
+    }
+    if (textureName.empty()) {
+        return false;
+    }
+
+    osg::ref_ptr<osg::Image> image = readTextureImage(textureName);
+    if (NULL == image || 0 >= image->s() || 0 >= image->t()) {
+        return false;
+    }
+
+    // A sparse grid of texels is plenty for an average. getColor decodes
+    // compressed images as well.
+    const unsigned int numSteps = 16;
+    osg::Vec4          sum(0.0f, 0.0f, 0.0f, 0.0f);
+    for (unsigned int y = 0; y < numSteps; ++y) {
+        for (unsigned int x = 0; x < numSteps; ++x) {
+            sum += image->getColor(x * image->s() / numSteps, y * image->t() / numSteps);
+        }
+    }
+    for (unsigned int c = 0; c < 3; ++c) {
+        color[c] = sum[c] / (numSteps * numSteps);
+    }
+    return true;
+}
+
+std::vector<float> swgRepository::loadShaderFamilyColors(const swgTerrainLayers& layers)
+{
+    const std::vector<swgTerrainLayers::shaderFamily>& families = layers.getShaderFamilies();
+
+    // Shaders are shared between families, read each once.
+    std::map<std::string, osg::Vec3> shaderColors;
+
+    std::vector<float> colors(3 * families.size());
+    for (unsigned int i = 0; i < families.size(); ++i) {
+        const swgTerrainLayers::shaderFamily& family = families[i];
+
+        osg::Vec3 sum(0.0f, 0.0f, 0.0f);
+        float     totalWeight = 0.0f;
+        for (unsigned int j = 0; j < family.shaders.size(); ++j) {
+            const std::string& shaderName = family.shaders[j];
+            if (shaderColors.end() == shaderColors.find(shaderName)) {
+                float color[3];
+                if (!getShaderColor(shaderName, color)) {
+                    std::cout << "Unable to read terrain shader: " << shaderName << std::endl;
+                    continue;
+                }
+                shaderColors[shaderName] = osg::Vec3(color[0], color[1], color[2]);
+            }
+
+            float weight = std::max(family.weights[j], 0.0f);
+            sum += shaderColors[shaderName] * weight;
+            totalWeight += weight;
+        }
+
+        // Families without a readable shader keep their editor color.
+        for (unsigned int c = 0; c < 3; ++c) {
+            colors[3 * i + c] = (0.0f < totalWeight) ? sum[c] / totalWeight
+                                                     : family.color[c] / 255.0f;
+        }
+    }
+
+    std::cout << "Terrain shader families: " << families.size() << ", shaders read "
+              << shaderColors.size() << std::endl;
+    return colors;
+}
+
+std::vector<std::vector<float>> swgRepository::loadColorRamps(const swgTerrainLayers& layers)
+{
+    const std::vector<std::string>& names = layers.getColorRamps();
+    std::vector<std::vector<float>> ramps(names.size());
+
+    osgDB::ReaderWriter* tgaPlugin =
+        osgDB::Registry::instance()->getReaderWriterForExtension("tga");
+    for (unsigned int i = 0; i < names.size(); ++i) {
+        std::shared_ptr<std::istream> rampFile(openArchiveFile(names[i]));
+        if (NULL == rampFile.get() || NULL == tgaPlugin) {
+            std::cout << "Unable to read color ramp: " << names[i] << std::endl;
+            continue;
+        }
+
+        osgDB::ReaderWriter::ReadResult result = tgaPlugin->readImage(*rampFile);
+        osg::ref_ptr<osg::Image>        image  = result.getImage();
+        if (NULL == image || 0 >= image->s()) {
+            std::cout << "Unable to read color ramp: " << names[i] << std::endl;
+            continue;
+        }
+
+        // 256 entries along the first row.
+        ramps[i].resize(256 * 3);
+        for (unsigned int entry = 0; entry < 256; ++entry) {
+            osg::Vec4 color = image->getColor(entry * (image->s() - 1) / 255);
+            for (unsigned int c = 0; c < 3; ++c) {
+                ramps[i][3 * entry + c] = color[c];
+            }
+        }
+    }
+    return ramps;
+}
+
+osg::ref_ptr<osg::Node> swgRepository::createRadialFlora(const std::string& shaderName)
+{
+    std::string filename = getShaderFilename(shaderName);
+    if (NULL == openArchiveFile(filename).get()) {
+        return NULL;
+    }
+    osg::ref_ptr<osg::StateSet> shader = loadShader(filename);
+    if (NULL == shader) {
+        return NULL;
+    }
+
+    // One quad in the x, y plane and one in the z, y plane, texture rows
+    // running top down as in the other SWG meshes.
+    osg::ref_ptr<osg::Vec3Array> vertices  = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec3Array> normals   = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec2Array> texCoords = new osg::Vec2Array;
+    for (unsigned int quad = 0; quad < 2; ++quad) {
+        osg::Vec3 across = (0 == quad) ? osg::Vec3(0.5f, 0.0f, 0.0f) : osg::Vec3(0.0f, 0.0f, 0.5f);
+        vertices->push_back(-across);
+        vertices->push_back(across);
+        vertices->push_back(across + osg::Vec3(0.0f, 1.0f, 0.0f));
+        vertices->push_back(-across + osg::Vec3(0.0f, 1.0f, 0.0f));
+
+        texCoords->push_back(osg::Vec2(0.0f, 1.0f));
+        texCoords->push_back(osg::Vec2(1.0f, 1.0f));
+        texCoords->push_back(osg::Vec2(1.0f, 0.0f));
+        texCoords->push_back(osg::Vec2(0.0f, 0.0f));
+    }
+
+    // Lit like the ground it stands on.
+    normals->push_back(osg::Vec3(0.0f, 1.0f, 0.0f));
+
+    osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
+    geometry->setVertexArray(vertices.get());
+    geometry->setNormalArray(normals.get());
+    geometry->setNormalBinding(osg::Geometry::BIND_OVERALL);
+    geometry->setTexCoordArray(0, texCoords.get());
+    geometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::QUADS, 0, vertices->size()));
+    geometry->setStateSet(shader.get());
+
+    // Seen from both sides, with the transparent parts of the texture cut.
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(geometry.get());
+    geode->getOrCreateStateSet()->setMode(GL_CULL_FACE, osg::StateAttribute::OFF);
+    geode->getOrCreateStateSet()->setAttributeAndModes(
+        new osg::AlphaFunc(osg::AlphaFunc::GREATER, 0.5f));
+    return geode;
+}
+
+std::shared_ptr<swgTerrainQuery> swgRepository::loadTerrainQuery(const std::string& filename)
+{
+    std::shared_ptr<std::istream> trnFile(openArchiveFile(filename));
+    if (NULL == trnFile.get()) {
+        std::cout << "Unable to find file in archive!" << std::endl;
+        return std::shared_ptr<swgTerrainQuery>();
+    }
+
+    std::string type = ml::base::getType(*trnFile);
+    if ("PTAT" != type) {
+        std::cout << "Not a terrain. File is type: " << type << std::endl;
+        return std::shared_ptr<swgTerrainQuery>();
+    }
+
+    std::string trnData((std::istreambuf_iterator<char>(*trnFile)),
+                        std::istreambuf_iterator<char>());
+    std::shared_ptr<swgTerrainGenerator> generator(
+        new swgTerrainGenerator(trnData, &threadPool, vectorTerrain));
+    generator->setCache(heightmapCache);
+
+    return std::shared_ptr<swgTerrainQuery>(
+        new swgTerrainQuery(generator, &threadPool, terrainSpacing));
+}
+
+std::shared_ptr<swgTriangleBVH> swgRepository::buildTriangleBVH(osg::Node& scene)
+{
+    // Ground this far beyond the meshes is still hit by rays cast from them.
+    const float terrainMargin = 512.0f;
+
+    swgLazyLOD::loadAll(scene);
+
+    std::shared_ptr<swgTriangleBVH> bvh(new swgTriangleBVH);
+    collectSceneTriangles(scene, *bvh, terrainSpacing, terrainMargin);
+    bvh->build();
+
+    return bvh;
+}
+
+void swgRepository::bakeTerrains(std::ostream& out)
+{
+    if (NULL == heightmapCache) {
+        out << "No heightmap cache to bake terrain into." << std::endl;
+        return;
+    }
+
+    for (unsigned int i = 0; i < terrains.size(); ++i) {
+        terrains[i]->bake(out);
+    }
+}
+
+void swgRepository::printStatistics(std::ostream& out) const
+{
+    out << "Loaded nodes: " << nodeMap.size() << std::endl;
+    out << "Loaded textures: " << textureMap.size() << std::endl;
+    out << "Loaded shaders: " << stateMap.size() << std::endl;
+
+    unsigned int numUniqueStates = 0;
+    for (std::map<unsigned long long, std::vector<osg::ref_ptr<osg::StateSet>>>::const_iterator
+             bucket = uniqueStateMap.begin();
+         bucket != uniqueStateMap.end();
+         ++bucket) {
+        numUniqueStates += bucket->second.size();
+    }
+
+    unsigned int numUniqueMaterials = 0;
+    for (std::map<unsigned long long, std::vector<osg::ref_ptr<osg::Material>>>::const_iterator
+             bucket = uniqueMaterialMap.begin();
+         bucket != uniqueMaterialMap.end();
+         ++bucket) {
+        numUniqueMaterials += bucket->second.size();
+    }
+
+    out << "Unique shader states: " << numUniqueStates << std::endl;
+    out << "Unique materials: " << numUniqueMaterials << std::endl;
+
+    if (simplifying) {
+        out << "Simplified meshes: " << numSimplifiedMeshes << std::endl;
+    }
+
+    if (lazyLOD) {
+        out << "Lazy LOD levels: " << numLazyLevels << " deferred, " << numLazyLoads
+            << " loaded" << std::endl;
+    }
+
+    arrayCache.report(out);
+    bufferPool.report(out);
+    textureManager.report(out);
+
+    if (atlasing) {
+        textureAtlas.report(out);
+    }
+
+    for (unsigned int i = 0; i < terrains.size(); ++i) {
+        terrains[i]->report(out);
+    }
+
+    if (NULL != heightmapCache) {
+        heightmapCache->report(out);
+    }
+}
+
+void swgRepository::buildTextureAtlases()
+{
+    // Atlases are copied from the decoded images.
+    textureManager.flush();
+    textureAtlas.build();
+
+    // Meshes sharing a material and an atlas now have equal states. Their
+    // new texture coordinates still need sharing and a buffer.
+    for (unsigned int i = 0; i < textureAtlas.getNumAtlasedGeometries(); ++i) {
+        osg::Geometry* geometry = textureAtlas.getAtlasedGeometry(i);
+        unsigned int   unit     = textureAtlas.getAtlasedUnit(i);
+
+        geometry->setStateSet(shareStateSet(geometry->getStateSet()).get());
+        geometry->setTexCoordArray(unit, arrayCache.share(geometry->getTexCoordArray(unit)));
+        bufferPool.addGeometry(geometry);
+    }
+}
 
 void swgRepository::createArchive(const std::string& basePath)
 {
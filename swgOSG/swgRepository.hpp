@@ -26,6 +26,8 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include <osg/Geode>
 #include <osg/Geometry>
@@ -48,6 +50,23 @@
 
 #include <treLib/treArchive.hpp>
 
+class swgAnimation;
+class swgLazyLOD;
+class swgSkeleton;
+class swgSkinnedMesh;
+class swgTerrain;
+class swgTerrainLayers;
+class swgTerrainQuery;
+class swgTriangleBVH;
+class swgWorldTable;
+
+#include "swgArrayCache.hpp"
+#include "swgBufferPool.hpp"
+#include "swgHeightmapCache.hpp"
+#include "swgTextureAtlas.hpp"
+#include "swgTextureManager.hpp"
+#include "swgThreadPool.hpp"
+
 #ifndef SWGREPOSITORY_HPP
 #define SWGREPOSITORY_HPP
 
@@ -56,6 +75,55 @@ public:
     swgRepository(const std::string& archiveFilePath);
     ~swgRepository();
 
+    // Draw repeated world snapshot objects with hardware instancing.
+    void setInstancing(bool enable);
+    bool getInstancing() const { return instancing; }
+
+    // Collect static meshes for packing their textures into atlases.
+    void setAtlasing(bool enable) { atlasing = enable; }
+    bool getAtlasing() const { return atlasing; }
+
+    // Read LOD levels the first time they come into range instead of all
+    // of them up front.
+    void setLazyLOD(bool enable) { lazyLOD = enable; }
+    bool getLazyLOD() const { return lazyLOD; }
+
+    // Screen size in pixels of an MLOD mesh below which its finest level
+    // gives way to the next one.
+    void  setLODPixelSize(float pixels) { lodPixelSize = pixels; }
+    float getLODPixelSize() const { return lodPixelSize; }
+
+    // Factor applied to the switch distances stored in LOD files.
+    void  setLODScale(float scale) { lodScale = scale; }
+    float getLODScale() const { return lodScale; }
+
+    // Give meshes that are not part of an LOD file reduced levels of their
+    // own, switched like MLOD levels.
+    void setSimplify(bool enable) { simplifying = enable; }
+    bool getSimplify() const { return simplifying; }
+
+    // Texture quality tier: drop this many of the largest mip levels of
+    // every texture when reading it.
+    void         setSkipMipLevels(unsigned int levels) { skipMipLevels = levels; }
+    unsigned int getSkipMipLevels() const { return skipMipLevels; }
+
+    // Finest distance in meters between terrain height samples.
+    void  setTerrainSpacing(float spacing) { terrainSpacing = spacing; }
+    float getTerrainSpacing() const { return terrainSpacing; }
+
+    // Evaluate terrain heights with the vector kernels of swgTerrainLayers
+    // rather than meshLib, for terrains loaded afterwards.
+    void setVectorTerrain(bool enable) { vectorTerrain = enable; }
+    bool getVectorTerrain() const { return vectorTerrain; }
+
+    // Keep generated terrain heights on disk between runs.
+    void setHeightmapCache(std::shared_ptr<swgHeightmapCache> cache) { heightmapCache = cache; }
+
+    // Distance in meters within which the flora of terrains loaded
+    // afterwards is drawn.
+    void  setFloraRange(float range) { floraRange = range; }
+    float getFloraRange() const { return floraRange; }
+
     osg::ref_ptr<osg::StateSet>          loadShader(const std::string& shaderFilename);
     osg::ref_ptr<osg::Node>              loadAPT(std::shared_ptr<std::istream> iffFile);
     osg::ref_ptr<osg::Node>              loadCMP(std::shared_ptr<std::istream> iffFile);
@@ -74,18 +142,146 @@ public:
 
     osg::ref_ptr<osg::Node>      loadFile(const std::string& filename);
     osg::ref_ptr<osg::Texture2D> loadTextureFile(const std::string& filename);
+    osg::ref_ptr<osg::Image>     readTextureImage(const std::string& filename);
+
+    swgTextureManager& getTextureManager() { return textureManager; }
+
+    // Answer height queries on a .trn file without building any nodes.
+    std::shared_ptr<swgTerrainQuery> loadTerrainQuery(const std::string& filename);
+
+    // Load the bones of a .sktm file for posing and skinning without
+    // building any nodes.
+    std::shared_ptr<swgSkeleton> loadSkeleton(const std::string& filename);
+
+    // Load the bone tracks of a KFAT or CKAT .ans file, to be played on a
+    // skeleton of loadSkeleton.
+    std::shared_ptr<swgAnimation> loadAnimation(const std::string& filename);
+
+    // Load the vertices and bone influences of a .mgn file for skinning on
+    // the CPU, in file coordinates.
+    std::shared_ptr<swgSkinnedMesh> loadSkinnedMesh(const std::string& filename);
+
+    /**
+     * Load only the snapshot objects whose meshes, together with those of
+     * the objects attached to them, reach into region, given in snapshot
+     * coordinates. The first query of a snapshot loads each distinct mesh
+     * once to bound its objects; the table and index are kept for later
+     * queries of the same file.
+     */
+    osg::ref_ptr<osg::Node> loadWSNPRegion(const std::string&      filename,
+                                           const osg::BoundingBox& region);
+    osg::ref_ptr<osg::Node> loadWSNPRegion(const std::string&         filename,
+                                           const osg::BoundingSphere& region);
+
 
+    // Triangle hierarchy for ray and line of sight queries over everything
+    // under scene, with every lazy LOD level read and terrain sampled around
+    // the meshes at the terrain spacing.
+    std::shared_ptr<swgTriangleBVH> buildTriangleBVH(osg::Node& scene);
+
+    // Pack the textures of meshes loaded since atlasing was enabled into
+    // shared atlases. Waits for outstanding texture reads.
+    void buildTextureAtlases();
+
+    // Bake every tile of the terrains loaded so far into the heightmap
+    // cache, so later runs only read them.
+    void bakeTerrains(std::ostream& out);
 
     void createArchive(const std::string& basePath);
 
+    void printStatistics(std::ostream& out) const;
 
 protected:
+    // A world snapshot with its root objects indexed by world bound.
+    struct worldSnapshot;
+
+    // Load a world snapshot as a flat table without building any nodes.
+    std::shared_ptr<swgWorldTable> loadWorldTable(const std::string& filename);
+
+    // The parsed snapshot of filename, read and indexed on first use.
+    std::shared_ptr<worldSnapshot> loadWorldSnapshot(const std::string& filename);
+
+    osg::ref_ptr<osg::Node> createWSNP(const swgWorldTable&     worldTable,
+                                       const std::vector<bool>& selected);
+    osg::ref_ptr<osg::Node> loadInstancedWSNP(const swgWorldTable&               worldTable,
+                                              const std::vector<bool>&           selected,
+                                              osg::ref_ptr<osg::MatrixTransform> wsnpMesh);
+
+    // Pixel size range in which level of numLevels MLOD levels is drawn.
+    void getMLODRange(unsigned int level,
+                      unsigned int numLevels,
+                      float&       minPixels,
+                      float&       maxPixels) const;
+
+    // LOD node reading its levels through loadLevel.
+    osg::ref_ptr<swgLazyLOD> createLazyLOD();
+
+    // loadFile for a level of an LOD file.
+    osg::ref_ptr<osg::Node> loadLevel(const std::string& filename);
+
+    // Wrap geode and simplified copies of it sharing its arrays in an LOD.
+    osg::ref_ptr<osg::Node> createSimplifiedLOD(osg::ref_ptr<osg::Geode> geode);
+
+    // Average color of the main texture of a terrain shader, false if it
+    // cannot be read.
+    bool getShaderColor(const std::string& shaderName, float color[3]);
+
+    // Colors for swgTerrainSplat::setLayers from the shader families and
+    // color ramp images of layers.
+    std::vector<float>              loadShaderFamilyColors(const swgTerrainLayers& layers);
+    std::vector<std::vector<float>> loadColorRamps(const swgTerrainLayers& layers);
+
+    // Prototype of a radial flora variant: two crossed unit quads standing
+    // on the origin, y up, drawn with the shader.
+    osg::ref_ptr<osg::Node> createRadialFlora(const std::string& shaderName);
+
+    osg::ref_ptr<osg::StateSet> shareStateSet(osg::ref_ptr<osg::StateSet> stateSet);
+    osg::ref_ptr<osg::Material> shareMaterial(osg::ref_ptr<osg::Material> material);
+
+    // Open a file from the archive. Safe to call from worker threads.
+    std::shared_ptr<std::istream> openArchiveFile(const std::string& filename);
+
+    bool                                                instancing;
+    bool                                                atlasing;
+    bool                                                lazyLOD;
+    float                                               lodPixelSize;
+    float                                               lodScale;
+    bool                                                simplifying;
+    unsigned int                                        lodDepth;
+    unsigned int                                        skipMipLevels;
+    float                                               terrainSpacing;
+    bool                                                vectorTerrain;
     osgDB::ReaderWriter*                                ddsPlugin;
     treArchive                                          archive;
+    std::mutex                                          archiveMutex;
     std::map<std::string, osg::ref_ptr<osg::Texture2D>> textureMap;
+
+    // Texture files opened by loadTextureFile to see that they exist, kept
+    // for the first readTextureImage so the file is read once. Guarded by
+    // archiveMutex.
+    std::map<std::string, std::shared_ptr<std::istream>> openedTextures;
+
     std::map<std::string, osg::ref_ptr<osg::Material>>  materialMap;
     std::map<std::string, osg::ref_ptr<osg::StateSet>>  stateMap;
     std::map<std::string, osg::ref_ptr<osg::Node>>      nodeMap;
+    swgArrayCache                                       arrayCache;
+    swgBufferPool                                       bufferPool;
+    swgTextureAtlas                                     textureAtlas;
+    swgTextureManager                                   textureManager;
+    swgThreadPool                                       threadPool;
+    std::vector<osg::ref_ptr<swgTerrain>>               terrains;
+    std::shared_ptr<swgHeightmapCache>                  heightmapCache;
+    float                                               floraRange;
+    unsigned int                                        numLazyLevels;
+    unsigned int                                        numLazyLoads;
+    unsigned int                                        numSimplifiedMeshes;
+
+    // Content hash buckets used to collapse identical states and materials.
+    std::map<unsigned long long, std::vector<osg::ref_ptr<osg::StateSet>>> uniqueStateMap;
+    std::map<unsigned long long, std::vector<osg::ref_ptr<osg::Material>>> uniqueMaterialMap;
+
+    // World snapshots read for region loads, by filename.
+    std::map<std::string, std::shared_ptr<worldSnapshot>> worldSnapshots;
 };
 
 #endif
@@ -0,0 +1,47 @@
+/** -*-c++-*-
+ *  \file   swgSIMD.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef SWGSIMD_HPP
+#define SWGSIMD_HPP
+
+// SSE2 is part of every x86-64 target, other platforms use the scalar paths.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SWG_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Wider paths are only built when the compiler targets them, e.g. with
+// -mavx2 -mf16c or -march=haswell.
+#if defined(__AVX2__)
+#define SWG_SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__F16C__)
+#define SWG_SIMD_F16C 1
+#include <immintrin.h>
+#endif
+
+#endif
@@ -0,0 +1,384 @@
+/** -*-c++-*-
+ *  \file   swgSceneTriangles.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgSceneTriangles.hpp"
+#include "swgInstancing.hpp"
+#include "swgTerrainGenerator.hpp"
+#include "swgTerrainTile.hpp"
+#include "swgTriangleBVH.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <osg/BoundingBox>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/LOD>
+#include <osg/NodeVisitor>
+#include <osg/TriangleFunctor>
+
+namespace
+{
+// Description that marks a scene helper.
+const char* const sceneHelperDescription = "swgSceneHelper";
+
+// Terrain cells along each side of one height grid read.
+const unsigned int terrainChunkCells = 128;
+
+// Terrain cells along each side of the whole area sampled, beyond which
+// the spacing grows.
+const unsigned int maxTerrainCells = 2048;
+
+// Receives the triangles of a drawable and places them in world space.
+struct triangleCollector {
+    triangleCollector()
+        : bvh(NULL)
+        , bound(NULL)
+        , numTriangles(0)
+    {
+    }
+
+    void operator()(const osg::Vec3& a, const osg::Vec3& b, const osg::Vec3& c)
+    {
+        osg::Vec3 corners[3] = { a * matrix, b * matrix, c * matrix };
+        bvh->addTriangle(corners[0].ptr(), corners[1].ptr(), corners[2].ptr());
+        for (unsigned int i = 0; i < 3; ++i) {
+            bound->expandBy(corners[i]);
+        }
+        ++numTriangles;
+    }
+
+    // Some OpenSceneGraph releases also pass whether the vertices are temporary.
+    void operator()(const osg::Vec3& a, const osg::Vec3& b, const osg::Vec3& c, bool)
+    {
+        (*this)(a, b, c);
+    }
+
+    swgTriangleBVH*   bvh;
+    osg::BoundingBox* bound;
+    osg::Matrix       matrix;
+    unsigned int      numTriangles;
+};
+
+class sceneTriangleVisitor : public osg::NodeVisitor {
+public:
+    sceneTriangleVisitor(swgTriangleBVH& bvh)
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+    {
+        functor.bvh   = &bvh;
+        functor.bound = &bound;
+    }
+
+    virtual void apply(osg::Group& group)
+    {
+        if (isSceneHelper(group)) {
+            return;
+        }
+
+        // Terrains are sampled from their generators afterwards, their
+        // tiles are only as fine as the last view needed.
+        swgTerrain* terrain = dynamic_cast<swgTerrain*>(&group);
+        if (NULL != terrain) {
+            terrains.push_back(terrain);
+            terrainMatrices.push_back(osg::computeLocalToWorld(getNodePath()));
+            return;
+        }
+        traverse(group);
+    }
+
+    virtual void apply(osg::LOD& lod)
+    {
+        if (0 == lod.getNumChildren()) {
+            return;
+        }
+
+        // Finest level: nearest for distance ranges, largest on screen for
+        // pixel size ranges.
+        bool         pixels = osg::LOD::PIXEL_SIZE_ON_SCREEN == lod.getRangeMode();
+        unsigned int finest = 0;
+        for (unsigned int i = 1; i < lod.getNumChildren() && i < lod.getNumRanges(); ++i) {
+            if (pixels ? lod.getMaxRange(i) > lod.getMaxRange(finest)
+                       : lod.getMinRange(i) < lod.getMinRange(finest)) {
+                finest = i;
+            }
+        }
+
+        lod.getChild(finest)->accept(*this);
+    }
+
+    virtual void apply(osg::Geode& geode)
+    {
+        if (isSceneHelper(geode)) {
+            return;
+        }
+
+        osg::Matrix world = osg::computeLocalToWorld(getNodePath());
+        std::string name  = geode.getName();
+        for (unsigned int i = 0; name.empty() && i < geode.getNumParents(); ++i) {
+            name = geode.getParent(i)->getName();
+        }
+        functor.bvh->addObject(name.empty() ? "mesh" : name);
+
+        for (unsigned int i = 0; i < geode.getNumDrawables(); ++i) {
+            osg::Drawable*  drawable  = geode.getDrawable(i);
+            swgInstanceSet* instances = dynamic_cast<swgInstanceSet*>(drawable->getUserData());
+            if (NULL == instances) {
+                functor.matrix = world;
+                drawable->accept(functor);
+            }
+            else {
+                for (unsigned int j = 0; j < instances->getNumInstances(); ++j) {
+                    functor.matrix = osg::Matrix(instances->getTransform(j)) * world;
+                    drawable->accept(functor);
+                }
+            }
+        }
+    }
+
+    osg::TriangleFunctor<triangleCollector> functor;
+    osg::BoundingBox                        bound;
+    std::vector<osg::ref_ptr<swgTerrain>>   terrains;
+    std::vector<osg::Matrix>                terrainMatrices;
+};
+
+// Triangles of terrain within its local x, y bounds, sampled every
+// spacing meters from the terrain origin.
+unsigned int addTerrainTriangles(swgTriangleBVH&      bvh,
+                                 swgTerrainGenerator& generator,
+                                 const osg::Matrix&   world,
+                                 float                minX,
+                                 float                minY,
+                                 float                maxX,
+                                 float                maxY,
+                                 float                spacing)
+{
+    float terrainSize = generator.getTerrainSize();
+    float origin      = -terrainSize / 2.0f;
+    spacing = std::max(spacing, std::max(maxX - minX, maxY - minY) / maxTerrainCells);
+
+    // Whole cells from the terrain origin, so the samples match the tiles.
+    unsigned int maxCell  = std::floor(terrainSize / spacing);
+    unsigned int first[2] = { 0, 0 };
+    unsigned int last[2]  = { 0, 0 };
+    float        low[2]   = { minX, minY };
+    float        high[2]  = { maxX, maxY };
+    for (unsigned int axis = 0; axis < 2; ++axis) {
+        first[axis] = std::floor(std::max(0.0f, (low[axis] - origin) / spacing));
+        last[axis]  = std::ceil(std::max(0.0f, (high[axis] - origin) / spacing));
+        first[axis] = std::min(first[axis], maxCell);
+        last[axis]  = std::min(last[axis], maxCell);
+    }
+
+    unsigned int numTriangles = 0;
+    for (unsigned int row = first[1]; row < last[1]; row += terrainChunkCells) {
+        for (unsigned int column = first[0]; column < last[0]; column += terrainChunkCells) {
+            unsigned int numRows    = std::min(terrainChunkCells, last[1] - row) + 1;
+            unsigned int numColumns = std::min(terrainChunkCells, last[0] - column) + 1;
+            float        originX    = origin + column * spacing;
+            float        originY    = origin + row * spacing;
+
+            std::shared_ptr<swgHeightGrid> grid =
+                generator.getGrid(originX, originY, spacing, spacing, numRows, numColumns);
+            const float* heights = grid->getHeights();
+
+            std::vector<osg::Vec3> vertices(numRows * numColumns);
+            for (unsigned int r = 0; r < numRows; ++r) {
+                for (unsigned int c = 0; c < numColumns; ++c) {
+                    vertices[r * numColumns + c] = osg::Vec3(originX + c * spacing,
+                                                             originY + r * spacing,
+                                                             heights[r * numColumns + c])
+                                                   * world;
+                }
+            }
+
+            for (unsigned int r = 0; r + 1 < numRows; ++r) {
+                for (unsigned int c = 0; c + 1 < numColumns; ++c) {
+                    // Split along the same diagonal as the drawn tiles.
+                    const osg::Vec3* corner = &vertices[r * numColumns + c];
+                    bvh.addTriangle(
+                        corner[0].ptr(), corner[1].ptr(), corner[numColumns + 1].ptr());
+                    bvh.addTriangle(
+                        corner[0].ptr(), corner[numColumns + 1].ptr(), corner[numColumns].ptr());
+                    numTriangles += 2;
+                }
+            }
+        }
+    }
+
+    return numTriangles;
+}
+
+// Geode of one quad with the given corners, a triangle strip.
+osg::Geode* createQuad(const std::string& name,
+                       const osg::Vec3&   a,
+                       const osg::Vec3&   b,
+                       const osg::Vec3&   c,
+                       const osg::Vec3&   d)
+{
+    osg::Vec3Array* vertices = new osg::Vec3Array;
+    vertices->push_back(a);
+    vertices->push_back(b);
+    vertices->push_back(c);
+    vertices->push_back(d);
+
+    osg::Geometry* geometry = new osg::Geometry;
+    geometry->setVertexArray(vertices);
+    geometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::TRIANGLE_STRIP, 0, 4));
+
+    osg::Geode* geode = new osg::Geode;
+    geode->setName(name);
+    geode->addDrawable(geometry);
+    return geode;
+}
+} // namespace
+
+void setSceneHelper(osg::Node& node)
+{
+    if (!isSceneHelper(node)) {
+        node.addDescription(sceneHelperDescription);
+    }
+}
+
+bool isSceneHelper(const osg::Node& node)
+{
+    const osg::Node::DescriptionList& descriptions = node.getDescriptions();
+    return descriptions.end()
+           != std::find(descriptions.begin(), descriptions.end(), sceneHelperDescription);
+}
+
+unsigned int collectSceneTriangles(osg::Node&      scene,
+                                   swgTriangleBVH& bvh,
+                                   float           terrainSpacing,
+                                   float           terrainMargin)
+{
+    sceneTriangleVisitor visitor(bvh);
+    scene.accept(visitor);
+
+    unsigned int numTriangles = visitor.functor.numTriangles;
+    for (unsigned int i = 0; i < visitor.terrains.size(); ++i) {
+        std::shared_ptr<swgTerrainGenerator> generator = visitor.terrains[i]->getGenerator();
+        if (NULL == generator.get() || !generator->isValid()) {
+            continue;
+        }
+
+        const osg::Matrix& world = visitor.terrainMatrices[i];
+        float              half  = generator->getTerrainSize() / 2.0f;
+        float              minX  = -half;
+        float              minY  = -half;
+        float              maxX  = half;
+        float              maxY  = half;
+
+        // Only the ground around the meshes is of interest when there are
+        // any, in the terrain's own coordinates.
+        if (visitor.bound.valid()) {
+            osg::Matrix      toTerrain = osg::Matrix::inverse(world);
+            osg::BoundingBox region;
+            for (unsigned int corner = 0; corner < 8; ++corner) {
+                region.expandBy(visitor.bound.corner(corner) * toTerrain);
+            }
+            minX = std::max(minX, region.xMin() - terrainMargin);
+            minY = std::max(minY, region.yMin() - terrainMargin);
+            maxX = std::min(maxX, region.xMax() + terrainMargin);
+            maxY = std::min(maxY, region.yMax() + terrainMargin);
+        }
+
+        const std::string& name = visitor.terrains[i]->getName();
+        bvh.addObject(name.empty() ? "terrain" : name);
+        numTriangles += addTerrainTriangles(
+            bvh, *generator, world, minX, minY, maxX, maxY, terrainSpacing);
+    }
+
+    return numTriangles;
+}
+
+bool checkSceneTriangles(std::ostream& out)
+{
+    // Ground rising from 20 meters below the water to 20 above it along x,
+    // and water at zero reaching twice as far.
+    osg::ref_ptr<osg::Group> scene = new osg::Group;
+    scene->addChild(createQuad("ground",
+                               osg::Vec3(-100.0f, -100.0f, -20.0f),
+                               osg::Vec3(100.0f, -100.0f, 20.0f),
+                               osg::Vec3(-100.0f, 100.0f, -20.0f),
+                               osg::Vec3(100.0f, 100.0f, 20.0f)));
+
+    osg::Geode* water = createQuad("water",
+                                   osg::Vec3(-200.0f, -200.0f, 0.0f),
+                                   osg::Vec3(200.0f, -200.0f, 0.0f),
+                                   osg::Vec3(-200.0f, 200.0f, 0.0f),
+                                   osg::Vec3(200.0f, 200.0f, 0.0f));
+    setSceneHelper(*water);
+    scene->addChild(water);
+
+    swgTriangleBVH bvh;
+    unsigned int   numTriangles = collectSceneTriangles(*scene, bvh, 1.0f, 0.0f);
+    bvh.build();
+
+    struct rayCheck {
+        const char*         name;
+        swgTriangleBVH::ray ray;
+        bool                hits;
+        float               distance;
+    };
+
+    // Down through the water onto ground 10 meters under it, along the
+    // ground below the water until it rises through -5, and down through
+    // the water past the edge of the ground.
+    const rayCheck checks[] = {
+        { "down through water", { { -50.0f, 0.0f, 50.0f }, { 0.0f, 0.0f, -1.0f }, 100.0f },
+          true, 60.0f },
+        { "under water", { { -90.0f, 0.0f, -5.0f }, { 1.0f, 0.0f, 0.0f }, 200.0f }, true, 65.0f },
+        { "water only", { { 150.0f, 0.0f, 50.0f }, { 0.0f, 0.0f, -1.0f }, 100.0f }, false, 0.0f },
+    };
+
+    bool passed = 2 == numTriangles;
+    out << "Scene triangles: " << numTriangles << " of 2" << std::endl;
+
+    for (unsigned int i = 0; i < sizeof(checks) / sizeof(checks[0]); ++i) {
+        swgTriangleBVH::hit result;
+        bool                hits = bvh.intersect(checks[i].ray, result);
+        bool                ok   = hits == checks[i].hits;
+        if (ok && hits) {
+            ok = 0.001f > std::fabs(result.distance - checks[i].distance)
+                 && "ground" == bvh.getObjectName(result.object);
+        }
+
+        out << "Scene ray " << checks[i].name << ": ";
+        if (hits) {
+            out << bvh.getObjectName(result.object) << " at " << result.distance;
+        } else {
+            out << "no hit";
+        }
+        out << (ok ? " ok" : " FAILED") << std::endl;
+        passed = passed && ok;
+    }
+
+    // The water is wider than the ground but must not widen the bounds.
+    bool bounded = 100.0f == bvh.getMax()[0] && -100.0f == bvh.getMin()[0];
+    out << "Scene bounds x: " << bvh.getMin()[0] << " to " << bvh.getMax()[0]
+        << (bounded ? " ok" : " FAILED") << std::endl;
+
+    return passed && bounded;
+}
@@ -0,0 +1,60 @@
+/** -*-c++-*-
+ *  \file   swgSceneTriangles.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <iostream>
+
+#include <osg/Node>
+
+class swgTriangleBVH;
+
+#ifndef SWGSCENETRIANGLES_HPP
+#define SWGSCENETRIANGLES_HPP
+
+// Mark node as a drawing aid, such as water or bone axes, that rays pass
+// through. collectSceneTriangles leaves out helpers and everything under them.
+void setSceneHelper(osg::Node& node);
+bool isSceneHelper(const osg::Node& node);
+
+/**
+ * Add the triangles under scene to bvh in world space, one object per
+ * geode. LOD nodes contribute only their finest level and instanced
+ * drawables one copy per instance. Terrains are sampled every
+ * terrainSpacing meters over the bounds of the other triangles grown by
+ * terrainMargin, or whole and coarser when there are none; their flora is
+ * left out. Returns the number of triangles added.
+ */
+unsigned int collectSceneTriangles(osg::Node&      scene,
+                                   swgTriangleBVH& bvh,
+                                   float           terrainSpacing,
+                                   float           terrainMargin);
+
+/**
+ * Collect a small sloped ground below a wider water helper and check that
+ * rays through the water hit the ground and that the water is left out of
+ * the bounds. Prints the result and returns whether all checks pass.
+ */
+bool checkSceneTriangles(std::ostream& out);
+
+#endif
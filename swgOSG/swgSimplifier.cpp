@@ -0,0 +1,365 @@
+/** -*-c++-*-
+ *  \file   swgSimplifier.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgSimplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <utility>
+
+namespace {
+struct collapse {
+    double       cost;
+    unsigned int from;
+    unsigned int to;
+    unsigned int fromVersion;
+    unsigned int toVersion;
+
+    bool operator>(const collapse& other) const { return cost > other.cost; }
+};
+
+struct positionLess {
+    const float* positions;
+
+    bool operator()(unsigned int a, unsigned int b) const
+    {
+        return std::lexicographical_compare(
+            positions + a * 3, positions + a * 3 + 3, positions + b * 3, positions + b * 3 + 3);
+    }
+};
+
+// Unnormalized normal of the triangle p0, p1, p2.
+void triangleNormal(const float* p0, const float* p1, const float* p2, double* normal)
+{
+    double u[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    double v[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+
+    normal[0] = u[1] * v[2] - u[2] * v[1];
+    normal[1] = u[2] * v[0] - u[0] * v[2];
+    normal[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+double dot(const double* a, const double* b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Sorted vertices other than vertex of the given live faces.
+void collectNeighbours(const std::vector<unsigned int>& faces,
+                       const std::vector<unsigned int>& vertexFaces,
+                       const std::vector<bool>&         alive,
+                       unsigned int                     vertex,
+                       std::vector<unsigned int>&       neighbours)
+{
+    neighbours.clear();
+    for (unsigned int i = 0; i < vertexFaces.size(); ++i) {
+        unsigned int face = vertexFaces[i];
+        if (!alive[face]) {
+            continue;
+        }
+        for (unsigned int k = 0; k < 3; ++k) {
+            if (vertex != faces[face * 3 + k]) {
+                neighbours.push_back(faces[face * 3 + k]);
+            }
+        }
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+}
+} // namespace
+
+swgSimplifier::swgSimplifier(const float* positions, unsigned int numVertices)
+    : positions(positions)
+    , numVertices(numVertices)
+{
+}
+
+void swgSimplifier::addTriangle(unsigned int a, unsigned int b, unsigned int c)
+{
+    // Degenerate triangles and ones indexing past the vertices stay as
+    // they are.
+    if (a >= numVertices || b >= numVertices || c >= numVertices || a == b || b == c || a == c) {
+        return;
+    }
+
+    triangles.push_back(a);
+    triangles.push_back(b);
+    triangles.push_back(c);
+}
+
+void swgSimplifier::addPlane(quadric& q, const double* normal, double distance, double weight)
+{
+    const double plane[4] = {normal[0], normal[1], normal[2], distance};
+
+    unsigned int i = 0;
+    for (unsigned int row = 0; row < 4; ++row) {
+        for (unsigned int column = row; column < 4; ++column) {
+            q.a[i++] += weight * plane[row] * plane[column];
+        }
+    }
+}
+
+double swgSimplifier::evaluate(const quadric& q, const float* point)
+{
+    double x = point[0];
+    double y = point[1];
+    double z = point[2];
+
+    return q.a[0] * x * x + 2.0 * q.a[1] * x * y + 2.0 * q.a[2] * x * z + 2.0 * q.a[3] * x
+           + q.a[4] * y * y + 2.0 * q.a[5] * y * z + 2.0 * q.a[6] * y + q.a[7] * z * z
+           + 2.0 * q.a[8] * z + q.a[9];
+}
+
+void swgSimplifier::simplify(const std::vector<unsigned int>&        targets,
+                             std::vector<std::vector<unsigned int>>& remaps,
+                             std::vector<unsigned int>&              numTriangles) const
+{
+    remaps.clear();
+    numTriangles.clear();
+
+    unsigned int              numFaces = triangles.size() / 3;
+    std::vector<unsigned int> faces(triangles);
+    std::vector<bool>         alive(numFaces, true);
+    unsigned int              numAlive = numFaces;
+
+    // Vertices sharing a position sit on a normal or texture coordinate
+    // seam, moving them would tear it open.
+    std::vector<bool>         locked(numVertices, false);
+    std::vector<unsigned int> order(numVertices);
+    positionLess              less = {positions};
+    for (unsigned int i = 0; i < numVertices; ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), less);
+    for (unsigned int i = 1; i < numVertices; ++i) {
+        if (!less(order[i - 1], order[i])) {
+            locked[order[i - 1]] = true;
+            locked[order[i]]     = true;
+        }
+    }
+
+    // Edges not shared by exactly two triangles are open or non-manifold.
+    std::vector<std::pair<unsigned int, unsigned int>> edges;
+    edges.reserve(faces.size());
+    for (unsigned int i = 0; i < faces.size(); ++i) {
+        unsigned int a = faces[i];
+        unsigned int b = faces[i % 3 == 2 ? i - 2 : i + 1];
+        edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+    }
+    std::sort(edges.begin(), edges.end());
+    for (unsigned int i = 0; i < edges.size();) {
+        unsigned int end = i + 1;
+        while (end < edges.size() && edges[end] == edges[i]) {
+            ++end;
+        }
+        if (2 != end - i) {
+            locked[edges[i].first]  = true;
+            locked[edges[i].second] = true;
+        }
+        i = end;
+    }
+
+    // Area weighted planes of the faces around each vertex.
+    quadric                                zero = {};
+    std::vector<quadric>                   quadrics(numVertices, zero);
+    std::vector<std::vector<unsigned int>> vertexFaces(numVertices);
+    for (unsigned int face = 0; face < numFaces; ++face) {
+        const unsigned int* v = &faces[face * 3];
+
+        double normal[3];
+        triangleNormal(positions + v[0] * 3, positions + v[1] * 3, positions + v[2] * 3, normal);
+        double length = std::sqrt(dot(normal, normal));
+
+        for (unsigned int k = 0; k < 3; ++k) {
+            vertexFaces[v[k]].push_back(face);
+        }
+
+        if (0.0 >= length) {
+            continue;
+        }
+
+        normal[0] /= length;
+        normal[1] /= length;
+        normal[2] /= length;
+
+        const float* p0       = positions + v[0] * 3;
+        double       distance = -(normal[0] * p0[0] + normal[1] * p0[1] + normal[2] * p0[2]);
+        for (unsigned int k = 0; k < 3; ++k) {
+            addPlane(quadrics[v[k]], normal, distance, length * 0.5);
+        }
+    }
+
+    std::vector<unsigned int> parent(numVertices);
+    std::vector<unsigned int> version(numVertices, 0);
+    for (unsigned int i = 0; i < numVertices; ++i) {
+        parent[i] = i;
+    }
+
+    std::priority_queue<collapse, std::vector<collapse>, std::greater<collapse>> queue;
+
+    auto push = [&](unsigned int from, unsigned int to) {
+        if (locked[from]) {
+            return;
+        }
+
+        quadric sum = quadrics[from];
+        for (unsigned int i = 0; i < 10; ++i) {
+            sum.a[i] += quadrics[to].a[i];
+        }
+
+        collapse candidate = {
+            evaluate(sum, positions + to * 3), from, to, version[from], version[to]};
+        queue.push(candidate);
+    };
+
+    for (unsigned int i = 0; i < edges.size(); ++i) {
+        if (0 == i || edges[i] != edges[i - 1]) {
+            push(edges[i].first, edges[i].second);
+            push(edges[i].second, edges[i].first);
+        }
+    }
+
+    std::vector<unsigned int> fromNeighbours;
+    std::vector<unsigned int> toNeighbours;
+    std::vector<unsigned int> shared;
+
+    for (unsigned int target = 0; target < targets.size(); ++target) {
+        while (numAlive > targets[target] && !queue.empty()) {
+            collapse candidate = queue.top();
+            queue.pop();
+
+            unsigned int from = candidate.from;
+            unsigned int to   = candidate.to;
+            if (version[from] != candidate.fromVersion || version[to] != candidate.toVersion) {
+                continue;
+            }
+
+            // More shared neighbours than the two across the edge would
+            // pinch the surface into a non-manifold one.
+            collectNeighbours(faces, vertexFaces[from], alive, from, fromNeighbours);
+            collectNeighbours(faces, vertexFaces[to], alive, to, toNeighbours);
+            shared.clear();
+            std::set_intersection(fromNeighbours.begin(),
+                                  fromNeighbours.end(),
+                                  toNeighbours.begin(),
+                                  toNeighbours.end(),
+                                  std::back_inserter(shared));
+            if (2 < shared.size()) {
+                continue;
+            }
+
+            // Reject collapses that fold a remaining face over or squash it.
+            bool valid = true;
+            for (unsigned int i = 0; valid && i < vertexFaces[from].size(); ++i) {
+                unsigned int face = vertexFaces[from][i];
+                if (!alive[face]) {
+                    continue;
+                }
+
+                unsigned int* v = &faces[face * 3];
+                if (to == v[0] || to == v[1] || to == v[2]) {
+                    continue;
+                }
+
+                const float* p[3];
+                const float* moved[3];
+                for (unsigned int k = 0; k < 3; ++k) {
+                    p[k]     = positions + v[k] * 3;
+                    moved[k] = positions + (from == v[k] ? to : v[k]) * 3;
+                }
+
+                double before[3], after[3];
+                triangleNormal(p[0], p[1], p[2], before);
+                triangleNormal(moved[0], moved[1], moved[2], after);
+
+                double limit = 0.25 * std::sqrt(dot(before, before) * dot(after, after));
+                valid        = 0.0 < limit && dot(before, after) > limit;
+            }
+            if (!valid) {
+                continue;
+            }
+
+            for (unsigned int i = 0; i < vertexFaces[from].size(); ++i) {
+                unsigned int face = vertexFaces[from][i];
+                if (!alive[face]) {
+                    continue;
+                }
+
+                unsigned int* v = &faces[face * 3];
+                if (to == v[0] || to == v[1] || to == v[2]) {
+                    alive[face] = false;
+                    --numAlive;
+                    continue;
+                }
+
+                for (unsigned int k = 0; k < 3; ++k) {
+                    if (from == v[k]) {
+                        v[k] = to;
+                    }
+                }
+                vertexFaces[to].push_back(face);
+            }
+            vertexFaces[from].clear();
+
+            for (unsigned int i = 0; i < 10; ++i) {
+                quadrics[to].a[i] += quadrics[from].a[i];
+            }
+            parent[from] = to;
+            ++version[from];
+            ++version[to];
+
+            // Drop the faces that died and queue the edges around to again.
+            std::vector<unsigned int>& around = vertexFaces[to];
+            unsigned int               kept   = 0;
+            for (unsigned int i = 0; i < around.size(); ++i) {
+                if (alive[around[i]]) {
+                    around[kept++] = around[i];
+                }
+            }
+            around.resize(kept);
+
+            collectNeighbours(faces, around, alive, to, toNeighbours);
+            for (unsigned int i = 0; i < toNeighbours.size(); ++i) {
+                push(toNeighbours[i], to);
+                push(to, toNeighbours[i]);
+            }
+        }
+
+        std::vector<unsigned int> remap(numVertices);
+        for (unsigned int i = 0; i < numVertices; ++i) {
+            unsigned int root = i;
+            while (parent[root] != root) {
+                root = parent[root];
+            }
+            remap[i] = root;
+        }
+
+        remaps.push_back(remap);
+        numTriangles.push_back(numAlive);
+    }
+}
@@ -0,0 +1,70 @@
+/** -*-c++-*-
+ *  \file   swgSimplifier.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <vector>
+
+#ifndef SWGSIMPLIFIER_HPP
+#define SWGSIMPLIFIER_HPP
+
+/**
+ * Quadric error edge collapse over an indexed triangle mesh. Every collapse
+ * moves one vertex onto a neighbour, so the reduced meshes keep indexing
+ * the original vertex arrays and only need new index lists. Vertices on
+ * open edges and vertices sharing their position with another vertex,
+ * where normals or texture coordinates are split, never move.
+ */
+class swgSimplifier {
+public:
+    // positions holds x, y, z for each of numVertices vertices.
+    swgSimplifier(const float* positions, unsigned int numVertices);
+
+    void addTriangle(unsigned int a, unsigned int b, unsigned int c);
+
+    unsigned int getNumTriangles() const { return triangles.size() / 3; }
+
+    /**
+     * Collapse edges until at most targets[i] triangles are left, for each
+     * of the decreasing targets in turn, or no collapse is possible. The
+     * vertex each original vertex ended up on and the triangles left are
+     * stored for every target.
+     */
+    void simplify(const std::vector<unsigned int>&        targets,
+                  std::vector<std::vector<unsigned int>>& remaps,
+                  std::vector<unsigned int>&              numTriangles) const;
+
+protected:
+    struct quadric {
+        double a[10];
+    };
+
+    static void   addPlane(quadric& q, const double* normal, double distance, double weight);
+    static double evaluate(const quadric& q, const float* point);
+
+    const float*              positions;
+    unsigned int              numVertices;
+    std::vector<unsigned int> triangles;
+};
+
+#endif
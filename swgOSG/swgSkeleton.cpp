@@ -0,0 +1,92 @@
+/** -*-c++-*-
+ *  \file   swgSkeleton.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgSkeleton.hpp"
+#include "swgSkinningKernels.hpp"
+
+bool swgSkeleton::addBone(const std::string& name,
+                          int                parent,
+                          const osg::Quat&   preRotation,
+                          const osg::Quat&   postRotation,
+                          const osg::Vec3&   offset)
+{
+    if (parent >= (int)getNumBones()) {
+        return false;
+    }
+
+    osg::Matrix local =
+        osg::Matrix::rotate(preRotation * postRotation) * osg::Matrix::translate(offset);
+
+    osg::Matrix world = local;
+    if (0 <= parent) {
+        world = local * bindWorld[parent];
+    }
+
+    boneNames.push_back(name);
+    parents.push_back(parent);
+    preRotations.push_back(preRotation);
+    postRotations.push_back(postRotation);
+    offsets.push_back(offset);
+    bindLocal.push_back(local);
+    bindWorld.push_back(world);
+    inverseBindWorld.push_back(osg::Matrix::inverse(world));
+
+    return true;
+}
+
+osg::Matrix swgSkeleton::computeLocal(unsigned int     bone,
+                                      const osg::Quat& rotation,
+                                      const osg::Vec3& translation) const
+{
+    return osg::Matrix::rotate(preRotations[bone] * rotation * postRotations[bone]) *
+           osg::Matrix::translate(offsets[bone] + translation);
+}
+
+void swgSkeleton::computeWorld(const std::vector<osg::Matrix>& local,
+                               std::vector<osg::Matrix>&       world) const
+{
+    world.resize(getNumBones());
+    for (unsigned int bone = 0; bone < getNumBones(); ++bone) {
+        world[bone] = local[bone];
+        if (0 <= parents[bone]) {
+            world[bone] = local[bone] * world[parents[bone]];
+        }
+    }
+}
+
+void swgSkeleton::computeSkinMatrices(const std::vector<osg::Matrix>& world,
+                                      float*                          matrices) const
+{
+    for (unsigned int bone = 0; bone < getNumBones(); ++bone) {
+        // Row vectors, so output component r takes column r.
+        osg::Matrix skin = inverseBindWorld[bone] * world[bone];
+        float*      m    = matrices + bone * swgSkinningKernels::matrixSize;
+        for (unsigned int r = 0; r < 3; ++r) {
+            for (unsigned int c = 0; c < 4; ++c) {
+                m[r * 4 + c] = skin(c, r);
+            }
+        }
+    }
+}
@@ -0,0 +1,85 @@
+/** -*-c++-*-
+ *  \file   swgSkeleton.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <string>
+#include <vector>
+
+#include <osg/Matrix>
+#include <osg/Quat>
+#include <osg/Vec3>
+
+#ifndef SWGSKELETON_HPP
+#define SWGSKELETON_HPP
+
+/**
+ * Bone hierarchy of an SKTM file with its bind pose, as plain tables for
+ * posing and skinning without building any nodes. Bones are stored after
+ * their parents, so a single pass in bone order composes a pose.
+ */
+class swgSkeleton {
+public:
+    // Append a bone placed relative to parent, -1 for a root. The parent
+    // has to be added first. Animations rotate between preRotation and
+    // postRotation.
+    bool addBone(const std::string& name,
+                 int                parent,
+                 const osg::Quat&   preRotation,
+                 const osg::Quat&   postRotation,
+                 const osg::Vec3&   offset);
+
+    unsigned int                    getNumBones() const { return boneNames.size(); }
+    const std::vector<std::string>& getBoneNames() const { return boneNames; }
+    int                             getParent(unsigned int bone) const { return parents[bone]; }
+
+    // Bone relative to its parent in the bind pose.
+    const osg::Matrix& getBindLocal(unsigned int bone) const { return bindLocal[bone]; }
+
+    // Bone relative to its parent given an animated rotation and an offset
+    // added to its bind position.
+    osg::Matrix computeLocal(unsigned int     bone,
+                             const osg::Quat& rotation,
+                             const osg::Vec3& translation) const;
+
+    // Model space transforms of every bone from parent relative ones.
+    void computeWorld(const std::vector<osg::Matrix>& local, std::vector<osg::Matrix>& world) const;
+
+    /**
+     * Write the matrices taking bind pose vertices to the pose world, in
+     * the layout of swgSkinningKernels, to matrices.
+     */
+    void computeSkinMatrices(const std::vector<osg::Matrix>& world, float* matrices) const;
+
+protected:
+    std::vector<std::string> boneNames;
+    std::vector<int>         parents;
+    std::vector<osg::Quat>   preRotations;
+    std::vector<osg::Quat>   postRotations;
+    std::vector<osg::Vec3>   offsets;
+    std::vector<osg::Matrix> bindLocal;
+    std::vector<osg::Matrix> bindWorld;
+    std::vector<osg::Matrix> inverseBindWorld;
+};
+
+#endif
@@ -0,0 +1,117 @@
+/** -*-c++-*-
+ *  \file   swgSkinnedMesh.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgSkinnedMesh.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <utility>
+
+swgSkinnedMesh::swgSkinnedMesh()
+    : numBones(1)
+{
+}
+
+void swgSkinnedMesh::addVertex(const float*        newPosition,
+                               const float*        newNormal,
+                               unsigned int        numInfluences,
+                               const unsigned int* newBones,
+                               const float*        newWeights)
+{
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        position[axis].push_back(newPosition[axis]);
+        normal[axis].push_back(newNormal[axis]);
+    }
+
+    // Heaviest first.
+    std::vector<std::pair<float, unsigned int>> influences;
+    for (unsigned int i = 0; i < numInfluences; ++i) {
+        if (0.0f < newWeights[i]) {
+            influences.push_back(std::make_pair(newWeights[i], newBones[i]));
+        }
+    }
+    std::sort(influences.begin(), influences.end(), std::greater<std::pair<float, unsigned int>>());
+    if (influences.size() > maxInfluences) {
+        influences.resize(maxInfluences);
+    }
+    if (influences.empty()) {
+        influences.push_back(std::make_pair(1.0f, 0u));
+    }
+
+    float total = 0.0f;
+    for (unsigned int i = 0; i < influences.size(); ++i) {
+        total += influences[i].first;
+    }
+
+    for (unsigned int slot = 0; slot < maxInfluences; ++slot) {
+        if (slot < influences.size()) {
+            bones[slot].push_back(influences[slot].second);
+            weights[slot].push_back(influences[slot].first / total);
+            numBones = std::max(numBones, influences[slot].second + 1);
+        }
+        else {
+            bones[slot].push_back(0);
+            weights[slot].push_back(0.0f);
+        }
+    }
+}
+
+void swgSkinnedMesh::setBoneNames(const std::vector<std::string>& names)
+{
+    boneNames = names;
+    numBones  = std::max<unsigned int>(numBones, names.size());
+}
+
+unsigned int swgSkinnedMesh::bind(const std::vector<std::string>& skeletonBones)
+{
+    std::map<std::string, unsigned int> skeletonIndex;
+    for (unsigned int i = 0; i < skeletonBones.size(); ++i) {
+        skeletonIndex[skeletonBones[i]] = i;
+    }
+
+    unsigned int              numMissing = 0;
+    std::vector<unsigned int> remap(numBones, 0);
+    for (unsigned int i = 0; i < boneNames.size() && i < numBones; ++i) {
+        std::map<std::string, unsigned int>::const_iterator found =
+            skeletonIndex.find(boneNames[i]);
+        if (skeletonIndex.end() == found) {
+            ++numMissing;
+            continue;
+        }
+        remap[i] = found->second;
+    }
+
+    for (unsigned int slot = 0; slot < maxInfluences; ++slot) {
+        for (unsigned int i = 0; i < bones[slot].size(); ++i) {
+            bones[slot][i] = remap[bones[slot][i]];
+        }
+    }
+
+    boneNames = skeletonBones;
+    numBones  = std::max<unsigned int>(1, skeletonBones.size());
+
+    return numMissing;
+}
@@ -0,0 +1,85 @@
+/** -*-c++-*-
+ *  \file   swgSkinnedMesh.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <string>
+#include <vector>
+
+#ifndef SWGSKINNEDMESH_HPP
+#define SWGSKINNEDMESH_HPP
+
+/**
+ * Bind pose vertices of a skinned mesh as structure of arrays, each vertex
+ * with up to four bone influences. Influence slot k of every vertex is
+ * stored in its own pair of bone and weight arrays, unused slots weigh
+ * nothing, so the skinning kernels can load several vertices at once.
+ */
+class swgSkinnedMesh {
+public:
+    static const unsigned int maxInfluences = 4;
+
+    swgSkinnedMesh();
+
+    /**
+     * Append a vertex. Only the maxInfluences heaviest influences are kept
+     * and their weights scaled to sum to one. A vertex without influences
+     * follows bone 0.
+     */
+    void addVertex(const float*        position,
+                   const float*        normal,
+                   unsigned int        numInfluences,
+                   const unsigned int* bones,
+                   const float*        weights);
+
+    unsigned int getNumVertices() const { return position[0].size(); }
+
+    // Bones influences refer to, by index.
+    void                            setBoneNames(const std::vector<std::string>& names);
+    const std::vector<std::string>& getBoneNames() const { return boneNames; }
+
+    // Matrices the kernels read, one past the highest bone referred to.
+    unsigned int getNumBones() const { return numBones; }
+
+    /**
+     * Point the influences at the skeleton bones of the same names, given
+     * in skeleton order. Influences of bones the skeleton lacks move to
+     * bone 0. Returns how many bone names were not found.
+     */
+    unsigned int bind(const std::vector<std::string>& skeletonBones);
+
+    const float* getPositions(unsigned int axis) const { return &position[axis][0]; }
+    const float* getNormals(unsigned int axis) const { return &normal[axis][0]; }
+    const int*   getBones(unsigned int slot) const { return &bones[slot][0]; }
+    const float* getWeights(unsigned int slot) const { return &weights[slot][0]; }
+
+protected:
+    std::vector<float>       position[3];
+    std::vector<float>       normal[3];
+    std::vector<int>         bones[maxInfluences];
+    std::vector<float>       weights[maxInfluences];
+    std::vector<std::string> boneNames;
+    unsigned int             numBones;
+};
+
+#endif
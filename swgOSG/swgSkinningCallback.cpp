@@ -0,0 +1,138 @@
+/** -*-c++-*-
+ *  \file   swgSkinningCallback.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgSkinningCallback.hpp"
+
+#include <algorithm>
+
+swgSkinningCallback::swgSkinningCallback(swgSkinningEngine* engine)
+    : engine(engine)
+    , player(NULL)
+    , lastTime(-1.0)
+{
+}
+
+int swgSkinningCallback::addInstance(const osg::Geode&                     geode,
+                                     std::shared_ptr<const swgSkinnedMesh> mesh,
+                                     osg::ref_ptr<osg::Geode>&             skinned)
+{
+    // loadSKMG adds a geometry per shader set, in the order the skinned
+    // mesh holds their vertices.
+    unsigned int numVertices = 0;
+    for (unsigned int i = 0; i < geode.getNumDrawables(); ++i) {
+        const osg::Geometry* geometry = geode.getDrawable(i)->asGeometry();
+        if (NULL == geometry) {
+            continue;
+        }
+
+        const osg::Vec3Array* vertices =
+            dynamic_cast<const osg::Vec3Array*>(geometry->getVertexArray());
+        const osg::Vec3Array* normals =
+            dynamic_cast<const osg::Vec3Array*>(geometry->getNormalArray());
+        if (NULL == vertices || NULL == normals || vertices->size() != normals->size()) {
+            return -1;
+        }
+        numVertices += vertices->size();
+    }
+
+    if (NULL == mesh.get() || numVertices != mesh->getNumVertices()) {
+        return -1;
+    }
+
+    unsigned int instance = engine->addInstance(mesh);
+
+    skinned = new osg::Geode(geode, osg::CopyOp::DEEP_COPY_DRAWABLES);
+
+    unsigned int first = 0;
+    for (unsigned int i = 0; i < skinned->getNumDrawables(); ++i) {
+        osg::Geometry* geometry = skinned->getDrawable(i)->asGeometry();
+        if (NULL == geometry) {
+            continue;
+        }
+
+        // Arrays of its own, leaving the shared buffer pool behind. The
+        // draw thread must not read them while they are rewritten.
+        osg::Vec3Array* vertices =
+            new osg::Vec3Array(*static_cast<osg::Vec3Array*>(geometry->getVertexArray()));
+        osg::Vec3Array* normals =
+            new osg::Vec3Array(*static_cast<osg::Vec3Array*>(geometry->getNormalArray()));
+        geometry->setVertexArray(vertices);
+        geometry->setNormalArray(normals);
+        geometry->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+        geometry->setDataVariance(osg::Object::DYNAMIC);
+        geometry->setUseDisplayList(false);
+        geometry->setUseVertexBufferObjects(true);
+
+        target added = {geometry, instance, first, (unsigned int)vertices->size()};
+        targets.push_back(added);
+        first += vertices->size();
+    }
+
+    return instance;
+}
+
+void swgSkinningCallback::copyResults()
+{
+    for (unsigned int t = 0; t < targets.size(); ++t) {
+        target&         current  = targets[t];
+        osg::Vec3Array* vertices = static_cast<osg::Vec3Array*>(current.geometry->getVertexArray());
+        osg::Vec3Array* normals  = static_cast<osg::Vec3Array*>(current.geometry->getNormalArray());
+
+        // The engine skins in file coordinates, loadSKMG draws z, y, x.
+        const float* px = engine->getPositions(current.instance, 0) + current.first;
+        const float* py = engine->getPositions(current.instance, 1) + current.first;
+        const float* pz = engine->getPositions(current.instance, 2) + current.first;
+        const float* nx = engine->getNormals(current.instance, 0) + current.first;
+        const float* ny = engine->getNormals(current.instance, 1) + current.first;
+        const float* nz = engine->getNormals(current.instance, 2) + current.first;
+        for (unsigned int i = 0; i < current.count; ++i) {
+            (*vertices)[i].set(pz[i], py[i], px[i]);
+            (*normals)[i].set(nz[i], ny[i], nx[i]);
+        }
+
+        vertices->dirty();
+        normals->dirty();
+        current.geometry->dirtyBound();
+    }
+}
+
+void swgSkinningCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+{
+    double time    = (NULL != nv->getFrameStamp()) ? nv->getFrameStamp()->getSimulationTime() : 0.0;
+    double seconds = (0.0 <= lastTime) ? std::max(time - lastTime, 0.0) : 0.0;
+    lastTime       = time;
+
+    if (!targets.empty()) {
+        if (NULL != player) {
+            player->update(seconds);
+        }
+        else {
+            engine->update();
+        }
+        copyResults();
+    }
+
+    traverse(node, nv);
+}
@@ -0,0 +1,89 @@
+/** -*-c++-*-
+ *  \file   swgSkinningCallback.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <memory>
+#include <vector>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/NodeCallback>
+
+#include "swgAnimationPlayer.hpp"
+#include "swgSkinnedMesh.hpp"
+#include "swgSkinningEngine.hpp"
+
+#ifndef SWGSKINNINGCALLBACK_HPP
+#define SWGSKINNINGCALLBACK_HPP
+
+/**
+ * Update callback drawing skinned meshes from a skinning engine. Each
+ * frame it poses the characters of an animation player, skins every
+ * instance and copies the results into the vertex and normal arrays of the
+ * geometries drawing it.
+ */
+class swgSkinningCallback : public osg::NodeCallback {
+public:
+    // engine has to outlive the callback.
+    swgSkinningCallback(swgSkinningEngine* engine);
+
+    // Advance player, which has to skin with engine, by the simulation
+    // time of each frame instead of only skinning. NULL stops animating.
+    void setPlayer(swgAnimationPlayer* animationPlayer) { player = animationPlayer; }
+
+    /**
+     * Add an engine instance drawing mesh, read from the same SKMG file as
+     * geode, and set skinned to a copy of geode whose geometries draw it.
+     * The copy has vertex and normal arrays of its own, so the geode the
+     * repository hands out stays in the bind pose. Returns the instance,
+     * or -1 when the geometries of geode hold a different number of
+     * vertices than mesh.
+     */
+    int addInstance(const osg::Geode&                     geode,
+                    std::shared_ptr<const swgSkinnedMesh> mesh,
+                    osg::ref_ptr<osg::Geode>&             skinned);
+
+    virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+protected:
+    // Vertices first to first + count of an instance drawn by geometry.
+    struct target {
+        osg::ref_ptr<osg::Geometry> geometry;
+        unsigned int                instance;
+        unsigned int                first;
+        unsigned int                count;
+    };
+
+    // Copy the skinned results into the arrays of every target.
+    void copyResults();
+
+    swgSkinningEngine*  engine;
+    swgAnimationPlayer* player;
+    std::vector<target> targets;
+
+    // Simulation time of the previous frame, negative before the first.
+    double lastTime;
+};
+
+#endif
@@ -0,0 +1,155 @@
+/** -*-c++-*-
+ *  \file   swgSkinningEngine.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgSkinningEngine.hpp"
+#include "swgSkinningKernels.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+// Vertices per task, enough to hide the cost of handing it out.
+const unsigned int jobSize = 4096;
+
+double getSeconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+swgSkinningEngine::swgSkinningEngine(swgThreadPool* threadPool)
+    : threadPool(threadPool)
+    , numUpdates(0)
+    , numSkinned(0)
+    , seconds(0.0)
+{
+}
+
+unsigned int swgSkinningEngine::addInstance(std::shared_ptr<const swgSkinnedMesh> mesh)
+{
+    unsigned int index       = instances.size();
+    unsigned int numVertices = mesh->getNumVertices();
+
+    instances.push_back(instance());
+    instance& added = instances.back();
+    added.mesh      = mesh;
+
+    added.matrices.resize(mesh->getNumBones() * swgSkinningKernels::matrixSize, 0.0f);
+    for (unsigned int bone = 0; bone < mesh->getNumBones(); ++bone) {
+        float* m = &added.matrices[bone * swgSkinningKernels::matrixSize];
+        m[0] = m[5] = m[10] = 1.0f;
+    }
+
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        added.positions[axis].resize(std::max(1u, numVertices));
+        added.normals[axis].resize(std::max(1u, numVertices));
+        added.positionArrays[axis] = &added.positions[axis][0];
+        added.normalArrays[axis]   = &added.normals[axis][0];
+    }
+
+    for (unsigned int first = 0; first < numVertices; first += jobSize) {
+        job newJob = {index, first, std::min(numVertices, first + jobSize)};
+        jobs.push_back(newJob);
+    }
+
+    return index;
+}
+
+void swgSkinningEngine::update()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    auto skinJob = [this](unsigned int j) {
+        const job& current = jobs[j];
+        instance&  skinned = instances[current.instance];
+        swgSkinningKernels::skin(*skinned.mesh,
+                                 &skinned.matrices[0],
+                                 current.first,
+                                 current.last,
+                                 skinned.positionArrays,
+                                 skinned.normalArrays);
+    };
+
+    if (NULL != threadPool) {
+        threadPool->parallelFor(0, jobs.size(), skinJob);
+    }
+    else {
+        for (unsigned int j = 0; j < jobs.size(); ++j) {
+            skinJob(j);
+        }
+    }
+
+    seconds += getSeconds(start);
+    ++numUpdates;
+    for (unsigned int i = 0; i < instances.size(); ++i) {
+        numSkinned += instances[i].mesh->getNumVertices();
+    }
+}
+
+void swgSkinningEngine::report(std::ostream& out) const
+{
+    out << "Skinning: " << instances.size() << " instances, " << numUpdates << " updates, "
+        << numSkinned << " vertices";
+    if (0.0 < seconds) {
+        out << ", " << (numSkinned / seconds / 1.0e6) << " M vertices/s";
+    }
+    out << std::endl;
+}
+
+void swgSkinningEngine::benchmark(std::ostream&   out,
+                                  swgThreadPool*  threadPool,
+                                  const meshList& meshes,
+                                  unsigned int    numInstances)
+{
+    const unsigned int numFrames = 20;
+
+    if (meshes.empty()) {
+        return;
+    }
+
+    // Bind pose matrices cost the same to apply as any other pose.
+    swgSkinningEngine  engine(threadPool);
+    unsigned long long perFrame = 0;
+    for (unsigned int i = 0; i < numInstances; ++i) {
+        engine.addInstance(meshes[i % meshes.size()]);
+        perFrame += meshes[i % meshes.size()]->getNumVertices();
+    }
+
+    // The first frame touches the output arrays for the first time.
+    engine.update();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned int frame = 0; frame < numFrames; ++frame) {
+        engine.update();
+    }
+    double elapsed = getSeconds(start);
+
+    out << "Skinning " << numInstances << " instances, " << perFrame << " vertices per frame, on "
+        << (NULL != threadPool ? threadPool->getNumThreads() : 0) << " worker threads, "
+        << swgSkinningKernels::getInstructionSet() << " build: "
+        << (perFrame * numFrames / elapsed / 1.0e6) << " M vertices/s, "
+        << (elapsed / numFrames * 1000.0) << " ms per frame" << std::endl;
+}
@@ -0,0 +1,114 @@
+/** -*-c++-*-
+ *  \file   swgSkinningEngine.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "swgSkinnedMesh.hpp"
+#include "swgThreadPool.hpp"
+
+#ifndef SWGSKINNINGENGINE_HPP
+#define SWGSKINNINGENGINE_HPP
+
+/**
+ * Skins many characters at once on the CPU. Each instance draws a shared
+ * swgSkinnedMesh with its own bone matrices and output arrays. An update
+ * splits all instances into runs of vertices skinned in parallel on the
+ * thread pool, so a crowd of small meshes and a single large one both keep
+ * every worker busy.
+ */
+class swgSkinningEngine {
+public:
+    typedef std::vector<std::shared_ptr<const swgSkinnedMesh>> meshList;
+
+    // threadPool may be NULL to skin on the calling thread.
+    swgSkinningEngine(swgThreadPool* threadPool);
+
+    // Add a character drawing mesh, returns its index.
+    unsigned int addInstance(std::shared_ptr<const swgSkinnedMesh> mesh);
+    unsigned int getNumInstances() const { return instances.size(); }
+
+    const swgSkinnedMesh& getMesh(unsigned int instance) const
+    {
+        return *instances[instance].mesh;
+    }
+
+    // Bone matrices of an instance in the layout of swgSkinningKernels,
+    // set before each update. They start out as identities.
+    float* getMatrices(unsigned int instance) { return &instances[instance].matrices[0]; }
+
+    // Skinned results per axis, valid after an update.
+    const float* getPositions(unsigned int instance, unsigned int axis) const
+    {
+        return &instances[instance].positions[axis][0];
+    }
+    const float* getNormals(unsigned int instance, unsigned int axis) const
+    {
+        return &instances[instance].normals[axis][0];
+    }
+
+    // Skin every instance, returns once all are done.
+    void update();
+
+    void report(std::ostream& out) const;
+
+    /**
+     * Skin a crowd of numInstances characters, taking turns at drawing each
+     * of meshes, for a number of frames and print the vertices skinned per
+     * second.
+     */
+    static void benchmark(std::ostream&   out,
+                          swgThreadPool*  threadPool,
+                          const meshList& meshes,
+                          unsigned int    numInstances);
+
+protected:
+    struct instance {
+        std::shared_ptr<const swgSkinnedMesh> mesh;
+        std::vector<float>                    matrices;
+        std::vector<float>                    positions[3];
+        std::vector<float>                    normals[3];
+        float*                                positionArrays[3];
+        float*                                normalArrays[3];
+    };
+
+    // A run of vertices of one instance skinned by one task.
+    struct job {
+        unsigned int instance;
+        unsigned int first;
+        unsigned int last;
+    };
+
+    swgThreadPool*        threadPool;
+    std::vector<instance> instances;
+    std::vector<job>      jobs;
+
+    unsigned long long numUpdates;
+    unsigned long long numSkinned;
+    double             seconds;
+};
+
+#endif
@@ -0,0 +1,433 @@
+/** -*-c++-*-
+ *  \file   swgSkinningKernels.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgSkinningKernels.hpp"
+#include "swgSIMD.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace
+{
+// Small deterministic generator for test data.
+unsigned int nextRandom(unsigned int& state)
+{
+    state = state * 1664525u + 1013904223u;
+    return state;
+}
+
+float nextUnit(unsigned int& state)
+{
+    return (nextRandom(state) >> 8) / 16777216.0f;
+}
+
+double getSeconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Skinned positions and normals, one array per axis.
+struct skinnedVertices {
+    skinnedVertices(unsigned int numVertices)
+    {
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            data[axis].resize(numVertices);
+            data[axis + 3].resize(numVertices);
+            positions[axis] = &data[axis][0];
+            normals[axis]   = &data[axis + 3][0];
+        }
+    }
+
+    std::vector<float> data[6];
+    float*             positions[3];
+    float*             normals[3];
+};
+
+// Lengths below this leave the normal unscaled rather than dividing by zero.
+const float minNormalLength2 = 1.0e-30f;
+
+#if defined(SWG_SIMD_AVX2)
+// Transpose the 4 by 4 blocks in both halves of a, b, c and d.
+void transpose8(__m256& a, __m256& b, __m256& c, __m256& d)
+{
+    __m256 t0 = _mm256_unpacklo_ps(a, b);
+    __m256 t1 = _mm256_unpackhi_ps(a, b);
+    __m256 t2 = _mm256_unpacklo_ps(c, d);
+    __m256 t3 = _mm256_unpackhi_ps(c, d);
+
+    a = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    b = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    c = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    d = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+__m256 load8(const float* low, const float* high)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)), _mm_loadu_ps(high), 1);
+}
+
+// Skin vertices i to i + 7.
+void skin8(const swgSkinnedMesh& mesh,
+           const float*          matrices,
+           unsigned int          i,
+           float* const*         positions,
+           float* const*         normals)
+{
+    const __m256 zero = _mm256_setzero_ps();
+
+    // Blended matrix, element e of all eight vertices in m[e].
+    __m256 m[swgSkinningKernels::matrixSize];
+    for (unsigned int e = 0; e < swgSkinningKernels::matrixSize; ++e) {
+        m[e] = zero;
+    }
+
+    for (unsigned int slot = 0; slot < swgSkinnedMesh::maxInfluences; ++slot) {
+        __m256 weight = _mm256_loadu_ps(mesh.getWeights(slot) + i);
+        if (0 == _mm256_movemask_ps(_mm256_cmp_ps(weight, zero, _CMP_NEQ_OQ))) {
+            continue;
+        }
+
+        const int*   bones = mesh.getBones(slot) + i;
+        const float* bone[8];
+        for (unsigned int lane = 0; lane < 8; ++lane) {
+            bone[lane] = matrices + bones[lane] * swgSkinningKernels::matrixSize;
+        }
+
+        // Each row of four elements, transposed to one element per register.
+        for (unsigned int row = 0; row < 12; row += 4) {
+            __m256 a = load8(bone[0] + row, bone[4] + row);
+            __m256 b = load8(bone[1] + row, bone[5] + row);
+            __m256 c = load8(bone[2] + row, bone[6] + row);
+            __m256 d = load8(bone[3] + row, bone[7] + row);
+            transpose8(a, b, c, d);
+
+            m[row]     = _mm256_add_ps(m[row], _mm256_mul_ps(weight, a));
+            m[row + 1] = _mm256_add_ps(m[row + 1], _mm256_mul_ps(weight, b));
+            m[row + 2] = _mm256_add_ps(m[row + 2], _mm256_mul_ps(weight, c));
+            m[row + 3] = _mm256_add_ps(m[row + 3], _mm256_mul_ps(weight, d));
+        }
+    }
+
+    __m256 x  = _mm256_loadu_ps(mesh.getPositions(0) + i);
+    __m256 y  = _mm256_loadu_ps(mesh.getPositions(1) + i);
+    __m256 z  = _mm256_loadu_ps(mesh.getPositions(2) + i);
+    __m256 nx = _mm256_loadu_ps(mesh.getNormals(0) + i);
+    __m256 ny = _mm256_loadu_ps(mesh.getNormals(1) + i);
+    __m256 nz = _mm256_loadu_ps(mesh.getNormals(2) + i);
+
+    __m256 n[3];
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        const __m256* r = m + axis * 4;
+
+        __m256 p = _mm256_add_ps(_mm256_mul_ps(r[0], x), _mm256_mul_ps(r[1], y));
+        p        = _mm256_add_ps(_mm256_add_ps(p, _mm256_mul_ps(r[2], z)), r[3]);
+        _mm256_storeu_ps(positions[axis] + i, p);
+
+        n[axis] = _mm256_add_ps(_mm256_mul_ps(r[0], nx), _mm256_mul_ps(r[1], ny));
+        n[axis] = _mm256_add_ps(n[axis], _mm256_mul_ps(r[2], nz));
+    }
+
+    __m256 length2 = _mm256_add_ps(_mm256_mul_ps(n[0], n[0]), _mm256_mul_ps(n[1], n[1]));
+    length2        = _mm256_add_ps(length2, _mm256_mul_ps(n[2], n[2]));
+    __m256 scale   = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(length2));
+    scale          = _mm256_blendv_ps(
+        _mm256_set1_ps(1.0f),
+        scale,
+        _mm256_cmp_ps(length2, _mm256_set1_ps(minNormalLength2), _CMP_GT_OQ));
+
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        _mm256_storeu_ps(normals[axis] + i, _mm256_mul_ps(n[axis], scale));
+    }
+}
+#endif
+
+#if defined(SWG_SIMD_SSE2)
+// Skin vertices i to i + 3.
+void skin4(const swgSkinnedMesh& mesh,
+           const float*          matrices,
+           unsigned int          i,
+           float* const*         positions,
+           float* const*         normals)
+{
+    const __m128 zero = _mm_setzero_ps();
+
+    // Blended matrix, element e of all four vertices in m[e].
+    __m128 m[swgSkinningKernels::matrixSize];
+    for (unsigned int e = 0; e < swgSkinningKernels::matrixSize; ++e) {
+        m[e] = zero;
+    }
+
+    for (unsigned int slot = 0; slot < swgSkinnedMesh::maxInfluences; ++slot) {
+        __m128 weight = _mm_loadu_ps(mesh.getWeights(slot) + i);
+        if (0 == _mm_movemask_ps(_mm_cmpneq_ps(weight, zero))) {
+            continue;
+        }
+
+        const int*   bones = mesh.getBones(slot) + i;
+        const float* bone[4];
+        for (unsigned int lane = 0; lane < 4; ++lane) {
+            bone[lane] = matrices + bones[lane] * swgSkinningKernels::matrixSize;
+        }
+
+        // Each row of four elements, transposed to one element per register.
+        for (unsigned int row = 0; row < 12; row += 4) {
+            __m128 a = _mm_loadu_ps(bone[0] + row);
+            __m128 b = _mm_loadu_ps(bone[1] + row);
+            __m128 c = _mm_loadu_ps(bone[2] + row);
+            __m128 d = _mm_loadu_ps(bone[3] + row);
+            _MM_TRANSPOSE4_PS(a, b, c, d);
+
+            m[row]     = _mm_add_ps(m[row], _mm_mul_ps(weight, a));
+            m[row + 1] = _mm_add_ps(m[row + 1], _mm_mul_ps(weight, b));
+            m[row + 2] = _mm_add_ps(m[row + 2], _mm_mul_ps(weight, c));
+            m[row + 3] = _mm_add_ps(m[row + 3], _mm_mul_ps(weight, d));
+        }
+    }
+
+    __m128 x  = _mm_loadu_ps(mesh.getPositions(0) + i);
+    __m128 y  = _mm_loadu_ps(mesh.getPositions(1) + i);
+    __m128 z  = _mm_loadu_ps(mesh.getPositions(2) + i);
+    __m128 nx = _mm_loadu_ps(mesh.getNormals(0) + i);
+    __m128 ny = _mm_loadu_ps(mesh.getNormals(1) + i);
+    __m128 nz = _mm_loadu_ps(mesh.getNormals(2) + i);
+
+    __m128 n[3];
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        const __m128* r = m + axis * 4;
+
+        __m128 p = _mm_add_ps(_mm_mul_ps(r[0], x), _mm_mul_ps(r[1], y));
+        p        = _mm_add_ps(_mm_add_ps(p, _mm_mul_ps(r[2], z)), r[3]);
+        _mm_storeu_ps(positions[axis] + i, p);
+
+        n[axis] = _mm_add_ps(_mm_mul_ps(r[0], nx), _mm_mul_ps(r[1], ny));
+        n[axis] = _mm_add_ps(n[axis], _mm_mul_ps(r[2], nz));
+    }
+
+    __m128 length2 = _mm_add_ps(_mm_mul_ps(n[0], n[0]), _mm_mul_ps(n[1], n[1]));
+    length2        = _mm_add_ps(length2, _mm_mul_ps(n[2], n[2]));
+    __m128 normal  = _mm_cmpgt_ps(length2, _mm_set1_ps(minNormalLength2));
+    __m128 scale   = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(length2));
+    scale = _mm_or_ps(_mm_and_ps(normal, scale), _mm_andnot_ps(normal, _mm_set1_ps(1.0f)));
+
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        _mm_storeu_ps(normals[axis] + i, _mm_mul_ps(n[axis], scale));
+    }
+}
+#endif
+} // namespace
+
+const char* swgSkinningKernels::getInstructionSet()
+{
+#if defined(SWG_SIMD_AVX2)
+    return "AVX2";
+#elif defined(SWG_SIMD_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+void swgSkinningKernels::skin(const swgSkinnedMesh& mesh,
+                              const float*          matrices,
+                              unsigned int          first,
+                              unsigned int          last,
+                              float* const*         positions,
+                              float* const*         normals)
+{
+    unsigned int i = first;
+
+#if defined(SWG_SIMD_AVX2)
+    for (; i + 8 <= last; i += 8) {
+        skin8(mesh, matrices, i, positions, normals);
+    }
+#endif
+
+#if defined(SWG_SIMD_SSE2)
+    for (; i + 4 <= last; i += 4) {
+        skin4(mesh, matrices, i, positions, normals);
+    }
+#endif
+
+    skinScalar(mesh, matrices, i, last, positions, normals);
+}
+
+void swgSkinningKernels::skinScalar(const swgSkinnedMesh& mesh,
+                                    const float*          matrices,
+                                    unsigned int          first,
+                                    unsigned int          last,
+                                    float* const*         positions,
+                                    float* const*         normals)
+{
+    for (unsigned int i = first; i < last; ++i) {
+        float m[matrixSize] = {};
+        for (unsigned int slot = 0; slot < swgSkinnedMesh::maxInfluences; ++slot) {
+            float weight = mesh.getWeights(slot)[i];
+            if (0.0f == weight) {
+                continue;
+            }
+
+            const float* bone = matrices + mesh.getBones(slot)[i] * matrixSize;
+            for (unsigned int e = 0; e < matrixSize; ++e) {
+                m[e] += weight * bone[e];
+            }
+        }
+
+        float x  = mesh.getPositions(0)[i];
+        float y  = mesh.getPositions(1)[i];
+        float z  = mesh.getPositions(2)[i];
+        float nx = mesh.getNormals(0)[i];
+        float ny = mesh.getNormals(1)[i];
+        float nz = mesh.getNormals(2)[i];
+
+        float n[3];
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            const float* r = m + axis * 4;
+
+            positions[axis][i] = r[0] * x + r[1] * y + r[2] * z + r[3];
+            n[axis]            = r[0] * nx + r[1] * ny + r[2] * nz;
+        }
+
+        float length2 = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+        float scale   = minNormalLength2 < length2 ? 1.0f / std::sqrt(length2) : 1.0f;
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            normals[axis][i] = n[axis] * scale;
+        }
+    }
+}
+
+void swgSkinningKernels::createTestMesh(unsigned int        numVertices,
+                                        unsigned int        numBones,
+                                        unsigned int        seed,
+                                        swgSkinnedMesh&     mesh,
+                                        std::vector<float>& matrices)
+{
+    unsigned int state = seed;
+    numBones           = std::max(1u, numBones);
+
+    // A column two meters tall, bones stacked along it.
+    for (unsigned int i = 0; i < numVertices; ++i) {
+        float angle  = nextUnit(state) * 6.2831853f;
+        float height = nextUnit(state) * 2.0f;
+
+        float position[3] = {0.3f * std::cos(angle), height, 0.3f * std::sin(angle)};
+        float normal[3]   = {std::cos(angle), 0.0f, std::sin(angle)};
+
+        unsigned int numInfluences = 1 + nextRandom(state) % swgSkinnedMesh::maxInfluences;
+        unsigned int nearest = std::min(numBones - 1, (unsigned int)(height / 2.0f * numBones));
+        unsigned int bones[swgSkinnedMesh::maxInfluences];
+        float        weights[swgSkinnedMesh::maxInfluences];
+        for (unsigned int k = 0; k < numInfluences; ++k) {
+            bones[k]   = std::min(numBones - 1, nearest + k);
+            weights[k] = 0.1f + nextUnit(state);
+        }
+
+        mesh.addVertex(position, normal, numInfluences, bones, weights);
+    }
+
+    // Each bone turned a little about y and moved a little.
+    matrices.resize(numBones * matrixSize);
+    for (unsigned int bone = 0; bone < numBones; ++bone) {
+        float  angle = (nextUnit(state) - 0.5f) * 0.5f;
+        float  c     = std::cos(angle);
+        float  s     = std::sin(angle);
+        float* m     = &matrices[bone * matrixSize];
+
+        const float rows[matrixSize] = {c,
+                                        0.0f,
+                                        s,
+                                        nextUnit(state) * 0.1f,
+                                        0.0f,
+                                        1.0f,
+                                        0.0f,
+                                        nextUnit(state) * 0.1f,
+                                        -s,
+                                        0.0f,
+                                        c,
+                                        nextUnit(state) * 0.1f};
+        std::copy(rows, rows + matrixSize, m);
+    }
+}
+
+bool swgSkinningKernels::check(std::ostream& out)
+{
+    out << "Checking skinning kernels, " << getInstructionSet() << " build" << std::endl;
+
+    // An odd count so the scalar tail runs as well.
+    swgSkinnedMesh     mesh;
+    std::vector<float> matrices;
+    createTestMesh(4099, 37, 12345, mesh, matrices);
+
+    unsigned int    numVertices = mesh.getNumVertices();
+    skinnedVertices expected(numVertices);
+    skinnedVertices result(numVertices);
+
+    skinScalar(mesh, &matrices[0], 0, numVertices, expected.positions, expected.normals);
+
+    // Start off the vector alignment as well.
+    skin(mesh, &matrices[0], 0, 1, result.positions, result.normals);
+    skin(mesh, &matrices[0], 1, numVertices, result.positions, result.normals);
+
+    float maxError = 0.0f;
+    for (unsigned int array = 0; array < 6; ++array) {
+        for (unsigned int i = 0; i < numVertices; ++i) {
+            maxError =
+                std::max(maxError, std::fabs(expected.data[array][i] - result.data[array][i]));
+        }
+    }
+
+    bool ok = 1.0e-5f >= maxError;
+    out << "Skinning: " << (ok ? "ok" : "FAILED") << ", largest error " << maxError << std::endl;
+    return ok;
+}
+
+void swgSkinningKernels::benchmark(std::ostream& out, unsigned int numVertices)
+{
+    swgSkinnedMesh     mesh;
+    std::vector<float> matrices;
+    createTestMesh(numVertices, 64, 1, mesh, matrices);
+
+    skinnedVertices skinned(numVertices);
+
+    // Best of several runs of each.
+    const unsigned int numRepeats = 10;
+
+    double scalar = 1.0e30;
+    double vector = 1.0e30;
+    for (unsigned int i = 0; i < numRepeats; ++i) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        skinScalar(mesh, &matrices[0], 0, numVertices, skinned.positions, skinned.normals);
+        scalar = std::min(scalar, getSeconds(start));
+
+        start = std::chrono::steady_clock::now();
+        skin(mesh, &matrices[0], 0, numVertices, skinned.positions, skinned.normals);
+        vector = std::min(vector, getSeconds(start));
+    }
+
+    out << "Skinning kernel on " << numVertices << " vertices, " << getInstructionSet()
+        << " build: scalar " << (numVertices / scalar / 1.0e6) << " M vertices/s, vector "
+        << (numVertices / vector / 1.0e6) << " M vertices/s, " << (scalar / vector) << "x"
+        << std::endl;
+}
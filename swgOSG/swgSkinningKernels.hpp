@@ -0,0 +1,87 @@
+/** -*-c++-*-
+ *  \file   swgSkinningKernels.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <iostream>
+#include <vector>
+
+#include "swgSkinnedMesh.hpp"
+
+#ifndef SWGSKINNINGKERNELS_HPP
+#define SWGSKINNINGKERNELS_HPP
+
+/**
+ * Linear blend skinning of swgSkinnedMesh vertices, several vertices at a
+ * time with the widest instruction set the build targets. Bone matrices are
+ * 12 floats each, row r holding the factors of output component r for the
+ * x, y, z and 1 of the input, so a point p becomes
+ * (m[0] p.x + m[1] p.y + m[2] p.z + m[3], m[4] p.x + ..., m[8] p.x + ...).
+ * The vector paths match the scalar reference to within rounding.
+ */
+class swgSkinningKernels {
+public:
+    static const unsigned int matrixSize = 12;
+
+    // Name of the widest instruction set the kernels were built for.
+    static const char* getInstructionSet();
+
+    /**
+     * Skin vertices first up to last of mesh with matrices, which holds
+     * mesh.getNumBones() of them. Positions and unit normals are written
+     * per axis to positions[axis][i] and normals[axis][i].
+     */
+    static void skin(const swgSkinnedMesh& mesh,
+                     const float*          matrices,
+                     unsigned int          first,
+                     unsigned int          last,
+                     float* const*         positions,
+                     float* const*         normals);
+
+    // Compare the kernel against its scalar reference on generated data.
+    static bool check(std::ostream& out);
+
+    // Time the kernel and its scalar reference on numVertices vertices.
+    static void benchmark(std::ostream& out, unsigned int numVertices);
+
+    /**
+     * Fill mesh with numVertices vertices of a body like shape on numBones
+     * bones, one to four influences each, and matrices with a pose bending
+     * every bone a little. Used to check and time skinning.
+     */
+    static void createTestMesh(unsigned int        numVertices,
+                               unsigned int        numBones,
+                               unsigned int        seed,
+                               swgSkinnedMesh&     mesh,
+                               std::vector<float>& matrices);
+
+protected:
+    static void skinScalar(const swgSkinnedMesh& mesh,
+                           const float*          matrices,
+                           unsigned int          first,
+                           unsigned int          last,
+                           float* const*         positions,
+                           float* const*         normals);
+};
+
+#endif
@@ -0,0 +1,231 @@
+/** -*-c++-*-
+ *  \file   swgSpatialIndex.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgSpatialIndex.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+struct lessThanX {
+    lessThanX(const std::vector<float>& x, float split)
+        : x(x)
+        , split(split)
+    {
+    }
+    bool operator()(unsigned int object) const { return x[object] < split; }
+
+    const std::vector<float>& x;
+    float                     split;
+};
+} // namespace
+
+swgSpatialIndex::swgSpatialIndex(unsigned int maxObjectsPerCell, unsigned int maxDepth)
+    : maxObjectsPerCell(maxObjectsPerCell)
+    , maxDepth(maxDepth)
+{
+}
+
+swgSpatialIndex::~swgSpatialIndex() {}
+
+void swgSpatialIndex::build(const float* x,
+                            const float* y,
+                            const float* z,
+                            const float* radius,
+                            unsigned int numObjects)
+{
+    cells.clear();
+    objects.resize(numObjects);
+    centerX.assign(x, x + numObjects);
+    centerY.assign(y, y + numObjects);
+    centerZ.assign(z, z + numObjects);
+    radii.assign(radius, radius + numObjects);
+
+    for (unsigned int i = 0; i < numObjects; ++i) {
+        objects[i] = i;
+    }
+
+    if (0 < numObjects) {
+        buildCell(0, numObjects, 0);
+    }
+}
+
+int swgSpatialIndex::buildCell(unsigned int first, unsigned int count, unsigned int depth)
+{
+    int index = cells.size();
+
+    cell current;
+    current.firstObject = first;
+    current.numObjects  = count;
+    current.leaf        = true;
+    for (unsigned int i = 0; i < 4; ++i) {
+        current.children[i] = -1;
+    }
+    for (unsigned int i = 0; i < 3; ++i) {
+        current.min[i] = FLT_MAX;
+        current.max[i] = -FLT_MAX;
+    }
+
+    // Bounds of all member spheres, plus the extent of their centers used
+    // to pick the split.
+    float centerMinX = FLT_MAX, centerMaxX = -FLT_MAX;
+    float centerMinZ = FLT_MAX, centerMaxZ = -FLT_MAX;
+    for (unsigned int i = first; i < first + count; ++i) {
+        unsigned int object = objects[i];
+        float        r      = radii[object];
+
+        current.min[0] = std::min(current.min[0], centerX[object] - r);
+        current.min[1] = std::min(current.min[1], centerY[object] - r);
+        current.min[2] = std::min(current.min[2], centerZ[object] - r);
+        current.max[0] = std::max(current.max[0], centerX[object] + r);
+        current.max[1] = std::max(current.max[1], centerY[object] + r);
+        current.max[2] = std::max(current.max[2], centerZ[object] + r);
+
+        centerMinX = std::min(centerMinX, centerX[object]);
+        centerMaxX = std::max(centerMaxX, centerX[object]);
+        centerMinZ = std::min(centerMinZ, centerZ[object]);
+        centerMaxZ = std::max(centerMaxZ, centerZ[object]);
+    }
+
+    cells.push_back(current);
+
+    bool separable = (centerMaxX > centerMinX) || (centerMaxZ > centerMinZ);
+    if (count <= maxObjectsPerCell || depth >= maxDepth || !separable) {
+        return index;
+    }
+
+    // Split the centers into x/z quadrants around the middle of their extent.
+    float splitX = 0.5f * (centerMinX + centerMaxX);
+    float splitZ = 0.5f * (centerMinZ + centerMaxZ);
+
+    unsigned int* begin = &objects[0] + first;
+    unsigned int* end   = begin + count;
+    unsigned int* midX  = std::partition(begin, end, lessThanX(centerX, splitX));
+    unsigned int* midZ0 = std::partition(begin, midX, lessThanX(centerZ, splitZ));
+    unsigned int* midZ1 = std::partition(midX, end, lessThanX(centerZ, splitZ));
+
+    unsigned int* bounds[5] = {begin, midZ0, midX, midZ1, end};
+
+    cells[index].leaf = false;
+    for (unsigned int quadrant = 0; quadrant < 4; ++quadrant) {
+        unsigned int quadrantCount = bounds[quadrant + 1] - bounds[quadrant];
+        if (0 < quadrantCount) {
+            int child = buildCell(bounds[quadrant] - &objects[0], quadrantCount, depth + 1);
+            cells[index].children[quadrant] = child;
+        }
+    }
+
+    return index;
+}
+
+bool swgSpatialIndex::overlaps(const cell& current, const float min[3], const float max[3]) const
+{
+    for (unsigned int i = 0; i < 3; ++i) {
+        if (current.max[i] < min[i] || current.min[i] > max[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void swgSpatialIndex::queryCells(const float                min[3],
+                                 const float                max[3],
+                                 std::vector<unsigned int>& result) const
+{
+    if (cells.empty()) {
+        return;
+    }
+
+    std::vector<unsigned int> stack(1, 0);
+    while (!stack.empty()) {
+        unsigned int index = stack.back();
+        stack.pop_back();
+
+        const cell& current = cells[index];
+        if (!overlaps(current, min, max)) {
+            continue;
+        }
+
+        if (current.leaf) {
+            result.push_back(index);
+            continue;
+        }
+
+        for (unsigned int i = 0; i < 4; ++i) {
+            if (0 <= current.children[i]) {
+                stack.push_back(current.children[i]);
+            }
+        }
+    }
+}
+
+void swgSpatialIndex::queryBox(const float                min[3],
+                               const float                max[3],
+                               std::vector<unsigned int>& result) const
+{
+    std::vector<unsigned int> leaves;
+    queryCells(min, max, leaves);
+
+    for (unsigned int i = 0; i < leaves.size(); ++i) {
+        const cell& current = cells[leaves[i]];
+        for (unsigned int j = current.firstObject; j < current.firstObject + current.numObjects;
+             ++j) {
+            unsigned int object = objects[j];
+            float        r      = radii[object];
+            if (centerX[object] + r >= min[0] && centerX[object] - r <= max[0]
+                && centerY[object] + r >= min[1] && centerY[object] - r <= max[1]
+                && centerZ[object] + r >= min[2] && centerZ[object] - r <= max[2]) {
+                result.push_back(object);
+            }
+        }
+    }
+}
+
+void swgSpatialIndex::querySphere(const float                center[3],
+                                  float                      radius,
+                                  std::vector<unsigned int>& result) const
+{
+    float min[3] = {center[0] - radius, center[1] - radius, center[2] - radius};
+    float max[3] = {center[0] + radius, center[1] + radius, center[2] + radius};
+
+    std::vector<unsigned int> leaves;
+    queryCells(min, max, leaves);
+
+    for (unsigned int i = 0; i < leaves.size(); ++i) {
+        const cell& current = cells[leaves[i]];
+        for (unsigned int j = current.firstObject; j < current.firstObject + current.numObjects;
+             ++j) {
+            unsigned int object = objects[j];
+            float        dx     = centerX[object] - center[0];
+            float        dy     = centerY[object] - center[1];
+            float        dz     = centerZ[object] - center[2];
+            float        reach  = radius + radii[object];
+            if ((dx * dx + dy * dy + dz * dz) <= reach * reach) {
+                result.push_back(object);
+            }
+        }
+    }
+}
@@ -0,0 +1,92 @@
+/** -*-c++-*-
+ *  \file   swgSpatialIndex.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <vector>
+
+#ifndef SWGSPATIALINDEX_HPP
+#define SWGSPATIALINDEX_HPP
+
+/**
+ * Quadtree shaped bounding volume hierarchy over object bounding spheres.
+ * Objects are split by the x/z position of their centers, which suits
+ * planet surfaces, and every cell keeps the full 3D box of its objects.
+ * Leaf cells are the unit used for regrouping and paging.
+ */
+class swgSpatialIndex {
+public:
+    struct cell {
+        float        min[3];
+        float        max[3];
+        unsigned int firstObject;
+        unsigned int numObjects;
+        int          children[4]; // -1 where there is no child
+        bool         leaf;
+    };
+
+    swgSpatialIndex(unsigned int maxObjectsPerCell = 64, unsigned int maxDepth = 10);
+    ~swgSpatialIndex();
+
+    // Build over numObjects spheres given as center arrays and radii.
+    void build(const float* x,
+               const float* y,
+               const float* z,
+               const float* radius,
+               unsigned int numObjects);
+
+    unsigned int getNumCells() const { return cells.size(); }
+    const cell&  getCell(unsigned int index) const { return cells[index]; }
+
+    // Object indices held by a cell, valid for leaf cells only.
+    const unsigned int* getCellObjects(unsigned int index) const
+    {
+        return &objects[cells[index].firstObject];
+    }
+
+    // Append objects whose bounds intersect the region to result.
+    void queryBox(const float                min[3],
+                  const float                max[3],
+                  std::vector<unsigned int>& result) const;
+    void querySphere(const float                center[3],
+                     float                      radius,
+                     std::vector<unsigned int>& result) const;
+
+    // Append leaf cells whose bounds intersect the region to result.
+    void queryCells(const float                min[3],
+                    const float                max[3],
+                    std::vector<unsigned int>& result) const;
+
+protected:
+    int  buildCell(unsigned int first, unsigned int count, unsigned int depth);
+    bool overlaps(const cell& current, const float min[3], const float max[3]) const;
+
+    unsigned int maxObjectsPerCell;
+    unsigned int maxDepth;
+
+    std::vector<cell>         cells;
+    std::vector<unsigned int> objects;
+    std::vector<float>        centerX, centerY, centerZ, radii;
+};
+
+#endif
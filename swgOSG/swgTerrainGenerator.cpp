@@ -0,0 +1,595 @@
+/** -*-c++-*-
+ *  \file   swgTerrainGenerator.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgTerrainGenerator.hpp"
+#include "swgHash.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+// Rows per parallel strip. Small enough to balance, large enough that the
+// per call overhead of applyLayers does not matter.
+const unsigned int minRowsPerStrip = 8;
+
+// Samples per side of the grid swgTerrainLayers is checked on, and the
+// largest height difference to ml::trn it may show there.
+const unsigned int probeSize     = 65;
+const float        maxProbeError = 0.01f;
+
+// Size of the terrains check builds, and samples per side of the grid the
+// evaluators are compared on.
+const float        checkTerrainSize = 8192.0f;
+const unsigned int checkGridSize    = 257;
+
+// Little endian values as stored in IFF chunks.
+void appendInt32(std::string& data, int value)
+{
+    for (unsigned int i = 0; i < 4; ++i) {
+        data.push_back((char)(((unsigned int)value >> (8 * i)) & 0xff));
+    }
+}
+
+void appendFloat(std::string& data, float value)
+{
+    int bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    appendInt32(data, bits);
+}
+
+void appendString(std::string& data, const std::string& value)
+{
+    data += value;
+    data.push_back('\0');
+}
+
+// A chunk, its size big endian as in every IFF block header.
+std::string createChunk(const std::string& tag, const std::string& data)
+{
+    std::string result = tag;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        result.push_back((char)((data.size() >> shift) & 0xff));
+    }
+    return result + data;
+}
+
+std::string createForm(const std::string& tag, const std::string& contents)
+{
+    return createChunk("FORM", tag + contents);
+}
+
+// Boundary, filter or affector with a header and its parameters.
+std::string createItem(const std::string& tag,
+                       const std::string& version,
+                       const std::string& parameters)
+{
+    std::string header;
+    appendInt32(header, 1);
+    appendString(header, tag);
+    return createForm(
+        tag,
+        createForm(version,
+                   createForm("IHDR", createForm("0001", createChunk("DATA", header)))
+                       + createChunk("DATA", parameters)));
+}
+
+std::string createLayer(const std::string& items)
+{
+    std::string header;
+    appendInt32(header, 1);
+    appendString(header, "layer");
+
+    std::string flags;
+    appendInt32(flags, 0);
+    appendInt32(flags, 0);
+    appendInt32(flags, 0);
+    appendString(flags, "");
+
+    return createForm(
+        "LAYR",
+        createForm("0003",
+                   createForm("IHDR", createForm("0001", createChunk("DATA", header)))
+                       + createChunk("ADTA", flags) + items));
+}
+
+// Whole .trn file with fractal family 1 and the given layers.
+std::string createTerrain(const std::string& layers)
+{
+    std::string header;
+    appendString(header, "terrain/check.trn");
+    appendFloat(header, checkTerrainSize);
+    appendFloat(header, 8.0f);
+    appendInt32(header, 2);
+    appendInt32(header, 0);
+    appendFloat(header, 0.0f);
+    appendFloat(header, 2.0f);
+    appendString(header, "");
+    appendFloat(header, 60.0f);
+    for (unsigned int i = 0; i < swgTerrainLayers::numFloraKinds; ++i) {
+        appendFloat(header, 0.0f);
+        appendFloat(header, 64.0f);
+        appendFloat(header, 8.0f);
+        appendFloat(header, 0.0f);
+        appendInt32(header, i);
+    }
+
+    std::string family;
+    appendInt32(family, 1);
+    appendString(family, "check");
+
+    std::string fractal;
+    appendInt32(fractal, 7);
+    appendInt32(fractal, 0);
+    appendFloat(fractal, 0.5f);
+    appendInt32(fractal, 0);
+    appendFloat(fractal, 0.5f);
+    appendInt32(fractal, 4);
+    appendFloat(fractal, 2.0f);
+    appendFloat(fractal, 0.5f);
+    appendFloat(fractal, 0.001f);
+    appendFloat(fractal, 0.001f);
+    appendFloat(fractal, 0.0f);
+    appendFloat(fractal, 0.0f);
+    appendInt32(fractal, 1);
+
+    std::string fractals = createForm(
+        "MGRP",
+        createForm("0000",
+                   createForm("MFAM",
+                              createChunk("DATA", family)
+                                  + createForm("MFRC",
+                                               createForm("0001", createChunk("DATA", fractal))))));
+
+    std::string generator = createForm("SGRP", createForm("0006", ""))
+                            + createForm("FGRP", createForm("0008", ""))
+                            + createForm("RGRP", createForm("0003", "")) + fractals
+                            + createForm("LYRS", layers);
+
+    return createForm(
+        "PTAT",
+        createForm("0015",
+                   createChunk("DATA", header)
+                       + createForm("TGEN", createForm("0000", generator))));
+}
+
+// Parameters of the items the checked terrains are built from.
+std::string heightConstant(int operation, float height)
+{
+    std::string data;
+    appendInt32(data, operation);
+    appendFloat(data, height);
+    return createItem("AHCN", "0000", data);
+}
+
+std::string heightFractal(int operation, float height)
+{
+    std::string data;
+    appendInt32(data, 1);
+    appendInt32(data, operation);
+    appendFloat(data, height);
+    return createItem("AHFR", "0003", data);
+}
+
+std::string heightTerrace(float flatRatio, float height)
+{
+    std::string data;
+    appendFloat(data, flatRatio);
+    appendFloat(data, height);
+    return createItem("AHTR", "0004", data);
+}
+
+std::string points(const float* xy, unsigned int count)
+{
+    std::string data;
+    appendInt32(data, count);
+    for (unsigned int i = 0; i < 2 * count; ++i) {
+        appendFloat(data, xy[i]);
+    }
+    return data;
+}
+
+std::string feather(int featherType, float featherAmount)
+{
+    std::string data;
+    appendInt32(data, featherType);
+    appendFloat(data, featherAmount);
+    return data;
+}
+
+struct checkCase {
+    std::string tag;
+    std::string layers;
+};
+
+// One terrain per kind of item, each also using some other kinds where
+// the item alone would leave the ground flat.
+std::vector<checkCase> createCheckCases()
+{
+    // Rolling ground for filters and terraces to work on.
+    std::string ground = createLayer(heightFractal(swgTerrainKernels::heightAdd, 300.0f));
+
+    std::vector<checkCase> cases(9);
+
+    std::string circle;
+    appendFloat(circle, 300.0f);
+    appendFloat(circle, -200.0f);
+    appendFloat(circle, 1500.0f);
+    circle += feather(1, 0.4f);
+    cases[0].tag    = "BCIR";
+    cases[0].layers = createLayer(createItem("BCIR", "0002", circle)
+                                  + heightConstant(swgTerrainKernels::heightAdd, 50.0f));
+
+    std::string rectangle;
+    appendFloat(rectangle, -2500.0f);
+    appendFloat(rectangle, -900.0f);
+    appendFloat(rectangle, 1200.0f);
+    appendFloat(rectangle, 1700.0f);
+    rectangle += feather(2, 0.3f);
+    cases[1].tag    = "BREC";
+    cases[1].layers = createLayer(createItem("BREC", "0003", rectangle)
+                                  + heightConstant(swgTerrainKernels::heightAdd, 40.0f));
+
+    const float polygon[] = {-3000.0f, -2000.0f, 2500.0f, -2600.0f, 3100.0f, 900.0f,
+                             200.0f,   2900.0f,  -1800.0f, 1200.0f};
+    cases[2].tag    = "BPOL";
+    cases[2].layers =
+        ground
+        + createLayer(createItem("BPOL", "0005", points(polygon, 5) + feather(3, 0.25f))
+                      + heightConstant(swgTerrainKernels::heightMultiply, 1.5f));
+
+    const float line[] = {-3500.0f, -3000.0f, 0.0f, 400.0f, 3600.0f, 1000.0f};
+    std::string width;
+    appendFloat(width, 250.0f);
+    cases[3].tag    = "BPLN";
+    cases[3].layers = ground
+                      + createLayer(createItem("BPLN", "0001", feather(0, 0.5f) + points(line, 3)
+                                                                   + width)
+                                    + heightConstant(swgTerrainKernels::heightReplace, 20.0f));
+
+    std::string heights;
+    appendFloat(heights, 100.0f);
+    appendFloat(heights, 200.0f);
+    heights += feather(1, 0.2f);
+    cases[4].tag    = "FHGT";
+    cases[4].layers = ground
+                      + createLayer(createItem("FHGT", "0002", heights)
+                                    + heightConstant(swgTerrainKernels::heightSubtract, 25.0f));
+
+    std::string fractal;
+    appendInt32(fractal, 1);
+    fractal += feather(2, 0.1f);
+    appendFloat(fractal, 0.3f);
+    appendFloat(fractal, 0.7f);
+    appendFloat(fractal, 1.0f);
+    cases[5].tag    = "FFRA";
+    cases[5].layers = createLayer(createItem("FFRA", "0005", fractal)
+                                  + heightConstant(swgTerrainKernels::heightAdd, 35.0f));
+
+    cases[6].tag    = "AHCN";
+    cases[6].layers = createLayer(heightConstant(swgTerrainKernels::heightAdd, 80.0f)
+                                  + heightConstant(swgTerrainKernels::heightMultiply, 0.75f)
+                                  + heightConstant(swgTerrainKernels::heightSubtract, 10.0f))
+                      + createLayer(createItem("BCIR", "0002", circle)
+                                    + heightConstant(swgTerrainKernels::heightReplace, 5.0f));
+
+    cases[7].tag    = "AHFR";
+    cases[7].layers = createLayer(heightFractal(swgTerrainKernels::heightReplace, 200.0f)
+                                  + heightFractal(swgTerrainKernels::heightAdd, 40.0f)
+                                  + heightFractal(swgTerrainKernels::heightSubtract, 15.0f)
+                                  + heightFractal(swgTerrainKernels::heightMultiply, 1.2f));
+
+    cases[8].tag    = "AHTR";
+    cases[8].layers = ground + createLayer(heightTerrace(0.3f, 12.0f));
+
+    return cases;
+}
+} // namespace
+
+swgTerrainGenerator::swgTerrainGenerator(const std::string& trnData,
+                                         swgThreadPool*     threadPool,
+                                         bool               vectorLayers)
+    : trnData(trnData)
+    , trnHash(0)
+    , threadPool(threadPool)
+    , valid(false)
+    , terrainSize(0.0f)
+    , waterTableHeight(0.0f)
+    , useLayers(false)
+{
+    ml::trn* trn     = acquire();
+    terrainSize      = trn->getTerrainSize();
+    waterTableHeight = trn->getWaterTableHeight();
+    valid            = 0.0f < terrainSize;
+    release(trn);
+
+    swgHash hash;
+    hash.add(trnData);
+    trnHash = hash.get();
+
+    // The layers are read regardless, for the colors and flora.
+    if (valid) {
+        layers.reset(new swgTerrainLayers(trnData));
+        useLayers = vectorLayers && checkLayers();
+    }
+}
+
+swgTerrainGenerator::~swgTerrainGenerator() {}
+
+unsigned int swgTerrainGenerator::getEvaluator() const
+{
+    return useLayers ? swgHeightmapCache::TERRAIN_LAYERS : swgHeightmapCache::MESHLIB;
+}
+
+unsigned int swgTerrainGenerator::getEvaluatorVersion() const
+{
+    // meshLib has no version of its own, its grids are keyed on the file.
+    return useLayers ? swgTerrainLayers::heightVersion : 0;
+}
+
+ml::trn* swgTerrainGenerator::acquire()
+{
+    {
+        std::unique_lock<std::mutex> lock(parsedMutex);
+        if (!available.empty()) {
+            ml::trn* trn = available.back();
+            available.pop_back();
+            return trn;
+        }
+    }
+
+    // Parse outside the lock so workers starting together do not queue.
+    std::unique_ptr<ml::trn> trn(new ml::trn);
+    std::istringstream       trnFile(trnData);
+    trn->readTRN(trnFile);
+
+    std::unique_lock<std::mutex> lock(parsedMutex);
+    parsed.push_back(std::move(trn));
+    return parsed.back().get();
+}
+
+void swgTerrainGenerator::release(ml::trn* trn)
+{
+    std::unique_lock<std::mutex> lock(parsedMutex);
+    available.push_back(trn);
+}
+
+bool swgTerrainGenerator::checkLayers()
+{
+    if (!layers->isValid()) {
+        std::cout << "Terrain heights: unable to read the layers, using meshLib." << std::endl;
+        return false;
+    }
+
+    const std::vector<std::string>& unsupported = layers->getUnsupportedHeightItems();
+    if (!unsupported.empty()) {
+        std::cout << "Terrain heights: no evaluator for";
+        for (unsigned int i = 0; i < unsupported.size(); ++i) {
+            std::cout << " " << unsupported[i];
+        }
+        std::cout << ", using meshLib." << std::endl;
+        return false;
+    }
+
+    // Both evaluators on a grid over the whole terrain.
+    float              origin  = -0.5f * terrainSize;
+    float              spacing = terrainSize / (probeSize - 1);
+    std::vector<float> expected(probeSize * probeSize);
+    std::vector<float> result(probeSize * probeSize, waterTableHeight);
+    applyMeshLib(origin, origin, spacing, spacing, probeSize, probeSize, &expected[0]);
+    layers->applyHeights(origin, origin, spacing, spacing, probeSize, probeSize, &result[0]);
+
+    float maxError = 0.0f;
+    for (unsigned int i = 0; i < expected.size(); ++i) {
+        maxError = std::max(maxError, std::fabs(expected[i] - result[i]));
+    }
+
+    bool matches = maxError <= maxProbeError;
+    std::cout << "Terrain heights: largest probe difference to meshLib " << maxError << ", using "
+              << (matches ? swgTerrainKernels::getInstructionSet() : "meshLib")
+              << (matches ? " kernels." : ".") << std::endl;
+    return matches;
+}
+
+void swgTerrainGenerator::applyMeshLib(float        originX,
+                                       float        originY,
+                                       float        spacingX,
+                                       float        spacingY,
+                                       unsigned int numRows,
+                                       unsigned int numColumns,
+                                       float*       data)
+{
+    std::fill(data, data + numRows * numColumns, waterTableHeight);
+
+    ml::trn* trn = acquire();
+    trn->applyLayers(originX, originY, spacingX, spacingY, numRows, numColumns, data);
+    release(trn);
+}
+
+void swgTerrainGenerator::applyLayers(float        originX,
+                                      float        originY,
+                                      float        spacingX,
+                                      float        spacingY,
+                                      unsigned int numRows,
+                                      unsigned int numColumns,
+                                      float*       data)
+{
+    if (!useLayers) {
+        applyMeshLib(originX, originY, spacingX, spacingY, numRows, numColumns, data);
+        return;
+    }
+
+    std::fill(data, data + numRows * numColumns, waterTableHeight);
+    layers->applyHeights(originX, originY, spacingX, spacingY, numRows, numColumns, data);
+}
+
+void swgTerrainGenerator::generate(float        originX,
+                                   float        originY,
+                                   float        spacingX,
+                                   float        spacingY,
+                                   unsigned int numRows,
+                                   unsigned int numColumns,
+                                   float*       data)
+{
+    // Strips start at a different origin, which is only safe when every
+    // row coordinate comes out the same either way.
+    bool split = NULL != threadPool && 2 * minRowsPerStrip <= numRows
+                 && isExactGrid(originY, spacingY, numRows);
+    if (!split) {
+        applyLayers(originX, originY, spacingX, spacingY, numRows, numColumns, data);
+        return;
+    }
+
+    // Several strips per thread so uneven layer cost still balances.
+    unsigned int maxStrips    = 8 * threadPool->getNumThreads();
+    unsigned int numStrips    = std::min(numRows / minRowsPerStrip, maxStrips);
+    unsigned int rowsPerStrip = (numRows + numStrips - 1) / numStrips;
+    numStrips                 = (numRows + rowsPerStrip - 1) / rowsPerStrip;
+
+    threadPool->parallelFor(0, numStrips, [&](unsigned int strip) {
+        unsigned int firstRow  = strip * rowsPerStrip;
+        unsigned int stripRows = std::min(rowsPerStrip, numRows - firstRow);
+        applyLayers(originX,
+                    originY + firstRow * spacingY,
+                    spacingX,
+                    spacingY,
+                    stripRows,
+                    numColumns,
+                    data + firstRow * numColumns);
+    });
+}
+
+std::shared_ptr<swgHeightGrid> swgTerrainGenerator::getGrid(float        originX,
+                                                            float        originY,
+                                                            float        spacingX,
+                                                            float        spacingY,
+                                                            unsigned int numRows,
+                                                            unsigned int numColumns)
+{
+    std::shared_ptr<swgHeightmapCache> heightmapCache = cache;
+    if (NULL != heightmapCache) {
+        std::shared_ptr<swgHeightGrid> grid = heightmapCache->load(trnHash,
+                                                                   getEvaluator(),
+                                                                   getEvaluatorVersion(),
+                                                                   originX,
+                                                                   originY,
+                                                                   spacingX,
+                                                                   spacingY,
+                                                                   numRows,
+                                                                   numColumns);
+        if (NULL != grid) {
+            return grid;
+        }
+    }
+
+    std::vector<float> heights(numRows * numColumns);
+    generate(originX, originY, spacingX, spacingY, numRows, numColumns, &heights[0]);
+
+    // Hand back what the cache stored, so lossy formats look the same on
+    // the first run as on later ones.
+    if (NULL != heightmapCache) {
+        return heightmapCache->store(trnHash,
+                                     getEvaluator(),
+                                     getEvaluatorVersion(),
+                                     originX,
+                                     originY,
+                                     spacingX,
+                                     spacingY,
+                                     numRows,
+                                     numColumns,
+                                     &heights[0]);
+    }
+
+    std::shared_ptr<swgHeightGrid> grid(new swgHeightGrid(numRows, numColumns));
+    grid->setHeights(heights);
+    return grid;
+}
+
+bool swgTerrainGenerator::isExactGrid(float origin, float spacing, unsigned int count)
+{
+    // Find the largest power of two fraction both values are multiples of.
+    double scale = 1.0;
+    for (unsigned int bits = 0; bits <= 24; ++bits, scale *= 2.0) {
+        double scaledOrigin  = origin * scale;
+        double scaledSpacing = spacing * scale;
+        if (scaledOrigin != std::floor(scaledOrigin)
+            || scaledSpacing != std::floor(scaledSpacing)) {
+            continue;
+        }
+
+        // Every coordinate on the way is then an integer in those units and
+        // exact as long as it fits the float mantissa.
+        double extent = std::fabs(scaledOrigin) + std::fabs(scaledSpacing) * count;
+        return extent < 16777216.0;
+    }
+
+    return false;
+}
+
+bool swgTerrainGenerator::check(std::ostream& out)
+{
+    bool passed = true;
+
+    std::vector<checkCase> cases = createCheckCases();
+    for (unsigned int i = 0; i < cases.size(); ++i) {
+        swgTerrainGenerator generator(createTerrain(cases[i].layers), NULL);
+        out << "Terrain layers " << cases[i].tag << ": ";
+        if (!generator.isValid() || !generator.layers->isValid()
+            || !generator.layers->getUnsupportedHeightItems().empty()) {
+            out << "FAILED, unable to read the terrain" << std::endl;
+            passed = false;
+            continue;
+        }
+
+        // Every sample of the whole terrain, edges included.
+        float              origin  = -0.5f * checkTerrainSize;
+        float              spacing = checkTerrainSize / (checkGridSize - 1);
+        unsigned int       size    = checkGridSize * checkGridSize;
+        std::vector<float> expected(size);
+        std::vector<float> result(size, generator.waterTableHeight);
+        generator.applyMeshLib(
+            origin, origin, spacing, spacing, checkGridSize, checkGridSize, &expected[0]);
+        generator.layers->applyHeights(
+            origin, origin, spacing, spacing, checkGridSize, checkGridSize, &result[0]);
+
+        unsigned int numDifferent = 0;
+        float        maxError     = 0.0f;
+        for (unsigned int j = 0; j < size; ++j) {
+            if (expected[j] != result[j]) {
+                ++numDifferent;
+                maxError = std::max(maxError, std::fabs(expected[j] - result[j]));
+            }
+        }
+
+        bool ok = 0 == numDifferent;
+        out << (ok ? "ok" : "FAILED") << ", " << numDifferent << " of " << size
+            << " samples differ, largest difference " << maxError << std::endl;
+        passed = passed && ok;
+    }
+
+    return passed;
+}
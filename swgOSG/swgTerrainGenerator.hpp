@@ -0,0 +1,167 @@
+/** -*-c++-*-
+ *  \file   swgTerrainGenerator.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <meshLib/trn.hpp>
+
+#include "swgHeightmapCache.hpp"
+#include "swgTerrainLayers.hpp"
+#include "swgThreadPool.hpp"
+
+#ifndef SWGTERRAINGENERATOR_HPP
+#define SWGTERRAINGENERATOR_HPP
+
+/**
+ * Evaluates the layers of a TRN file into height grids. Large grids are
+ * split into strips of rows evaluated in parallel.
+ *
+ * Heights come from ml::trn, each worker on its own parsed copy of the file
+ * since ml::trn is not safe to share. The vector kernels of
+ * swgTerrainLayers are used instead only when asked for, and then only on
+ * files whose height layers they fully cover and whose probe grid they
+ * reproduce.
+ */
+class swgTerrainGenerator {
+public:
+    /**
+     * trnData holds the bytes of a .trn file, threadPool may be NULL.
+     * vectorLayers asks for swgTerrainLayers where it can stand in for
+     * ml::trn.
+     */
+    swgTerrainGenerator(const std::string& trnData,
+                        swgThreadPool*     threadPool,
+                        bool               vectorLayers = false);
+    ~swgTerrainGenerator();
+
+    bool  isValid() const { return valid; }
+    float getTerrainSize() const { return terrainSize; }
+    float getWaterTableHeight() const { return waterTableHeight; }
+
+    const std::string& getData() const { return trnData; }
+
+    // Content hash of the .trn file.
+    unsigned long long getHash() const { return trnHash; }
+
+    // True when heights come from swgTerrainLayers rather than ml::trn.
+    bool isUsingLayers() const { return useLayers; }
+
+    // swgHeightmapCache::heightEvaluator of the heights and its version,
+    // which cached grids are keyed on besides the file.
+    unsigned int getEvaluator() const;
+    unsigned int getEvaluatorVersion() const;
+
+    // The layers as read from the file, NULL for an invalid file.
+    const swgTerrainLayers* getLayers() const { return layers.get(); }
+
+    // Keep generated grids on disk for getGrid.
+    void setCache(std::shared_ptr<swgHeightmapCache> heightmapCache) { cache = heightmapCache; }
+    std::shared_ptr<swgHeightmapCache> getCache() const { return cache; }
+
+    /**
+     * Fill data, numRows by numColumns in row major order, with the terrain
+     * height at originX + column * spacingX, originY + row * spacingY. The
+     * result does not depend on how the grid is split. Safe to call from
+     * several threads at once.
+     */
+    void generate(float        originX,
+                  float        originY,
+                  float        spacingX,
+                  float        spacingY,
+                  unsigned int numRows,
+                  unsigned int numColumns,
+                  float*       data);
+
+    /**
+     * Like generate, but served from the heightmap cache when one is set
+     * and the grid was generated before. Safe to call from several threads
+     * at once.
+     */
+    std::shared_ptr<swgHeightGrid> getGrid(float        originX,
+                                           float        originY,
+                                           float        spacingX,
+                                           float        spacingY,
+                                           unsigned int numRows,
+                                           unsigned int numColumns);
+
+    /**
+     * True when origin + i * spacing is exactly representable for every
+     * i up to count, so a grid may be split at any row or column without
+     * changing a single sample coordinate.
+     */
+    static bool isExactGrid(float origin, float spacing, unsigned int count);
+
+    /**
+     * Build a small terrain for each kind of height boundary, filter and
+     * affector swgTerrainLayers evaluates, generate the whole terrain with
+     * both evaluators and require every sample to be equal. Prints the
+     * result per kind and returns whether all of them match.
+     */
+    static bool check(std::ostream& out);
+
+protected:
+    // Parsed copies of the file not in use by any thread.
+    ml::trn* acquire();
+    void     release(ml::trn* trn);
+
+    // Whether swgTerrainLayers can stand in for ml::trn on this file.
+    bool checkLayers();
+
+    void applyMeshLib(float        originX,
+                      float        originY,
+                      float        spacingX,
+                      float        spacingY,
+                      unsigned int numRows,
+                      unsigned int numColumns,
+                      float*       data);
+
+    void applyLayers(float        originX,
+                     float        originY,
+                     float        spacingX,
+                     float        spacingY,
+                     unsigned int numRows,
+                     unsigned int numColumns,
+                     float*       data);
+
+    std::string                        trnData;
+    unsigned long long                 trnHash;
+    swgThreadPool*                     threadPool;
+    std::shared_ptr<swgHeightmapCache> cache;
+    bool                               valid;
+    float                              terrainSize;
+    float                              waterTableHeight;
+    std::unique_ptr<swgTerrainLayers>  layers;
+    bool                               useLayers;
+
+    std::mutex                            parsedMutex;
+    std::vector<std::unique_ptr<ml::trn>> parsed;
+    std::vector<ml::trn*>                 available;
+};
+
+#endif
@@ -0,0 +1,1443 @@
+/** -*-c++-*-
+ *  \file   swgTerrainKernels.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgTerrainKernels.hpp"
+#include "swgSIMD.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+namespace
+{
+unsigned int floatBits(float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+bool isNaNBits(unsigned int bits)
+{
+    return 0x7f800000 == (bits & 0x7f800000) && 0 != (bits & 0x7fffff);
+}
+
+bool isHalfNaN(unsigned short half)
+{
+    return 0x7c00 == (half & 0x7c00) && 0 != (half & 0x3ff);
+}
+
+// Small deterministic generator for test data.
+unsigned int nextRandom(unsigned int& state)
+{
+    state = state * 1664525u + 1013904223u;
+    return state;
+}
+
+// Rolling hills with some roughness, roughly like real terrain.
+void fillHeights(std::vector<float>& heights, unsigned int numRows, unsigned int numColumns)
+{
+    unsigned int state = 12345;
+    heights.resize(numRows * numColumns);
+    for (unsigned int row = 0; row < numRows; ++row) {
+        for (unsigned int col = 0; col < numColumns; ++col) {
+            float noise = (nextRandom(state) >> 8) / 16777216.0f;
+            heights[row * numColumns + col] = 120.0f * std::sin(row * 0.05f)
+                                              * std::cos(col * 0.03f)
+                                              + 4.0f * noise - 30.0f;
+        }
+    }
+}
+
+// Settings like those of real planets, with a given combination rule.
+swgTerrainKernels::fractalSettings makeTestFractal(int combination)
+{
+    swgTerrainKernels::fractalSettings settings;
+    settings.numOctaves      = 4;
+    settings.octaveFrequency = 2.1f;
+    settings.octaveAmplitude = 0.55f;
+    settings.frequencyX      = 0.0123f;
+    settings.frequencyY      = 0.0097f;
+    settings.offsetX         = 3.5f;
+    settings.offsetY         = -7.25f;
+    settings.combination     = combination;
+    settings.useBias         = 1 == combination;
+    settings.bias            = 0.6f;
+    settings.useGain         = 2 == combination;
+    settings.gain            = 0.7f;
+    swgTerrainKernels::setNoiseSeed(settings, 1000 + combination);
+    return settings;
+}
+
+double getSeconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+#if defined(SWG_SIMD_SSE2) && !defined(SWG_SIMD_F16C)
+__m128 halfToFloat4(__m128i halves)
+{
+    const __m128i shiftedExponent = _mm_set1_epi32(0x7c00 << 13);
+
+    __m128i bits     = _mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x7fff)), 13);
+    __m128i exponent = _mm_and_si128(bits, shiftedExponent);
+    bits             = _mm_add_epi32(bits, _mm_set1_epi32((127 - 15) << 23));
+
+    // Infinity and NaN keep an all ones exponent.
+    __m128i special = _mm_cmpeq_epi32(exponent, shiftedExponent);
+    bits = _mm_add_epi32(bits, _mm_and_si128(special, _mm_set1_epi32((128 - 16) << 23)));
+
+    // Denormals are renormalized by letting the float unit subtract the
+    // implicit one back out.
+    __m128i denormal    = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+    __m128  magic       = _mm_castsi128_ps(_mm_set1_epi32(113 << 23));
+    __m128i renormalized = _mm_castps_si128(_mm_sub_ps(
+        _mm_castsi128_ps(_mm_add_epi32(bits, _mm_set1_epi32(1 << 23))), magic));
+    bits = _mm_or_si128(_mm_andnot_si128(denormal, bits), _mm_and_si128(denormal, renormalized));
+
+    __m128i sign = _mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x8000)), 16);
+    return _mm_castsi128_ps(_mm_or_si128(bits, sign));
+}
+
+__m128i floatToHalf4(__m128 values)
+{
+    __m128i bits = _mm_castps_si128(values);
+    __m128i sign = _mm_and_si128(bits, _mm_set1_epi32(0x80000000));
+    bits         = _mm_xor_si128(bits, sign);
+
+    // Round to nearest even by adding just under half an ulp, plus one
+    // when the kept mantissa is odd, then rebias the exponent.
+    __m128i odd    = _mm_and_si128(_mm_srli_epi32(bits, 13), _mm_set1_epi32(1));
+    __m128i normal = _mm_add_epi32(_mm_add_epi32(bits, _mm_set1_epi32((int)0xc8000fff)), odd);
+    normal         = _mm_srli_epi32(normal, 13);
+
+    // Results below the smallest normal are rounded by the float unit
+    // while adding a magic number that lines the mantissa up.
+    __m128  magic    = _mm_castsi128_ps(_mm_set1_epi32((127 - 15 + 23 - 10 + 1) << 23));
+    __m128i denormal = _mm_sub_epi32(
+        _mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(bits), magic)), _mm_castps_si128(magic));
+
+    // Overflow becomes infinity, NaN a quiet NaN.
+    __m128i nan     = _mm_cmpgt_epi32(bits, _mm_set1_epi32(0x7f800000));
+    __m128i special =
+        _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(nan, _mm_set1_epi32(0x200)));
+
+    __m128i isSpecial  = _mm_cmpgt_epi32(bits, _mm_set1_epi32(((127 + 16) << 23) - 1));
+    __m128i isDenormal = _mm_cmplt_epi32(bits, _mm_set1_epi32(113 << 23));
+
+    __m128i half = _mm_or_si128(_mm_andnot_si128(isDenormal, normal),
+                                _mm_and_si128(isDenormal, denormal));
+    half = _mm_or_si128(_mm_andnot_si128(isSpecial, half), _mm_and_si128(isSpecial, special));
+
+    return _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+}
+#endif
+
+#ifdef SWG_SIMD_SSE2
+
+// Pack two vectors of values below 65536 into eight shorts.
+__m128i packUnsigned(__m128i low, __m128i high)
+{
+    // Sign extend the low halves so the signed saturating pack keeps them.
+    low  = _mm_srai_epi32(_mm_slli_epi32(low, 16), 16);
+    high = _mm_srai_epi32(_mm_slli_epi32(high, 16), 16);
+    return _mm_packs_epi32(low, high);
+}
+#endif
+
+typedef swgTerrainKernels::noiseTable      noiseTable;
+typedef swgTerrainKernels::fractalSettings fractalSettings;
+
+float fade(float r)
+{
+    return r * r * (3.0f - 2.0f * r);
+}
+
+// Classic two dimensional gradient noise in [-1, 1].
+float noise(const noiseTable& table, float x, float y)
+{
+    float floorX = std::floor(x);
+    float floorY = std::floor(y);
+    int   cellX  = (int)floorX & 255;
+    int   cellY  = (int)floorY & 255;
+
+    int i   = table.permutation[cellX];
+    int j   = table.permutation[cellX + 1];
+    int b00 = table.permutation[i + cellY];
+    int b10 = table.permutation[j + cellY];
+    int b01 = table.permutation[i + cellY + 1];
+    int b11 = table.permutation[j + cellY + 1];
+
+    float rx0 = x - floorX;
+    float ry0 = y - floorY;
+    float rx1 = rx0 - 1.0f;
+    float ry1 = ry0 - 1.0f;
+    float sx  = fade(rx0);
+    float sy  = fade(ry0);
+
+    float u = rx0 * table.gradientX[b00] + ry0 * table.gradientY[b00];
+    float v = rx1 * table.gradientX[b10] + ry0 * table.gradientY[b10];
+    float a = u + sx * (v - u);
+    u       = rx0 * table.gradientX[b01] + ry1 * table.gradientY[b01];
+    v       = rx1 * table.gradientX[b11] + ry1 * table.gradientY[b11];
+    float b = u + sx * (v - u);
+    return a + sy * (b - a);
+}
+
+bool isCrest(int combination)
+{
+    return 2 == combination || 4 == combination;
+}
+
+bool isTurbulence(int combination)
+{
+    return 3 == combination || 5 == combination;
+}
+
+// Scale that brings the sum of all octaves back to about [-1, 1].
+float getOctaveScale(const fractalSettings& settings)
+{
+    float total     = 0.0f;
+    float amplitude = 1.0f;
+    for (unsigned int octave = 0; octave < settings.numOctaves; ++octave) {
+        total += amplitude;
+        amplitude *= settings.octaveAmplitude;
+    }
+    return (0.0f != total) ? 1.0f / total : 0.0f;
+}
+
+float finishSample(int combination, float sum, float scale)
+{
+    float value = sum * scale;
+    if (isCrest(combination) || isTurbulence(combination)) {
+        return (3 < combination) ? std::min(1.0f, std::max(0.0f, value)) : value;
+    }
+    return (value + 1.0f) * 0.5f;
+}
+
+// Samples begin to end of a fractal row, without bias and gain.
+void fractalRange(const fractalSettings& settings,
+                  float                  originX,
+                  float                  spacingX,
+                  float                  y,
+                  std::size_t            begin,
+                  std::size_t            end,
+                  float*                 out)
+{
+    float scale = getOctaveScale(settings);
+    float rowY  = y * settings.frequencyY + settings.offsetY;
+    for (std::size_t i = begin; i < end; ++i) {
+        float x         = originX + (float)i * spacingX;
+        float cx        = x * settings.frequencyX + settings.offsetX;
+        float cy        = rowY;
+        float sum       = 0.0f;
+        float amplitude = 1.0f;
+        for (unsigned int octave = 0; octave < settings.numOctaves; ++octave) {
+            float n = noise(settings.noise, cx, cy);
+            if (isCrest(settings.combination)) {
+                n = 1.0f - std::fabs(n);
+            } else if (isTurbulence(settings.combination)) {
+                n = std::fabs(n);
+            }
+            sum += n * amplitude;
+            cx *= settings.octaveFrequency;
+            cy *= settings.octaveFrequency;
+            amplitude *= settings.octaveAmplitude;
+        }
+        out[i] = finishSample(settings.combination, sum, scale);
+    }
+}
+
+float applyBias(float value, float bias)
+{
+    if (0.0f >= value || 0.0f >= bias) {
+        return 0.0f;
+    }
+    return std::pow(value, std::log(bias) / std::log(0.5f));
+}
+
+// Bias and gain need pow and run per sample after the vector part.
+void applyBiasGain(const fractalSettings& settings, std::size_t count, float* out)
+{
+    if (!settings.useBias && !settings.useGain) {
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        float value = out[i];
+        if (settings.useBias) {
+            value = applyBias(value, settings.bias);
+        }
+        if (settings.useGain) {
+            float bias = 1.0f - settings.gain;
+            value      = (0.5f > value) ? applyBias(2.0f * value, bias) * 0.5f
+                                        : 1.0f - applyBias(2.0f - 2.0f * value, bias) * 0.5f;
+        }
+        out[i] = value;
+    }
+}
+
+#if defined(SWG_SIMD_AVX2)
+__m256 fade8(__m256 r)
+{
+    __m256 rise = _mm256_sub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(_mm256_set1_ps(2.0f), r));
+    return _mm256_mul_ps(_mm256_mul_ps(r, r), rise);
+}
+
+__m256 dot8(__m256 rx, __m256 ry, const noiseTable& table, __m256i index)
+{
+    __m256 gx = _mm256_i32gather_ps(table.gradientX, index, 4);
+    __m256 gy = _mm256_i32gather_ps(table.gradientY, index, 4);
+    return _mm256_add_ps(_mm256_mul_ps(rx, gx), _mm256_mul_ps(ry, gy));
+}
+
+__m256 noise8(const noiseTable& table, __m256 x, __m256 y)
+{
+    const __m256i mask = _mm256_set1_epi32(255);
+    const __m256i one  = _mm256_set1_epi32(1);
+
+    __m256  floorX = _mm256_floor_ps(x);
+    __m256  floorY = _mm256_floor_ps(y);
+    __m256i cellX  = _mm256_and_si256(_mm256_cvttps_epi32(floorX), mask);
+    __m256i cellY  = _mm256_and_si256(_mm256_cvttps_epi32(floorY), mask);
+    __m256i cellY1 = _mm256_add_epi32(cellY, one);
+
+    const int* permutation = table.permutation;
+    __m256i    i           = _mm256_i32gather_epi32(permutation, cellX, 4);
+    __m256i    j = _mm256_i32gather_epi32(permutation, _mm256_add_epi32(cellX, one), 4);
+    __m256i b00 = _mm256_i32gather_epi32(permutation, _mm256_add_epi32(i, cellY), 4);
+    __m256i b10 = _mm256_i32gather_epi32(permutation, _mm256_add_epi32(j, cellY), 4);
+    __m256i b01 = _mm256_i32gather_epi32(permutation, _mm256_add_epi32(i, cellY1), 4);
+    __m256i b11 = _mm256_i32gather_epi32(permutation, _mm256_add_epi32(j, cellY1), 4);
+
+    __m256 rx0 = _mm256_sub_ps(x, floorX);
+    __m256 ry0 = _mm256_sub_ps(y, floorY);
+    __m256 rx1 = _mm256_sub_ps(rx0, _mm256_set1_ps(1.0f));
+    __m256 ry1 = _mm256_sub_ps(ry0, _mm256_set1_ps(1.0f));
+    __m256 sx  = fade8(rx0);
+    __m256 sy  = fade8(ry0);
+
+    __m256 u = dot8(rx0, ry0, table, b00);
+    __m256 v = dot8(rx1, ry0, table, b10);
+    __m256 a = _mm256_add_ps(u, _mm256_mul_ps(sx, _mm256_sub_ps(v, u)));
+    u        = dot8(rx0, ry1, table, b01);
+    v        = dot8(rx1, ry1, table, b11);
+    __m256 b = _mm256_add_ps(u, _mm256_mul_ps(sx, _mm256_sub_ps(v, u)));
+    return _mm256_add_ps(a, _mm256_mul_ps(sy, _mm256_sub_ps(b, a)));
+}
+#elif defined(SWG_SIMD_SSE2)
+// Floor for values that fit an int, SSE2 has no rounding instruction.
+__m128 floor4(__m128 x)
+{
+    __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+}
+
+__m128 fade4(__m128 r)
+{
+    return _mm_mul_ps(_mm_mul_ps(r, r),
+                      _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), r)));
+}
+
+__m128 dot4(__m128 rx, __m128 ry, const float* gradientX, const float* gradientY)
+{
+    return _mm_add_ps(_mm_mul_ps(rx, _mm_load_ps(gradientX)),
+                      _mm_mul_ps(ry, _mm_load_ps(gradientY)));
+}
+
+__m128 noise4(const noiseTable& table, __m128 x, __m128 y)
+{
+    const __m128i mask = _mm_set1_epi32(255);
+
+    __m128 floorX = floor4(x);
+    __m128 floorY = floor4(y);
+
+    alignas(16) int cellX[4];
+    alignas(16) int cellY[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(cellX),
+                    _mm_and_si128(_mm_cvttps_epi32(floorX), mask));
+    _mm_store_si128(reinterpret_cast<__m128i*>(cellY),
+                    _mm_and_si128(_mm_cvttps_epi32(floorY), mask));
+
+    // SSE2 has no gathers, the lattice lookups run per lane.
+    alignas(16) float gradients[8][4];
+    for (unsigned int lane = 0; lane < 4; ++lane) {
+        int i   = table.permutation[cellX[lane]];
+        int j   = table.permutation[cellX[lane] + 1];
+        int b00 = table.permutation[i + cellY[lane]];
+        int b10 = table.permutation[j + cellY[lane]];
+        int b01 = table.permutation[i + cellY[lane] + 1];
+        int b11 = table.permutation[j + cellY[lane] + 1];
+
+        gradients[0][lane] = table.gradientX[b00];
+        gradients[1][lane] = table.gradientY[b00];
+        gradients[2][lane] = table.gradientX[b10];
+        gradients[3][lane] = table.gradientY[b10];
+        gradients[4][lane] = table.gradientX[b01];
+        gradients[5][lane] = table.gradientY[b01];
+        gradients[6][lane] = table.gradientX[b11];
+        gradients[7][lane] = table.gradientY[b11];
+    }
+
+    __m128 rx0 = _mm_sub_ps(x, floorX);
+    __m128 ry0 = _mm_sub_ps(y, floorY);
+    __m128 rx1 = _mm_sub_ps(rx0, _mm_set1_ps(1.0f));
+    __m128 ry1 = _mm_sub_ps(ry0, _mm_set1_ps(1.0f));
+    __m128 sx  = fade4(rx0);
+    __m128 sy  = fade4(ry0);
+
+    __m128 u = dot4(rx0, ry0, gradients[0], gradients[1]);
+    __m128 v = dot4(rx1, ry0, gradients[2], gradients[3]);
+    __m128 a = _mm_add_ps(u, _mm_mul_ps(sx, _mm_sub_ps(v, u)));
+    u        = dot4(rx0, ry1, gradients[4], gradients[5]);
+    v        = dot4(rx1, ry1, gradients[6], gradients[7]);
+    __m128 b = _mm_add_ps(u, _mm_mul_ps(sx, _mm_sub_ps(v, u)));
+    return _mm_add_ps(a, _mm_mul_ps(sy, _mm_sub_ps(b, a)));
+}
+#endif
+} // namespace
+
+const char* swgTerrainKernels::getInstructionSet()
+{
+#if defined(SWG_SIMD_AVX2)
+    return "AVX2";
+#elif defined(SWG_SIMD_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+void swgTerrainKernels::computeNormals(const float* heights,
+                                       unsigned int numRows,
+                                       unsigned int numColumns,
+                                       float        spacing,
+                                       float*       normals)
+{
+    for (unsigned int row = 0; row < numRows; ++row) {
+        unsigned int col = 0;
+
+#ifdef SWG_SIMD_SSE2
+        if (3 <= numColumns) {
+            unsigned int up   = std::min(row + 1, numRows - 1);
+            unsigned int down = (0 < row) ? row - 1 : 0;
+
+            const float* center = heights + row * numColumns;
+            const float* above  = heights + up * numColumns;
+            const float* below  = heights + down * numColumns;
+            float*       out    = normals + 3 * (row * numColumns);
+
+            // The first and last column take one sided differences.
+            computeNormalsScalar(heights, numRows, numColumns, spacing, row, 0, 1, normals);
+
+            col               = 1;
+            unsigned int last = numColumns - 1;
+
+#ifdef SWG_SIMD_AVX2
+            {
+                const __m256 dxScale = _mm256_set1_ps(2.0f * spacing);
+                const __m256 dyScale = _mm256_set1_ps((up - down) * spacing);
+                const __m256 one     = _mm256_set1_ps(1.0f);
+                const __m256 negate  = _mm256_set1_ps(-0.0f);
+
+                for (; col + 8 <= last; col += 8) {
+                    __m256 dx = _mm256_div_ps(
+                        _mm256_sub_ps(_mm256_loadu_ps(center + col + 1),
+                                      _mm256_loadu_ps(center + col - 1)),
+                        dxScale);
+                    __m256 dy = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(above + col),
+                                                            _mm256_loadu_ps(below + col)),
+                                              dyScale);
+
+                    __m256 length = _mm256_sqrt_ps(_mm256_add_ps(
+                        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), one));
+                    __m256 inverse = _mm256_div_ps(one, length);
+
+                    alignas(32) float x[8];
+                    alignas(32) float y[8];
+                    alignas(32) float z[8];
+                    _mm256_store_ps(x, _mm256_xor_ps(_mm256_mul_ps(dx, inverse), negate));
+                    _mm256_store_ps(y, _mm256_xor_ps(_mm256_mul_ps(dy, inverse), negate));
+                    _mm256_store_ps(z, inverse);
+
+                    for (unsigned int i = 0; i < 8; ++i) {
+                        out[3 * (col + i)]     = x[i];
+                        out[3 * (col + i) + 1] = y[i];
+                        out[3 * (col + i) + 2] = z[i];
+                    }
+                }
+            }
+#endif
+
+            {
+                const __m128 dxScale = _mm_set1_ps(2.0f * spacing);
+                const __m128 dyScale = _mm_set1_ps((up - down) * spacing);
+                const __m128 one     = _mm_set1_ps(1.0f);
+                const __m128 negate  = _mm_set1_ps(-0.0f);
+
+                for (; col + 4 <= last; col += 4) {
+                    __m128 dx = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(center + col + 1),
+                                                      _mm_loadu_ps(center + col - 1)),
+                                           dxScale);
+                    __m128 dy = _mm_div_ps(
+                        _mm_sub_ps(_mm_loadu_ps(above + col), _mm_loadu_ps(below + col)),
+                        dyScale);
+
+                    __m128 length = _mm_sqrt_ps(
+                        _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), one));
+                    __m128 inverse = _mm_div_ps(one, length);
+
+                    alignas(16) float x[4];
+                    alignas(16) float y[4];
+                    alignas(16) float z[4];
+                    _mm_store_ps(x, _mm_xor_ps(_mm_mul_ps(dx, inverse), negate));
+                    _mm_store_ps(y, _mm_xor_ps(_mm_mul_ps(dy, inverse), negate));
+                    _mm_store_ps(z, inverse);
+
+                    for (unsigned int i = 0; i < 4; ++i) {
+                        out[3 * (col + i)]     = x[i];
+                        out[3 * (col + i) + 1] = y[i];
+                        out[3 * (col + i) + 2] = z[i];
+                    }
+                }
+            }
+        }
+#endif
+
+        computeNormalsScalar(heights, numRows, numColumns, spacing, row, col, numColumns,
+                             normals);
+    }
+}
+
+void swgTerrainKernels::computeNormalsScalar(const float* heights,
+                                             unsigned int numRows,
+                                             unsigned int numColumns,
+                                             float        spacing,
+                                             unsigned int row,
+                                             unsigned int firstColumn,
+                                             unsigned int lastColumn,
+                                             float*       normals)
+{
+    unsigned int up   = std::min(row + 1, numRows - 1);
+    unsigned int down = (0 < row) ? row - 1 : 0;
+
+    for (unsigned int col = firstColumn; col < lastColumn; ++col) {
+        unsigned int right = std::min(col + 1, numColumns - 1);
+        unsigned int left  = (0 < col) ? col - 1 : 0;
+
+        float dx = (heights[row * numColumns + right] - heights[row * numColumns + left])
+                   / ((right - left) * spacing);
+        float dy = (heights[up * numColumns + col] - heights[down * numColumns + col])
+                   / ((up - down) * spacing);
+
+        float inverse = 1.0f / std::sqrt(dx * dx + dy * dy + 1.0f);
+
+        float* out = normals + 3 * (row * numColumns + col);
+        out[0]     = -(dx * inverse);
+        out[1]     = -(dy * inverse);
+        out[2]     = inverse;
+    }
+}
+
+void swgTerrainKernels::floatToHalf(const float* in, unsigned short* out, std::size_t count)
+{
+    std::size_t i = 0;
+
+#if defined(SWG_SIMD_F16C)
+    for (; i + 8 <= count; i += 8) {
+        __m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), halves);
+    }
+#elif defined(SWG_SIMD_SSE2)
+    for (; i + 8 <= count; i += 8) {
+        __m128i halves = packUnsigned(floatToHalf4(_mm_loadu_ps(in + i)),
+                                      floatToHalf4(_mm_loadu_ps(in + i + 4)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), halves);
+    }
+#endif
+
+    floatToHalfScalar(in + i, out + i, count - i);
+}
+
+void swgTerrainKernels::halfToFloat(const unsigned short* in, float* out, std::size_t count)
+{
+    std::size_t i = 0;
+
+#if defined(SWG_SIMD_F16C)
+    for (; i + 8 <= count; i += 8) {
+        __m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(halves));
+    }
+#elif defined(SWG_SIMD_SSE2)
+    for (; i + 8 <= count; i += 8) {
+        __m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_ps(out + i, halfToFloat4(_mm_unpacklo_epi16(halves, _mm_setzero_si128())));
+        _mm_storeu_ps(out + i + 4,
+                      halfToFloat4(_mm_unpackhi_epi16(halves, _mm_setzero_si128())));
+    }
+#endif
+
+    halfToFloatScalar(in + i, out + i, count - i);
+}
+
+void swgTerrainKernels::floatToHalfScalar(const float* in, unsigned short* out, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        unsigned int bits = floatBits(in[i]);
+
+        unsigned int sign     = (bits >> 16) & 0x8000;
+        int          exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+        unsigned int mantissa = bits & 0x7fffff;
+
+        if (0xff == ((bits >> 23) & 0xff)) {
+            // Infinity stays infinity, NaN stays a quiet NaN.
+            out[i] = sign | 0x7c00 | ((0 != mantissa) ? 0x200 : 0);
+        }
+        else if (31 <= exponent) {
+            out[i] = sign | 0x7c00;
+        }
+        else if (0 >= exponent) {
+            // Denormal or zero in half precision.
+            if (-10 > exponent) {
+                out[i] = sign;
+                continue;
+            }
+
+            mantissa |= 0x800000;
+            unsigned int shift     = 14 - exponent;
+            unsigned int half      = mantissa >> shift;
+            unsigned int remainder = mantissa & ((1u << shift) - 1);
+            unsigned int halfway   = 1u << (shift - 1);
+            if (remainder > halfway || (remainder == halfway && 0 != (half & 1))) {
+                ++half;
+            }
+            out[i] = sign | half;
+        }
+        else {
+            // A carry out of the mantissa correctly bumps the exponent.
+            unsigned int half      = (exponent << 10) | (mantissa >> 13);
+            unsigned int remainder = mantissa & 0x1fff;
+            if (0x1000 < remainder || (0x1000 == remainder && 0 != (half & 1))) {
+                ++half;
+            }
+            out[i] = sign | half;
+        }
+    }
+}
+
+void swgTerrainKernels::halfToFloatScalar(const unsigned short* in, float* out, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        unsigned int sign     = (in[i] & 0x8000) << 16;
+        unsigned int exponent = (in[i] >> 10) & 0x1f;
+        unsigned int mantissa = in[i] & 0x3ff;
+        unsigned int bits     = sign;
+
+        if (31 == exponent) {
+            bits |= 0x7f800000 | (mantissa << 13);
+        }
+        else if (0 != exponent) {
+            bits |= ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        }
+        else if (0 != mantissa) {
+            // Normalize the denormal.
+            exponent = 127 - 15 + 1;
+            while (0 == (mantissa & 0x400)) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits |= (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+
+        memcpy(&out[i], &bits, sizeof(bits));
+    }
+}
+
+void swgTerrainKernels::getRange(const float* in,
+                                 std::size_t  count,
+                                 float&       minimum,
+                                 float&       maximum)
+{
+    std::size_t i = 0;
+    getRangeScalar(in, std::min<std::size_t>(count, 1), minimum, maximum);
+
+#ifdef SWG_SIMD_SSE2
+    if (8 <= count) {
+        __m128 low  = _mm_set1_ps(minimum);
+        __m128 high = low;
+
+        // Two accumulators each to hide the latency of min and max.
+        __m128 low2  = low;
+        __m128 high2 = low;
+        for (; i + 8 <= count; i += 8) {
+            __m128 a = _mm_loadu_ps(in + i);
+            __m128 b = _mm_loadu_ps(in + i + 4);
+            low      = _mm_min_ps(low, a);
+            high     = _mm_max_ps(high, a);
+            low2     = _mm_min_ps(low2, b);
+            high2    = _mm_max_ps(high2, b);
+        }
+
+        alignas(16) float lows[4];
+        alignas(16) float highs[4];
+        _mm_store_ps(lows, _mm_min_ps(low, low2));
+        _mm_store_ps(highs, _mm_max_ps(high, high2));
+        for (unsigned int j = 0; j < 4; ++j) {
+            minimum = std::min(minimum, lows[j]);
+            maximum = std::max(maximum, highs[j]);
+        }
+    }
+#endif
+
+    if (i < count) {
+        float low;
+        float high;
+        getRangeScalar(in + i, count - i, low, high);
+        minimum = std::min(minimum, low);
+        maximum = std::max(maximum, high);
+    }
+}
+
+void swgTerrainKernels::getRangeScalar(const float* in,
+                                       std::size_t  count,
+                                       float&       minimum,
+                                       float&       maximum)
+{
+    minimum = maximum = (0 < count) ? in[0] : 0.0f;
+    for (std::size_t i = 1; i < count; ++i) {
+        minimum = std::min(minimum, in[i]);
+        maximum = std::max(maximum, in[i]);
+    }
+}
+
+void swgTerrainKernels::quantize(const float*    in,
+                                 unsigned short* out,
+                                 std::size_t     count,
+                                 float           minimum,
+                                 float           scale)
+{
+    std::size_t i = 0;
+
+#ifdef SWG_SIMD_SSE2
+    if (0.0f < scale) {
+        const __m128 base  = _mm_set1_ps(minimum);
+        const __m128 step  = _mm_set1_ps(scale);
+        const __m128 half  = _mm_set1_ps(0.5f);
+        const __m128 zero  = _mm_setzero_ps();
+        const __m128 limit = _mm_set1_ps(65535.0f);
+
+        // Truncating is flooring once the value is clamped at zero.
+        for (; i + 8 <= count; i += 8) {
+            __m128 a = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(in + i), base), step);
+            __m128 b = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(in + i + 4), base), step);
+            a        = _mm_min_ps(_mm_max_ps(_mm_add_ps(a, half), zero), limit);
+            b        = _mm_min_ps(_mm_max_ps(_mm_add_ps(b, half), zero), limit);
+
+            __m128i steps = packUnsigned(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), steps);
+        }
+    }
+#endif
+
+    quantizeScalar(in + i, out + i, count - i, minimum, scale);
+}
+
+void swgTerrainKernels::quantizeScalar(const float*    in,
+                                       unsigned short* out,
+                                       std::size_t     count,
+                                       float           minimum,
+                                       float           scale)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        float step = (0.0f < scale) ? (in[i] - minimum) / scale : 0.0f;
+        out[i] = (unsigned short)std::min(65535.0f, std::max(0.0f, std::floor(step + 0.5f)));
+    }
+}
+
+void swgTerrainKernels::dequantize(const unsigned short* in,
+                                   float*                out,
+                                   std::size_t           count,
+                                   float                 minimum,
+                                   float                 scale)
+{
+    std::size_t i = 0;
+
+#if defined(SWG_SIMD_AVX2)
+    {
+        const __m256 base = _mm256_set1_ps(minimum);
+        const __m256 step = _mm256_set1_ps(scale);
+        for (; i + 8 <= count; i += 8) {
+            __m128i steps = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            __m256  value = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(steps));
+            _mm256_storeu_ps(out + i, _mm256_add_ps(base, _mm256_mul_ps(value, step)));
+        }
+    }
+#elif defined(SWG_SIMD_SSE2)
+    {
+        const __m128 base = _mm_set1_ps(minimum);
+        const __m128 step = _mm_set1_ps(scale);
+        for (; i + 8 <= count; i += 8) {
+            __m128i steps = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            __m128  low   = _mm_cvtepi32_ps(_mm_unpacklo_epi16(steps, _mm_setzero_si128()));
+            __m128  high  = _mm_cvtepi32_ps(_mm_unpackhi_epi16(steps, _mm_setzero_si128()));
+            _mm_storeu_ps(out + i, _mm_add_ps(base, _mm_mul_ps(low, step)));
+            _mm_storeu_ps(out + i + 4, _mm_add_ps(base, _mm_mul_ps(high, step)));
+        }
+    }
+#endif
+
+    dequantizeScalar(in + i, out + i, count - i, minimum, scale);
+}
+
+void swgTerrainKernels::dequantizeScalar(const unsigned short* in,
+                                         float*                out,
+                                         std::size_t           count,
+                                         float                 minimum,
+                                         float                 scale)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        out[i] = minimum + in[i] * scale;
+    }
+}
+
+void swgTerrainKernels::setNoiseSeed(fractalSettings& settings, unsigned int seed)
+{
+    // Any fixed generator will do, the lattice only has to follow the seed.
+    unsigned int state = seed;
+    auto         next  = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return state;
+    };
+
+    noiseTable& table = settings.noise;
+    for (unsigned int i = 0; i < 256; ++i) {
+        table.permutation[i] = i;
+    }
+    for (unsigned int i = 255; i > 0; --i) {
+        std::swap(table.permutation[i], table.permutation[(next() >> 8) % (i + 1)]);
+    }
+    for (unsigned int i = 0; i < 256; ++i) {
+        table.permutation[i + 256] = table.permutation[i];
+
+        float angle        = (next() >> 8) * (6.2831853f / 16777216.0f);
+        table.gradientX[i] = std::cos(angle);
+        table.gradientY[i] = std::sin(angle);
+    }
+}
+
+void swgTerrainKernels::fractal(const fractalSettings& settings,
+                                float                  originX,
+                                float                  spacingX,
+                                float                  y,
+                                std::size_t            count,
+                                float*                 out)
+{
+    std::size_t i = 0;
+
+    const bool  crest      = isCrest(settings.combination);
+    const bool  turbulence = isTurbulence(settings.combination);
+    const bool  clamp      = 3 < settings.combination && (crest || turbulence);
+    const float scale      = getOctaveScale(settings);
+    const float rowY       = y * settings.frequencyY + settings.offsetY;
+
+#if defined(SWG_SIMD_AVX2)
+    {
+        const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+        const __m256 one   = _mm256_set1_ps(1.0f);
+        const __m256 sign  = _mm256_set1_ps(-0.0f);
+        for (; i + 8 <= count; i += 8) {
+            __m256 index = _mm256_add_ps(_mm256_set1_ps((float)i), lanes);
+            __m256 x     = _mm256_add_ps(_mm256_set1_ps(originX),
+                                     _mm256_mul_ps(index, _mm256_set1_ps(spacingX)));
+            __m256 cx    = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(settings.frequencyX)),
+                                      _mm256_set1_ps(settings.offsetX));
+            __m256 cy    = _mm256_set1_ps(rowY);
+            __m256 sum   = _mm256_setzero_ps();
+
+            float amplitude = 1.0f;
+            for (unsigned int octave = 0; octave < settings.numOctaves; ++octave) {
+                __m256 n = noise8(settings.noise, cx, cy);
+                if (crest) {
+                    n = _mm256_sub_ps(one, _mm256_andnot_ps(sign, n));
+                } else if (turbulence) {
+                    n = _mm256_andnot_ps(sign, n);
+                }
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(n, _mm256_set1_ps(amplitude)));
+                cx  = _mm256_mul_ps(cx, _mm256_set1_ps(settings.octaveFrequency));
+                cy  = _mm256_mul_ps(cy, _mm256_set1_ps(settings.octaveFrequency));
+                amplitude *= settings.octaveAmplitude;
+            }
+
+            __m256 value = _mm256_mul_ps(sum, _mm256_set1_ps(scale));
+            if (clamp) {
+                value = _mm256_min_ps(one, _mm256_max_ps(_mm256_setzero_ps(), value));
+            } else if (!crest && !turbulence) {
+                value = _mm256_mul_ps(_mm256_add_ps(value, one), _mm256_set1_ps(0.5f));
+            }
+            _mm256_storeu_ps(out + i, value);
+        }
+    }
+#elif defined(SWG_SIMD_SSE2)
+    {
+        const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+        const __m128 one   = _mm_set1_ps(1.0f);
+        const __m128 sign  = _mm_set1_ps(-0.0f);
+        for (; i + 4 <= count; i += 4) {
+            __m128 index = _mm_add_ps(_mm_set1_ps((float)i), lanes);
+            __m128 x = _mm_add_ps(_mm_set1_ps(originX), _mm_mul_ps(index, _mm_set1_ps(spacingX)));
+            __m128 cx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(settings.frequencyX)),
+                                   _mm_set1_ps(settings.offsetX));
+            __m128 cy  = _mm_set1_ps(rowY);
+            __m128 sum = _mm_setzero_ps();
+
+            float amplitude = 1.0f;
+            for (unsigned int octave = 0; octave < settings.numOctaves; ++octave) {
+                __m128 n = noise4(settings.noise, cx, cy);
+                if (crest) {
+                    n = _mm_sub_ps(one, _mm_andnot_ps(sign, n));
+                } else if (turbulence) {
+                    n = _mm_andnot_ps(sign, n);
+                }
+                sum = _mm_add_ps(sum, _mm_mul_ps(n, _mm_set1_ps(amplitude)));
+                cx  = _mm_mul_ps(cx, _mm_set1_ps(settings.octaveFrequency));
+                cy  = _mm_mul_ps(cy, _mm_set1_ps(settings.octaveFrequency));
+                amplitude *= settings.octaveAmplitude;
+            }
+
+            __m128 value = _mm_mul_ps(sum, _mm_set1_ps(scale));
+            if (clamp) {
+                value = _mm_min_ps(one, _mm_max_ps(_mm_setzero_ps(), value));
+            } else if (!crest && !turbulence) {
+                value = _mm_mul_ps(_mm_add_ps(value, one), _mm_set1_ps(0.5f));
+            }
+            _mm_storeu_ps(out + i, value);
+        }
+    }
+#endif
+
+    fractalRange(settings, originX, spacingX, y, i, count, out);
+    applyBiasGain(settings, count, out);
+}
+
+void swgTerrainKernels::fractalScalar(const fractalSettings& settings,
+                                      float                  originX,
+                                      float                  spacingX,
+                                      float                  y,
+                                      std::size_t            count,
+                                      float*                 out)
+{
+    fractalRange(settings, originX, spacingX, y, 0, count, out);
+    applyBiasGain(settings, count, out);
+}
+
+void swgTerrainKernels::blendHeights(const float* values,
+                                     float        valueScale,
+                                     const float* weights,
+                                     std::size_t  count,
+                                     int          operation,
+                                     float*       heights)
+{
+    std::size_t i = 0;
+
+#if defined(SWG_SIMD_AVX2)
+    {
+        const __m256 scale = _mm256_set1_ps(valueScale);
+        for (; i + 8 <= count; i += 8) {
+            __m256 value =
+                (NULL != values) ? _mm256_mul_ps(_mm256_loadu_ps(values + i), scale) : scale;
+            __m256 weight = _mm256_loadu_ps(weights + i);
+            __m256 height = _mm256_loadu_ps(heights + i);
+            switch (operation) {
+            case heightAdd:
+                height = _mm256_add_ps(height, _mm256_mul_ps(value, weight));
+                break;
+            case heightSubtract:
+                height = _mm256_sub_ps(height, _mm256_mul_ps(value, weight));
+                break;
+            case heightMultiply:
+                height = _mm256_add_ps(
+                    height,
+                    _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(height, value), height), weight));
+                break;
+            case heightReplace:
+                height = _mm256_add_ps(height, _mm256_mul_ps(_mm256_sub_ps(value, height), weight));
+                break;
+            }
+            _mm256_storeu_ps(heights + i, height);
+        }
+    }
+#elif defined(SWG_SIMD_SSE2)
+    {
+        const __m128 scale = _mm_set1_ps(valueScale);
+        for (; i + 4 <= count; i += 4) {
+            __m128 value  = (NULL != values) ? _mm_mul_ps(_mm_loadu_ps(values + i), scale) : scale;
+            __m128 weight = _mm_loadu_ps(weights + i);
+            __m128 height = _mm_loadu_ps(heights + i);
+            switch (operation) {
+            case heightAdd:
+                height = _mm_add_ps(height, _mm_mul_ps(value, weight));
+                break;
+            case heightSubtract:
+                height = _mm_sub_ps(height, _mm_mul_ps(value, weight));
+                break;
+            case heightMultiply:
+                height = _mm_add_ps(
+                    height, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(height, value), height), weight));
+                break;
+            case heightReplace:
+                height = _mm_add_ps(height, _mm_mul_ps(_mm_sub_ps(value, height), weight));
+                break;
+            }
+            _mm_storeu_ps(heights + i, height);
+        }
+    }
+#endif
+
+    blendHeightsScalar((NULL != values) ? values + i : NULL,
+                       valueScale,
+                       weights + i,
+                       count - i,
+                       operation,
+                       heights + i);
+}
+
+void swgTerrainKernels::blendHeightsScalar(const float* values,
+                                           float        valueScale,
+                                           const float* weights,
+                                           std::size_t  count,
+                                           int          operation,
+                                           float*       heights)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        float value  = (NULL != values) ? values[i] * valueScale : valueScale;
+        float height = heights[i];
+        switch (operation) {
+        case heightAdd:
+            height = height + value * weights[i];
+            break;
+        case heightSubtract:
+            height = height - value * weights[i];
+            break;
+        case heightMultiply:
+            height = height + (height * value - height) * weights[i];
+            break;
+        case heightReplace:
+            height = height + (value - height) * weights[i];
+            break;
+        }
+        heights[i] = height;
+    }
+}
+
+void swgTerrainKernels::terrace(const float* weights,
+                                std::size_t  count,
+                                float        flatRatio,
+                                float        stepHeight,
+                                float*       heights)
+{
+    if (0.0f >= stepHeight) {
+        return;
+    }
+
+    std::size_t i         = 0;
+    const float rampScale = (1.0f > flatRatio) ? 1.0f / (1.0f - flatRatio) : 0.0f;
+
+#if defined(SWG_SIMD_AVX2)
+    {
+        const __m256 step = _mm256_set1_ps(stepHeight);
+        const __m256 flat = _mm256_set1_ps(flatRatio);
+        const __m256 ramp = _mm256_set1_ps(rampScale);
+        for (; i + 8 <= count; i += 8) {
+            __m256 height = _mm256_loadu_ps(heights + i);
+            __m256 base   = _mm256_mul_ps(_mm256_floor_ps(_mm256_div_ps(height, step)), step);
+            __m256 t      = _mm256_div_ps(_mm256_sub_ps(height, base), step);
+            __m256 above  = _mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(t, flat));
+            __m256 rise   = _mm256_mul_ps(above, ramp);
+            __m256 terraced = _mm256_add_ps(base, _mm256_mul_ps(rise, step));
+            height          = _mm256_add_ps(
+                height,
+                _mm256_mul_ps(_mm256_sub_ps(terraced, height), _mm256_loadu_ps(weights + i)));
+            _mm256_storeu_ps(heights + i, height);
+        }
+    }
+#elif defined(SWG_SIMD_SSE2)
+    {
+        const __m128 step = _mm_set1_ps(stepHeight);
+        const __m128 flat = _mm_set1_ps(flatRatio);
+        const __m128 ramp = _mm_set1_ps(rampScale);
+        for (; i + 4 <= count; i += 4) {
+            __m128 height   = _mm_loadu_ps(heights + i);
+            __m128 steps    = _mm_div_ps(height, step);
+
+            // floor4 needs values that fit an int, leave the rest to the
+            // scalar loop.
+            __m128 magnitude = _mm_andnot_ps(_mm_set1_ps(-0.0f), steps);
+            if (0 != _mm_movemask_ps(_mm_cmpnlt_ps(magnitude, _mm_set1_ps(2.0e9f)))) {
+                break;
+            }
+            __m128 base     = _mm_mul_ps(floor4(steps), step);
+            __m128 t        = _mm_div_ps(_mm_sub_ps(height, base), step);
+            __m128 rise     = _mm_mul_ps(_mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(t, flat)), ramp);
+            __m128 terraced = _mm_add_ps(base, _mm_mul_ps(rise, step));
+            height          = _mm_add_ps(
+                height, _mm_mul_ps(_mm_sub_ps(terraced, height), _mm_loadu_ps(weights + i)));
+            _mm_storeu_ps(heights + i, height);
+        }
+    }
+#endif
+
+    terraceScalar(weights + i, count - i, flatRatio, stepHeight, heights + i);
+}
+
+void swgTerrainKernels::terraceScalar(const float* weights,
+                                      std::size_t  count,
+                                      float        flatRatio,
+                                      float        stepHeight,
+                                      float*       heights)
+{
+    if (0.0f >= stepHeight) {
+        return;
+    }
+
+    const float rampScale = (1.0f > flatRatio) ? 1.0f / (1.0f - flatRatio) : 0.0f;
+    for (std::size_t i = 0; i < count; ++i) {
+        float height   = heights[i];
+        float base     = std::floor(height / stepHeight) * stepHeight;
+        float t        = (height - base) / stepHeight;
+        float rise     = std::max(0.0f, t - flatRatio) * rampScale;
+        float terraced = base + rise * stepHeight;
+        heights[i]     = height + (terraced - height) * weights[i];
+    }
+}
+
+bool swgTerrainKernels::check(std::ostream& out)
+{
+    bool passed = true;
+
+    // Odd sizes so every kernel runs its scalar tail as well.
+    const unsigned int numRows    = 61;
+    const unsigned int numColumns = 77;
+    const unsigned int numSamples = numRows * numColumns;
+
+    std::vector<float> heights;
+    fillHeights(heights, numRows, numColumns);
+
+    {
+        std::vector<float> expected(3 * numSamples);
+        std::vector<float> result(3 * numSamples);
+        for (unsigned int row = 0; row < numRows; ++row) {
+            computeNormalsScalar(
+                &heights[0], numRows, numColumns, 7.5f, row, 0, numColumns, &expected[0]);
+        }
+        computeNormals(&heights[0], numRows, numColumns, 7.5f, &result[0]);
+
+        float maxError = 0.0f;
+        for (unsigned int i = 0; i < expected.size(); ++i) {
+            maxError = std::max(maxError, std::fabs(expected[i] - result[i]));
+        }
+        bool ok = 1.0e-6f >= maxError;
+        out << "Normals: " << (ok ? "ok" : "FAILED") << ", largest error " << maxError
+            << std::endl;
+        passed = passed && ok;
+    }
+
+    {
+        // Every half value, including denormals, infinities and NaNs.
+        std::vector<unsigned short> halves(65536);
+        for (unsigned int i = 0; i < halves.size(); ++i) {
+            halves[i] = (unsigned short)i;
+        }
+
+        std::vector<float> expected(halves.size());
+        std::vector<float> result(halves.size());
+        halfToFloatScalar(&halves[0], &expected[0], halves.size());
+        halfToFloat(&halves[0], &result[0], halves.size());
+
+        // NaN payloads may be quieted differently by conversion hardware.
+        unsigned int numWrong = 0;
+        for (unsigned int i = 0; i < halves.size(); ++i) {
+            unsigned int a = floatBits(expected[i]);
+            unsigned int b = floatBits(result[i]);
+            if (a != b && !(isNaNBits(a) && isNaNBits(b))) {
+                ++numWrong;
+            }
+        }
+        out << "Half to float: " << (0 == numWrong ? "ok" : "FAILED") << ", " << numWrong
+            << " of " << halves.size() << " wrong" << std::endl;
+        passed = passed && 0 == numWrong;
+
+        // Every finite half, the ties halfway between neighbours and random
+        // bit patterns.
+        std::vector<float> values;
+        for (unsigned int i = 0; i < 0x7c00; ++i) {
+            values.push_back(expected[i]);
+            values.push_back(-expected[i]);
+            if (i + 1 < 0x7c00) {
+                values.push_back((expected[i] + expected[i + 1]) * 0.5f);
+            }
+        }
+        unsigned int state = 6789;
+        for (unsigned int i = 0; i < 65536; ++i) {
+            unsigned int bits = nextRandom(state);
+            float        value;
+            memcpy(&value, &bits, sizeof(value));
+            values.push_back(value);
+        }
+
+        std::vector<unsigned short> expectedHalves(values.size());
+        std::vector<unsigned short> resultHalves(values.size());
+        floatToHalfScalar(&values[0], &expectedHalves[0], values.size());
+        floatToHalf(&values[0], &resultHalves[0], values.size());
+
+        numWrong = 0;
+        for (unsigned int i = 0; i < values.size(); ++i) {
+            unsigned short a = expectedHalves[i];
+            unsigned short b = resultHalves[i];
+            if (a != b && !(isHalfNaN(a) && isHalfNaN(b))) {
+                ++numWrong;
+            }
+        }
+        out << "Float to half: " << (0 == numWrong ? "ok" : "FAILED") << ", " << numWrong
+            << " of " << values.size() << " wrong" << std::endl;
+        passed = passed && 0 == numWrong;
+    }
+
+    {
+        float expectedMin;
+        float expectedMax;
+        float minimum;
+        float maximum;
+        getRangeScalar(&heights[0], numSamples, expectedMin, expectedMax);
+        getRange(&heights[0], numSamples, minimum, maximum);
+
+        float scale = (expectedMax - expectedMin) / 65535.0f;
+
+        std::vector<unsigned short> expected(numSamples);
+        std::vector<unsigned short> result(numSamples);
+        quantizeScalar(&heights[0], &expected[0], numSamples, expectedMin, scale);
+        quantize(&heights[0], &result[0], numSamples, expectedMin, scale);
+
+        std::vector<float> expectedHeights(numSamples);
+        std::vector<float> resultHeights(numSamples);
+        dequantizeScalar(&expected[0], &expectedHeights[0], numSamples, expectedMin, scale);
+        dequantize(&expected[0], &resultHeights[0], numSamples, expectedMin, scale);
+
+        float maxError = 0.0f;
+        for (unsigned int i = 0; i < numSamples; ++i) {
+            float error = std::fabs(expectedHeights[i] - resultHeights[i]);
+            maxError    = std::max(maxError, error / std::max(1.0f, std::fabs(expectedHeights[i])));
+        }
+
+        bool rangeOk    = expectedMin == minimum && expectedMax == maximum;
+        bool quantizeOk = expected == result;
+        bool ok         = rangeOk && quantizeOk && 1.0e-6f >= maxError;
+        out << "Quantization: " << (ok ? "ok" : "FAILED") << ", range "
+            << (rangeOk ? "matches" : "differs") << ", steps "
+            << (quantizeOk ? "match" : "differ") << ", largest relative error " << maxError
+            << std::endl;
+        passed = passed && ok;
+    }
+
+    {
+        // Every combination rule, on rows crossing zero so negative lattice
+        // cells are covered.
+        std::vector<float> expected(numColumns);
+        std::vector<float> result(numColumns);
+
+        float maxError = 0.0f;
+        for (int combination = 0; combination <= 5; ++combination) {
+            fractalSettings settings = makeTestFractal(combination);
+            for (unsigned int row = 0; row < numRows; ++row) {
+                float y = (row - numRows / 2.0f) * 13.0f;
+                fractalScalar(settings, -400.0f, 11.0f, y, numColumns, &expected[0]);
+                fractal(settings, -400.0f, 11.0f, y, numColumns, &result[0]);
+                for (unsigned int i = 0; i < numColumns; ++i) {
+                    maxError = std::max(maxError, std::fabs(expected[i] - result[i]));
+                }
+            }
+        }
+        bool ok = 1.0e-5f >= maxError;
+        out << "Fractal: " << (ok ? "ok" : "FAILED") << ", largest error " << maxError
+            << std::endl;
+        passed = passed && ok;
+    }
+
+    {
+        std::vector<float> values(numSamples);
+        std::vector<float> weights(numSamples);
+        unsigned int       state = 4321;
+        for (unsigned int i = 0; i < numSamples; ++i) {
+            values[i]  = (nextRandom(state) >> 8) / 16777216.0f;
+            weights[i] = (0 == i % 7) ? 0.0f : (nextRandom(state) >> 8) / 16777216.0f;
+        }
+
+        float maxError = 0.0f;
+        for (int operation = heightAdd; operation <= heightReplace; ++operation) {
+            for (unsigned int constant = 0; constant < 2; ++constant) {
+                const float* source   = constant ? NULL : &values[0];
+                std::vector<float> expected = heights;
+                std::vector<float> result   = heights;
+                blendHeightsScalar(source, 50.0f, &weights[0], numSamples, operation, &expected[0]);
+                blendHeights(source, 50.0f, &weights[0], numSamples, operation, &result[0]);
+                for (unsigned int i = 0; i < numSamples; ++i) {
+                    float error = std::fabs(expected[i] - result[i]);
+                    error       = error / std::max(1.0f, std::fabs(expected[i]));
+                    maxError    = std::max(maxError, error);
+                }
+            }
+        }
+
+        std::vector<float> expected = heights;
+        std::vector<float> result   = heights;
+        terraceScalar(&weights[0], numSamples, 0.3f, 8.0f, &expected[0]);
+        terrace(&weights[0], numSamples, 0.3f, 8.0f, &result[0]);
+        for (unsigned int i = 0; i < numSamples; ++i) {
+            float error = std::fabs(expected[i] - result[i]);
+            maxError    = std::max(maxError, error / std::max(1.0f, std::fabs(expected[i])));
+        }
+
+        bool ok = 1.0e-6f >= maxError;
+        out << "Height affectors: " << (ok ? "ok" : "FAILED") << ", largest relative error "
+            << maxError << std::endl;
+        passed = passed && ok;
+    }
+
+    return passed;
+}
+
+void swgTerrainKernels::benchmark(std::ostream& out, unsigned int numSamples)
+{
+    unsigned int numColumns = std::max(3u, (unsigned int)std::sqrt((double)numSamples));
+    unsigned int numRows    = std::max(3u, numSamples / numColumns);
+    numSamples              = numRows * numColumns;
+
+    std::vector<float> heights;
+    fillHeights(heights, numRows, numColumns);
+
+    std::vector<float>          normals(3 * numSamples);
+    std::vector<float>          decoded(numSamples);
+    std::vector<unsigned short> packed(numSamples);
+    std::vector<float>          noise(numSamples);
+    std::vector<float>          weights(numSamples, 0.75f);
+    std::vector<float>          blended(heights);
+
+    fractalSettings settings = makeTestFractal(0);
+
+    float minimum;
+    float maximum;
+    getRangeScalar(&heights[0], numSamples, minimum, maximum);
+    float scale = (maximum - minimum) / 65535.0f;
+
+    const unsigned int numRepeats = 10;
+
+    struct timing {
+        const char* name;
+        double      scalar;
+        double      vector;
+    };
+    std::vector<timing> timings;
+
+    // Runs each variant numRepeats times and keeps the best time.
+    auto measure = [&](const char* name, std::function<void()> scalar,
+                       std::function<void()> vector) {
+        timing result = {name, 1.0e30, 1.0e30};
+        for (unsigned int i = 0; i < numRepeats; ++i) {
+            auto start    = std::chrono::steady_clock::now();
+            scalar();
+            result.scalar = std::min(result.scalar, getSeconds(start));
+
+            start         = std::chrono::steady_clock::now();
+            vector();
+            result.vector = std::min(result.vector, getSeconds(start));
+        }
+        timings.push_back(result);
+    };
+
+    measure(
+        "Normals",
+        [&]() {
+            for (unsigned int row = 0; row < numRows; ++row) {
+                computeNormalsScalar(
+                    &heights[0], numRows, numColumns, 7.5f, row, 0, numColumns, &normals[0]);
+            }
+        },
+        [&]() { computeNormals(&heights[0], numRows, numColumns, 7.5f, &normals[0]); });
+    measure(
+        "Float to half",
+        [&]() { floatToHalfScalar(&heights[0], &packed[0], numSamples); },
+        [&]() { floatToHalf(&heights[0], &packed[0], numSamples); });
+    measure(
+        "Half to float",
+        [&]() { halfToFloatScalar(&packed[0], &decoded[0], numSamples); },
+        [&]() { halfToFloat(&packed[0], &decoded[0], numSamples); });
+    measure(
+        "Height range",
+        [&]() { getRangeScalar(&heights[0], numSamples, minimum, maximum); },
+        [&]() { getRange(&heights[0], numSamples, minimum, maximum); });
+    measure(
+        "Quantize",
+        [&]() { quantizeScalar(&heights[0], &packed[0], numSamples, minimum, scale); },
+        [&]() { quantize(&heights[0], &packed[0], numSamples, minimum, scale); });
+    measure(
+        "Dequantize",
+        [&]() { dequantizeScalar(&packed[0], &decoded[0], numSamples, minimum, scale); },
+        [&]() { dequantize(&packed[0], &decoded[0], numSamples, minimum, scale); });
+    measure(
+        "Fractal",
+        [&]() {
+            for (unsigned int row = 0; row < numRows; ++row) {
+                fractalScalar(
+                    settings, 0.0f, 2.0f, row * 2.0f, numColumns, &noise[row * numColumns]);
+            }
+        },
+        [&]() {
+            for (unsigned int row = 0; row < numRows; ++row) {
+                fractal(settings, 0.0f, 2.0f, row * 2.0f, numColumns, &noise[row * numColumns]);
+            }
+        });
+    measure(
+        "Blend heights",
+        [&]() {
+            blendHeightsScalar(
+                &noise[0], 40.0f, &weights[0], numSamples, heightReplace, &blended[0]);
+        },
+        [&]() {
+            blendHeights(&noise[0], 40.0f, &weights[0], numSamples, heightReplace, &blended[0]);
+        });
+    measure(
+        "Terrace",
+        [&]() { terraceScalar(&weights[0], numSamples, 0.3f, 8.0f, &blended[0]); },
+        [&]() { terrace(&weights[0], numSamples, 0.3f, 8.0f, &blended[0]); });
+
+    out << "Terrain kernels on " << numSamples << " samples, " << getInstructionSet()
+        << " build:" << std::endl;
+    for (unsigned int i = 0; i < timings.size(); ++i) {
+        out << "  " << timings[i].name << ": scalar " << (numSamples / timings[i].scalar / 1.0e6)
+            << " M/s, vector " << (numSamples / timings[i].vector / 1.0e6) << " M/s, "
+            << (timings[i].scalar / timings[i].vector) << "x" << std::endl;
+    }
+}
@@ -0,0 +1,193 @@
+/** -*-c++-*-
+ *  \file   swgTerrainKernels.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <cstddef>
+#include <iostream>
+
+#ifndef SWGTERRAINKERNELS_HPP
+#define SWGTERRAINKERNELS_HPP
+
+/**
+ * Per sample work on terrain height grids, evaluated several samples at a
+ * time with the widest instruction set the build targets. Every kernel has
+ * a scalar reference the vector paths are checked against. Conversions
+ * match it bit for bit, arithmetic to within rounding since the compiler
+ * may fuse the scalar multiply adds.
+ */
+class swgTerrainKernels {
+public:
+    // Name of the widest instruction set the kernels were built for.
+    static const char* getInstructionSet();
+
+    /**
+     * Write numRows by numColumns unit normals as x, y, z triples to
+     * normals, from central differences of heights spaced spacing apart.
+     * Differences along the grid edges are one sided.
+     */
+    static void computeNormals(const float* heights,
+                               unsigned int numRows,
+                               unsigned int numColumns,
+                               float        spacing,
+                               float*       normals);
+
+    // IEEE half floats, rounded to nearest even.
+    static void floatToHalf(const float* in, unsigned short* out, std::size_t count);
+    static void halfToFloat(const unsigned short* in, float* out, std::size_t count);
+
+    static void getRange(const float* in, std::size_t count, float& minimum, float& maximum);
+
+    // Round (in - minimum) / scale to the nearest step, zero when scale is.
+    static void quantize(const float*    in,
+                         unsigned short* out,
+                         std::size_t     count,
+                         float           minimum,
+                         float           scale);
+    static void dequantize(const unsigned short* in,
+                           float*                out,
+                           std::size_t           count,
+                           float                 minimum,
+                           float                 scale);
+
+    // Gradient noise lattice, a permutation of 0 to 255 repeated once and a
+    // unit gradient per entry.
+    struct noiseTable {
+        int   permutation[512];
+        float gradientX[256];
+        float gradientY[256];
+    };
+
+    // Multifractal settings as stored in the MFRC forms of a TRN file.
+    struct fractalSettings {
+        unsigned int numOctaves;
+
+        // Frequency and amplitude factors from one octave to the next.
+        float octaveFrequency;
+        float octaveAmplitude;
+
+        float frequencyX;
+        float frequencyY;
+        float offsetX;
+        float offsetY;
+
+        // 0 and 1 add octaves, 2 adds crests, 3 adds turbulence, 4 and 5
+        // are crests and turbulence clamped to [0, 1].
+        int combination;
+
+        bool  useBias;
+        float bias;
+        bool  useGain;
+        float gain;
+
+        noiseTable noise;
+    };
+
+    // Fill the noise lattice of settings from seed.
+    static void setNoiseSeed(fractalSettings& settings, unsigned int seed);
+
+    /**
+     * Write count fractal values, roughly in [0, 1], sampled at
+     * originX + i * spacingX along the row at y.
+     */
+    static void fractal(const fractalSettings& settings,
+                        float                  originX,
+                        float                  spacingX,
+                        float                  y,
+                        std::size_t            count,
+                        float*                 out);
+
+    // Height affector operations, as stored in AHCN and AHFR.
+    enum heightOperation { heightAdd = 0, heightSubtract, heightMultiply, heightReplace };
+
+    /**
+     * Blend values times valueScale into heights by weights: add or subtract
+     * value * weight, scale by 1 + (value - 1) * weight or move towards
+     * value by weight. values may be NULL for a constant valueScale.
+     */
+    static void blendHeights(const float* values,
+                             float        valueScale,
+                             const float* weights,
+                             std::size_t  count,
+                             int          operation,
+                             float*       heights);
+
+    /**
+     * Cut heights into terraces stepHeight high, flat for flatRatio of each
+     * step and rising linearly over the rest, blended in by weights.
+     */
+    static void terrace(const float* weights,
+                        std::size_t  count,
+                        float        flatRatio,
+                        float        stepHeight,
+                        float*       heights);
+
+    // Compare every kernel against its scalar reference on generated data.
+    static bool check(std::ostream& out);
+
+    // Time every kernel and its scalar reference on numSamples samples.
+    static void benchmark(std::ostream& out, unsigned int numSamples);
+
+protected:
+    static void computeNormalsScalar(const float* heights,
+                                     unsigned int numRows,
+                                     unsigned int numColumns,
+                                     float        spacing,
+                                     unsigned int row,
+                                     unsigned int firstColumn,
+                                     unsigned int lastColumn,
+                                     float*       normals);
+
+    static void floatToHalfScalar(const float* in, unsigned short* out, std::size_t count);
+    static void halfToFloatScalar(const unsigned short* in, float* out, std::size_t count);
+    static void getRangeScalar(const float* in, std::size_t count, float& minimum, float& maximum);
+    static void quantizeScalar(const float*    in,
+                               unsigned short* out,
+                               std::size_t     count,
+                               float           minimum,
+                               float           scale);
+    static void dequantizeScalar(const unsigned short* in,
+                                 float*                out,
+                                 std::size_t           count,
+                                 float                 minimum,
+                                 float                 scale);
+    static void fractalScalar(const fractalSettings& settings,
+                              float                  originX,
+                              float                  spacingX,
+                              float                  y,
+                              std::size_t            count,
+                              float*                 out);
+    static void blendHeightsScalar(const float* values,
+                                   float        valueScale,
+                                   const float* weights,
+                                   std::size_t  count,
+                                   int          operation,
+                                   float*       heights);
+    static void terraceScalar(const float* weights,
+                              std::size_t  count,
+                              float        flatRatio,
+                              float        stepHeight,
+                              float*       heights);
+};
+
+#endif
@@ -0,0 +1,1308 @@
+/** -*-c++-*-
+ *  \file   swgTerrainLayers.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgTerrainLayers.hpp"
+#include "swgIFFReader.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+/**
+ * Enter FORM tag, its version form and read the IHDR item header. Leaves
+ * iff inside the version form.
+ */
+bool enterItem(swgIFFReader& iff, const std::string& tag, bool& enabled, std::string& name)
+{
+    enabled = true;
+    if (!iff.enterForm(tag) || !iff.enterForm(iff.peek())) {
+        return false;
+    }
+
+    if (iff.isForm() && "IHDR" == iff.peek()) {
+        iff.enterForm("IHDR");
+        iff.enterForm(iff.peek());
+        iff.enterChunk("DATA");
+        enabled = 0 != iff.readInt32();
+        name    = iff.readString();
+        iff.exit();
+        iff.exit();
+        iff.exit();
+    }
+    return iff.isValid();
+}
+
+/**
+ * Step into the parameters of the item iff is in, a DATA or PARM chunk,
+ * possibly inside a DATA form. Returns the number of blocks entered, zero
+ * if there are no parameters.
+ */
+unsigned int enterParameters(swgIFFReader& iff)
+{
+    while (iff.isValid() && !iff.atEnd()) {
+        std::string tag = iff.peek();
+        if (iff.isForm()) {
+            if ("DATA" == tag) {
+                iff.enterForm(tag);
+                unsigned int depth = enterParameters(iff);
+                if (0 < depth) {
+                    return depth + 1;
+                }
+                iff.exit();
+                continue;
+            }
+        } else if ("DATA" == tag || "PARM" == tag) {
+            iff.enterChunk(tag);
+            return 1;
+        }
+        iff.skip();
+    }
+    return 0;
+}
+
+// Leave the parameters and the item entered with enterItem.
+void exitItem(swgIFFReader& iff, unsigned int depth)
+{
+    for (unsigned int i = 0; i < depth + 2; ++i) {
+        iff.exit();
+    }
+}
+
+// floraKind of a flora affector tag, -1 for other tags.
+int getFloraKind(const std::string& tag)
+{
+    static const char* const floraTags[] = {"AFSC", "AFSN", "AFDN", "AFDF"};
+    for (unsigned int i = 0; i < sizeof(floraTags) / sizeof(floraTags[0]); ++i) {
+        if (tag == floraTags[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Edge shaping of boundaries and filters: linear, squared, square root or
+// smooth step.
+float feather(int featherType, float value)
+{
+    switch (featherType) {
+    case 1:
+        return value * value;
+    case 2:
+        return std::sqrt(value);
+    case 3:
+        return value * value * (3.0f - 2.0f * value);
+    default:
+        return value;
+    }
+}
+
+// One inside (low, high), fading to zero over featherAmount of half the
+// range at either end.
+float getRangeWeight(float value, float low, float high, float featherAmount)
+{
+    if (value <= low || value >= high) {
+        return 0.0f;
+    }
+
+    float featherRange = (high - low) * 0.5f * featherAmount;
+    if (value < low + featherRange) {
+        return (value - low) / featherRange;
+    }
+    if (value > high - featherRange) {
+        return (high - value) / featherRange;
+    }
+    return 1.0f;
+}
+
+// Apply a height style operation to one color channel.
+float blendChannel(int operation, float current, float value, float weight)
+{
+    switch (operation) {
+    case swgTerrainKernels::heightAdd:
+        return current + value * weight;
+    case swgTerrainKernels::heightSubtract:
+        return current - value * weight;
+    case swgTerrainKernels::heightMultiply:
+        return current + (current * value - current) * weight;
+    default:
+        return current + (value - current) * weight;
+    }
+}
+
+// Ramp entry for t in [0, 1], NULL if the ramp was not read.
+const float* getRampColor(const std::vector<float>& ramp, float t)
+{
+    if (256 * 3 > ramp.size()) {
+        return NULL;
+    }
+    int entry = (int)(std::min(1.0f, std::max(0.0f, t)) * 255.0f + 0.5f);
+    return &ramp[3 * entry];
+}
+
+float getSegmentDistance(float x, float y, float x0, float y0, float x1, float y1)
+{
+    float dx     = x1 - x0;
+    float dy     = y1 - y0;
+    float length = dx * dx + dy * dy;
+    float t      = (0.0f < length) ? ((x - x0) * dx + (y - y0) * dy) / length : 0.0f;
+    t            = std::min(1.0f, std::max(0.0f, t));
+
+    float ex = x0 + t * dx - x;
+    float ey = y0 + t * dy - y;
+    return std::sqrt(ex * ex + ey * ey);
+}
+
+// Distance to the nearest edge of a polyline, closing it for polygons.
+float getEdgeDistance(const std::vector<float>& xs,
+                      const std::vector<float>& ys,
+                      bool                      closed,
+                      float                     x,
+                      float                     y)
+{
+    float        distance = 1.0e30f;
+    unsigned int count    = xs.size();
+    for (unsigned int i = 0; i + 1 < count + (closed ? 1 : 0); ++i) {
+        unsigned int j = (i + 1) % count;
+        distance       = std::min(distance, getSegmentDistance(x, y, xs[i], ys[i], xs[j], ys[j]));
+    }
+    return distance;
+}
+
+bool isInsidePolygon(const std::vector<float>& xs, const std::vector<float>& ys, float x, float y)
+{
+    bool         inside = false;
+    unsigned int count  = xs.size();
+    for (unsigned int i = 0, j = count - 1; i < count; j = i++) {
+        if ((ys[i] > y) != (ys[j] > y)
+            && x < (xs[j] - xs[i]) * (y - ys[i]) / (ys[j] - ys[i]) + xs[i]) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+} // namespace
+
+swgTerrainLayers::swgTerrainLayers(const std::string& trnData)
+    : valid(false)
+{
+    for (unsigned int i = 0; i < numFloraKinds; ++i) {
+        floraTiles[i].tileSize   = 0.0f;
+        floraTiles[i].tileBorder = 0.0f;
+        floraTiles[i].seed       = 0;
+    }
+
+    // Flora affectors refer to the families by id, so read them first.
+    swgIFFReader floraIff(trnData);
+    readFlora(floraIff);
+
+    swgIFFReader iff(trnData);
+    valid = read(iff);
+
+    for (unsigned int i = 0; i < layers.size(); ++i) {
+        checkLayer(layers[i]);
+    }
+}
+
+swgTerrainLayers::~swgTerrainLayers() {}
+
+bool swgTerrainLayers::affector::affectsHeight() const
+{
+    // Everything but color, shader, flora, environment and exclusion
+    // affectors is assumed to move the ground.
+    static const char* const otherTags[] = {"ACCN",
+                                            "ACRH",
+                                            "ACRF",
+                                            "ASCN",
+                                            "ASRP",
+                                            "AFSC",
+                                            "AFSN",
+                                            "AFDN",
+                                            "AFDF",
+                                            "AENV",
+                                            "AEXC"};
+    for (unsigned int i = 0; i < sizeof(otherTags) / sizeof(otherTags[0]); ++i) {
+        if (tag == otherTags[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool swgTerrainLayers::affector::affectsColor() const
+{
+    return "ASCN" == tag || "ASRP" == tag || "ACCN" == tag || "ACRH" == tag || "ACRF" == tag;
+}
+
+void swgTerrainLayers::readFlora(swgIFFReader& iff)
+{
+    // The terrain settings come before the TGEN form holding the families.
+    if (!iff.enterForm("PTAT") || !iff.enterForm(iff.peek())) {
+        return;
+    }
+    while (iff.isValid() && !iff.atEnd() && !(iff.isForm() && "TGEN" == iff.peek())) {
+        if (!iff.isForm() && "DATA" == iff.peek()) {
+            readFloraSettings(iff);
+        } else {
+            iff.skip();
+        }
+    }
+    if (!iff.enterForm("TGEN") || !iff.enterForm(iff.peek())) {
+        return;
+    }
+
+    while (iff.isValid() && !iff.atEnd()) {
+        std::string tag = iff.isForm() ? iff.peek() : std::string();
+        if ("FGRP" == tag || "RGRP" == tag) {
+            readFloraFamilies(iff, "RGRP" == tag);
+        } else {
+            iff.skip();
+        }
+    }
+
+    // A family list cut short is of no use, the affectors would place
+    // whichever families happen to come first.
+    if (!iff.isValid()) {
+        floraFamilies.clear();
+        radialFamilies.clear();
+    }
+}
+
+void swgTerrainLayers::readFloraSettings(swgIFFReader& iff)
+{
+    // Name, map width, chunk width, tiles per chunk, global water table
+    // use, height, shader size and shader, environment cycle time, then
+    // for each kind of flora its minimum and maximum distance, tile size,
+    // tile border and seed.
+    iff.enterChunk("DATA");
+
+    // Older layouts are shorter, and reading past their end would end
+    // the flora pass.
+    const unsigned int minSize = 2 + 7 * 4 + numFloraKinds * 5 * 4;
+    if (minSize > iff.getRemaining()) {
+        iff.exit();
+        return;
+    }
+
+    iff.readString();
+    for (unsigned int i = 0; i < 6; ++i) {
+        iff.readUInt32();
+    }
+    iff.readString();
+    iff.readFloat();
+
+    floraSettings settings[numFloraKinds];
+    for (unsigned int i = 0; i < numFloraKinds; ++i) {
+        iff.readFloat();
+        iff.readFloat();
+        settings[i].tileSize   = iff.readFloat();
+        settings[i].tileBorder = iff.readFloat();
+        settings[i].seed       = iff.readUInt32();
+    }
+
+    for (unsigned int i = 0; i < numFloraKinds && iff.isValid(); ++i) {
+        if (0.0f < settings[i].tileSize && 1.0e4f > settings[i].tileSize) {
+            floraTiles[i] = settings[i];
+            floraTiles[i].tileBorder =
+                std::min(std::max(settings[i].tileBorder, 0.0f), settings[i].tileSize / 2.0f);
+        }
+    }
+    iff.exit();
+}
+
+void swgTerrainLayers::readFloraFamilies(swgIFFReader& iff, bool radial)
+{
+    std::string              tag      = radial ? "RFAM" : "FFAM";
+    std::vector<floraFamily>& families = radial ? radialFamilies : floraFamilies;
+
+    iff.enterForm(radial ? "RGRP" : "FGRP");
+    iff.enterForm(iff.peek());
+    while (iff.isValid() && !iff.atEnd()) {
+        if (iff.isForm() || tag != iff.peek()) {
+            iff.skip();
+            continue;
+        }
+
+        // Id, name, editor color and density. Static families have a flag
+        // more before the children.
+        iff.enterChunk(tag);
+        floraFamily family;
+        family.id   = iff.readInt32();
+        family.name = iff.readString();
+        for (unsigned int i = 0; i < 3; ++i) {
+            iff.readUInt8();
+        }
+        family.density = iff.readFloat();
+        if (!radial) {
+            iff.readInt32();
+        }
+
+        int count = iff.readInt32();
+        for (int i = 0; i < count && iff.isValid(); ++i) {
+            floraChild child;
+            child.name     = iff.readString();
+            child.weight   = iff.readFloat();
+            child.minScale = child.maxScale = 1.0f;
+            child.minWidth = child.maxWidth = child.minHeight = child.maxHeight = 1.0f;
+
+            if (radial) {
+                // Distance, width and height ranges, keep aspect ratio,
+                // then sway flag, displacement and period.
+                iff.readFloat();
+                child.minWidth  = iff.readFloat();
+                child.maxWidth  = iff.readFloat();
+                child.minHeight = iff.readFloat();
+                child.maxHeight = iff.readFloat();
+                iff.readInt32();
+                iff.readInt32();
+                iff.readFloat();
+                iff.readFloat();
+            } else {
+                // Sway flag, displacement and period, align to terrain,
+                // then whether to scale and the scale range.
+                iff.readInt32();
+                iff.readFloat();
+                iff.readFloat();
+                iff.readInt32();
+                bool  scaled   = 0 != iff.readInt32();
+                float minScale = iff.readFloat();
+                float maxScale = iff.readFloat();
+                if (scaled) {
+                    child.minScale = minScale;
+                    child.maxScale = maxScale;
+                }
+            }
+            family.children.push_back(child);
+        }
+        iff.exit();
+
+        families.push_back(family);
+    }
+    iff.exit();
+    iff.exit();
+}
+
+bool swgTerrainLayers::read(swgIFFReader& iff)
+{
+    // PTAT/version holds the TGEN generator form next to the terrain
+    // settings.
+    if (!iff.enterForm("PTAT") || !iff.enterForm(iff.peek())) {
+        return false;
+    }
+    while (iff.isValid() && !iff.atEnd() && !(iff.isForm() && "TGEN" == iff.peek())) {
+        iff.skip();
+    }
+    if (!iff.enterForm("TGEN") || !iff.enterForm(iff.peek())) {
+        return false;
+    }
+
+    bool hasLayers = false;
+    while (iff.isValid() && !iff.atEnd()) {
+        std::string tag = iff.isForm() ? iff.peek() : std::string();
+        if ("SGRP" == tag) {
+            readShaderFamilies(iff);
+        } else if ("MGRP" == tag) {
+            readFractals(iff);
+        } else if ("LYRS" == tag) {
+            iff.enterForm("LYRS");
+            while (iff.isValid() && !iff.atEnd()) {
+                layer current;
+                if (iff.isForm() && "LAYR" == iff.peek() && readLayer(iff, current)) {
+                    if (current.enabled) {
+                        layers.push_back(current);
+                    }
+                } else {
+                    iff.skip();
+                }
+            }
+            iff.exit();
+            hasLayers = true;
+        } else {
+            iff.skip();
+        }
+    }
+
+    return hasLayers && iff.isValid();
+}
+
+void swgTerrainLayers::readShaderFamilies(swgIFFReader& iff)
+{
+    iff.enterForm("SGRP");
+    iff.enterForm(iff.peek());
+    while (iff.isValid() && !iff.atEnd()) {
+        if (iff.isForm() || "SFAM" != iff.peek()) {
+            iff.skip();
+            continue;
+        }
+
+        // Id, name, surface properties file, editor color, shader size,
+        // feather clamp, then the weighted shaders.
+        iff.enterChunk("SFAM");
+        shaderFamily family;
+        family.id   = iff.readInt32();
+        family.name = iff.readString();
+        iff.readString();
+        for (unsigned int i = 0; i < 3; ++i) {
+            family.color[i] = iff.readUInt8();
+        }
+        iff.readFloat();
+        iff.readFloat();
+
+        int count = iff.readInt32();
+        for (int i = 0; i < count && iff.isValid(); ++i) {
+            family.shaders.push_back(iff.readString());
+            family.weights.push_back(iff.readFloat());
+        }
+        iff.exit();
+
+        shaderFamilies.push_back(family);
+    }
+    iff.exit();
+    iff.exit();
+}
+
+void swgTerrainLayers::readFractals(swgIFFReader& iff)
+{
+    iff.enterForm("MGRP");
+    iff.enterForm(iff.peek());
+    while (iff.isValid() && !iff.atEnd()) {
+        if (!iff.isForm() || "MFAM" != iff.peek()) {
+            iff.skip();
+            continue;
+        }
+
+        iff.enterForm("MFAM");
+        iff.enterChunk("DATA");
+        int id = iff.readInt32();
+        iff.readString();
+        iff.exit();
+
+        // MFRC/version/DATA holds the settings.
+        iff.enterForm("MFRC");
+        iff.enterForm(iff.peek());
+        iff.enterChunk("DATA");
+
+        swgTerrainKernels::fractalSettings settings;
+        unsigned int                       seed = iff.readUInt32();
+        settings.useBias                        = 0 != iff.readInt32();
+        settings.bias                           = iff.readFloat();
+        settings.useGain                        = 0 != iff.readInt32();
+        settings.gain                           = iff.readFloat();
+        settings.numOctaves                     = std::min(16, std::max(0, iff.readInt32()));
+        settings.octaveFrequency                = iff.readFloat();
+        settings.octaveAmplitude                = iff.readFloat();
+        settings.frequencyX                     = iff.readFloat();
+        settings.frequencyY                     = iff.readFloat();
+        settings.offsetX                        = iff.readFloat();
+        settings.offsetY                        = iff.readFloat();
+        settings.combination                    = iff.readInt32();
+        swgTerrainKernels::setNoiseSeed(settings, seed);
+
+        iff.exit();
+        iff.exit();
+        iff.exit();
+        iff.exit();
+
+        fractalIds.push_back(id);
+        fractals.push_back(settings);
+    }
+    iff.exit();
+    iff.exit();
+}
+
+bool swgTerrainLayers::readLayer(swgIFFReader& iff, layer& result)
+{
+    result.invertBoundaries = false;
+    result.invertFilters    = false;
+    result.affectsHeight    = false;
+    result.affectsColor     = false;
+    result.affectsFlora     = false;
+    if (!enterItem(iff, "LAYR", result.enabled, result.name)) {
+        return false;
+    }
+
+    // Everything after the header and the ADTA flags is a child item, in
+    // file order.
+    while (iff.isValid() && !iff.atEnd()) {
+        if (!iff.isForm()) {
+            if ("ADTA" == iff.peek()) {
+                iff.enterChunk("ADTA");
+                result.invertBoundaries = 0 != iff.readInt32();
+                result.invertFilters    = 0 != iff.readInt32();
+                iff.exit();
+            } else {
+                iff.skip();
+            }
+            continue;
+        }
+
+        std::string tag = iff.peek();
+        if ("LAYR" == tag) {
+            layer child;
+            if (readLayer(iff, child) && child.enabled) {
+                result.children.push_back(child);
+            }
+        } else if ('B' == tag[0]) {
+            readBoundary(iff, result);
+        } else if ('F' == tag[0]) {
+            readFilter(iff, result);
+        } else if ('A' == tag[0]) {
+            readAffector(iff, result);
+        } else {
+            iff.skip();
+        }
+    }
+
+    iff.exit();
+    iff.exit();
+    return iff.isValid();
+}
+
+void swgTerrainLayers::readBoundary(swgIFFReader& iff, layer& parent)
+{
+    boundary    result;
+    bool        enabled;
+    std::string name;
+    result.tag = iff.peek();
+    if (!enterItem(iff, result.tag, enabled, name)) {
+        return;
+    }
+    unsigned int depth = enterParameters(iff);
+
+    result.supported     = true;
+    result.featherType   = 0;
+    result.featherAmount = 0.0f;
+    result.x0 = result.y0 = result.x1 = result.y1 = result.radius = result.lineWidth = 0.0f;
+
+    if (0 == depth) {
+        result.supported = false;
+    } else if ("BCIR" == result.tag) {
+        result.x0            = iff.readFloat();
+        result.y0            = iff.readFloat();
+        result.radius        = iff.readFloat();
+        result.featherType   = iff.readInt32();
+        result.featherAmount = iff.readFloat();
+        result.minX          = result.x0 - result.radius;
+        result.minY          = result.y0 - result.radius;
+        result.maxX          = result.x0 + result.radius;
+        result.maxY          = result.y0 + result.radius;
+    } else if ("BREC" == result.tag) {
+        float x0             = iff.readFloat();
+        float y0             = iff.readFloat();
+        float x1             = iff.readFloat();
+        float y1             = iff.readFloat();
+        result.featherType   = iff.readInt32();
+        result.featherAmount = iff.readFloat();
+        result.minX = result.x0 = std::min(x0, x1);
+        result.minY = result.y0 = std::min(y0, y1);
+        result.maxX = result.x1 = std::max(x0, x1);
+        result.maxY = result.y1 = std::max(y0, y1);
+    } else if ("BPOL" == result.tag || "BPLN" == result.tag) {
+        bool line = "BPLN" == result.tag;
+        if (line) {
+            result.featherType   = iff.readInt32();
+            result.featherAmount = iff.readFloat();
+        }
+
+        int count = iff.readInt32();
+        for (int i = 0; i < count && iff.isValid(); ++i) {
+            result.xs.push_back(iff.readFloat());
+            result.ys.push_back(iff.readFloat());
+        }
+
+        if (line) {
+            result.lineWidth = iff.readFloat();
+        } else {
+            result.featherType   = iff.readInt32();
+            result.featherAmount = iff.readFloat();
+        }
+
+        float margin = result.lineWidth * 0.5f;
+        result.minX  = result.minY = 1.0e30f;
+        result.maxX  = result.maxY = -1.0e30f;
+        for (unsigned int i = 0; i < result.xs.size(); ++i) {
+            result.minX = std::min(result.minX, result.xs[i] - margin);
+            result.minY = std::min(result.minY, result.ys[i] - margin);
+            result.maxX = std::max(result.maxX, result.xs[i] + margin);
+            result.maxY = std::max(result.maxY, result.ys[i] + margin);
+        }
+        result.supported = (line ? 2u : 3u) <= result.xs.size();
+    } else {
+        result.supported = false;
+    }
+
+    result.supported = result.supported && iff.isValid();
+    exitItem(iff, depth);
+    if (enabled) {
+        parent.boundaries.push_back(result);
+    }
+}
+
+void swgTerrainLayers::readFilter(swgIFFReader& iff, layer& parent)
+{
+    filter      result;
+    bool        enabled;
+    std::string name;
+    result.tag = iff.peek();
+    if (!enterItem(iff, result.tag, enabled, name)) {
+        return;
+    }
+    unsigned int depth = enterParameters(iff);
+
+    result.supported     = true;
+    result.featherType   = 0;
+    result.featherAmount = 0.0f;
+    result.low           = 0.0f;
+    result.high          = 0.0f;
+    result.fractal       = -1;
+    result.scale         = 1.0f;
+    result.family        = -1;
+
+    if (0 == depth) {
+        result.supported = false;
+    } else if ("FHGT" == result.tag) {
+        result.low           = iff.readFloat();
+        result.high          = iff.readFloat();
+        result.featherType   = iff.readInt32();
+        result.featherAmount = iff.readFloat();
+    } else if ("FFRA" == result.tag) {
+        result.fractal       = findFractal(iff.readInt32());
+        result.featherType   = iff.readInt32();
+        result.featherAmount = iff.readFloat();
+        result.low           = iff.readFloat();
+        result.high          = iff.readFloat();
+        result.scale         = iff.readFloat();
+        result.supported     = 0 <= result.fractal;
+    } else if ("FSLP" == result.tag) {
+        // Angles from the vertical in degrees.
+        result.low           = iff.readFloat();
+        result.high          = iff.readFloat();
+        result.featherType   = iff.readInt32();
+        result.featherAmount = iff.readFloat();
+    } else if ("FSHD" == result.tag) {
+        result.family        = findShaderFamily(iff.readInt32());
+        result.featherType   = iff.readInt32();
+        result.featherAmount = iff.readFloat();
+    } else {
+        result.supported = false;
+    }
+
+    result.supported = result.supported && iff.isValid();
+    exitItem(iff, depth);
+    if (enabled) {
+        parent.filters.push_back(result);
+    }
+}
+
+void swgTerrainLayers::readAffector(swgIFFReader& iff, layer& parent)
+{
+    affector    result;
+    bool        enabled;
+    std::string name;
+    result.tag = iff.peek();
+    if (!enterItem(iff, result.tag, enabled, name)) {
+        return;
+    }
+    unsigned int depth = enterParameters(iff);
+
+    result.supported       = true;
+    result.operation       = swgTerrainKernels::heightAdd;
+    result.height          = 0.0f;
+    result.flatRatio       = 0.0f;
+    result.fractal         = -1;
+    result.family          = -1;
+    result.replacement     = -1;
+    result.featherType     = 0;
+    result.featherAmount   = 0.0f;
+    result.low             = 0.0f;
+    result.high            = 0.0f;
+    result.ramp            = -1;
+    result.floraKind       = getFloraKind(result.tag);
+    result.removeAll       = false;
+    result.densityOverride = false;
+    result.density         = 0.0f;
+    std::fill(result.color, result.color + 3, 1.0f);
+
+    if (0 == depth) {
+        result.supported = false;
+    } else if ("AHCN" == result.tag) {
+        result.operation = iff.readInt32();
+        result.height    = iff.readFloat();
+    } else if ("AHFR" == result.tag) {
+        result.fractal   = findFractal(iff.readInt32());
+        result.operation = iff.readInt32();
+        result.height    = iff.readFloat();
+        result.supported = 0 <= result.fractal;
+    } else if ("AHTR" == result.tag) {
+        result.flatRatio = iff.readFloat();
+        result.height    = iff.readFloat();
+    } else if ("ASCN" == result.tag) {
+        result.family        = findShaderFamily(iff.readInt32());
+        result.featherType   = iff.readInt32();
+        result.featherAmount = iff.readFloat();
+        result.supported     = 0 <= result.family;
+    } else if ("ASRP" == result.tag) {
+        result.family        = findShaderFamily(iff.readInt32());
+        result.replacement   = findShaderFamily(iff.readInt32());
+        result.featherType   = iff.readInt32();
+        result.featherAmount = iff.readFloat();
+        result.supported     = 0 <= result.family && 0 <= result.replacement;
+    } else if ("ACCN" == result.tag) {
+        result.operation = iff.readInt32();
+        for (unsigned int i = 0; i < 3; ++i) {
+            result.color[i] = iff.readUInt8() / 255.0f;
+        }
+    } else if ("ACRH" == result.tag || "ACRF" == result.tag) {
+        if ("ACRF" == result.tag) {
+            result.fractal   = findFractal(iff.readInt32());
+            result.supported = 0 <= result.fractal;
+        }
+        result.operation = iff.readInt32();
+        if ("ACRH" == result.tag) {
+            result.low  = iff.readFloat();
+            result.high = iff.readFloat();
+        }
+
+        std::string ramp = iff.readString();
+        result.ramp = std::find(colorRamps.begin(), colorRamps.end(), ramp) - colorRamps.begin();
+        if ((int)colorRamps.size() == result.ramp) {
+            colorRamps.push_back(ramp);
+        }
+    } else if (result.affectsFlora()) {
+        // Family id, operation, whether to clear flora, whether to
+        // override the family density and the density to use.
+        bool radial            = floraRadialNear <= result.floraKind;
+        result.family          = findFloraFamily(iff.readInt32(), radial);
+        result.operation       = iff.readInt32();
+        result.removeAll       = 0 != iff.readInt32();
+        result.densityOverride = 0 != iff.readInt32();
+        result.density         = iff.readFloat();
+        result.supported       = result.removeAll || 0 <= result.family;
+    } else {
+        result.supported = false;
+    }
+
+    if ("AHCN" == result.tag || "AHFR" == result.tag) {
+        result.supported = result.supported && swgTerrainKernels::heightAdd <= result.operation
+                           && swgTerrainKernels::heightReplace >= result.operation;
+    }
+
+    result.supported = result.supported && iff.isValid();
+    exitItem(iff, depth);
+    if (enabled) {
+        parent.affectors.push_back(result);
+    }
+}
+
+int swgTerrainLayers::findFractal(int id) const
+{
+    for (unsigned int i = 0; i < fractalIds.size(); ++i) {
+        if (id == fractalIds[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int swgTerrainLayers::findShaderFamily(int id) const
+{
+    for (unsigned int i = 0; i < shaderFamilies.size(); ++i) {
+        if (id == shaderFamilies[i].id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int swgTerrainLayers::findFloraFamily(int id, bool radial) const
+{
+    const std::vector<floraFamily>& families = radial ? radialFamilies : floraFamilies;
+    for (unsigned int i = 0; i < families.size(); ++i) {
+        if (id == families[i].id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void swgTerrainLayers::checkLayer(layer& current)
+{
+    current.affectsHeight = false;
+    current.affectsColor  = false;
+    current.affectsFlora  = false;
+    for (unsigned int i = 0; i < current.affectors.size(); ++i) {
+        current.affectsHeight = current.affectsHeight || current.affectors[i].affectsHeight();
+        current.affectsColor  = current.affectsColor || current.affectors[i].affectsColor();
+        current.affectsFlora  = current.affectsFlora || current.affectors[i].affectsFlora();
+    }
+    for (unsigned int i = 0; i < current.children.size(); ++i) {
+        checkLayer(current.children[i]);
+        current.affectsHeight = current.affectsHeight || current.children[i].affectsHeight;
+        current.affectsColor  = current.affectsColor || current.children[i].affectsColor;
+        current.affectsFlora  = current.affectsFlora || current.children[i].affectsFlora;
+    }
+    if (!current.affectsHeight) {
+        return;
+    }
+
+    // Weights only matter for layers that change heights.
+    std::vector<std::string> tags;
+    for (unsigned int i = 0; i < current.boundaries.size(); ++i) {
+        if (!current.boundaries[i].supported) {
+            tags.push_back(current.boundaries[i].tag);
+        }
+    }
+    for (unsigned int i = 0; i < current.filters.size(); ++i) {
+        if (!current.filters[i].supported || current.filters[i].needsSurface()) {
+            tags.push_back(current.filters[i].tag);
+        }
+    }
+    for (unsigned int i = 0; i < current.affectors.size(); ++i) {
+        if (current.affectors[i].affectsHeight() && !current.affectors[i].supported) {
+            tags.push_back(current.affectors[i].tag);
+        }
+    }
+
+    for (unsigned int i = 0; i < tags.size(); ++i) {
+        if (unsupportedHeightItems.end()
+            == std::find(unsupportedHeightItems.begin(), unsupportedHeightItems.end(), tags[i])) {
+            unsupportedHeightItems.push_back(tags[i]);
+        }
+    }
+}
+
+float swgTerrainLayers::getBoundaryWeight(const boundary& area, float x, float y)
+{
+    if (x < area.minX || x > area.maxX || y < area.minY || y > area.maxY) {
+        return 0.0f;
+    }
+
+    if ("BCIR" == area.tag) {
+        float dx       = x - area.x0;
+        float dy       = y - area.y0;
+        float distance = dx * dx + dy * dy;
+        float inner    = area.radius * (1.0f - area.featherAmount);
+        if (distance > area.radius * area.radius) {
+            return 0.0f;
+        }
+        if (distance <= inner * inner) {
+            return 1.0f;
+        }
+        return (area.radius - std::sqrt(distance)) / (area.radius - inner);
+    }
+
+    if ("BREC" == area.tag) {
+        float width = std::min(area.x1 - area.x0, area.y1 - area.y0) * 0.5f * area.featherAmount;
+        float edge  = std::min(std::min(x - area.x0, area.x1 - x),
+                              std::min(y - area.y0, area.y1 - y));
+        return (0.0f < width) ? std::min(1.0f, edge / width) : 1.0f;
+    }
+
+    if ("BPOL" == area.tag) {
+        if (!isInsidePolygon(area.xs, area.ys, x, y)) {
+            return 0.0f;
+        }
+
+        // The feather amount of polygons is a distance.
+        if (0.0f >= area.featherAmount) {
+            return 1.0f;
+        }
+        return std::min(1.0f, getEdgeDistance(area.xs, area.ys, true, x, y) / area.featherAmount);
+    }
+
+    float halfWidth = area.lineWidth * 0.5f;
+    float distance  = getEdgeDistance(area.xs, area.ys, false, x, y);
+    float inner     = halfWidth * (1.0f - area.featherAmount);
+    if (distance > halfWidth) {
+        return 0.0f;
+    }
+    if (distance <= inner) {
+        return 1.0f;
+    }
+    return (halfWidth - distance) / (halfWidth - inner);
+}
+
+bool swgTerrainLayers::getWeights(const layer&              current,
+                                  const grid&               area,
+                                  const std::vector<float>& parentWeights,
+                                  const float*              heights,
+                                  const surface*            ground,
+                                  std::vector<float>&       weights) const
+{
+    const unsigned int numSamples = area.numRows * area.numColumns;
+    weights.assign(numSamples, current.boundaries.empty() ? 1.0f : 0.0f);
+
+    for (unsigned int b = 0; b < current.boundaries.size(); ++b) {
+        const boundary& edge = current.boundaries[b];
+        if (!edge.supported) {
+            continue;
+        }
+        for (unsigned int row = 0; row < area.numRows; ++row) {
+            float y = area.originY + row * area.spacingY;
+            if (y < edge.minY || y > edge.maxY) {
+                continue;
+            }
+            float* rowWeights = &weights[row * area.numColumns];
+            for (unsigned int col = 0; col < area.numColumns; ++col) {
+                float weight = getBoundaryWeight(edge, area.originX + col * area.spacingX, y);
+                if (0.0f < weight) {
+                    rowWeights[col] = std::max(rowWeights[col], feather(edge.featherType, weight));
+                }
+            }
+        }
+    }
+
+    if (current.invertBoundaries) {
+        for (unsigned int i = 0; i < numSamples; ++i) {
+            weights[i] = 1.0f - weights[i];
+        }
+    }
+
+    std::vector<float> values(area.numColumns);
+    for (unsigned int f = 0; f < current.filters.size(); ++f) {
+        const filter& limit = current.filters[f];
+        if (!limit.supported || (limit.needsSurface() && NULL == ground)) {
+            continue;
+        }
+
+        if ("FSHD" == limit.tag) {
+            float weight = feather(limit.featherType, 1.0f);
+            for (unsigned int i = 0; i < numSamples; ++i) {
+                weights[i] = (limit.family == ground->families[i]) ? std::min(weights[i], weight)
+                                                                    : 0.0f;
+            }
+            continue;
+        }
+
+        if ("FSLP" == limit.tag) {
+            const float toDegrees = 57.2957795f;
+            for (unsigned int i = 0; i < numSamples; ++i) {
+                float upward = std::min(1.0f, std::max(-1.0f, ground->normals[3 * i + 2]));
+                float angle  = std::acos(upward) * toDegrees;
+                float weight = getRangeWeight(angle, limit.low, limit.high, limit.featherAmount);
+                weights[i]   = std::min(weights[i], feather(limit.featherType, weight));
+            }
+            continue;
+        }
+
+        for (unsigned int row = 0; row < area.numRows; ++row) {
+            const float* source     = &heights[row * area.numColumns];
+            float*       rowWeights = &weights[row * area.numColumns];
+            if (0 <= limit.fractal) {
+                swgTerrainKernels::fractal(fractals[limit.fractal],
+                                           area.originX,
+                                           area.spacingX,
+                                           area.originY + row * area.spacingY,
+                                           area.numColumns,
+                                           &values[0]);
+                for (unsigned int col = 0; col < area.numColumns; ++col) {
+                    values[col] *= limit.scale;
+                }
+                source = &values[0];
+            }
+            for (unsigned int col = 0; col < area.numColumns; ++col) {
+                float weight =
+                    getRangeWeight(source[col], limit.low, limit.high, limit.featherAmount);
+                rowWeights[col] = std::min(rowWeights[col], feather(limit.featherType, weight));
+            }
+        }
+    }
+
+    bool any = false;
+    for (unsigned int i = 0; i < numSamples; ++i) {
+        float weight = current.invertFilters ? 1.0f - weights[i] : weights[i];
+        weights[i]   = weight * parentWeights[i];
+        any          = any || 0.0f != weights[i];
+    }
+    return any;
+}
+
+void swgTerrainLayers::applyLayerHeights(const layer&              current,
+                                         const grid&               area,
+                                         const std::vector<float>& parentWeights,
+                                         float*                    heights) const
+{
+    std::vector<float> weights;
+    if (!getWeights(current, area, parentWeights, heights, NULL, weights)) {
+        return;
+    }
+
+    const unsigned int numSamples = area.numRows * area.numColumns;
+    std::vector<float> values(area.numColumns);
+    for (unsigned int a = 0; a < current.affectors.size(); ++a) {
+        const affector& change = current.affectors[a];
+        if ("AHCN" == change.tag) {
+            swgTerrainKernels::blendHeights(
+                NULL, change.height, &weights[0], numSamples, change.operation, heights);
+        } else if ("AHFR" == change.tag) {
+            for (unsigned int row = 0; row < area.numRows; ++row) {
+                unsigned int first = row * area.numColumns;
+                swgTerrainKernels::fractal(fractals[change.fractal],
+                                           area.originX,
+                                           area.spacingX,
+                                           area.originY + row * area.spacingY,
+                                           area.numColumns,
+                                           &values[0]);
+                swgTerrainKernels::blendHeights(&values[0],
+                                                change.height,
+                                                &weights[first],
+                                                area.numColumns,
+                                                change.operation,
+                                                heights + first);
+            }
+        } else if ("AHTR" == change.tag) {
+            swgTerrainKernels::terrace(
+                &weights[0], numSamples, change.flatRatio, change.height, heights);
+        }
+    }
+
+    for (unsigned int i = 0; i < current.children.size(); ++i) {
+        if (current.children[i].affectsHeight) {
+            applyLayerHeights(current.children[i], area, weights, heights);
+        }
+    }
+}
+
+void swgTerrainLayers::applyHeights(float        originX,
+                                    float        originY,
+                                    float        spacingX,
+                                    float        spacingY,
+                                    unsigned int numRows,
+                                    unsigned int numColumns,
+                                    float*       data) const
+{
+    grid               area = {originX, originY, spacingX, spacingY, numRows, numColumns};
+    std::vector<float> weights(numRows * numColumns, 1.0f);
+    for (unsigned int i = 0; i < layers.size(); ++i) {
+        if (layers[i].affectsHeight) {
+            applyLayerHeights(layers[i], area, weights, data);
+        }
+    }
+}
+
+bool swgTerrainLayers::affectsSurface(const layer& current, const surface& ground)
+{
+    // Flora layers may filter on the shader families the color layers
+    // lay down, so those are walked for flora as well.
+    return current.affectsColor || (NULL != ground.flora && current.affectsFlora);
+}
+
+void swgTerrainLayers::applyFloraAffector(const affector&           change,
+                                          const std::vector<float>& weights,
+                                          unsigned int              numSamples,
+                                          surface&                  ground) const
+{
+    const std::vector<floraFamily>& families =
+        (floraRadialNear <= change.floraKind) ? radialFamilies : floraFamilies;
+
+    int*   flora     = ground.flora + change.floraKind * numSamples;
+    float* densities = ground.floraDensities + change.floraKind * numSamples;
+    for (unsigned int i = 0; i < numSamples; ++i) {
+        // One family per sample, so the layer covering more of it wins,
+        // thinning out toward its edges.
+        float weight = weights[i];
+        if (0.5f > weight) {
+            continue;
+        }
+
+        if (change.removeAll) {
+            flora[i]     = -1;
+            densities[i] = 0.0f;
+            continue;
+        }
+
+        float density = change.densityOverride ? change.density : families[change.family].density;
+        flora[i]      = change.family;
+        densities[i]  = std::max(density, 0.0f) * weight;
+    }
+}
+
+void swgTerrainLayers::applyLayerSurface(const layer&              current,
+                                         const grid&               area,
+                                         const std::vector<float>& parentWeights,
+                                         surface&                  ground) const
+{
+    std::vector<float> weights;
+    if (!getWeights(current, area, parentWeights, ground.heights, &ground, weights)) {
+        return;
+    }
+
+    const unsigned int numSamples = area.numRows * area.numColumns;
+    std::vector<float> values;
+    for (unsigned int a = 0; a < current.affectors.size(); ++a) {
+        const affector& change = current.affectors[a];
+        if (!change.supported) {
+            continue;
+        }
+
+        if (change.affectsFlora()) {
+            if (NULL != ground.flora) {
+                applyFloraAffector(change, weights, numSamples, ground);
+            }
+            continue;
+        }
+
+        // Without colors only the shader families matter, for the shader
+        // filters of flora layers.
+        bool shader = "ASCN" == change.tag || "ASRP" == change.tag;
+        if (!change.affectsColor() || (NULL == ground.colors && !shader)) {
+            continue;
+        }
+
+        // Fractal values of ACRF pick the ramp entry.
+        if ("ACRF" == change.tag) {
+            values.resize(numSamples);
+            for (unsigned int row = 0; row < area.numRows; ++row) {
+                swgTerrainKernels::fractal(fractals[change.fractal],
+                                           area.originX,
+                                           area.spacingX,
+                                           area.originY + row * area.spacingY,
+                                           area.numColumns,
+                                           &values[row * area.numColumns]);
+            }
+        }
+
+        const std::vector<float>& familyColors = *ground.familyColors;
+        for (unsigned int i = 0; i < numSamples; ++i) {
+            float weight = weights[i];
+            if (0.0f == weight) {
+                continue;
+            }
+
+            // Shader affectors lay down their family, or swap one family
+            // for another, the winner being whichever covers more.
+            if (shader) {
+                int family = ("ASCN" == change.tag) ? change.family : change.replacement;
+                if ("ASRP" == change.tag && change.family != ground.families[i]) {
+                    continue;
+                }
+
+                weight = feather(change.featherType, weight);
+                if (NULL != ground.colors && familyColors.size() >= 3 * (family + 1u)) {
+                    for (unsigned int c = 0; c < 3; ++c) {
+                        float& color = ground.colors[3 * i + c];
+                        color        = color + (familyColors[3 * family + c] - color) * weight;
+                    }
+                }
+                if (0.5f <= weight) {
+                    ground.families[i] = family;
+                }
+                continue;
+            }
+
+            const float* tint = change.color;
+            if (0 <= change.ramp) {
+                if (ground.ramps->size() <= (unsigned int)change.ramp) {
+                    continue;
+                }
+
+                const std::vector<float>& ramp = (*ground.ramps)[change.ramp];
+                if ("ACRH" == change.tag) {
+                    float range = change.high - change.low;
+                    float t = (0.0f != range) ? (ground.heights[i] - change.low) / range : 0.0f;
+                    tint    = getRampColor(ramp, t);
+                } else {
+                    tint = getRampColor(ramp, values[i]);
+                }
+            }
+            if (NULL == tint) {
+                continue;
+            }
+
+            for (unsigned int c = 0; c < 3; ++c) {
+                float& color = ground.tints[3 * i + c];
+                color        = blendChannel(change.operation, color, tint[c], weight);
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < current.children.size(); ++i) {
+        if (affectsSurface(current.children[i], ground)) {
+            applyLayerSurface(current.children[i], area, weights, ground);
+        }
+    }
+}
+
+void swgTerrainLayers::applyColors(float                                  originX,
+                                   float                                  originY,
+                                   float                                  spacingX,
+                                   float                                  spacingY,
+                                   unsigned int                           numRows,
+                                   unsigned int                           numColumns,
+                                   const float*                           heights,
+                                   const float*                           normals,
+                                   const std::vector<float>&              familyColors,
+                                   const std::vector<std::vector<float>>& ramps,
+                                   float*                                 colors) const
+{
+    const unsigned int numSamples = numRows * numColumns;
+    grid               area       = {originX, originY, spacingX, spacingY, numRows, numColumns};
+    std::vector<float> weights(numSamples, 1.0f);
+    std::vector<int>   families(numSamples, -1);
+    std::vector<float> tints(3 * numSamples, 1.0f);
+
+    surface ground = {
+        heights, normals, &familyColors, &ramps, &families[0], colors, &tints[0], NULL, NULL};
+    for (unsigned int i = 0; i < layers.size(); ++i) {
+        if (affectsSurface(layers[i], ground)) {
+            applyLayerSurface(layers[i], area, weights, ground);
+        }
+    }
+
+    for (unsigned int i = 0; i < 3 * numSamples; ++i) {
+        colors[i] = std::min(1.0f, std::max(0.0f, colors[i] * tints[i]));
+    }
+}
+
+void swgTerrainLayers::applyFlora(float        originX,
+                                  float        originY,
+                                  float        spacingX,
+                                  float        spacingY,
+                                  unsigned int numRows,
+                                  unsigned int numColumns,
+                                  const float* heights,
+                                  const float* normals,
+                                  int*         families,
+                                  float*       densities) const
+{
+    const unsigned int numSamples = numRows * numColumns;
+    grid               area       = {originX, originY, spacingX, spacingY, numRows, numColumns};
+    std::vector<float> weights(numSamples, 1.0f);
+    std::vector<int>   shaders(numSamples, -1);
+
+    std::vector<float>              familyColors;
+    std::vector<std::vector<float>> ramps;
+
+    std::fill(families, families + numFloraKinds * numSamples, -1);
+    std::fill(densities, densities + numFloraKinds * numSamples, 0.0f);
+
+    surface ground = {
+        heights, normals, &familyColors, &ramps, &shaders[0], NULL, NULL, families, densities};
+    for (unsigned int i = 0; i < layers.size(); ++i) {
+        if (affectsSurface(layers[i], ground)) {
+            applyLayerSurface(layers[i], area, weights, ground);
+        }
+    }
+}
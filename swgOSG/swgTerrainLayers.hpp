@@ -0,0 +1,372 @@
+/** -*-c++-*-
+ *  \file   swgTerrainLayers.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <string>
+#include <vector>
+
+#include "swgTerrainKernels.hpp"
+
+#ifndef SWGTERRAINLAYERS_HPP
+#define SWGTERRAINLAYERS_HPP
+
+class swgIFFReader;
+
+/**
+ * The layer tree of a TRN file, read straight from the file and evaluated
+ * over whole grids of samples at a time, into heights, ground colors or
+ * flora. Height affectors and fractals run through swgTerrainKernels.
+ *
+ * Every layer is weighted by the strongest of its boundaries, limited by
+ * its filters and by the weight of its parent. Items without an evaluator
+ * here are recorded, so callers can tell whether a result is complete.
+ */
+class swgTerrainLayers {
+public:
+    struct shaderFamily {
+        int         id;
+        std::string name;
+
+        // Color the family is shown with in the terrain editor.
+        unsigned char color[3];
+
+        // Shaders as named in the file and their relative weights.
+        std::vector<std::string> shaders;
+        std::vector<float>       weights;
+    };
+
+    struct floraChild {
+        // Appearance of static flora, shader of radial flora.
+        std::string name;
+        float       weight;
+
+        // Uniform scale range of static flora.
+        float minScale;
+        float maxScale;
+
+        // Size ranges in meters of radial flora.
+        float minWidth;
+        float maxWidth;
+        float minHeight;
+        float maxHeight;
+    };
+
+    struct floraFamily {
+        int         id;
+        std::string name;
+
+        // Chance of a placement per flora tile.
+        float                   density;
+        std::vector<floraChild> children;
+    };
+
+    // Kinds of flora affectors, in the order applyFlora writes them. Static
+    // kinds place flora families, radial kinds radial families.
+    enum floraKind {
+        floraCollidable = 0,
+        floraNonCollidable,
+        floraRadialNear,
+        floraRadialFar,
+        numFloraKinds
+    };
+
+    // Square tiles a kind of flora is scattered on, inset by tileBorder,
+    // and the seed of its placements. tileSize is 0 when the terrain
+    // settings could not be read.
+    struct floraSettings {
+        float        tileSize;
+        float        tileBorder;
+        unsigned int seed;
+    };
+
+    // Raised whenever a change here changes the heights applyHeights
+    // produces, so grids cached by older code are generated again.
+    static const unsigned int heightVersion = 1;
+
+    // trnData holds the bytes of a .trn file.
+    swgTerrainLayers(const std::string& trnData);
+    ~swgTerrainLayers();
+
+    bool isValid() const { return valid; }
+
+    // Tags of the enabled items that may change heights but have no
+    // evaluator here. Empty when applyHeights covers the whole file.
+    const std::vector<std::string>& getUnsupportedHeightItems() const
+    {
+        return unsupportedHeightItems;
+    }
+
+    /**
+     * Apply the height layers to data, numRows by numColumns in row major
+     * order, holding the starting heights of the samples at
+     * originX + column * spacingX, originY + row * spacingY. Safe to call
+     * from several threads at once.
+     */
+    void applyHeights(float        originX,
+                      float        originY,
+                      float        spacingX,
+                      float        spacingY,
+                      unsigned int numRows,
+                      unsigned int numColumns,
+                      float*       data) const;
+
+    const std::vector<shaderFamily>& getShaderFamilies() const { return shaderFamilies; }
+
+    // Color ramp images of the ACRH and ACRF affectors.
+    const std::vector<std::string>& getColorRamps() const { return colorRamps; }
+
+    /**
+     * Paint colors, RGB triples in [0, 1] for a grid of samples as in
+     * applyHeights, with the shader and color layers. heights and normals
+     * describe the finished ground, normals as x, y, z triples.
+     *
+     * Shader affectors blend in their family's entry of familyColors, an
+     * RGB triple per shader family. Color affectors then tint the result,
+     * ramps holding 256 RGB triples per color ramp, or none for a ramp
+     * that could not be read.
+     */
+    void applyColors(float                                  originX,
+                     float                                  originY,
+                     float                                  spacingX,
+                     float                                  spacingY,
+                     unsigned int                           numRows,
+                     unsigned int                           numColumns,
+                     const float*                           heights,
+                     const float*                           normals,
+                     const std::vector<float>&              familyColors,
+                     const std::vector<std::vector<float>>& ramps,
+                     float*                                 colors) const;
+
+    const std::vector<floraFamily>& getFloraFamilies() const { return floraFamilies; }
+    const std::vector<floraFamily>& getRadialFamilies() const { return radialFamilies; }
+
+    const floraSettings& getFloraSettings(unsigned int kind) const { return floraTiles[kind]; }
+
+    /**
+     * Find the flora of a grid of samples as in applyColors. For each kind
+     * in turn, families receives numRows by numColumns indices into the
+     * flora or radial families, -1 for none, and densities the chance of a
+     * placement per flora tile.
+     */
+    void applyFlora(float        originX,
+                    float        originY,
+                    float        spacingX,
+                    float        spacingY,
+                    unsigned int numRows,
+                    unsigned int numColumns,
+                    const float* heights,
+                    const float* normals,
+                    int*         families,
+                    float*       densities) const;
+
+protected:
+    struct grid {
+        float        originX;
+        float        originY;
+        float        spacingX;
+        float        spacingY;
+        unsigned int numRows;
+        unsigned int numColumns;
+    };
+
+    struct boundary {
+        // BCIR, BREC, BPOL or BPLN. Other boundaries are kept unsupported.
+        std::string tag;
+        bool        supported;
+        int         featherType;
+        float       featherAmount;
+
+        // Circle center and radius, rectangle corners.
+        float x0;
+        float y0;
+        float x1;
+        float y1;
+        float radius;
+
+        // Polygon and polyline vertices, polyline width.
+        std::vector<float> xs;
+        std::vector<float> ys;
+        float              lineWidth;
+
+        // Bounding box, nothing outside it is weighted.
+        float minX;
+        float minY;
+        float maxX;
+        float maxY;
+    };
+
+    struct filter {
+        // FHGT, FFRA, FSLP or FSHD. Other filters are kept unsupported.
+        std::string tag;
+        bool        supported;
+        int         featherType;
+        float       featherAmount;
+        float       low;
+        float       high;
+
+        // Index into fractals and the scale of its values.
+        int   fractal;
+        float scale;
+
+        // Index into shaderFamilies for FSHD.
+        int family;
+
+        // FSLP and FSHD need the finished ground.
+        bool needsSurface() const { return "FSLP" == tag || "FSHD" == tag; }
+    };
+
+    struct affector {
+        std::string tag;
+        bool        supported;
+
+        // Height change for AHCN and AHFR, step height for AHTR.
+        int   operation;
+        float height;
+        float flatRatio;
+        int   fractal;
+
+        // Shader family indices, source and replacement for ASRP, or the
+        // index among the flora or radial families for flora affectors.
+        int   family;
+        int   replacement;
+        int   featherType;
+        float featherAmount;
+
+        // Tint of ACCN, height range of ACRH and index into colorRamps.
+        float color[3];
+        float low;
+        float high;
+        int   ramp;
+
+        // floraKind of flora affectors, -1 for others. Flora affectors
+        // clear the flora instead with removeAll, and place it at density
+        // instead of the family's with densityOverride.
+        int   floraKind;
+        bool  removeAll;
+        bool  densityOverride;
+        float density;
+
+        bool affectsHeight() const;
+        bool affectsColor() const;
+        bool affectsFlora() const { return 0 <= floraKind; }
+    };
+
+    struct layer {
+        std::string           name;
+        bool                  enabled;
+        bool                  invertBoundaries;
+        bool                  invertFilters;
+        std::vector<boundary> boundaries;
+        std::vector<filter>   filters;
+        std::vector<affector> affectors;
+        std::vector<layer>    children;
+
+        // Whether the layer or any of its children change heights, colors
+        // or flora.
+        bool affectsHeight;
+        bool affectsColor;
+        bool affectsFlora;
+    };
+
+    // Per sample state of a color or flora evaluation. colors and tints
+    // are NULL when only flora is evaluated, flora and floraDensities when
+    // only colors are.
+    struct surface {
+        const float*                           heights;
+        const float*                           normals;
+        const std::vector<float>*              familyColors;
+        const std::vector<std::vector<float>>* ramps;
+        int*                                   families;
+        float*                                 colors;
+        float*                                 tints;
+        int*                                   flora;
+        float*                                 floraDensities;
+    };
+
+    bool read(swgIFFReader& iff);
+
+    // Flora families and settings, read in a pass of their own so a file
+    // they cannot be read from still gives heights and colors.
+    void readFlora(swgIFFReader& iff);
+    void readFloraSettings(swgIFFReader& iff);
+    void readFloraFamilies(swgIFFReader& iff, bool radial);
+
+    void readShaderFamilies(swgIFFReader& iff);
+    void readFractals(swgIFFReader& iff);
+    bool readLayer(swgIFFReader& iff, layer& result);
+    void readBoundary(swgIFFReader& iff, layer& parent);
+    void readFilter(swgIFFReader& iff, layer& parent);
+    void readAffector(swgIFFReader& iff, layer& parent);
+
+    // Index of the fractal or shader family with id, -1 if there is none.
+    int findFractal(int id) const;
+    int findShaderFamily(int id) const;
+    int findFloraFamily(int id, bool radial) const;
+
+    void checkLayer(layer& current);
+
+    /**
+     * Compute the weights of current over area into weights, from the
+     * heights so far and the parent weights. Slope and shader filters are
+     * only evaluated with a finished surface. Returns false if every weight
+     * is zero.
+     */
+    bool getWeights(const layer&              current,
+                    const grid&               area,
+                    const std::vector<float>& parentWeights,
+                    const float*              heights,
+                    const surface*            ground,
+                    std::vector<float>&       weights) const;
+
+    void applyLayerHeights(const layer&              current,
+                           const grid&               area,
+                           const std::vector<float>& parentWeights,
+                           float*                    heights) const;
+    void applyLayerSurface(const layer&              current,
+                           const grid&               area,
+                           const std::vector<float>& parentWeights,
+                           surface&                  ground) const;
+    void applyFloraAffector(const affector&           change,
+                            const std::vector<float>& weights,
+                            unsigned int              numSamples,
+                            surface&                  ground) const;
+
+    // Whether current changes what ground evaluates.
+    static bool affectsSurface(const layer& current, const surface& ground);
+
+    static float getBoundaryWeight(const boundary& area, float x, float y);
+
+    bool                                            valid;
+    std::vector<layer>                              layers;
+    std::vector<int>                                fractalIds;
+    std::vector<swgTerrainKernels::fractalSettings> fractals;
+    std::vector<shaderFamily>                       shaderFamilies;
+    std::vector<floraFamily>                        floraFamilies;
+    std::vector<floraFamily>                        radialFamilies;
+    floraSettings                                   floraTiles[numFloraKinds];
+    std::vector<std::string>                        colorRamps;
+    std::vector<std::string>                        unsupportedHeightItems;
+};
+
+#endif
@@ -0,0 +1,265 @@
+/** -*-c++-*-
+ *  \file   swgTerrainQuery.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgTerrainQuery.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+// Points per parallel chunk, enough to amortize the task overhead.
+const std::size_t pointsPerChunk = 16384;
+} // namespace
+
+swgTerrainQuery::swgTerrainQuery(std::shared_ptr<swgTerrainGenerator> generator,
+                                 swgThreadPool*                       threadPool,
+                                 float                                spacing,
+                                 unsigned int                         tileResolution)
+    : generator(generator)
+    , threadPool(threadPool)
+    , spacing(spacing)
+    , tileResolution(tileResolution)
+    , terrainSize(generator->getTerrainSize())
+    , terrainOrigin(-terrainSize / 2.0f)
+    , numTilesPerSide(0)
+    , maxTiles(4096)
+    , numActiveBatches(0)
+    , batchCounter(0)
+    , numResidentTiles(0)
+    , numQueries(0)
+    , numTilesGenerated(0)
+    , numTilesEvicted(0)
+{
+    float extent    = terrainSize / spacing;
+    numTilesPerSide = std::max(1u, (unsigned int)std::ceil(extent / tileResolution));
+
+    std::size_t numTiles = (std::size_t)numTilesPerSide * numTilesPerSide;
+    tiles.reset(new std::atomic<tile*>[numTiles]);
+    for (std::size_t i = 0; i < numTiles; ++i) {
+        tiles[i] = NULL;
+    }
+}
+
+swgTerrainQuery::~swgTerrainQuery()
+{
+    std::size_t numTiles = (std::size_t)numTilesPerSide * numTilesPerSide;
+    for (std::size_t i = 0; i < numTiles; ++i) {
+        delete tiles[i].load();
+    }
+}
+
+void swgTerrainQuery::heights(const float* xs, const float* ys, float* out, std::size_t n)
+{
+    query(xs, ys, out, NULL, n);
+}
+
+void swgTerrainQuery::normals(const float* xs, const float* ys, float* out, std::size_t n)
+{
+    query(xs, ys, NULL, out, n);
+}
+
+void swgTerrainQuery::query(const float* xs,
+                            const float* ys,
+                            float*       heightsOut,
+                            float*       normalsOut,
+                            std::size_t  n)
+{
+    unsigned long long batch;
+    {
+        std::unique_lock<std::mutex> lock(tilesMutex);
+        ++numActiveBatches;
+        batch = ++batchCounter;
+    }
+
+    if (NULL == threadPool || 2 * pointsPerChunk > n) {
+        queryRange(xs, ys, heightsOut, normalsOut, 0, n, batch);
+    }
+    else {
+        unsigned int numChunks = (unsigned int)((n + pointsPerChunk - 1) / pointsPerChunk);
+        threadPool->parallelFor(0, numChunks, [&](unsigned int chunk) {
+            std::size_t begin = chunk * pointsPerChunk;
+            std::size_t end   = std::min(n, begin + pointsPerChunk);
+            queryRange(xs, ys, heightsOut, normalsOut, begin, end, batch);
+        });
+    }
+
+    numQueries += n;
+
+    // Nobody holds a tile pointer once the last running batch is done.
+    std::unique_lock<std::mutex> lock(tilesMutex);
+    --numActiveBatches;
+    if (0 == numActiveBatches && numResidentTiles > maxTiles) {
+        evict();
+    }
+}
+
+void swgTerrainQuery::queryRange(const float*       xs,
+                                 const float*       ys,
+                                 float*             heightsOut,
+                                 float*             normalsOut,
+                                 std::size_t        begin,
+                                 std::size_t        end,
+                                 unsigned long long batch)
+{
+    unsigned int currentX = ~0u;
+    unsigned int currentY = ~0u;
+    const float* samples  = NULL;
+
+    const unsigned int rowLength = tileResolution + 1;
+    const float        extent    = terrainSize / spacing;
+
+    for (std::size_t i = begin; i < end; ++i) {
+        // Clamping this way round also maps NaN onto the terrain.
+        float fx = std::min(std::max(0.0f, (xs[i] - terrainOrigin) / spacing), extent);
+        float fy = std::min(std::max(0.0f, (ys[i] - terrainOrigin) / spacing), extent);
+
+        unsigned int column = (unsigned int)fx;
+        unsigned int row    = (unsigned int)fy;
+        unsigned int tileX  = std::min(column / tileResolution, numTilesPerSide - 1);
+        unsigned int tileY  = std::min(row / tileResolution, numTilesPerSide - 1);
+
+        // Tiles share their edge samples, so the far edge of the terrain
+        // is the last cell of the last tile.
+        column = std::min(column - tileX * tileResolution, tileResolution - 1);
+        row    = std::min(row - tileY * tileResolution, tileResolution - 1);
+
+        float u = fx - (float)(tileX * tileResolution + column);
+        float v = fy - (float)(tileY * tileResolution + row);
+
+        if (tileX != currentX || tileY != currentY) {
+            tile* current = getTile(tileX, tileY);
+
+            // Only write when it changes, tiles are shared between threads.
+            if (batch != current->lastBatch.load(std::memory_order_relaxed)) {
+                current->lastBatch.store(batch, std::memory_order_relaxed);
+            }
+
+            currentX = tileX;
+            currentY = tileY;
+            samples  = current->grid->getHeights();
+        }
+
+        const float* cell = samples + row * rowLength + column;
+        float        h00  = cell[0];
+        float        h10  = cell[1];
+        float        h01  = cell[rowLength];
+        float        h11  = cell[rowLength + 1];
+
+        // The tiles split each cell along the h00 to h11 diagonal, into a
+        // triangle below it where u >= v and one above it. Interpolating on
+        // the same triangles keeps queries on the drawn surface.
+        float slopeX, slopeY;
+        if (u >= v) {
+            slopeX = h10 - h00;
+            slopeY = h11 - h10;
+        }
+        else {
+            slopeX = h11 - h01;
+            slopeY = h01 - h00;
+        }
+
+        if (NULL != heightsOut) {
+            heightsOut[i] = h00 + slopeX * u + slopeY * v;
+        }
+
+        if (NULL != normalsOut) {
+            // Slope of the triangle holding the point.
+            float dx = slopeX / spacing;
+            float dy = slopeY / spacing;
+
+            float inverse = 1.0f / std::sqrt(dx * dx + dy * dy + 1.0f);
+
+            normalsOut[3 * i]     = -dx * inverse;
+            normalsOut[3 * i + 1] = -dy * inverse;
+            normalsOut[3 * i + 2] = inverse;
+        }
+    }
+}
+
+swgTerrainQuery::tile* swgTerrainQuery::getTile(unsigned int tileX, unsigned int tileY)
+{
+    std::atomic<tile*>& entry = tiles[(std::size_t)tileY * numTilesPerSide + tileX];
+
+    tile* found = entry.load(std::memory_order_acquire);
+    if (NULL == found) {
+        std::unique_lock<std::mutex> lock(tilesMutex);
+        found = entry.load(std::memory_order_relaxed);
+        if (NULL == found) {
+            found            = new tile;
+            found->lastBatch = 0;
+            entry.store(found, std::memory_order_release);
+            ++numResidentTiles;
+        }
+    }
+
+    // Other threads wanting the same tile wait here rather than generating
+    // it a second time.
+    std::call_once(found->generated, [&]() {
+        float tileSize = tileResolution * spacing;
+        found->grid    = generator->getGrid(terrainOrigin + tileX * tileSize,
+                                         terrainOrigin + tileY * tileSize,
+                                         spacing,
+                                         spacing,
+                                         tileResolution + 1,
+                                         tileResolution + 1);
+        ++numTilesGenerated;
+    });
+
+    return found;
+}
+
+void swgTerrainQuery::evict()
+{
+    std::size_t numTiles = (std::size_t)numTilesPerSide * numTilesPerSide;
+
+    std::vector<std::pair<unsigned long long, std::size_t>> uses;
+    uses.reserve(numResidentTiles);
+    for (std::size_t i = 0; i < numTiles; ++i) {
+        tile* current = tiles[i].load(std::memory_order_relaxed);
+        if (NULL != current) {
+            uses.push_back(std::make_pair(current->lastBatch.load(), i));
+        }
+    }
+
+    // Drop down to three quarters of the budget so eviction runs rarely.
+    std::size_t numKept    = maxTiles - maxTiles / 4;
+    std::size_t numEvicted = uses.size() - std::min(uses.size(), numKept);
+    std::nth_element(uses.begin(), uses.begin() + numEvicted, uses.end());
+    for (std::size_t i = 0; i < numEvicted; ++i) {
+        delete tiles[uses[i].second].exchange(NULL);
+    }
+
+    numResidentTiles -= numEvicted;
+    numTilesEvicted += numEvicted;
+}
+
+void swgTerrainQuery::report(std::ostream& out) const
+{
+    out << "Terrain queries: " << numQueries << " points, " << numTilesGenerated
+        << " tiles generated, " << numResidentTiles << " resident, " << numTilesEvicted
+        << " evicted" << std::endl;
+}
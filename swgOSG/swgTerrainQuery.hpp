@@ -0,0 +1,122 @@
+/** -*-c++-*-
+ *  \file   swgTerrainQuery.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "swgTerrainGenerator.hpp"
+#include "swgThreadPool.hpp"
+
+#ifndef SWGTERRAINQUERY_HPP
+#define SWGTERRAINQUERY_HPP
+
+/**
+ * Answers terrain height and normal queries for batches of points without
+ * building a scene graph. Heights are interpolated from square tiles of
+ * samples on the triangles the terrain is drawn with. Tiles are generated
+ * the first time a point falls on them and found again through a flat
+ * table without locking. Large batches are spread over the thread pool.
+ */
+class swgTerrainQuery {
+public:
+    // threadPool may be NULL, tileResolution is the samples per tile side.
+    swgTerrainQuery(std::shared_ptr<swgTerrainGenerator> generator,
+                    swgThreadPool*                       threadPool,
+                    float                                spacing,
+                    unsigned int                         tileResolution = 64);
+    ~swgTerrainQuery();
+
+    float getSpacing() const { return spacing; }
+    float getTerrainSize() const { return terrainSize; }
+
+    // Most tiles kept in memory. Tiles are only released while no batch is
+    // running, dropping those unused for the most batches first.
+    void         setMaxTiles(unsigned int tiles) { maxTiles = tiles; }
+    unsigned int getMaxTiles() const { return maxTiles; }
+
+    /**
+     * Write the terrain height at xs[i], ys[i] to out[i] for n points, in
+     * the coordinates of swgTerrainGenerator::generate. Points outside the
+     * terrain get the height at the nearest edge. Safe to call from several
+     * threads at once.
+     */
+    void heights(const float* xs, const float* ys, float* out, std::size_t n);
+
+    // Like heights, but writes unit normals as x, y, z triples.
+    void normals(const float* xs, const float* ys, float* out, std::size_t n);
+
+    void report(std::ostream& out) const;
+
+protected:
+    struct tile {
+        std::once_flag                  generated;
+        std::shared_ptr<swgHeightGrid>  grid;
+        std::atomic<unsigned long long> lastBatch;
+    };
+
+    // Either output may be NULL.
+    void query(const float* xs,
+               const float* ys,
+               float*       heightsOut,
+               float*       normalsOut,
+               std::size_t  n);
+    void queryRange(const float*       xs,
+                    const float*       ys,
+                    float*             heightsOut,
+                    float*             normalsOut,
+                    std::size_t        begin,
+                    std::size_t        end,
+                    unsigned long long batch);
+
+    // Find or generate the tile at tileX, tileY.
+    tile* getTile(unsigned int tileX, unsigned int tileY);
+    void  evict();
+
+    std::shared_ptr<swgTerrainGenerator> generator;
+    swgThreadPool*                       threadPool;
+    float                                spacing;
+    unsigned int                         tileResolution;
+    float                                terrainSize;
+    float                                terrainOrigin;
+    unsigned int                         numTilesPerSide;
+    unsigned int                         maxTiles;
+
+    // Row major, numTilesPerSide squared. Written under tilesMutex, read
+    // without it.
+    std::unique_ptr<std::atomic<tile*>[]> tiles;
+    std::mutex                            tilesMutex;
+    unsigned int                          numActiveBatches;
+    unsigned long long                    batchCounter;
+
+    std::atomic<unsigned int>       numResidentTiles;
+    std::atomic<unsigned long long> numQueries;
+    std::atomic<unsigned long long> numTilesGenerated;
+    std::atomic<unsigned long long> numTilesEvicted;
+};
+
+#endif
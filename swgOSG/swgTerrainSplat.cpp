@@ -0,0 +1,120 @@
+/** -*-c++-*-
+ *  \file   swgTerrainSplat.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgTerrainSplat.hpp"
+
+#include <algorithm>
+
+namespace
+{
+struct color {
+    float r, g, b;
+};
+
+const color sand  = {0.76f, 0.70f, 0.50f};
+const color grass = {0.34f, 0.49f, 0.27f};
+const color dirt  = {0.47f, 0.39f, 0.27f};
+const color rock  = {0.43f, 0.41f, 0.39f};
+const color snow  = {0.94f, 0.94f, 0.96f};
+
+float smoothStep(float edge0, float edge1, float x)
+{
+    float t = std::min(std::max((x - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+color mix(const color& a, const color& b, float weight)
+{
+    color result = {a.r + (b.r - a.r) * weight,
+                    a.g + (b.g - a.g) * weight,
+                    a.b + (b.b - a.b) * weight};
+    return result;
+}
+
+unsigned char toByte(float value)
+{
+    return (unsigned char)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+} // namespace
+
+swgTerrainSplat::swgTerrainSplat(float waterHeight)
+    : waterHeight(waterHeight)
+    , layers(NULL)
+{
+}
+
+void swgTerrainSplat::setLayers(const swgTerrainLayers*                layers,
+                                const std::vector<float>&              familyColors,
+                                const std::vector<std::vector<float>>& ramps)
+{
+    this->layers       = layers;
+    this->familyColors = familyColors;
+    this->ramps        = ramps;
+}
+
+void swgTerrainSplat::bake(float          originX,
+                           float          originY,
+                           float          spacing,
+                           unsigned int   numRows,
+                           unsigned int   numColumns,
+                           const float*   heights,
+                           const float*   normals,
+                           unsigned char* colors) const
+{
+    std::size_t        count = (std::size_t)numRows * numColumns;
+    std::vector<float> result(3 * count);
+    for (std::size_t i = 0; i < count; ++i) {
+        float height = heights[i] - waterHeight;
+        float upward = normals[3 * i + 2];
+
+        // Layers go on bottom to top, each covering what is below it.
+        color ground = mix(grass, dirt, smoothStep(0.97f, 0.88f, upward));
+        ground       = mix(ground, sand, smoothStep(6.0f, 1.0f, height));
+        ground       = mix(ground, snow, smoothStep(350.0f, 450.0f, height));
+        ground       = mix(ground, rock, smoothStep(0.85f, 0.65f, upward));
+
+        result[3 * i]     = ground.r;
+        result[3 * i + 1] = ground.g;
+        result[3 * i + 2] = ground.b;
+    }
+
+    if (NULL != layers) {
+        layers->applyColors(originX,
+                            originY,
+                            spacing,
+                            spacing,
+                            numRows,
+                            numColumns,
+                            heights,
+                            normals,
+                            familyColors,
+                            ramps,
+                            &result[0]);
+    }
+
+    for (std::size_t i = 0; i < 3 * count; ++i) {
+        colors[i] = toByte(result[i]);
+    }
+}
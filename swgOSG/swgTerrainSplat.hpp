@@ -0,0 +1,83 @@
+/** -*-c++-*-
+ *  \file   swgTerrainSplat.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <cstddef>
+#include <vector>
+
+#include "swgTerrainLayers.hpp"
+
+#ifndef SWGTERRAINSPLAT_HPP
+#define SWGTERRAINSPLAT_HPP
+
+/**
+ * Bakes terrain color maps from sampled heights and normals. The shader
+ * and color layers of the TRN file paint the ground when they are set.
+ * Otherwise, and below them, a fixed palette is used: sand lines the
+ * water, grass covers the flats and gives way to dirt and rock as the
+ * ground steepens, snow caps the peaks.
+ */
+class swgTerrainSplat {
+public:
+    // Bumped whenever the colors change, so cached maps are baked again.
+    static const unsigned int version        = 2;
+    static const unsigned int paletteVersion = 1;
+
+    swgTerrainSplat(float waterHeight);
+
+    /**
+     * Paint with the shader and color layers of layers, which has to
+     * outlive this. familyColors holds an RGB triple in [0, 1] per shader
+     * family, ramps 256 triples per color ramp, see
+     * swgTerrainLayers::applyColors.
+     */
+    void setLayers(const swgTerrainLayers*                layers,
+                   const std::vector<float>&              familyColors,
+                   const std::vector<std::vector<float>>& ramps);
+
+    // Version the maps are cached under, the palette keeps its own.
+    unsigned int getVersion() const { return (NULL != layers) ? version : paletteVersion; }
+
+    /**
+     * Write three bytes of color for each sample of a numRows by numColumns
+     * grid at originX + column * spacing, originY + row * spacing, normals
+     * being x, y, z triples.
+     */
+    void bake(float          originX,
+              float          originY,
+              float          spacing,
+              unsigned int   numRows,
+              unsigned int   numColumns,
+              const float*   heights,
+              const float*   normals,
+              unsigned char* colors) const;
+
+protected:
+    float                           waterHeight;
+    const swgTerrainLayers*         layers;
+    std::vector<float>              familyColors;
+    std::vector<std::vector<float>> ramps;
+};
+
+#endif
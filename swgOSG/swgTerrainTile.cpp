@@ -0,0 +1,524 @@
+/** -*-c++-*-
+ *  \file   swgTerrainTile.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgTerrainTile.hpp"
+#include "swgInstancing.hpp"
+#include "swgTerrainKernels.hpp"
+
+#include <chrono>
+
+#include <osg/FrameStamp>
+#include <osg/Geometry>
+#include <osg/Image>
+#include <osg/LOD>
+#include <osg/NodeVisitor>
+#include <osg/Texture2D>
+
+swgTerrainTile::swgTerrainTile(swgTerrain*  terrain,
+                               unsigned int level,
+                               float        originX,
+                               float        originY,
+                               float        size)
+    : terrain(terrain)
+    , level(level)
+    , originX(originX)
+    , originY(originY)
+    , size(size)
+    , finerRequested(false)
+    , lastFinerFrame(0)
+{
+}
+
+void swgTerrainTile::traverse(osg::NodeVisitor& nv)
+{
+    if (osg::NodeVisitor::CULL_VISITOR != nv.getVisitorType() || 0 == getNumChildren()) {
+        osg::Group::traverse(nv);
+        return;
+    }
+
+    const osg::BoundingSphere& bound = getBound();
+
+    float distance = nv.getDistanceToViewPoint(bound.center(), true) - bound.radius();
+    bool  refine   = level < terrain->getMaxLevel() && distance < size * terrain->getSplitFactor();
+
+    if (refine && hasFinerTiles()) {
+        if (NULL != nv.getFrameStamp()) {
+            lastFinerFrame = nv.getFrameStamp()->getFrameNumber();
+        }
+        for (unsigned int i = 1; i < getNumChildren(); ++i) {
+            getChild(i)->accept(nv);
+        }
+        return;
+    }
+
+    // Draw this level until the finer tiles arrive.
+    getChild(0)->accept(nv);
+
+    if (refine && !finerRequested.exchange(true)) {
+        terrain->requestFinerTiles(this);
+    }
+}
+
+swgTerrain::swgTerrain(std::shared_ptr<swgTerrainGenerator> generator,
+                       const swgTerrainSplat&               splat,
+                       swgThreadPool*                       threadPool,
+                       float                                finestSpacing,
+                       unsigned int                         tileResolution)
+    : generator(generator)
+    , threadPool(threadPool)
+    , splat(splat)
+    , tileResolution(tileResolution)
+    , maxLevel(0)
+    , splitFactor(2.0f)
+    , expiryFrames(120)
+    , floraRange(0.0f)
+    , numPending(0)
+    , numGenerated(0)
+    , numExpired(0)
+    , numFloraPlacements(0)
+{
+    float terrainSize = generator->getTerrainSize();
+
+    // Split until the tile spacing reaches the finest spacing asked for.
+    while (0.0f < finestSpacing && 24 > maxLevel
+           && terrainSize / (tileResolution << (maxLevel + 1)) >= finestSpacing) {
+        ++maxLevel;
+    }
+
+    // The whole terrain at the coarsest level is always there.
+    osg::ref_ptr<swgTerrainTile> root =
+        new swgTerrainTile(this, 0, -terrainSize / 2.0f, -terrainSize / 2.0f, terrainSize);
+    root->addChild(createTile(0, root->getOriginX(), root->getOriginY(), terrainSize).get());
+    addChild(root.get());
+    ++numGenerated;
+
+    setUpdateCallback(new swgTerrainUpdateCallback);
+}
+
+swgTerrain::~swgTerrain() {}
+
+void swgTerrain::setFlora(std::shared_ptr<swgFloraScatter>            scatter,
+                          const std::vector<osg::ref_ptr<osg::Node>>& prototypes,
+                          float                                       range)
+{
+    floraScatter    = scatter;
+    floraPrototypes = prototypes;
+    floraRange      = range;
+
+    // A single level terrain has its finest tile already.
+    if (0 == maxLevel) {
+        swgTerrainTile* root = static_cast<swgTerrainTile*>(getChild(0));
+        root->setChild(
+            0, createTile(0, root->getOriginX(), root->getOriginY(), root->getSize()).get());
+    }
+}
+
+osg::ref_ptr<osg::Node>
+swgTerrain::createTile(unsigned int level, float originX, float originY, float size) const
+{
+    std::shared_ptr<swgHeightGrid> grid;
+    osg::ref_ptr<osg::Geode>       mesh = createTileMesh(originX, originY, size, grid);
+
+    if (level < maxLevel || NULL == floraScatter) {
+        return mesh;
+    }
+
+    osg::ref_ptr<osg::Group> tile = new osg::Group;
+    tile->addChild(mesh.get());
+
+    osg::ref_ptr<osg::Node> flora = createTileFlora(originX, originY, size, *grid);
+    if (NULL != flora) {
+        tile->addChild(flora.get());
+    }
+
+    return tile;
+}
+
+osg::ref_ptr<osg::Node> swgTerrain::createTileFlora(float                originX,
+                                                    float                originY,
+                                                    float                size,
+                                                    const swgHeightGrid& grid) const
+{
+    std::vector<std::vector<swgFloraScatter::placement>> placements;
+    floraScatter->scatter(originX, originY, size, grid, placements);
+
+    // Distances are measured to the tile center, so reach out by half the
+    // tile diagonal to cover its corners.
+    osg::ref_ptr<osg::LOD> flora = new osg::LOD;
+    flora->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+    flora->setCenter(osg::Vec3(originX + size / 2.0f,
+                               originY + size / 2.0f,
+                               grid.getHeights()[grid.getNumRows() * grid.getNumColumns() / 2]));
+    flora->setRadius(size * 0.7071f);
+
+    osg::ref_ptr<osg::Group> families = new osg::Group;
+    for (unsigned int f = 0; f < placements.size() && f < floraPrototypes.size(); ++f) {
+        const std::vector<swgFloraScatter::placement>& current = placements[f];
+        if (current.empty() || NULL == floraPrototypes[f]) {
+            continue;
+        }
+
+        // Appearances are y up, the terrain is z up.
+        std::vector<osg::Matrix> matrices;
+        matrices.reserve(current.size());
+        for (unsigned int i = 0; i < current.size(); ++i) {
+            matrices.push_back(osg::Matrix::scale(osg::Vec3(
+                                   current[i].scale, current[i].height, current[i].scale))
+                               * osg::Matrix::rotate(osg::PI_2, osg::X_AXIS)
+                               * osg::Matrix::rotate(current[i].rotation, osg::Z_AXIS)
+                               * osg::Matrix::translate(current[i].x, current[i].y, current[i].z));
+        }
+
+        osg::ref_ptr<osg::Node> instanced =
+            createInstancedNode(floraPrototypes[f].get(), matrices);
+        if (NULL != instanced) {
+            families->addChild(instanced.get());
+            numFloraPlacements += current.size();
+        }
+    }
+
+    if (0 == families->getNumChildren()) {
+        return NULL;
+    }
+
+    flora->addChild(families.get(), 0.0f, floraRange + size * 0.7071f);
+    return flora;
+}
+
+osg::ref_ptr<osg::Geode> swgTerrain::createTileMesh(float                           originX,
+                                                    float                           originY,
+                                                    float                           size,
+                                                    std::shared_ptr<swgHeightGrid>& grid) const
+{
+    unsigned int numSamples = tileResolution + 1;
+    float        spacing    = size / tileResolution;
+
+    std::vector<unsigned char>   colorMap;
+    osg::ref_ptr<osg::Vec3Array> normals = new osg::Vec3Array(numSamples * numSamples);
+
+    // osg::Vec3 is three packed floats, so normals are written in place.
+    bakeTile(originX, originY, size, grid, (*normals)[0].ptr(), colorMap);
+    const float* heights = grid->getHeights();
+
+    osg::ref_ptr<osg::Vec3Array> vertices  = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec2Array> texCoords = new osg::Vec2Array;
+    vertices->reserve(numSamples * (numSamples + 4));
+    normals->reserve(numSamples * (numSamples + 4));
+    texCoords->reserve(numSamples * (numSamples + 4));
+
+    // One texel per sample, texel centers on the samples.
+    for (unsigned int row = 0; row < numSamples; ++row) {
+        for (unsigned int col = 0; col < numSamples; ++col) {
+            vertices->push_back(osg::Vec3(
+                originX + col * spacing, originY + row * spacing, heights[row * numSamples + col]));
+            texCoords->push_back(
+                osg::Vec2((col + 0.5f) / numSamples, (row + 0.5f) / numSamples));
+        }
+    }
+
+    osg::ref_ptr<osg::DrawElementsUShort> triangles =
+        new osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES);
+    triangles->reserve(6 * tileResolution * (tileResolution + 4));
+
+    for (unsigned int row = 0; row < tileResolution; ++row) {
+        for (unsigned int col = 0; col < tileResolution; ++col) {
+            unsigned int corner = row * numSamples + col;
+            triangles->push_back(corner);
+            triangles->push_back(corner + 1);
+            triangles->push_back(corner + numSamples + 1);
+            triangles->push_back(corner);
+            triangles->push_back(corner + numSamples + 1);
+            triangles->push_back(corner + numSamples);
+        }
+    }
+
+    // Hang a skirt below each edge, deep enough to cover the height error
+    // between this tile and a coarser neighbour.
+    float skirtDepth = 4.0f * spacing;
+    int   last       = numSamples - 1;
+    int   corners[4] = {0, last, last * (int)numSamples + last, last * (int)numSamples};
+    int   steps[4]   = {1, (int)numSamples, -1, -(int)numSamples};
+
+    // Walk the edges around the tile, each starting at the corner the
+    // previous one ended in.
+    for (unsigned int edge = 0; edge < 4; ++edge) {
+        unsigned int first = vertices->size();
+        for (int i = 0; i <= last; ++i) {
+            int sample = corners[edge] + i * steps[edge];
+            vertices->push_back((*vertices)[sample] - osg::Vec3(0.0f, 0.0f, skirtDepth));
+            normals->push_back((*normals)[sample]);
+            texCoords->push_back((*texCoords)[sample]);
+        }
+
+        for (int i = 0; i < last; ++i) {
+            int top    = corners[edge] + i * steps[edge];
+            int bottom = first + i;
+            triangles->push_back(top);
+            triangles->push_back(bottom);
+            triangles->push_back(bottom + 1);
+            triangles->push_back(top);
+            triangles->push_back(bottom + 1);
+            triangles->push_back(top + steps[edge]);
+        }
+    }
+
+    osg::ref_ptr<osg::Vec4Array> colors = new osg::Vec4Array;
+    colors->push_back(osg::Vec4(1.0f, 1.0f, 1.0f, 1.0f));
+
+    osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
+    geometry->setVertexArray(vertices.get());
+    geometry->setNormalArray(normals.get());
+    geometry->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+    geometry->setColorArray(colors.get());
+    geometry->setColorBinding(osg::Geometry::BIND_OVERALL);
+    geometry->setTexCoordArray(0, texCoords.get());
+    geometry->addPrimitiveSet(triangles.get());
+
+    // Tiles come and go, so they get buffers of their own rather than
+    // pooled ones that would outlive them.
+    geometry->setUseDisplayList(false);
+    geometry->setUseVertexBufferObjects(true);
+
+    osg::ref_ptr<osg::Image> image = new osg::Image;
+    unsigned char*           pixels = new unsigned char[colorMap.size()];
+    std::copy(colorMap.begin(), colorMap.end(), pixels);
+    image->setImage(numSamples,
+                    numSamples,
+                    1,
+                    GL_RGB,
+                    GL_RGB,
+                    GL_UNSIGNED_BYTE,
+                    pixels,
+                    osg::Image::USE_NEW_DELETE);
+
+    osg::ref_ptr<osg::Texture2D> texture = new osg::Texture2D(image.get());
+    texture->setWrap(osg::Texture::WRAP_S, osg::Texture::CLAMP_TO_EDGE);
+    texture->setWrap(osg::Texture::WRAP_T, osg::Texture::CLAMP_TO_EDGE);
+    texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+    texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+    texture->setResizeNonPowerOfTwoHint(false);
+    texture->setUnRefImageDataAfterApply(true);
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->addDrawable(geometry.get());
+    geode->getOrCreateStateSet()->setTextureAttributeAndModes(0, texture.get());
+
+    return geode;
+}
+
+void swgTerrain::bakeTile(float                           originX,
+                          float                           originY,
+                          float                           size,
+                          std::shared_ptr<swgHeightGrid>& grid,
+                          float*                          normals,
+                          std::vector<unsigned char>&     colors) const
+{
+    unsigned int numSamples = tileResolution + 1;
+    float        spacing    = size / tileResolution;
+
+    // Read straight from the mapped cache file when there is one.
+    grid = generator->getGrid(originX, originY, spacing, spacing, numSamples, numSamples);
+    swgTerrainKernels::computeNormals(
+        grid->getHeights(), numSamples, numSamples, spacing, normals);
+
+    std::shared_ptr<swgHeightmapCache> cache = generator->getCache();
+    if (NULL != cache
+        && cache->loadColors(generator->getHash(),
+                             generator->getEvaluator(),
+                             generator->getEvaluatorVersion(),
+                             originX,
+                             originY,
+                             spacing,
+                             spacing,
+                             numSamples,
+                             numSamples,
+                             splat.getVersion(),
+                             colors)) {
+        return;
+    }
+
+    colors.resize(3 * numSamples * numSamples);
+    splat.bake(originX,
+               originY,
+               spacing,
+               numSamples,
+               numSamples,
+               grid->getHeights(),
+               normals,
+               &colors[0]);
+
+    if (NULL != cache) {
+        cache->storeColors(generator->getHash(),
+                           generator->getEvaluator(),
+                           generator->getEvaluatorVersion(),
+                           originX,
+                           originY,
+                           spacing,
+                           spacing,
+                           numSamples,
+                           numSamples,
+                           splat.getVersion(),
+                           &colors[0]);
+    }
+}
+
+void swgTerrain::bake(std::ostream& out)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    float        terrainSize = generator->getTerrainSize();
+    unsigned int numSamples  = tileResolution + 1;
+    unsigned int numTiles    = 0;
+
+    // Tile origins along either axis, derived from the parent's the same way
+    // requestFinerTiles does so the cache keys match bit for bit.
+    std::vector<float> origins(1, -terrainSize / 2.0f);
+
+    for (unsigned int level = 0; level <= maxLevel; ++level) {
+        unsigned int tilesPerSide = 1u << level;
+        float        size         = terrainSize / tilesPerSide;
+
+        if (0 < level) {
+            std::vector<float> parents;
+            parents.swap(origins);
+            origins.resize(tilesPerSide);
+            for (unsigned int i = 0; i < tilesPerSide; ++i) {
+                origins[i] = parents[i / 2] + (i % 2) * size;
+            }
+        }
+
+        threadPool->parallelFor(0, tilesPerSide * tilesPerSide, [&](unsigned int tile) {
+            std::shared_ptr<swgHeightGrid> grid;
+            std::vector<float>             normals(3 * numSamples * numSamples);
+            std::vector<unsigned char>     colors;
+            bakeTile(origins[tile % tilesPerSide],
+                     origins[tile / tilesPerSide],
+                     size,
+                     grid,
+                     &normals[0],
+                     colors);
+        });
+
+        numTiles += tilesPerSide * tilesPerSide;
+    }
+
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    out << "Baked " << numTiles << " terrain tiles on " << (maxLevel + 1) << " levels in "
+        << seconds << " seconds" << std::endl;
+}
+
+void swgTerrain::requestFinerTiles(swgTerrainTile* tile)
+{
+    ++numPending;
+
+    osg::ref_ptr<swgTerrain>     terrain(this);
+    osg::ref_ptr<swgTerrainTile> parent(tile);
+    threadPool->run([terrain, parent]() {
+        finishedTiles tiles;
+        tiles.parent = parent;
+
+        float size = parent->getSize() / 2.0f;
+        for (unsigned int i = 0; i < 4; ++i) {
+            float originX = parent->getOriginX() + (i % 2) * size;
+            float originY = parent->getOriginY() + (i / 2) * size;
+
+            tiles.finer[i] = new swgTerrainTile(
+                terrain.get(), parent->getLevel() + 1, originX, originY, size);
+            tiles.finer[i]->addChild(
+                terrain->createTile(parent->getLevel() + 1, originX, originY, size).get());
+        }
+
+        std::unique_lock<std::mutex> lock(terrain->finishedMutex);
+        terrain->finished.push_back(tiles);
+        --terrain->numPending;
+    });
+}
+
+void swgTerrain::update(unsigned int frameNumber)
+{
+    std::vector<finishedTiles> ready;
+    {
+        std::unique_lock<std::mutex> lock(finishedMutex);
+        ready.swap(finished);
+    }
+
+    for (unsigned int i = 0; i < ready.size(); ++i) {
+        // The parent may have been expired and requested again meanwhile.
+        swgTerrainTile* parent = ready[i].parent.get();
+        if (1 != parent->getNumChildren()) {
+            continue;
+        }
+
+        parent->lastFinerFrame = frameNumber;
+        for (unsigned int j = 0; j < 4; ++j) {
+            parent->addChild(ready[i].finer[j].get());
+        }
+        numGenerated += 4;
+    }
+
+    for (unsigned int i = 0; i < getNumChildren(); ++i) {
+        swgTerrainTile* tile = dynamic_cast<swgTerrainTile*>(getChild(i));
+        if (NULL != tile) {
+            expire(tile, frameNumber);
+        }
+    }
+}
+
+void swgTerrain::expire(swgTerrainTile* tile, unsigned int frameNumber)
+{
+    if (!tile->hasFinerTiles()) {
+        return;
+    }
+
+    if (tile->lastFinerFrame + expiryFrames < frameNumber) {
+        // Dropping the finer tiles drops everything below them as well.
+        tile->removeChildren(1, 4);
+        tile->finerRequested = false;
+        ++numExpired;
+        return;
+    }
+
+    for (unsigned int i = 1; i < tile->getNumChildren(); ++i) {
+        expire(static_cast<swgTerrainTile*>(tile->getChild(i)), frameNumber);
+    }
+}
+
+void swgTerrain::report(std::ostream& out) const
+{
+    out << "Terrain levels: " << (maxLevel + 1) << ", " << numGenerated << " tiles generated, "
+        << numExpired << " tile groups expired, " << numPending << " requests pending, "
+        << numFloraPlacements << " flora placements" << std::endl;
+}
+
+void swgTerrainUpdateCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+{
+    swgTerrain* terrain = dynamic_cast<swgTerrain*>(node);
+    if (NULL != terrain && NULL != nv->getFrameStamp()) {
+        terrain->update(nv->getFrameStamp()->getFrameNumber());
+    }
+
+    traverse(node, nv);
+}
@@ -0,0 +1,205 @@
+/** -*-c++-*-
+ *  \file   swgTerrainTile.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <osg/Geode>
+#include <osg/Group>
+#include <osg/NodeCallback>
+
+#include "swgFloraScatter.hpp"
+#include "swgTerrainGenerator.hpp"
+#include "swgTerrainSplat.hpp"
+#include "swgThreadPool.hpp"
+
+#ifndef SWGTERRAINTILE_HPP
+#define SWGTERRAINTILE_HPP
+
+class swgTerrain;
+
+/**
+ * One square of the terrain quadtree. Child 0 is the tile's own mesh, the
+ * four finer tiles covering it follow once they have been generated. The
+ * cull traversal draws either the mesh or the finer tiles depending on
+ * distance and asks for the finer tiles when they are missing.
+ */
+class swgTerrainTile : public osg::Group {
+public:
+    swgTerrainTile(swgTerrain*  terrain,
+                   unsigned int level,
+                   float        originX,
+                   float        originY,
+                   float        size);
+
+    unsigned int getLevel() const { return level; }
+    float        getOriginX() const { return originX; }
+    float        getOriginY() const { return originY; }
+    float        getSize() const { return size; }
+
+    bool hasFinerTiles() const { return 5 == getNumChildren(); }
+
+    virtual void traverse(osg::NodeVisitor& nv);
+
+protected:
+    virtual ~swgTerrainTile() {}
+
+    friend class swgTerrain;
+
+    swgTerrain*  terrain;
+    unsigned int level;
+    float        originX;
+    float        originY;
+    float        size;
+
+    // Written by the cull thread, read by the update thread.
+    std::atomic<bool>         finerRequested;
+    std::atomic<unsigned int> lastFinerFrame;
+};
+
+/**
+ * Chunked level of detail terrain. Tiles are generated from the TRN layers
+ * on the thread pool when the viewer comes close and dropped again once
+ * they have gone unused for a while, so only the neighbourhood of the
+ * viewer is held at full resolution. Tile edges carry skirts hiding the
+ * cracks between neighbours of different levels. Each tile is drawn with a
+ * color map baked alongside its heights.
+ */
+class swgTerrain : public osg::Group {
+public:
+    // finestSpacing limits the depth of the quadtree, tileResolution is
+    // the number of cells along each tile edge. Tiles are colored by splat.
+    swgTerrain(std::shared_ptr<swgTerrainGenerator> generator,
+               const swgTerrainSplat&               splat,
+               swgThreadPool*                       threadPool,
+               float                                finestSpacing,
+               unsigned int                         tileResolution = 32);
+
+    unsigned int getMaxLevel() const { return maxLevel; }
+
+    std::shared_ptr<swgTerrainGenerator> getGenerator() const { return generator; }
+
+    // Tiles split when the viewer is closer than factor times their size.
+    void  setSplitFactor(float factor) { splitFactor = factor; }
+    float getSplitFactor() const { return splitFactor; }
+
+    // Frames finer tiles may go undrawn before they are dropped.
+    void setExpiryFrames(unsigned int frames) { expiryFrames = frames; }
+
+    /**
+     * Scatter flora over the tiles of the finest level created from now on,
+     * drawing variant i of scatter instanced with prototypes[i], if it is
+     * not NULL, when the viewer is within range meters.
+     */
+    void setFlora(std::shared_ptr<swgFloraScatter>            scatter,
+                  const std::vector<osg::ref_ptr<osg::Node>>& prototypes,
+                  float                                       range);
+
+    // Build the mesh of one tile, plus its flora on the finest level. Safe
+    // to call from any thread.
+    osg::ref_ptr<osg::Node> createTile(unsigned int level,
+                                       float        originX,
+                                       float        originY,
+                                       float        size) const;
+
+    osg::ref_ptr<osg::Geode> createTileMesh(float                           originX,
+                                            float                           originY,
+                                            float                           size,
+                                            std::shared_ptr<swgHeightGrid>& grid) const;
+    osg::ref_ptr<osg::Node>  createTileFlora(float                originX,
+                                             float                originY,
+                                             float                size,
+                                             const swgHeightGrid& grid) const;
+
+    /**
+     * Generate the heights, normals and colors of one tile, reading and
+     * filling the heightmap cache when the generator has one. normals
+     * receives three floats per sample. Safe to call from any thread.
+     */
+    void bakeTile(float                           originX,
+                  float                           originY,
+                  float                           size,
+                  std::shared_ptr<swgHeightGrid>& grid,
+                  float*                          normals,
+                  std::vector<unsigned char>&     colors) const;
+
+    // Bake every tile of every level into the heightmap cache up front,
+    // spread over the thread pool.
+    void bake(std::ostream& out);
+
+    // Queue generation of the four finer tiles of tile. Called during cull.
+    void requestFinerTiles(swgTerrainTile* tile);
+
+    // Attach generated tiles and drop expired ones. Called once per frame
+    // from the update traversal.
+    void update(unsigned int frameNumber);
+
+    void report(std::ostream& out) const;
+
+protected:
+    virtual ~swgTerrain();
+
+    struct finishedTiles {
+        osg::ref_ptr<swgTerrainTile> parent;
+        osg::ref_ptr<swgTerrainTile> finer[4];
+    };
+
+    void expire(swgTerrainTile* tile, unsigned int frameNumber);
+
+    std::shared_ptr<swgTerrainGenerator> generator;
+    swgThreadPool*                       threadPool;
+    swgTerrainSplat                      splat;
+    unsigned int                         tileResolution;
+    unsigned int                         maxLevel;
+    float                                splitFactor;
+    unsigned int                         expiryFrames;
+
+    std::shared_ptr<swgFloraScatter>     floraScatter;
+    std::vector<osg::ref_ptr<osg::Node>> floraPrototypes;
+    float                                floraRange;
+
+    std::mutex                 finishedMutex;
+    std::vector<finishedTiles> finished;
+    std::atomic<unsigned int>  numPending;
+
+    unsigned int numGenerated;
+    unsigned int numExpired;
+
+    // Counted from the worker threads.
+    mutable std::atomic<unsigned long long> numFloraPlacements;
+};
+
+/**
+ * Update callback driving a terrain from the scene graph.
+ */
+class swgTerrainUpdateCallback : public osg::NodeCallback {
+public:
+    virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+};
+
+#endif
@@ -0,0 +1,435 @@
+/** -*-c++-*-
+ *  \file   swgTextureAtlas.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgTextureAtlas.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+#include <osg/Math>
+
+namespace
+{
+// The texture unit holding the only texture of stateSet, or -1.
+int getTexturedUnit(const osg::StateSet* stateSet)
+{
+    if (NULL == stateSet) {
+        return -1;
+    }
+
+    int unit = -1;
+    for (unsigned int i = 0; i < stateSet->getTextureAttributeList().size(); ++i) {
+        if (NULL != stateSet->getTextureAttribute(i, osg::StateAttribute::TEXTURE)) {
+            if (-1 != unit) {
+                return -1;
+            }
+            unit = i;
+        }
+    }
+
+    return unit;
+}
+
+bool isPowerOfTwo(unsigned int value)
+{
+    return 0 < value && 0 == (value & (value - 1));
+}
+
+// Bytes per 4x4 block of the compressed formats that can be copied blockwise.
+unsigned int getBlockBytes(GLenum pixelFormat)
+{
+    switch (pixelFormat) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        return 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        return 16;
+    default:
+        return 0;
+    }
+}
+} // namespace
+
+bool swgTextureAtlas::textureFormat::operator<(const textureFormat& other) const
+{
+    const GLint a[] = {internalFormat,
+                       (GLint)pixelFormat,
+                       (GLint)dataType,
+                       (GLint)width,
+                       (GLint)height,
+                       (GLint)numLevels,
+                       wrapS,
+                       wrapT,
+                       minFilter,
+                       magFilter};
+    const GLint b[] = {other.internalFormat,
+                       (GLint)other.pixelFormat,
+                       (GLint)other.dataType,
+                       (GLint)other.width,
+                       (GLint)other.height,
+                       (GLint)other.numLevels,
+                       other.wrapS,
+                       other.wrapT,
+                       other.minFilter,
+                       other.magFilter};
+
+    return std::lexicographical_compare(a, a + 10, b, b + 10);
+}
+
+swgTextureAtlas::swgTextureAtlas(unsigned int maxTextureSize, unsigned int maxAtlasSize)
+    : maxTextureSize(maxTextureSize)
+    , maxAtlasSize(maxAtlasSize)
+    , numAtlases(0)
+    , numPackedTextures(0)
+    , numRepeating(0)
+    , numStatesBefore(0)
+    , usedTexels(0)
+    , atlasTexels(0)
+{
+}
+
+swgTextureAtlas::~swgTextureAtlas() {}
+
+void swgTextureAtlas::addGeometry(osg::Geometry* geometry)
+{
+    if (NULL != geometry) {
+        candidates.push_back(geometry);
+    }
+}
+
+bool swgTextureAtlas::getFormat(const osg::Texture2D* texture, textureFormat& format) const
+{
+    const osg::Image* image = texture->getImage();
+    if (NULL == image || 1 != image->r()) {
+        return false;
+    }
+
+    // Power of two tiles keep every mip level on the grid.
+    unsigned int width  = image->s();
+    unsigned int height = image->t();
+    if (!isPowerOfTwo(width) || !isPowerOfTwo(height) || 4 > width || 4 > height
+        || maxTextureSize < width || maxTextureSize < height) {
+        return false;
+    }
+
+    if (image->isCompressed()) {
+        if (0 == getBlockBytes(image->getPixelFormat())) {
+            return false;
+        }
+    }
+    else {
+        unsigned int bits = osg::Image::computePixelSizeInBits(image->getPixelFormat(),
+                                                               image->getDataType());
+        if (1 != image->getPacking() || 0 == bits || 0 != (bits % 8)) {
+            return false;
+        }
+    }
+
+    format.internalFormat = image->getInternalTextureFormat();
+    format.pixelFormat    = image->getPixelFormat();
+    format.dataType       = image->getDataType();
+    format.width          = width;
+    format.height         = height;
+    format.numLevels      = image->getNumMipmapLevels();
+    format.wrapS          = texture->getWrap(osg::Texture::WRAP_S);
+    format.wrapT          = texture->getWrap(osg::Texture::WRAP_T);
+    format.minFilter      = texture->getFilter(osg::Texture::MIN_FILTER);
+    format.magFilter      = texture->getFilter(osg::Texture::MAG_FILTER);
+
+    return true;
+}
+
+void swgTextureAtlas::build()
+{
+    numStatesBefore = countStates();
+
+    // Collect the geometries using each texture. A geometry with repeating
+    // texture coordinates keeps its texture, the others may still move.
+    std::map<osg::Texture2D*, std::vector<textureUse>> uses;
+    for (unsigned int i = 0; i < candidates.size(); ++i) {
+        osg::Geometry* geometry = candidates[i].get();
+        int            unit     = getTexturedUnit(geometry->getStateSet());
+        if (0 > unit) {
+            continue;
+        }
+
+        osg::Texture2D* texture = dynamic_cast<osg::Texture2D*>(
+            geometry->getStateSet()->getTextureAttribute(unit, osg::StateAttribute::TEXTURE));
+        const osg::Vec2Array* texCoords =
+            dynamic_cast<const osg::Vec2Array*>(geometry->getTexCoordArray(unit));
+        if (NULL == texture || NULL == texCoords) {
+            continue;
+        }
+
+        bool repeating = false;
+        for (unsigned int j = 0; j < texCoords->size() && !repeating; ++j) {
+            const osg::Vec2& texCoord = (*texCoords)[j];
+            repeating = (-0.001f > texCoord.x() || 1.001f < texCoord.x() || -0.001f > texCoord.y()
+                         || 1.001f < texCoord.y());
+        }
+
+        if (repeating) {
+            ++numRepeating;
+            continue;
+        }
+
+        textureUse use;
+        use.geometry = geometry;
+        use.unit     = unit;
+        uses[texture].push_back(use);
+    }
+
+    std::map<textureFormat, std::vector<osg::Texture2D*>> groups;
+    for (std::map<osg::Texture2D*, std::vector<textureUse>>::iterator i = uses.begin();
+         i != uses.end();
+         ++i) {
+        textureFormat format;
+        if (getFormat(i->first, format)) {
+            groups[format].push_back(i->first);
+        }
+    }
+
+    for (std::map<textureFormat, std::vector<osg::Texture2D*>>::iterator group = groups.begin();
+         group != groups.end();
+         ++group) {
+        const textureFormat&                format   = group->first;
+        const std::vector<osg::Texture2D*>& textures = group->second;
+
+        unsigned int maxColumns = maxAtlasSize / format.width;
+        unsigned int maxRows    = maxAtlasSize / format.height;
+        unsigned int capacity   = maxColumns * maxRows;
+
+        for (unsigned int first = 0; first < textures.size(); first += capacity) {
+            std::vector<osg::Texture2D*> packed(
+                textures.begin() + first,
+                textures.begin() + std::min<size_t>(first + capacity, textures.size()));
+
+            // A single texture gains nothing from an atlas.
+            if (2 > packed.size()) {
+                continue;
+            }
+
+            // Grow the grid along its shorter side to keep atlases square.
+            unsigned int numColumns = 1;
+            unsigned int numRows    = 1;
+            while (numColumns * numRows < packed.size()) {
+                bool wider = numColumns * format.width <= numRows * format.height;
+                if ((wider && numColumns < maxColumns) || numRows >= maxRows) {
+                    numColumns *= 2;
+                }
+                else {
+                    numRows *= 2;
+                }
+            }
+
+            placement place;
+            place.atlas      = createAtlas(format, packed, numColumns, numRows);
+            place.numColumns = numColumns;
+            place.numRows    = numRows;
+
+            for (unsigned int i = 0; i < packed.size(); ++i) {
+                place.column = i % numColumns;
+                place.row    = i / numColumns;
+
+                const std::vector<textureUse>& textureUses = uses[packed[i]];
+                for (unsigned int j = 0; j < textureUses.size(); ++j) {
+                    remap(textureUses[j], place, format);
+                }
+            }
+
+            ++numAtlases;
+            numPackedTextures += packed.size();
+            usedTexels += (unsigned long long)packed.size() * format.width * format.height;
+            atlasTexels +=
+                (unsigned long long)numColumns * numRows * format.width * format.height;
+        }
+    }
+}
+
+osg::ref_ptr<osg::Texture2D> swgTextureAtlas::createAtlas(
+    const textureFormat&                format,
+    const std::vector<osg::Texture2D*>& textures,
+    unsigned int                        numColumns,
+    unsigned int                        numRows)
+{
+    unsigned int width  = numColumns * format.width;
+    unsigned int height = numRows * format.height;
+
+    // Compressed data is copied in 4x4 blocks, everything else in pixels.
+    unsigned int unitSize  = 4;
+    unsigned int unitBytes = getBlockBytes(format.pixelFormat);
+    if (0 == unitBytes) {
+        unitSize  = 1;
+        unitBytes = osg::Image::computePixelSizeInBits(format.pixelFormat, format.dataType) / 8;
+    }
+
+    // Mipmapped sources get a full chain down to 1x1.
+    unsigned int numLevels = 1;
+    if (1 < format.numLevels) {
+        while ((width >> numLevels) > 0 || (height >> numLevels) > 0) {
+            ++numLevels;
+        }
+    }
+
+    osg::Image::MipmapDataType offsets;
+    unsigned int               totalBytes = 0;
+    for (unsigned int level = 0; level < numLevels; ++level) {
+        if (0 < level) {
+            offsets.push_back(totalBytes);
+        }
+        unsigned int levelWidth  = std::max(1u, width >> level);
+        unsigned int levelHeight = std::max(1u, height >> level);
+        totalBytes += ((levelWidth + unitSize - 1) / unitSize)
+                      * ((levelHeight + unitSize - 1) / unitSize) * unitBytes;
+    }
+
+    unsigned char* data = new unsigned char[totalBytes];
+
+    for (unsigned int level = 0; level < numLevels; ++level) {
+        unsigned char* levelData   = data + ((0 < level) ? offsets[level - 1] : 0);
+        unsigned int   levelWidth  = std::max(1u, width >> level);
+        unsigned int   levelHeight = std::max(1u, height >> level);
+        unsigned int   unitsWide   = (levelWidth + unitSize - 1) / unitSize;
+        unsigned int   unitsHigh   = (levelHeight + unitSize - 1) / unitSize;
+
+        // Levels past the end of a short source chain repeat its last level.
+        unsigned int sourceLevel  = std::min(level, format.numLevels - 1);
+        unsigned int sourceWidth  = std::max(1u, format.width >> sourceLevel);
+        unsigned int sourceHeight = std::max(1u, format.height >> sourceLevel);
+        unsigned int sourceWide   = (sourceWidth + unitSize - 1) / unitSize;
+        unsigned int sourceHigh   = (sourceHeight + unitSize - 1) / unitSize;
+
+        // Each atlas unit takes the source unit under its first pixel. Once
+        // tiles shrink below a unit this picks the tile in its corner.
+        for (unsigned int y = 0; y < unitsHigh; ++y) {
+            unsigned int baseY = (y * unitSize) << level;
+            unsigned int row   = std::min(numRows - 1, baseY / format.height);
+            unsigned int tileY = (baseY - row * format.height) >> sourceLevel;
+            unsigned int unitY = std::min(sourceHigh - 1, tileY / unitSize);
+
+            for (unsigned int x = 0; x < unitsWide; ++x) {
+                unsigned int baseX  = (x * unitSize) << level;
+                unsigned int column = std::min(numColumns - 1, baseX / format.width);
+                unsigned int tileX  = (baseX - column * format.width) >> sourceLevel;
+                unsigned int unitX  = std::min(sourceWide - 1, tileX / unitSize);
+
+                unsigned int         tile   = row * numColumns + column;
+                const unsigned char* source = NULL;
+                if (tile < textures.size()) {
+                    source = textures[tile]->getImage()->getMipmapData(sourceLevel);
+                }
+
+                unsigned char* target = levelData + (y * unitsWide + x) * unitBytes;
+                if (NULL != source) {
+                    memcpy(target, source + (unitY * sourceWide + unitX) * unitBytes, unitBytes);
+                }
+                else {
+                    memset(target, 0, unitBytes);
+                }
+            }
+        }
+    }
+
+    osg::ref_ptr<osg::Image> image = new osg::Image;
+    image->setImage(width,
+                    height,
+                    1,
+                    format.internalFormat,
+                    format.pixelFormat,
+                    format.dataType,
+                    data,
+                    osg::Image::USE_NEW_DELETE,
+                    textures[0]->getImage()->getPacking());
+    image->setMipmapLevels(offsets);
+
+    osg::ref_ptr<osg::Texture2D> atlas = new osg::Texture2D(image.get());
+    atlas->setWrap(osg::Texture::WRAP_S, (osg::Texture::WrapMode)format.wrapS);
+    atlas->setWrap(osg::Texture::WRAP_T, (osg::Texture::WrapMode)format.wrapT);
+    atlas->setFilter(osg::Texture::MIN_FILTER, (osg::Texture::FilterMode)format.minFilter);
+    atlas->setFilter(osg::Texture::MAG_FILTER, (osg::Texture::FilterMode)format.magFilter);
+
+    std::cout << "Created " << width << "x" << height << " texture atlas holding "
+              << textures.size() << " textures" << std::endl;
+
+    return atlas;
+}
+
+void swgTextureAtlas::remap(const textureUse&    use,
+                            const placement&     place,
+                            const textureFormat& format)
+{
+    osg::Geometry*        geometry = use.geometry.get();
+    const osg::Vec2Array* texCoords =
+        static_cast<const osg::Vec2Array*>(geometry->getTexCoordArray(use.unit));
+
+    // Keep half a texel away from the tile border so filtering does not
+    // pick up the neighbouring texture.
+    float minS = 0.5f / format.width;
+    float minT = 0.5f / format.height;
+
+    // The original array may be shared with meshes that stay unchanged.
+    osg::ref_ptr<osg::Vec2Array> remapped = new osg::Vec2Array;
+    remapped->reserve(texCoords->size());
+    for (unsigned int i = 0; i < texCoords->size(); ++i) {
+        float s = osg::clampBetween((*texCoords)[i].x(), minS, 1.0f - minS);
+        float t = osg::clampBetween((*texCoords)[i].y(), minT, 1.0f - minT);
+        remapped->push_back(
+            osg::Vec2((place.column + s) / place.numColumns, (place.row + t) / place.numRows));
+    }
+    geometry->setTexCoordArray(use.unit, remapped.get());
+
+    osg::ref_ptr<osg::StateSet> stateSet =
+        new osg::StateSet(*geometry->getStateSet(), osg::CopyOp::SHALLOW_COPY);
+    stateSet->setTextureAttributeAndModes(use.unit, place.atlas.get(), osg::StateAttribute::ON);
+    geometry->setStateSet(stateSet.get());
+
+    atlased.push_back(use);
+}
+
+unsigned int swgTextureAtlas::countStates() const
+{
+    std::set<const osg::StateSet*> states;
+    for (unsigned int i = 0; i < candidates.size(); ++i) {
+        states.insert(candidates[i]->getStateSet());
+    }
+
+    return states.size();
+}
+
+void swgTextureAtlas::report(std::ostream& out) const
+{
+    unsigned int numStates = countStates();
+
+    out << "Texture atlases: " << numAtlases << " holding " << numPackedTextures
+        << " textures for " << atlased.size() << " meshes, " << numRepeating
+        << " meshes with repeating texture coordinates";
+    if (0 < atlasTexels) {
+        out << ", " << (100.0 * usedTexels / atlasTexels) << "% utilization";
+    }
+    out << ", " << (numStatesBefore - std::min(numStatesBefore, numStates))
+        << " state switches removed" << std::endl;
+}
@@ -0,0 +1,116 @@
+/** -*-c++-*-
+ *  \file   swgTextureAtlas.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <osg/Geometry>
+#include <osg/Texture2D>
+
+#ifndef SWGTEXTUREATLAS_HPP
+#define SWGTEXTUREATLAS_HPP
+
+/**
+ * Packs small textures of the same format, size and sampling into shared
+ * atlases so the meshes using them can share a state. Textures are placed
+ * on a grid and copied level by level, compressed data block by block, so
+ * nothing is re-encoded. Meshes whose texture coordinates leave [0, 1]
+ * rely on repeating and keep their own texture.
+ */
+class swgTextureAtlas {
+public:
+    swgTextureAtlas(unsigned int maxTextureSize = 256, unsigned int maxAtlasSize = 2048);
+    ~swgTextureAtlas();
+
+    // Consider geometry when build runs.
+    void addGeometry(osg::Geometry* geometry);
+
+    // Pack the textures of all candidates and point the candidates at the
+    // atlases. Texture images must be loaded.
+    void build();
+
+    // Geometries changed by build and the texture unit remapped on each.
+    unsigned int   getNumAtlasedGeometries() const { return atlased.size(); }
+    osg::Geometry* getAtlasedGeometry(unsigned int i) const { return atlased[i].geometry.get(); }
+    unsigned int   getAtlasedUnit(unsigned int i) const { return atlased[i].unit; }
+
+    void report(std::ostream& out) const;
+
+protected:
+    // Textures may only share an atlas when all of this matches.
+    struct textureFormat {
+        GLint        internalFormat;
+        GLenum       pixelFormat;
+        GLenum       dataType;
+        unsigned int width;
+        unsigned int height;
+        unsigned int numLevels;
+        GLint        wrapS;
+        GLint        wrapT;
+        GLint        minFilter;
+        GLint        magFilter;
+
+        bool operator<(const textureFormat& other) const;
+    };
+
+    struct textureUse {
+        osg::ref_ptr<osg::Geometry> geometry;
+        unsigned int                unit;
+    };
+
+    struct placement {
+        osg::ref_ptr<osg::Texture2D> atlas;
+        unsigned int                 column;
+        unsigned int                 row;
+        unsigned int                 numColumns;
+        unsigned int                 numRows;
+    };
+
+    bool getFormat(const osg::Texture2D* texture, textureFormat& format) const;
+
+    osg::ref_ptr<osg::Texture2D> createAtlas(const textureFormat&                format,
+                                             const std::vector<osg::Texture2D*>& textures,
+                                             unsigned int                        numColumns,
+                                             unsigned int                        numRows);
+
+    void remap(const textureUse& use, const placement& place, const textureFormat& format);
+
+    unsigned int countStates() const;
+
+    unsigned int                             maxTextureSize;
+    unsigned int                             maxAtlasSize;
+    std::vector<osg::ref_ptr<osg::Geometry>> candidates;
+    std::vector<textureUse>                  atlased;
+
+    unsigned int       numAtlases;
+    unsigned int       numPackedTextures;
+    unsigned int       numRepeating;
+    unsigned int       numStatesBefore;
+    unsigned long long usedTexels;
+    unsigned long long atlasTexels;
+};
+
+#endif
@@ -0,0 +1,342 @@
+/** -*-c++-*-
+ *  \file   swgTextureManager.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgTextureManager.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <osg/FrameStamp>
+#include <osg/NodeVisitor>
+
+namespace
+{
+bool lessRecentlyUsed(const swgManagedTexture* a, const swgManagedTexture* b)
+{
+    return a->getLastUsedFrame() < b->getLastUsedFrame();
+}
+} // namespace
+
+swgManagedTexture::swgManagedTexture(const std::string& filename)
+    : filename(filename)
+    , lastUsedFrame(0)
+    , reloadRequested(false)
+    , imageBytes(0)
+    , dynamicFrame(0)
+    , evicted(false)
+    , pending(false)
+{
+    // The manager swaps images during the update traversal. The state sets
+    // holding the texture are made DYNAMIC by the manager as well.
+    setDataVariance(osg::Object::DYNAMIC);
+}
+
+void swgManagedTexture::apply(osg::State& state) const
+{
+    const osg::FrameStamp* frameStamp = state.getFrameStamp();
+    if (NULL != frameStamp) {
+        lastUsedFrame = frameStamp->getFrameNumber();
+    }
+
+    // Neither image nor texture object: this texture was evicted and is
+    // visible again.
+    if (NULL == _image.get() && NULL == getTextureObject(state.getContextID())) {
+        reloadRequested = true;
+    }
+
+    osg::Texture2D::apply(state);
+}
+
+swgTextureManager::swgTextureManager()
+    : threadPool(NULL)
+    , numPending(0)
+    , cpuBudget(0)
+    , gpuBudget(0)
+    , unrefImageData(false)
+    , minIdleFrames(2)
+    , numEvictions(0)
+    , numReloads(0)
+{
+    // Shown by textures whose image is still being read.
+    placeholder = new osg::Image;
+    placeholder->allocateImage(1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    memset(placeholder->data(), 255, 4);
+}
+
+swgTextureManager::~swgTextureManager()
+{
+    // Workers still hold this manager.
+    std::unique_lock<std::mutex> lock(decodeMutex);
+    while (0 != numPending) {
+        decodeDone.wait(lock);
+    }
+}
+
+void swgTextureManager::setUnRefImageDataAfterApply(bool unref)
+{
+    unrefImageData = unref;
+    for (unsigned int i = 0; i < textures.size(); ++i) {
+        textures[i]->setUnRefImageDataAfterApply(unref);
+    }
+}
+
+void swgTextureManager::addTexture(swgManagedTexture* texture, osg::Image* image)
+{
+    texture->setUnRefImageDataAfterApply(unrefImageData);
+    setImage(texture, image);
+    textures.push_back(texture);
+}
+
+void swgTextureManager::addTextureAsync(swgManagedTexture* texture)
+{
+    addTexture(texture, placeholder.get());
+    requestImage(texture);
+}
+
+void swgTextureManager::requestImage(swgManagedTexture* texture)
+{
+    if (!readImage) {
+        return;
+    }
+
+    texture->reloadRequested = false;
+
+    if (NULL == threadPool) {
+        osg::ref_ptr<osg::Image> image = readImage(texture->getFilename());
+        if (NULL != image) {
+            texture->releaseGLObjects();
+            setImage(texture, image.get());
+        }
+        return;
+    }
+
+    texture->pending = true;
+    {
+        std::unique_lock<std::mutex> lock(decodeMutex);
+        ++numPending;
+    }
+
+    osg::ref_ptr<swgManagedTexture> pendingTexture(texture);
+    threadPool->run([this, pendingTexture]() {
+        decodedImage decoded;
+        decoded.texture = pendingTexture;
+        decoded.image   = readImage(pendingTexture->getFilename());
+
+        std::unique_lock<std::mutex> lock(decodeMutex);
+        decodedImages.push_back(decoded);
+        --numPending;
+        decodeDone.notify_all();
+    });
+}
+
+void swgTextureManager::applyDecodedImages(unsigned int frameNumber, bool all)
+{
+    std::vector<decodedImage> finished;
+    std::vector<decodedImage> waiting;
+    {
+        std::unique_lock<std::mutex> lock(decodeMutex);
+        finished.swap(decodedImages);
+    }
+
+    for (unsigned int i = 0; i < finished.size(); ++i) {
+        swgManagedTexture* texture = finished[i].texture.get();
+
+        // The previous frame may still draw the texture with its old image.
+        if (!all && !isSwappable(texture, frameNumber)) {
+            waiting.push_back(finished[i]);
+            continue;
+        }
+
+        texture->pending           = false;
+        texture->reloadRequested   = false;
+
+        if (NULL == finished[i].image) {
+            std::cout << "Unable to read texture: " << texture->getFilename() << std::endl;
+            continue;
+        }
+
+        // The texture object still has the size of the previous image.
+        texture->releaseGLObjects();
+        setImage(texture, finished[i].image.get());
+    }
+
+    if (!waiting.empty()) {
+        std::unique_lock<std::mutex> lock(decodeMutex);
+        decodedImages.insert(decodedImages.end(), waiting.begin(), waiting.end());
+    }
+}
+
+void swgTextureManager::flush()
+{
+    {
+        std::unique_lock<std::mutex> lock(decodeMutex);
+        while (0 != numPending) {
+            decodeDone.wait(lock);
+        }
+    }
+
+    // Called between frames, nothing is being drawn.
+    applyDecodedImages(0, true);
+}
+
+bool swgTextureManager::markStateSets(swgManagedTexture* texture, unsigned int frameNumber)
+{
+    const osg::StateAttribute::ParentList& parents = texture->getParents();
+    for (unsigned int i = 0; i < parents.size(); ++i) {
+        if (osg::Object::DYNAMIC != parents[i]->getDataVariance()) {
+            parents[i]->setDataVariance(osg::Object::DYNAMIC);
+            texture->dynamicFrame = frameNumber;
+        }
+    }
+
+    return isSwappable(texture, frameNumber);
+}
+
+bool swgTextureManager::isSwappable(const swgManagedTexture* texture,
+                                    unsigned int             frameNumber) const
+{
+    // State sets marked in this update were still STATIC when the previous
+    // frame was culled, so its draw does not hold back this update.
+    return texture->dynamicFrame < frameNumber;
+}
+
+void swgTextureManager::setImage(swgManagedTexture* texture, osg::Image* image)
+{
+    texture->setImage(image);
+    texture->imageBytes = (NULL != image) ? image->getTotalSizeInBytesIncludingMipmaps() : 0;
+    texture->evicted    = false;
+}
+
+void swgTextureManager::evict(swgManagedTexture* texture, bool releaseGPU)
+{
+    texture->setImage(NULL);
+
+    if (releaseGPU) {
+        texture->releaseGLObjects();
+        texture->evicted = true;
+    }
+
+    ++numEvictions;
+}
+
+unsigned long long swgTextureManager::getCPUBytes(const swgManagedTexture* texture) const
+{
+    return (NULL != texture->getImage()) ? texture->imageBytes : 0;
+}
+
+unsigned long long swgTextureManager::getGPUBytes(const swgManagedTexture* texture) const
+{
+    // A texture is on the GPU once it has been drawn and until it is evicted.
+    return (0 != texture->lastUsedFrame && !texture->evicted) ? texture->imageBytes : 0;
+}
+
+void swgTextureManager::update(unsigned int frameNumber)
+{
+    unsigned long long cpuBytes = 0;
+    unsigned long long gpuBytes = 0;
+
+    std::vector<swgManagedTexture*> idle;
+    std::vector<bool>               swappable(textures.size());
+
+    // Textures may have been added to new state sets since the last frame.
+    for (unsigned int i = 0; i < textures.size(); ++i) {
+        swappable[i] = markStateSets(textures[i].get(), frameNumber);
+    }
+
+    applyDecodedImages(frameNumber, false);
+
+    for (unsigned int i = 0; i < textures.size(); ++i) {
+        swgManagedTexture* texture = textures[i].get();
+
+        if (texture->reloadRequested && !texture->pending && swappable[i]) {
+            requestImage(texture);
+            ++numReloads;
+        }
+
+        cpuBytes += getCPUBytes(texture);
+        gpuBytes += getGPUBytes(texture);
+
+        // Textures drawn in the last few frames belong to visible states.
+        if (swappable[i] && !texture->pending
+            && texture->lastUsedFrame + minIdleFrames < frameNumber
+            && 0 != getCPUBytes(texture) + getGPUBytes(texture)) {
+            idle.push_back(texture);
+        }
+    }
+
+    bool overCPU = (0 != cpuBudget && cpuBytes > cpuBudget);
+    bool overGPU = (0 != gpuBudget && gpuBytes > gpuBudget);
+    if (!overCPU && !overGPU) {
+        return;
+    }
+
+    std::sort(idle.begin(), idle.end(), lessRecentlyUsed);
+
+    for (unsigned int i = 0; i < idle.size() && (overCPU || overGPU); ++i) {
+        swgManagedTexture* texture = idle[i];
+
+        unsigned long long textureCPU = getCPUBytes(texture);
+        unsigned long long textureGPU = getGPUBytes(texture);
+
+        if (overGPU && 0 != textureGPU) {
+            evict(texture, true);
+            cpuBytes -= textureCPU;
+            gpuBytes -= textureGPU;
+        }
+        else if (overCPU && 0 != textureCPU && 0 != textureGPU) {
+            // Already uploaded, the GPU copy is enough until it is evicted.
+            evict(texture, false);
+            cpuBytes -= textureCPU;
+        }
+
+        overCPU = (0 != cpuBudget && cpuBytes > cpuBudget);
+        overGPU = (0 != gpuBudget && gpuBytes > gpuBudget);
+    }
+}
+
+void swgTextureManager::report(std::ostream& out) const
+{
+    unsigned long long cpuBytes   = 0;
+    unsigned long long gpuBytes   = 0;
+    unsigned int       numWaiting = 0;
+    for (unsigned int i = 0; i < textures.size(); ++i) {
+        cpuBytes += getCPUBytes(textures[i].get());
+        gpuBytes += getGPUBytes(textures[i].get());
+        numWaiting += textures[i]->pending ? 1 : 0;
+    }
+
+    out << "Managed textures: " << textures.size() << ", " << cpuBytes << " CPU bytes, "
+        << gpuBytes << " GPU bytes, " << numEvictions << " evictions, " << numReloads
+        << " reloads, " << numWaiting << " pending" << std::endl;
+}
+
+void swgTextureUpdateCallback::operator()(osg::Node* node, osg::NodeVisitor* nv)
+{
+    if (NULL != manager && NULL != nv->getFrameStamp()) {
+        manager->update(nv->getFrameStamp()->getFrameNumber());
+    }
+
+    traverse(node, nv);
+}
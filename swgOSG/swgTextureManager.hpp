@@ -0,0 +1,179 @@
+/** -*-c++-*-
+ *  \file   swgTextureManager.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <osg/Image>
+#include <osg/NodeCallback>
+#include <osg/State>
+#include <osg/Texture2D>
+
+#include "swgThreadPool.hpp"
+
+#ifndef SWGTEXTUREMANAGER_HPP
+#define SWGTEXTUREMANAGER_HPP
+
+/**
+ * Texture whose image can be dropped and read back from the archive.
+ * Applying it records the frame it was last drawn in and, once evicted,
+ * asks the manager to reload its image.
+ */
+class swgManagedTexture : public osg::Texture2D {
+public:
+    swgManagedTexture(const std::string& filename);
+
+    const std::string& getFilename() const { return filename; }
+
+    virtual void apply(osg::State& state) const;
+
+    unsigned int getLastUsedFrame() const { return lastUsedFrame; }
+    bool         isReloadRequested() const { return reloadRequested; }
+    bool         isPending() const { return pending; }
+
+protected:
+    virtual ~swgManagedTexture() {}
+
+    friend class swgTextureManager;
+
+    std::string filename;
+
+    // Written by the draw thread, read by the update thread.
+    mutable std::atomic<unsigned int> lastUsedFrame;
+    mutable std::atomic<bool>         reloadRequested;
+
+    // Bookkeeping owned by the manager.
+    unsigned int imageBytes;
+    unsigned int dynamicFrame;
+    bool         evicted;
+    bool         pending;
+};
+
+/**
+ * Keeps texture memory within a CPU and GPU byte budget. Textures that
+ * have not been drawn recently are evicted least recently used first and
+ * read back transparently when they become visible again.
+ *
+ * With a thread pool set, images are read and decoded on its workers and
+ * swapped into their textures by update, so the reader must be thread safe.
+ *
+ * The state sets holding a managed texture are made DYNAMIC, and a texture
+ * is only changed once they were DYNAMIC while the previous frame was
+ * culled. The viewer then holds update until that frame's draw has used
+ * them, so images are never swapped under a draw still in flight.
+ */
+class swgTextureManager {
+public:
+    typedef std::function<osg::ref_ptr<osg::Image>(const std::string&)> imageReader;
+
+    swgTextureManager();
+    ~swgTextureManager();
+
+    void setImageReader(const imageReader& reader) { readImage = reader; }
+    void setThreadPool(swgThreadPool* pool) { threadPool = pool; }
+
+    // Budgets in bytes, zero disables the limit.
+    void setCPUBudget(unsigned long long bytes) { cpuBudget = bytes; }
+    void setGPUBudget(unsigned long long bytes) { gpuBudget = bytes; }
+
+    // Release image data once it has been uploaded to the GPU.
+    void setUnRefImageDataAfterApply(bool unref);
+
+    // Frames a texture must go undrawn before it may be evicted.
+    void setMinIdleFrames(unsigned int frames) { minIdleFrames = frames; }
+
+    void addTexture(swgManagedTexture* texture, osg::Image* image);
+
+    // Add texture showing a placeholder until its image has been read.
+    void addTextureAsync(swgManagedTexture* texture);
+
+    // Swap in decoded images, reload requested textures and evict until
+    // within budget. Called once per frame from the update traversal.
+    void update(unsigned int frameNumber);
+
+    // Wait for all outstanding reads and swap their images in.
+    void flush();
+
+    void report(std::ostream& out) const;
+
+protected:
+    struct decodedImage {
+        osg::ref_ptr<swgManagedTexture> texture;
+        osg::ref_ptr<osg::Image>        image;
+    };
+
+    bool markStateSets(swgManagedTexture* texture, unsigned int frameNumber);
+    bool isSwappable(const swgManagedTexture* texture, unsigned int frameNumber) const;
+
+    void requestImage(swgManagedTexture* texture);
+    void applyDecodedImages(unsigned int frameNumber, bool all);
+    void setImage(swgManagedTexture* texture, osg::Image* image);
+    void evict(swgManagedTexture* texture, bool releaseGPU);
+
+    unsigned long long getCPUBytes(const swgManagedTexture* texture) const;
+    unsigned long long getGPUBytes(const swgManagedTexture* texture) const;
+
+    imageReader                                  readImage;
+    swgThreadPool*                               threadPool;
+    osg::ref_ptr<osg::Image>                     placeholder;
+    std::vector<osg::ref_ptr<swgManagedTexture>> textures;
+
+    // Images finished by the workers, waiting for update to swap them in.
+    std::mutex                decodeMutex;
+    std::condition_variable   decodeDone;
+    std::vector<decodedImage> decodedImages;
+    unsigned int              numPending;
+
+    unsigned long long cpuBudget;
+    unsigned long long gpuBudget;
+    bool               unrefImageData;
+    unsigned int       minIdleFrames;
+
+    unsigned int numEvictions;
+    unsigned int numReloads;
+};
+
+/**
+ * Update callback driving a texture manager from the scene graph.
+ */
+class swgTextureUpdateCallback : public osg::NodeCallback {
+public:
+    swgTextureUpdateCallback(swgTextureManager* manager)
+        : manager(manager)
+    {
+    }
+
+    virtual void operator()(osg::Node* node, osg::NodeVisitor* nv);
+
+protected:
+    swgTextureManager* manager;
+};
+
+#endif
@@ -0,0 +1,162 @@
+/** -*-c++-*-
+ *  \file   swgThreadPool.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgThreadPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+swgThreadPool::swgThreadPool(unsigned int numThreads)
+    : numRunning(0)
+    , stopping(false)
+{
+    if (0 == numThreads) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned int i = 0; i < numThreads; ++i) {
+        threads.push_back(std::thread(&swgThreadPool::workerLoop, this));
+    }
+}
+
+swgThreadPool::~swgThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+
+    for (unsigned int i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+}
+
+void swgThreadPool::run(const std::function<void()>& task)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        tasks.push_back(task);
+    }
+    taskAvailable.notify_one();
+}
+
+void swgThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!tasks.empty() || 0 != numRunning) {
+        tasksDone.wait(lock);
+    }
+}
+
+void swgThreadPool::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        while (tasks.empty() && !stopping) {
+            taskAvailable.wait(lock);
+        }
+
+        // Finish queued work before shutting down.
+        if (tasks.empty()) {
+            return;
+        }
+
+        std::function<void()> task = tasks.front();
+        tasks.pop_front();
+        ++numRunning;
+
+        lock.unlock();
+        task();
+        lock.lock();
+
+        --numRunning;
+        if (tasks.empty() && 0 == numRunning) {
+            tasksDone.notify_all();
+        }
+    }
+}
+
+namespace
+{
+struct parallelForState {
+    std::atomic<unsigned int> next;
+    unsigned int              numActive;
+    bool                      finished;
+    std::mutex                mutex;
+    std::condition_variable   helpersDone;
+};
+} // namespace
+
+void swgThreadPool::parallelFor(unsigned int                             begin,
+                                unsigned int                             end,
+                                const std::function<void(unsigned int)>& body)
+{
+    if (begin >= end) {
+        return;
+    }
+
+    std::shared_ptr<parallelForState> state(new parallelForState);
+    state->next      = begin;
+    state->numActive = 0;
+    state->finished  = false;
+
+    // Helpers still queued when the caller finishes never touch body, so the
+    // caller only waits for those that already started.
+    const std::function<void(unsigned int)>* work = &body;
+
+    unsigned int numHelpers = std::min(getNumThreads(), end - begin - 1);
+    for (unsigned int i = 0; i < numHelpers; ++i) {
+        run([state, work, end]() {
+            {
+                std::unique_lock<std::mutex> lock(state->mutex);
+                if (state->finished) {
+                    return;
+                }
+                ++state->numActive;
+            }
+
+            for (unsigned int index = state->next++; index < end; index = state->next++) {
+                (*work)(index);
+            }
+
+            std::unique_lock<std::mutex> lock(state->mutex);
+            if (0 == --state->numActive) {
+                state->helpersDone.notify_all();
+            }
+        });
+    }
+
+    for (unsigned int index = state->next++; index < end; index = state->next++) {
+        body(index);
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished = true;
+    while (0 != state->numActive) {
+        state->helpersDone.wait(lock);
+    }
+}
@@ -0,0 +1,74 @@
+/** -*-c++-*-
+ *  \file   swgThreadPool.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef SWGTHREADPOOL_HPP
+#define SWGTHREADPOOL_HPP
+
+/**
+ * Fixed set of worker threads running queued tasks in order.
+ */
+class swgThreadPool {
+public:
+    // Zero threads uses one per hardware thread.
+    swgThreadPool(unsigned int numThreads = 0);
+    ~swgThreadPool();
+
+    unsigned int getNumThreads() const { return threads.size(); }
+
+    // Queue a task to run on a worker thread.
+    void run(const std::function<void()>& task);
+
+    // Block until every queued task has finished.
+    void wait();
+
+    /**
+     * Call body for every index in [begin, end) spread over the workers and
+     * return once all calls are done. The calling thread takes part, so this
+     * also makes progress when called from inside a task.
+     */
+    void parallelFor(unsigned int                             begin,
+                     unsigned int                             end,
+                     const std::function<void(unsigned int)>& body);
+
+protected:
+    void workerLoop();
+
+    std::vector<std::thread>          threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex                        mutex;
+    std::condition_variable           taskAvailable;
+    std::condition_variable           tasksDone;
+    unsigned int                      numRunning;
+    bool                              stopping;
+};
+
+#endif
@@ -0,0 +1,660 @@
+/** -*-c++-*-
+ *  \file   swgTriangleBVH.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgTriangleBVH.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace
+{
+// Bins the surface area heuristic sorts triangle centers into per axis.
+const unsigned int numBins = 16;
+
+// Leaves with no more triangles than this may be kept when splitting them
+// is not worth it.
+const unsigned int maxSAHLeaf = 16;
+
+// Rays handed to one task of a batch.
+const std::size_t raysPerTask = 256;
+
+// Batches smaller than this are traced in the order given.
+const std::size_t minOrderedBatch = 4096;
+
+// Cells per axis of the grid rays are ordered by, as a power of two.
+const unsigned int orderBits = 6;
+
+// Depth below which nodes are halved rather than split by the heuristic,
+// which keeps the tree shallow enough for the traversal stack.
+const unsigned int maxSAHDepth = 64;
+const unsigned int maxStack    = 128;
+
+double getSeconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void cross(const float* a, const float* b, float* result)
+{
+    result[0] = a[1] * b[2] - a[2] * b[1];
+    result[1] = a[2] * b[0] - a[0] * b[2];
+    result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+float dot(const float* a, const float* b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Half the surface area of a box, which is all the heuristic compares.
+float halfArea(const float* min, const float* max)
+{
+    float x = max[0] - min[0];
+    float y = max[1] - min[1];
+    float z = max[2] - min[2];
+    return x * y + y * z + z * x;
+}
+
+void resetBounds(float* min, float* max)
+{
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        min[axis] = std::numeric_limits<float>::max();
+        max[axis] = -std::numeric_limits<float>::max();
+    }
+}
+
+void growBounds(float* min, float* max, const float* otherMin, const float* otherMax)
+{
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        min[axis] = std::min(min[axis], otherMin[axis]);
+        max[axis] = std::max(max[axis], otherMax[axis]);
+    }
+}
+
+// Whether the ray enters the box before maxDistance. Zero direction
+// components are given a huge finite inverse so no product is NaN.
+bool hitsBox(const float* min,
+             const float* max,
+             const float* origin,
+             const float* inverse,
+             float        maxDistance)
+{
+    float nearest  = 0.0f;
+    float farthest = maxDistance;
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        float t0 = (min[axis] - origin[axis]) * inverse[axis];
+        float t1 = (max[axis] - origin[axis]) * inverse[axis];
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        nearest  = std::max(nearest, t0);
+        farthest = std::min(farthest, t1);
+    }
+    return nearest <= farthest;
+}
+} // namespace
+
+swgTriangleBVH::swgTriangleBVH(unsigned int maxTrianglesPerLeaf)
+    : maxTrianglesPerLeaf(std::min(maxSAHLeaf, std::max(1u, maxTrianglesPerLeaf)))
+    , maxDepth(0)
+    , buildSeconds(0.0)
+    , numRays(0)
+    , numRayNanoseconds(0)
+{
+    resetBounds(bounds[0], bounds[1]);
+}
+
+unsigned int swgTriangleBVH::addObject(const std::string& name)
+{
+    objectNames.push_back(name);
+    return objectNames.size() - 1;
+}
+
+void swgTriangleBVH::addTriangle(const float* a, const float* b, const float* c)
+{
+    input added;
+    const float* corners[3] = {a, b, c};
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        for (unsigned int i = 0; i < 3; ++i) {
+            added.vertices[i][axis] = corners[i][axis];
+        }
+        added.min[axis]    = std::min(a[axis], std::min(b[axis], c[axis]));
+        added.max[axis]    = std::max(a[axis], std::max(b[axis], c[axis]));
+        added.center[axis] = (added.min[axis] + added.max[axis]) * 0.5f;
+    }
+
+    // Triangles added before any object belong to an unnamed one.
+    if (objectNames.empty()) {
+        addObject(std::string());
+    }
+    added.object = objectNames.size() - 1;
+
+    inputs.push_back(added);
+}
+
+void swgTriangleBVH::build()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Rebuilding adds the triangles of the last build back in first.
+    for (unsigned int i = 0; i < triangles.size(); ++i) {
+        const triangle& t = triangles[i];
+        float           b[3], c[3];
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            b[axis] = t.corner[axis] + t.edge1[axis];
+            c[axis] = t.corner[axis] + t.edge2[axis];
+        }
+        unsigned int object = t.object;
+        addTriangle(t.corner, b, c);
+        inputs.back().object = object;
+    }
+
+    nodes.clear();
+    triangles.clear();
+    maxDepth = 0;
+    resetBounds(bounds[0], bounds[1]);
+
+    if (!inputs.empty()) {
+        nodes.reserve(2 * inputs.size() / maxTrianglesPerLeaf + 1);
+        triangles.reserve(inputs.size());
+        buildNode(0, inputs.size(), 0);
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            bounds[0][axis] = nodes[0].min[axis];
+            bounds[1][axis] = nodes[0].max[axis];
+        }
+    }
+
+    std::vector<input>().swap(inputs);
+    buildSeconds = getSeconds(start);
+}
+
+unsigned int swgTriangleBVH::buildNode(unsigned int first, unsigned int count, unsigned int depth)
+{
+    unsigned int index = nodes.size();
+    nodes.push_back(node());
+    maxDepth = std::max(maxDepth, depth);
+
+    float min[3], max[3], centerMin[3], centerMax[3];
+    resetBounds(min, max);
+    resetBounds(centerMin, centerMax);
+    for (unsigned int i = first; i < first + count; ++i) {
+        growBounds(min, max, inputs[i].min, inputs[i].max);
+        growBounds(centerMin, centerMax, inputs[i].center, inputs[i].center);
+    }
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        nodes[index].min[axis] = min[axis];
+        nodes[index].max[axis] = max[axis];
+    }
+
+    // Find the cheapest split between bins of triangle centers on any axis.
+    float        bestCost  = std::numeric_limits<float>::max();
+    unsigned int bestAxis  = 0;
+    unsigned int bestSplit = 0;
+    bool binning = count > maxTrianglesPerLeaf && depth < maxSAHDepth;
+    for (unsigned int axis = 0; axis < 3 && binning; ++axis) {
+        float extent = centerMax[axis] - centerMin[axis];
+        if (0.0f >= extent) {
+            continue;
+        }
+
+        unsigned int binCounts[numBins] = {0};
+        float        binMin[numBins][3], binMax[numBins][3];
+        for (unsigned int b = 0; b < numBins; ++b) {
+            resetBounds(binMin[b], binMax[b]);
+        }
+
+        float scale = numBins / extent;
+        for (unsigned int i = first; i < first + count; ++i) {
+            unsigned int b = std::min<unsigned int>(
+                numBins - 1, (inputs[i].center[axis] - centerMin[axis]) * scale);
+            ++binCounts[b];
+            growBounds(binMin[b], binMax[b], inputs[i].min, inputs[i].max);
+        }
+
+        // Sweep from the right recording the cost of each right side, then
+        // from the left adding the cost of each left side.
+        float        rightCost[numBins];
+        float        sideMin[3], sideMax[3];
+        unsigned int sideCount = 0;
+        resetBounds(sideMin, sideMax);
+        for (unsigned int b = numBins - 1; b > 0; --b) {
+            sideCount += binCounts[b];
+            if (0 < binCounts[b]) {
+                growBounds(sideMin, sideMax, binMin[b], binMax[b]);
+            }
+            rightCost[b] = 0 < sideCount ? sideCount * halfArea(sideMin, sideMax) : 0.0f;
+        }
+
+        sideCount = 0;
+        resetBounds(sideMin, sideMax);
+        for (unsigned int b = 0; b + 1 < numBins; ++b) {
+            sideCount += binCounts[b];
+            if (0 < binCounts[b]) {
+                growBounds(sideMin, sideMax, binMin[b], binMax[b]);
+            }
+            if (0 == sideCount || count == sideCount) {
+                continue;
+            }
+            float cost = sideCount * halfArea(sideMin, sideMax) + rightCost[b + 1];
+            if (cost < bestCost) {
+                bestCost  = cost;
+                bestAxis  = axis;
+                bestSplit = b + 1;
+            }
+        }
+    }
+
+    // Keep a leaf when it is small enough, or when splitting it costs more
+    // than testing all its triangles and it is still small.
+    bool leaf = count <= maxTrianglesPerLeaf;
+    if (!leaf && count <= maxSAHLeaf) {
+        leaf = bestCost >= count * halfArea(min, max);
+    }
+
+    if (leaf) {
+        nodes[index].offset = triangles.size();
+        nodes[index].count  = count;
+        nodes[index].axis   = 0;
+        for (unsigned int i = first; i < first + count; ++i) {
+            const input& in = inputs[i];
+            triangle     t;
+            for (unsigned int axis = 0; axis < 3; ++axis) {
+                t.corner[axis] = in.vertices[0][axis];
+                t.edge1[axis]  = in.vertices[1][axis] - in.vertices[0][axis];
+                t.edge2[axis]  = in.vertices[2][axis] - in.vertices[0][axis];
+            }
+            t.object = in.object;
+            triangles.push_back(t);
+        }
+        return index;
+    }
+
+    unsigned int middle = first;
+    if (std::numeric_limits<float>::max() > bestCost) {
+        float scale  = numBins / (centerMax[bestAxis] - centerMin[bestAxis]);
+        auto  isLeft = [&](const input& in) {
+            float b = (in.center[bestAxis] - centerMin[bestAxis]) * scale;
+            return std::min<unsigned int>(numBins - 1, b) < bestSplit;
+        };
+        middle = std::partition(inputs.begin() + first, inputs.begin() + first + count, isLeft) -
+                 inputs.begin();
+    }
+
+    // Centers all in one place, or too many triangles for a leaf: halve
+    // the list along the longest axis.
+    if (first == middle || first + count == middle) {
+        bestAxis = 0;
+        for (unsigned int axis = 1; axis < 3; ++axis) {
+            if (max[axis] - min[axis] > max[bestAxis] - min[bestAxis]) {
+                bestAxis = axis;
+            }
+        }
+        middle = first + count / 2;
+        std::nth_element(inputs.begin() + first,
+                         inputs.begin() + middle,
+                         inputs.begin() + first + count,
+                         [&](const input& a, const input& b) {
+                             return a.center[bestAxis] < b.center[bestAxis];
+                         });
+    }
+
+    nodes[index].count = 0;
+    nodes[index].axis  = bestAxis;
+    buildNode(first, middle - first, depth + 1);
+    unsigned int second = buildNode(middle, first + count - middle, depth + 1);
+    nodes[index].offset = second;
+
+    return index;
+}
+
+bool swgTriangleBVH::intersectTriangle(const triangle& t, const ray& r, float& distance)
+{
+    float p[3];
+    cross(r.direction, t.edge2, p);
+    float determinant = dot(t.edge1, p);
+    if (0.0f == determinant) {
+        return false;
+    }
+    float inverse = 1.0f / determinant;
+
+    float offset[3] = {r.origin[0] - t.corner[0],
+                       r.origin[1] - t.corner[1],
+                       r.origin[2] - t.corner[2]};
+    float u         = dot(offset, p) * inverse;
+    if (0.0f > u || 1.0f < u) {
+        return false;
+    }
+
+    float q[3];
+    cross(offset, t.edge1, q);
+    float v = dot(r.direction, q) * inverse;
+    if (0.0f > v || 1.0f < u + v) {
+        return false;
+    }
+
+    float along = dot(t.edge2, q) * inverse;
+    if (0.0f >= along || along >= distance) {
+        return false;
+    }
+
+    distance = along;
+    return true;
+}
+
+bool swgTriangleBVH::traverse(const ray& r, hit& result, bool anyHit) const
+{
+    result.distance = r.maxDistance;
+    result.triangle = noHit;
+    result.object   = noHit;
+    if (nodes.empty()) {
+        return false;
+    }
+
+    float inverse[3];
+    bool  negative[3];
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        float d         = r.direction[axis];
+        inverse[axis]  = 1.0e-30f < std::fabs(d) ? 1.0f / d : (0.0f > d ? -1.0e30f : 1.0e30f);
+        negative[axis] = 0.0f > d;
+    }
+
+    // Children are visited nearer first, so closer hits shorten the ray
+    // before the farther child is tested. The build keeps the tree less
+    // deep than the stack.
+    unsigned int stack[maxStack];
+    unsigned int depth   = 0;
+    unsigned int current = 0;
+    for (;;) {
+        const node& n = nodes[current];
+        if (hitsBox(n.min, n.max, r.origin, inverse, result.distance)) {
+            if (0 == n.count) {
+                unsigned int nearChild = current + 1;
+                unsigned int farChild  = n.offset;
+                if (negative[n.axis]) {
+                    std::swap(nearChild, farChild);
+                }
+                stack[depth++] = farChild;
+                current        = nearChild;
+                continue;
+            }
+
+            for (unsigned int i = n.offset; i < n.offset + n.count; ++i) {
+                if (intersectTriangle(triangles[i], r, result.distance)) {
+                    result.triangle = i;
+                    result.object   = triangles[i].object;
+                    if (anyHit) {
+                        return true;
+                    }
+                }
+            }
+        }
+
+        if (0 == depth) {
+            break;
+        }
+        current = stack[--depth];
+    }
+
+    return noHit != result.triangle;
+}
+
+bool swgTriangleBVH::intersect(const ray& r, hit& result) const
+{
+    return traverse(r, result, false);
+}
+
+bool swgTriangleBVH::occluded(const ray& r) const
+{
+    hit result;
+    return traverse(r, result, true);
+}
+
+void swgTriangleBVH::intersect(const ray*     rays,
+                               hit*           hits,
+                               std::size_t    n,
+                               swgThreadPool* threadPool) const
+{
+    traceBatch(rays, n, threadPool, [&](std::size_t i) { traverse(rays[i], hits[i], false); });
+}
+
+void swgTriangleBVH::occluded(const ray*     rays,
+                              unsigned char* results,
+                              std::size_t    n,
+                              swgThreadPool* threadPool) const
+{
+    traceBatch(rays, n, threadPool, [&](std::size_t i) {
+        hit result;
+        results[i] = traverse(rays[i], result, true) ? 1 : 0;
+    });
+}
+
+void swgTriangleBVH::orderRays(const ray*                 rays,
+                               std::size_t                n,
+                               std::vector<unsigned int>& order) const
+{
+    order.resize(n);
+    if (minOrderedBatch > n || nodes.empty()) {
+        for (std::size_t i = 0; i < n; ++i) {
+            order[i] = i;
+        }
+        return;
+    }
+
+    // Counting sort by the Morton code of the grid cell over the scene
+    // bounds holding each origin, clamped to the bounds.
+    const unsigned int numCells = 1 << orderBits;
+    float              scale[3];
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        float extent = bounds[1][axis] - bounds[0][axis];
+        scale[axis]  = 0.0f < extent ? numCells / extent : 0.0f;
+    }
+
+    std::vector<unsigned int> keys(n);
+    std::vector<unsigned int> starts((1 << (3 * orderBits)) + 1, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+        unsigned int key = 0;
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            float        offset = (rays[i].origin[axis] - bounds[0][axis]) * scale[axis];
+            unsigned int cell   = std::min(numCells - 1.0f, std::max(0.0f, offset));
+            for (unsigned int bit = 0; bit < orderBits; ++bit) {
+                key |= ((cell >> bit) & 1) << (3 * bit + axis);
+            }
+        }
+        keys[i] = key;
+        ++starts[key + 1];
+    }
+
+    for (unsigned int key = 1; key < starts.size(); ++key) {
+        starts[key] += starts[key - 1];
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        order[starts[keys[i]]++] = i;
+    }
+}
+
+void swgTriangleBVH::traceBatch(const ray*                              rays,
+                                std::size_t                             n,
+                                swgThreadPool*                          threadPool,
+                                const std::function<void(std::size_t)>& trace) const
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<unsigned int> order;
+    orderRays(rays, n, order);
+
+    auto traceTask = [&](unsigned int task) {
+        std::size_t last = std::min(n, (task + 1) * raysPerTask);
+        for (std::size_t i = task * raysPerTask; i < last; ++i) {
+            trace(order[i]);
+        }
+    };
+
+    unsigned int numTasks = (n + raysPerTask - 1) / raysPerTask;
+    if (NULL != threadPool && 1 < numTasks) {
+        threadPool->parallelFor(0, numTasks, traceTask);
+    }
+    else {
+        for (unsigned int task = 0; task < numTasks; ++task) {
+            traceTask(task);
+        }
+    }
+
+    numRays += n;
+    numRayNanoseconds += (unsigned long long)(getSeconds(start) * 1.0e9);
+}
+
+void swgTriangleBVH::createRays(unsigned int seed, bool segments, std::vector<ray>& rays) const
+{
+    std::mt19937                          random(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::normal_distribution<float>       normal(0.0f, 1.0f);
+
+    float size[3];
+    for (unsigned int axis = 0; axis < 3; ++axis) {
+        size[axis] = bounds[1][axis] - bounds[0][axis];
+    }
+    float diagonal = std::sqrt(dot(size, size));
+
+    for (unsigned int i = 0; i < rays.size(); ++i) {
+        ray& r = rays[i];
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            r.origin[axis] = bounds[0][axis] + unit(random) * size[axis];
+        }
+
+        if (segments) {
+            for (unsigned int axis = 0; axis < 3; ++axis) {
+                r.direction[axis] = bounds[0][axis] + unit(random) * size[axis] - r.origin[axis];
+            }
+            r.maxDistance = 1.0f;
+            continue;
+        }
+
+        float length = 0.0f;
+        while (1.0e-6f > length) {
+            for (unsigned int axis = 0; axis < 3; ++axis) {
+                r.direction[axis] = normal(random);
+            }
+            length = std::sqrt(dot(r.direction, r.direction));
+        }
+        for (unsigned int axis = 0; axis < 3; ++axis) {
+            r.direction[axis] /= length;
+        }
+        r.maxDistance = diagonal;
+    }
+}
+
+bool swgTriangleBVH::check(std::ostream& out, unsigned int count) const
+{
+    std::vector<ray> rays(count);
+    createRays(7, false, rays);
+
+    unsigned int numHits       = 0;
+    unsigned int numMismatches = 0;
+    for (unsigned int i = 0; i < rays.size(); ++i) {
+        hit result;
+        intersect(rays[i], result);
+
+        float        nearest = rays[i].maxDistance;
+        unsigned int found   = noHit;
+        for (unsigned int t = 0; t < triangles.size(); ++t) {
+            if (intersectTriangle(triangles[t], rays[i], nearest)) {
+                found = t;
+            }
+        }
+
+        if (noHit != found) {
+            ++numHits;
+        }
+
+        // Ties on shared edges may pick either triangle at the same place.
+        bool agrees = (noHit == found) == (noHit == result.triangle);
+        if (agrees && noHit != found) {
+            agrees = std::fabs(nearest - result.distance) <= 1.0e-4f * (1.0f + nearest);
+        }
+        if (!agrees) {
+            ++numMismatches;
+        }
+    }
+
+    out << "Ray check: " << count << " rays, " << numHits << " hits, " << numMismatches
+        << " differ from testing every triangle" << std::endl;
+    return 0 == numMismatches;
+}
+
+void swgTriangleBVH::benchmark(std::ostream&  out,
+                               swgThreadPool* threadPool,
+                               unsigned int   count) const
+{
+    if (triangles.empty() || 0 == count) {
+        return;
+    }
+
+    std::vector<ray>           rays(count);
+    std::vector<ray>           segments(count);
+    std::vector<hit>           hits(count);
+    std::vector<unsigned char> blocked(count);
+    createRays(1, false, rays);
+    createRays(2, true, segments);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    intersect(&rays[0], &hits[0], count, NULL);
+    double serial = getSeconds(start);
+
+    start = std::chrono::steady_clock::now();
+    intersect(&rays[0], &hits[0], count, threadPool);
+    double parallel = getSeconds(start);
+
+    start = std::chrono::steady_clock::now();
+    occluded(&segments[0], &blocked[0], count, threadPool);
+    double lineOfSight = getSeconds(start);
+
+    unsigned int numHits    = 0;
+    unsigned int numBlocked = 0;
+    for (unsigned int i = 0; i < count; ++i) {
+        numHits += noHit != hits[i].triangle ? 1 : 0;
+        numBlocked += blocked[i];
+    }
+
+    out << "Rays through " << triangles.size() << " triangles: " << (count / serial / 1.0e6)
+        << " M rays/s on one thread, " << (count / parallel / 1.0e6) << " M rays/s on "
+        << (NULL != threadPool ? threadPool->getNumThreads() : 0) << " worker threads ("
+        << (60.0 * count / parallel / 1.0e6) << " M per minute), " << (count / lineOfSight / 1.0e6)
+        << " M line of sight segments/s; " << (100.0 * numHits / count) << "% of rays hit, "
+        << (100.0 * numBlocked / count) << "% of segments blocked" << std::endl;
+}
+
+void swgTriangleBVH::report(std::ostream& out) const
+{
+    out << "Triangle BVH: " << triangles.size() << " triangles of " << objectNames.size()
+        << " objects, " << nodes.size() << " nodes, depth " << maxDepth << ", built in "
+        << buildSeconds << " s, " << numRays << " rays";
+    if (0 < numRayNanoseconds) {
+        out << ", " << (numRays / (numRayNanoseconds * 1.0e-9) / 1.0e6) << " M rays/s";
+    }
+    out << std::endl;
+}
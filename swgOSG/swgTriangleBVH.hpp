@@ -0,0 +1,169 @@
+/** -*-c++-*-
+ *  \file   swgTriangleBVH.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "swgThreadPool.hpp"
+
+#ifndef SWGTRIANGLEBVH_HPP
+#define SWGTRIANGLEBVH_HPP
+
+/**
+ * Bounding volume hierarchy over the triangles of a scene for ray and line
+ * of sight queries without a scene graph. Nodes are split by the surface
+ * area heuristic and stored depth first in one array, the first child of
+ * an inner node right after it. Triangles are kept in leaf order as a
+ * corner and two edges, ready for intersection. Batches of rays are traced
+ * in order of where they start, so neighbours find the nodes they share
+ * still in cache, and spread over the thread pool. Every query is safe to
+ * run from several threads at once after build.
+ */
+class swgTriangleBVH {
+public:
+    // Segment from origin along direction, which need not be unit length,
+    // up to maxDistance times direction.
+    struct ray {
+        float origin[3];
+        float direction[3];
+        float maxDistance;
+    };
+
+    struct hit {
+        float        distance; // in units of the ray direction
+        unsigned int triangle; // noHit when nothing was hit
+        unsigned int object;
+    };
+
+    static const unsigned int noHit = 0xffffffff;
+
+    swgTriangleBVH(unsigned int maxTrianglesPerLeaf = 4);
+
+    // Name what the following triangles belong to, returns its index.
+    unsigned int       addObject(const std::string& name);
+    unsigned int       getNumObjects() const { return objectNames.size(); }
+    const std::string& getObjectName(unsigned int object) const { return objectNames[object]; }
+
+    // Append a triangle of the current object. Call build afterwards.
+    void addTriangle(const float* a, const float* b, const float* c);
+
+    void build();
+
+    unsigned int getNumTriangles() const { return triangles.size(); }
+    unsigned int getNumNodes() const { return nodes.size(); }
+
+    // Bounds of all triangles, valid after build.
+    const float* getMin() const { return bounds[0]; }
+    const float* getMax() const { return bounds[1]; }
+
+    // Nearest hit along r, false when there is none.
+    bool intersect(const ray& r, hit& result) const;
+
+    // True when anything lies on r, stopping at the first hit found.
+    bool occluded(const ray& r) const;
+
+    // The same for n rays at once, on the thread pool when one is given.
+    void intersect(const ray* rays, hit* hits, std::size_t n, swgThreadPool* threadPool) const;
+    void occluded(const ray*     rays,
+                  unsigned char* results,
+                  std::size_t    n,
+                  swgThreadPool* threadPool) const;
+
+    /**
+     * Compare nearest hits of numRays random rays against testing every
+     * triangle, print the result and return whether all agree.
+     */
+    bool check(std::ostream& out, unsigned int numRays) const;
+
+    // Time batches of random rays and segments through the scene bounds.
+    void benchmark(std::ostream& out, swgThreadPool* threadPool, unsigned int numRays) const;
+
+    void report(std::ostream& out) const;
+
+protected:
+    struct node {
+        float          min[3];
+        float          max[3];
+        unsigned int   offset; // first triangle of a leaf, second child otherwise
+        unsigned short count;  // triangles of a leaf, zero otherwise
+        unsigned short axis;   // split axis of an inner node
+    };
+
+    struct triangle {
+        float        corner[3];
+        float        edge1[3];
+        float        edge2[3];
+        unsigned int object;
+    };
+
+    // Triangles of the scene before build, with their bounds.
+    struct input {
+        float        vertices[3][3];
+        float        min[3];
+        float        max[3];
+        float        center[3];
+        unsigned int object;
+    };
+
+    unsigned int buildNode(unsigned int first, unsigned int count, unsigned int depth);
+
+    // Closest hit when anyHit is false, else the first one found.
+    bool traverse(const ray& r, hit& result, bool anyHit) const;
+
+    // Distance of the triangle hit along r if nearer than distance.
+    static bool intersectTriangle(const triangle& t, const ray& r, float& distance);
+
+    // Order in which to trace a batch, rays starting close together next to
+    // each other.
+    void orderRays(const ray* rays, std::size_t n, std::vector<unsigned int>& order) const;
+
+    // Call trace for every ray index of a batch in the order of orderRays.
+    void traceBatch(const ray*                              rays,
+                    std::size_t                             n,
+                    swgThreadPool*                          threadPool,
+                    const std::function<void(std::size_t)>& trace) const;
+
+    // Random rays and segments inside the scene bounds.
+    void createRays(unsigned int seed, bool segments, std::vector<ray>& rays) const;
+
+    unsigned int maxTrianglesPerLeaf;
+
+    std::vector<std::string> objectNames;
+    std::vector<input>       inputs;
+    std::vector<node>        nodes;
+    std::vector<triangle>    triangles;
+    float                    bounds[2][3];
+    unsigned int             maxDepth;
+    double                   buildSeconds;
+
+    mutable std::atomic<unsigned long long> numRays;
+    mutable std::atomic<unsigned long long> numRayNanoseconds;
+};
+
+#endif
@@ -0,0 +1,390 @@
+/** -*-c++-*-
+ *  \file   swgWorldTable.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgWorldTable.hpp"
+#include "swgSIMD.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+template<class T>
+void permute(std::vector<T>& values, const std::vector<unsigned int>& order)
+{
+    std::vector<T> sorted;
+    sorted.reserve(values.size());
+    for (unsigned int i = 0; i < order.size(); ++i) {
+        sorted.push_back(values[order[i]]);
+    }
+    values.swap(sorted);
+}
+} // namespace
+
+swgWorldTable::swgWorldTable()
+    : numOrphans(0)
+{
+}
+
+swgWorldTable::~swgWorldTable() {}
+
+void swgWorldTable::reserve(unsigned int numObjects)
+{
+    ids.reserve(numObjects);
+    parentIds.reserve(numObjects);
+    pathIds.reserve(numObjects);
+    posX.reserve(numObjects);
+    posY.reserve(numObjects);
+    posZ.reserve(numObjects);
+    rotX.reserve(numObjects);
+    rotY.reserve(numObjects);
+    rotZ.reserve(numObjects);
+    rotW.reserve(numObjects);
+}
+
+void swgWorldTable::addObject(unsigned int       id,
+                              unsigned int       parentId,
+                              const std::string& objectFilename,
+                              const float        position[3],
+                              const float        rotation[4])
+{
+    std::map<std::string, unsigned int>::iterator path = pathMap.find(objectFilename);
+    if (pathMap.end() == path) {
+        path = pathMap.insert(std::make_pair(objectFilename, paths.size())).first;
+        paths.push_back(objectFilename);
+    }
+
+    ids.push_back(id);
+    parentIds.push_back(parentId);
+    pathIds.push_back(path->second);
+
+    posX.push_back(position[0]);
+    posY.push_back(position[1]);
+    posZ.push_back(position[2]);
+
+    float x = rotation[0];
+    float y = rotation[1];
+    float z = rotation[2];
+    float w = rotation[3];
+
+    float length = std::sqrt(x * x + y * y + z * z + w * w);
+    if (length > 0.0f) {
+        x /= length;
+        y /= length;
+        z /= length;
+        w /= length;
+    }
+    else {
+        w = 1.0f;
+    }
+
+    // Move the rotation into the space the nodes are drawn in: the file
+    // rotation is inverted and mirrored in z, then turned a quarter about
+    // y. This is the quaternion of flip(R) * rotate(-PI_2, y).
+    const float half = std::sqrt(0.5f);
+    rotX.push_back(half * (x + z));
+    rotY.push_back(half * (y - w));
+    rotZ.push_back(half * (x - z));
+    rotW.push_back(half * (w + y));
+}
+
+void swgWorldTable::resolve()
+{
+    unsigned int numObjects = ids.size();
+
+    idIndex.clear();
+    idIndex.reserve(numObjects);
+    for (unsigned int i = 0; i < numObjects; ++i) {
+        idIndex.push_back(std::make_pair(ids[i], i));
+    }
+    std::sort(idIndex.begin(), idIndex.end());
+
+    // Turn parent ids into indices. Snapshots may list a child before its
+    // parent, so this can only happen once every object is known.
+    numOrphans = 0;
+    parents.assign(numObjects, -1);
+    for (unsigned int i = 0; i < numObjects; ++i) {
+        if (0 == parentIds[i]) {
+            continue;
+        }
+
+        int parent = find(parentIds[i]);
+        if (parent < 0 || static_cast<unsigned int>(parent) == i) {
+            ++numOrphans;
+        }
+        else {
+            parents[i] = parent;
+        }
+    }
+
+    // Find the depth of every object, breaking any parent cycles.
+    const int                 unknown = -1;
+    const int                 walking = -2;
+    std::vector<int>          depth(numObjects, unknown);
+    std::vector<unsigned int> chain;
+    unsigned int              maxDepth = 0;
+    for (unsigned int i = 0; i < numObjects; ++i) {
+        chain.clear();
+        unsigned int current = i;
+        while (unknown == depth[current]) {
+            depth[current] = walking;
+            chain.push_back(current);
+
+            int parent = parents[current];
+            if (parent < 0) {
+                break;
+            }
+            if (walking == depth[parent]) {
+                parents[current] = -1;
+                ++numOrphans;
+                break;
+            }
+            current = parent;
+        }
+
+        for (unsigned int j = chain.size(); j > 0; --j) {
+            unsigned int node   = chain[j - 1];
+            int          parent = parents[node];
+            depth[node]         = (parent < 0) ? 0 : depth[parent] + 1;
+            maxDepth            = std::max(maxDepth, static_cast<unsigned int>(depth[node]));
+        }
+    }
+
+    // Counting sort by depth keeps the original order within a level.
+    std::vector<unsigned int> levelStart(maxDepth + 2, 0);
+    for (unsigned int i = 0; i < numObjects; ++i) {
+        ++levelStart[depth[i] + 1];
+    }
+    for (unsigned int level = 1; level < levelStart.size(); ++level) {
+        levelStart[level] += levelStart[level - 1];
+    }
+
+    std::vector<unsigned int> order(numObjects);
+    std::vector<unsigned int> next(levelStart.begin(), levelStart.end() - 1);
+    for (unsigned int i = 0; i < numObjects; ++i) {
+        order[next[depth[i]]++] = i;
+    }
+
+    reorder(order);
+
+    worldX.resize(numObjects);
+    worldY.resize(numObjects);
+    worldZ.resize(numObjects);
+    worldRotX.resize(numObjects);
+    worldRotY.resize(numObjects);
+    worldRotZ.resize(numObjects);
+    worldRotW.resize(numObjects);
+
+    // Roots are already in world space.
+    for (unsigned int i = 0; i < levelStart[1]; ++i) {
+        worldX[i]    = posX[i];
+        worldY[i]    = posY[i];
+        worldZ[i]    = posZ[i];
+        worldRotX[i] = rotX[i];
+        worldRotY[i] = rotY[i];
+        worldRotZ[i] = rotZ[i];
+        worldRotW[i] = rotW[i];
+    }
+
+    // Every object in a level only depends on the levels before it.
+    for (unsigned int level = 1; level <= maxDepth; ++level) {
+        resolveRange(levelStart[level], levelStart[level + 1]);
+    }
+
+    // Parent ids are only needed while resolving.
+    std::vector<unsigned int>().swap(parentIds);
+}
+
+void swgWorldTable::reorder(const std::vector<unsigned int>& order)
+{
+    unsigned int numObjects = order.size();
+
+    std::vector<int> newIndex(numObjects);
+    for (unsigned int i = 0; i < numObjects; ++i) {
+        newIndex[order[i]] = i;
+    }
+
+    permute(ids, order);
+    permute(pathIds, order);
+    permute(parents, order);
+    permute(posX, order);
+    permute(posY, order);
+    permute(posZ, order);
+    permute(rotX, order);
+    permute(rotY, order);
+    permute(rotZ, order);
+    permute(rotW, order);
+
+    for (unsigned int i = 0; i < numObjects; ++i) {
+        if (parents[i] >= 0) {
+            parents[i] = newIndex[parents[i]];
+        }
+    }
+
+    for (unsigned int i = 0; i < idIndex.size(); ++i) {
+        idIndex[i].second = newIndex[idIndex[i].second];
+    }
+}
+
+void swgWorldTable::resolveRange(unsigned int begin, unsigned int end)
+{
+    unsigned int i = begin;
+
+#ifdef SWG_SIMD_SSE2
+    const __m128 two = _mm_set1_ps(2.0f);
+
+    for (; i + 4 <= end; i += 4) {
+        const int p0 = parents[i];
+        const int p1 = parents[i + 1];
+        const int p2 = parents[i + 2];
+        const int p3 = parents[i + 3];
+
+        // Gather the parents' world transforms.
+        __m128 px  = _mm_set_ps(worldX[p3], worldX[p2], worldX[p1], worldX[p0]);
+        __m128 py  = _mm_set_ps(worldY[p3], worldY[p2], worldY[p1], worldY[p0]);
+        __m128 pz  = _mm_set_ps(worldZ[p3], worldZ[p2], worldZ[p1], worldZ[p0]);
+        __m128 pqx = _mm_set_ps(worldRotX[p3], worldRotX[p2], worldRotX[p1], worldRotX[p0]);
+        __m128 pqy = _mm_set_ps(worldRotY[p3], worldRotY[p2], worldRotY[p1], worldRotY[p0]);
+        __m128 pqz = _mm_set_ps(worldRotZ[p3], worldRotZ[p2], worldRotZ[p1], worldRotZ[p0]);
+        __m128 pqw = _mm_set_ps(worldRotW[p3], worldRotW[p2], worldRotW[p1], worldRotW[p0]);
+
+        __m128 lx  = _mm_loadu_ps(&posX[i]);
+        __m128 ly  = _mm_loadu_ps(&posY[i]);
+        __m128 lz  = _mm_loadu_ps(&posZ[i]);
+        __m128 lqx = _mm_loadu_ps(&rotX[i]);
+        __m128 lqy = _mm_loadu_ps(&rotY[i]);
+        __m128 lqz = _mm_loadu_ps(&rotZ[i]);
+        __m128 lqw = _mm_loadu_ps(&rotW[i]);
+
+        __m128 tx = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(pqy, lz), _mm_mul_ps(pqz, ly)));
+        __m128 ty = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(pqz, lx), _mm_mul_ps(pqx, lz)));
+        __m128 tz = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(pqx, ly), _mm_mul_ps(pqy, lx)));
+
+        __m128 wx = _mm_add_ps(_mm_add_ps(_mm_add_ps(px, lx), _mm_mul_ps(pqw, tx)),
+                               _mm_sub_ps(_mm_mul_ps(pqy, tz), _mm_mul_ps(pqz, ty)));
+        __m128 wy = _mm_add_ps(_mm_add_ps(_mm_add_ps(py, ly), _mm_mul_ps(pqw, ty)),
+                               _mm_sub_ps(_mm_mul_ps(pqz, tx), _mm_mul_ps(pqx, tz)));
+        __m128 wz = _mm_add_ps(_mm_add_ps(_mm_add_ps(pz, lz), _mm_mul_ps(pqw, tz)),
+                               _mm_sub_ps(_mm_mul_ps(pqx, ty), _mm_mul_ps(pqy, tx)));
+
+        __m128 wqw = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(pqw, lqw), _mm_mul_ps(pqx, lqx)),
+                                _mm_add_ps(_mm_mul_ps(pqy, lqy), _mm_mul_ps(pqz, lqz)));
+        __m128 wqx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pqw, lqx), _mm_mul_ps(pqx, lqw)),
+                                _mm_sub_ps(_mm_mul_ps(pqy, lqz), _mm_mul_ps(pqz, lqy)));
+        __m128 wqy = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(pqw, lqy), _mm_mul_ps(pqx, lqz)),
+                                _mm_add_ps(_mm_mul_ps(pqy, lqw), _mm_mul_ps(pqz, lqx)));
+        __m128 wqz = _mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(pqw, lqz), _mm_mul_ps(pqx, lqy)),
+                                           _mm_mul_ps(pqy, lqx)),
+                                _mm_mul_ps(pqz, lqw));
+
+        _mm_storeu_ps(&worldX[i], wx);
+        _mm_storeu_ps(&worldY[i], wy);
+        _mm_storeu_ps(&worldZ[i], wz);
+        _mm_storeu_ps(&worldRotX[i], wqx);
+        _mm_storeu_ps(&worldRotY[i], wqy);
+        _mm_storeu_ps(&worldRotZ[i], wqz);
+        _mm_storeu_ps(&worldRotW[i], wqw);
+    }
+#endif
+
+    for (; i < end; ++i) {
+        const int   p   = parents[i];
+        const float pqx = worldRotX[p];
+        const float pqy = worldRotY[p];
+        const float pqz = worldRotZ[p];
+        const float pqw = worldRotW[p];
+
+        // Rotate the local position by the parent rotation: v + w*t + q x t,
+        // where t = 2 * (q x v).
+        float tx = 2.0f * (pqy * posZ[i] - pqz * posY[i]);
+        float ty = 2.0f * (pqz * posX[i] - pqx * posZ[i]);
+        float tz = 2.0f * (pqx * posY[i] - pqy * posX[i]);
+
+        worldX[i] = worldX[p] + posX[i] + pqw * tx + (pqy * tz - pqz * ty);
+        worldY[i] = worldY[p] + posY[i] + pqw * ty + (pqz * tx - pqx * tz);
+        worldZ[i] = worldZ[p] + posZ[i] + pqw * tz + (pqx * ty - pqy * tx);
+
+        worldRotW[i] = pqw * rotW[i] - pqx * rotX[i] - pqy * rotY[i] - pqz * rotZ[i];
+        worldRotX[i] = pqw * rotX[i] + pqx * rotW[i] + pqy * rotZ[i] - pqz * rotY[i];
+        worldRotY[i] = pqw * rotY[i] - pqx * rotZ[i] + pqy * rotW[i] + pqz * rotX[i];
+        worldRotZ[i] = pqw * rotZ[i] + pqx * rotY[i] - pqy * rotX[i] + pqz * rotW[i];
+    }
+}
+
+int swgWorldTable::find(unsigned int id) const
+{
+    std::vector<std::pair<unsigned int, unsigned int>>::const_iterator found =
+        std::lower_bound(idIndex.begin(), idIndex.end(), std::make_pair(id, 0u));
+
+    if (idIndex.end() == found || found->first != id) {
+        return -1;
+    }
+
+    return found->second;
+}
+
+int swgWorldTable::findPath(const std::string& objectFilename) const
+{
+    std::map<std::string, unsigned int>::const_iterator path = pathMap.find(objectFilename);
+    if (pathMap.end() == path) {
+        return -1;
+    }
+
+    return path->second;
+}
+
+void swgWorldTable::getPosition(unsigned int index, float& x, float& y, float& z) const
+{
+    x = posX[index];
+    y = posY[index];
+    z = posZ[index];
+}
+
+void swgWorldTable::getRotation(unsigned int index, float& x, float& y, float& z, float& w) const
+{
+    x = rotX[index];
+    y = rotY[index];
+    z = rotZ[index];
+    w = rotW[index];
+}
+
+void swgWorldTable::getWorldPosition(unsigned int index, float& x, float& y, float& z) const
+{
+    x = worldX[index];
+    y = worldY[index];
+    z = worldZ[index];
+}
+
+void swgWorldTable::getWorldRotation(unsigned int index,
+                                     float&       x,
+                                     float&       y,
+                                     float&       z,
+                                     float&       w) const
+{
+    x = worldRotX[index];
+    y = worldRotY[index];
+    z = worldRotZ[index];
+    w = worldRotW[index];
+}
@@ -0,0 +1,119 @@
+/** -*-c++-*-
+ *  \file   swgWorldTable.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef SWGWORLDTABLE_HPP
+#define SWGWORLDTABLE_HPP
+
+/**
+ * Compact structure-of-arrays copy of a world snapshot. Objects are kept
+ * ordered so every parent comes before its children, and world space
+ * transforms are resolved one hierarchy level at a time.
+ *
+ * Positions are kept as read. Rotations are normalized and converted on
+ * insertion to the axes the snapshot nodes are drawn in, so a node's local
+ * matrix is rotate(rotation) * translate(position) and the world matrices
+ * match the drawn scene under the snapshot root. Quaternions are stored
+ * as x, y, z, w and composed as world = parent * local.
+ */
+class swgWorldTable {
+public:
+    swgWorldTable();
+    ~swgWorldTable();
+
+    void reserve(unsigned int numObjects);
+
+    // Parent id 0 marks a root object, as in the snapshot file. The rotation
+    // is the quaternion stored in the snapshot.
+    void addObject(unsigned int       id,
+                   unsigned int       parentId,
+                   const std::string& objectFilename,
+                   const float        position[3],
+                   const float        rotation[4]);
+
+    // Order parents before children and compute world transforms. Objects
+    // whose parent is missing are treated as roots.
+    void resolve();
+
+    unsigned int size() const { return ids.size(); }
+
+    unsigned int getId(unsigned int index) const { return ids[index]; }
+    int          getParent(unsigned int index) const { return parents[index]; }
+    unsigned int getPathId(unsigned int index) const { return pathIds[index]; }
+
+    const std::string& getObjectFilename(unsigned int index) const
+    {
+        return paths[pathIds[index]];
+    }
+
+    unsigned int       getNumPaths() const { return paths.size(); }
+    const std::string& getPath(unsigned int pathId) const { return paths[pathId]; }
+
+    // Index of the object with the given id, -1 if there is none.
+    int find(unsigned int id) const;
+
+    // Path id of an object filename, -1 if no object uses it.
+    int findPath(const std::string& objectFilename) const;
+
+    void getPosition(unsigned int index, float& x, float& y, float& z) const;
+    void getRotation(unsigned int index, float& x, float& y, float& z, float& w) const;
+    void getWorldPosition(unsigned int index, float& x, float& y, float& z) const;
+    void getWorldRotation(unsigned int index, float& x, float& y, float& z, float& w) const;
+
+    // Raw world space arrays for bulk processing.
+    const float* getWorldX() const { return worldX.empty() ? NULL : &worldX[0]; }
+    const float* getWorldY() const { return worldY.empty() ? NULL : &worldY[0]; }
+    const float* getWorldZ() const { return worldZ.empty() ? NULL : &worldZ[0]; }
+
+    // Objects that were attached to the root because their parent is missing.
+    unsigned int getNumOrphans() const { return numOrphans; }
+
+protected:
+    void reorder(const std::vector<unsigned int>& order);
+    void resolveRange(unsigned int begin, unsigned int end);
+
+    std::vector<unsigned int> ids;
+    std::vector<unsigned int> parentIds;
+    std::vector<int>          parents;
+    std::vector<unsigned int> pathIds;
+
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> rotX, rotY, rotZ, rotW;
+    std::vector<float> worldX, worldY, worldZ;
+    std::vector<float> worldRotX, worldRotY, worldRotZ, worldRotW;
+
+    // Sorted (id, index) pairs for lookups.
+    std::vector<std::pair<unsigned int, unsigned int>> idIndex;
+
+    std::vector<std::string>            paths;
+    std::map<std::string, unsigned int> pathMap;
+
+    unsigned int numOrphans;
+};
+
+#endif
@@ -0,0 +1,275 @@
+/** -*-c++-*-
+ *  \file   swgZonedElements.cpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "swgZonedElements.hpp"
+
+#include <osg/BufferObject>
+#include <osg/GLExtensions>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/NodeVisitor>
+
+namespace
+{
+// Sets the occlusion of a named zone on every zoned primitive set it finds.
+class zoneOcclusionVisitor : public osg::NodeVisitor {
+public:
+    zoneOcclusionVisitor(const std::string& name, bool occluded)
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+        , name(name)
+        , occluded(occluded)
+        , numChanged(0)
+    {
+    }
+
+    virtual void apply(osg::Geode& geode)
+    {
+        for (unsigned int i = 0; i < geode.getNumDrawables(); ++i) {
+            osg::Geometry* geometry = geode.getDrawable(i)->asGeometry();
+            if (NULL == geometry) {
+                continue;
+            }
+
+            for (unsigned int j = 0; j < geometry->getNumPrimitiveSets(); ++j) {
+                swgZonedElements* zoned =
+                    dynamic_cast<swgZonedElements*>(geometry->getPrimitiveSet(j));
+                int zone = NULL != zoned ? zoned->findZone(name) : -1;
+                if (0 > zone) {
+                    continue;
+                }
+
+                // The draw thread reads the ranges while the next frame updates.
+                geometry->setDataVariance(osg::Object::DYNAMIC);
+                zoned->setZoneOccluded(zone, occluded);
+                ++numChanged;
+            }
+        }
+
+        traverse(geode);
+    }
+
+    std::string  name;
+    bool         occluded;
+    unsigned int numChanged;
+};
+
+// Copies nodes and drawables, but only the zoned primitive sets among the
+// primitives, as DEEP_COPY_PRIMITIVES would. Arrays stay shared.
+class zoneCopyOp : public osg::CopyOp {
+public:
+    zoneCopyOp()
+        : osg::CopyOp(osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES)
+    {
+    }
+
+    virtual osg::PrimitiveSet* operator()(const osg::PrimitiveSet* primitives) const
+    {
+        const swgZonedElements* zoned = dynamic_cast<const swgZonedElements*>(primitives);
+        if (NULL != zoned) {
+            return new swgZonedElements(*zoned, osg::CopyOp::DEEP_COPY_PRIMITIVES);
+        }
+        return const_cast<osg::PrimitiveSet*>(primitives);
+    }
+
+    using osg::CopyOp::operator();
+};
+} // namespace
+
+swgZonedElements::swgZonedElements()
+    : osg::DrawElementsUShort(osg::PrimitiveSet::TRIANGLES)
+{
+}
+
+swgZonedElements::swgZonedElements(const swgZonedElements& other, const osg::CopyOp& copyop)
+    : osg::DrawElementsUShort(other, copyop)
+    , zoneNames(other.zoneNames)
+    , occludedZones(other.occludedZones)
+    , ranges(other.ranges)
+    , runs(other.runs)
+{
+}
+
+unsigned int swgZonedElements::addZone(const std::string& name)
+{
+    zoneNames.push_back(name);
+    occludedZones.push_back(false);
+    return zoneNames.size() - 1;
+}
+
+int swgZonedElements::findZone(const std::string& name) const
+{
+    for (unsigned int zone = 0; zone < zoneNames.size(); ++zone) {
+        if (name == zoneNames[zone]) {
+            return zone;
+        }
+    }
+    return -1;
+}
+
+void swgZonedElements::addRange(const std::vector<unsigned int>& indices,
+                                const std::vector<unsigned int>& zones)
+{
+    range added;
+    added.first = size();
+    added.count = indices.size();
+    for (unsigned int i = 0; i < zones.size(); ++i) {
+        if (zones[i] < zoneNames.size()) {
+            added.zones.push_back(zones[i]);
+        }
+    }
+
+    insert(end(), indices.begin(), indices.end());
+    ranges.push_back(added);
+
+    dirty();
+    updateRuns();
+}
+
+void swgZonedElements::setZoneOccluded(unsigned int zone, bool occluded)
+{
+    if (occludedZones[zone] == occluded) {
+        return;
+    }
+    occludedZones[zone] = occluded;
+    updateRuns();
+}
+
+unsigned int swgZonedElements::getNumDrawnTriangles() const
+{
+    unsigned int numIndices = 0;
+    for (unsigned int i = 0; i < runs.size(); ++i) {
+        numIndices += runs[i].second;
+    }
+    return numIndices / 3;
+}
+
+osg::ref_ptr<swgZonedElements> swgZonedElements::reduce(
+    const std::vector<unsigned int>& remap) const
+{
+    osg::ref_ptr<swgZonedElements> reduced = new swgZonedElements;
+    reduced->zoneNames     = zoneNames;
+    reduced->occludedZones = occludedZones;
+
+    std::vector<unsigned int> indices;
+    for (unsigned int r = 0; r < ranges.size(); ++r) {
+        indices.clear();
+        unsigned int last = ranges[r].first + ranges[r].count;
+        for (unsigned int j = ranges[r].first; j + 2 < last; j += 3) {
+            unsigned int a = (*this)[j];
+            unsigned int b = (*this)[j + 1];
+            unsigned int c = (*this)[j + 2];
+            if (a < remap.size() && b < remap.size() && c < remap.size()) {
+                a = remap[a];
+                b = remap[b];
+                c = remap[c];
+            }
+            if (a != b && b != c && a != c) {
+                indices.push_back(a);
+                indices.push_back(b);
+                indices.push_back(c);
+            }
+        }
+        reduced->addRange(indices, ranges[r].zones);
+    }
+
+    return reduced;
+}
+
+bool swgZonedElements::isVisible(const range& current) const
+{
+    if (current.zones.empty()) {
+        return true;
+    }
+    for (unsigned int i = 0; i < current.zones.size(); ++i) {
+        if (!occludedZones[current.zones[i]]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void swgZonedElements::updateRuns()
+{
+    runs.clear();
+    for (unsigned int r = 0; r < ranges.size(); ++r) {
+        if (0 == ranges[r].count || !isVisible(ranges[r])) {
+            continue;
+        }
+
+        if (!runs.empty() && runs.back().first + runs.back().second == ranges[r].first) {
+            runs.back().second += ranges[r].count;
+        }
+        else {
+            runs.push_back(std::make_pair(ranges[r].first, ranges[r].count));
+        }
+    }
+}
+
+void swgZonedElements::draw(osg::State& state, bool useVertexBufferObjects) const
+{
+    // Nothing occluded draws the whole list as usual.
+    if (1 == runs.size() && 0 == runs[0].first && size() == runs[0].second) {
+        osg::DrawElementsUShort::draw(state, useVertexBufferObjects);
+        return;
+    }
+
+    const GLubyte* indices = reinterpret_cast<const GLubyte*>(empty() ? NULL : &front());
+    if (useVertexBufferObjects) {
+        osg::GLBufferObject* ebo = getOrCreateGLBufferObject(state.getContextID());
+        state.bindElementBufferObject(ebo);
+        if (NULL != ebo) {
+            indices = reinterpret_cast<const GLubyte*>(ebo->getOffset(getBufferIndex()));
+        }
+    }
+
+    // Instanced copies draw every run once per instance, as the base class
+    // draws the whole list.
+    const osg::GLExtensions* extensions = state.get<osg::GLExtensions>();
+    for (unsigned int i = 0; i < runs.size(); ++i) {
+        const GLvoid* first = indices + runs[i].first * sizeof(GLushort);
+        if (0 < _numInstances) {
+            extensions->glDrawElementsInstanced(
+                _mode, runs[i].second, GL_UNSIGNED_SHORT, first, _numInstances);
+        }
+        else {
+            glDrawElements(_mode, runs[i].second, GL_UNSIGNED_SHORT, first);
+        }
+    }
+}
+
+unsigned int swgZonedElements::setZoneOccluded(osg::Node&         node,
+                                               const std::string& name,
+                                               bool               occluded)
+{
+    zoneOcclusionVisitor visitor(name, occluded);
+    node.accept(visitor);
+    return visitor.numChanged;
+}
+
+osg::ref_ptr<osg::Node> swgZonedElements::cloneZones(const osg::Node& node)
+{
+    zoneCopyOp copyop;
+    return static_cast<osg::Node*>(node.clone(copyop));
+}
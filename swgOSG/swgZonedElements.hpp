@@ -0,0 +1,113 @@
+/** -*-c++-*-
+ *  \file   swgZonedElements.hpp
+ *  \author Kenneth R. Sewell III
+
+ Visualization of SWG data files.
+ Copyright (C) 2009 Kenneth R. Sewell III
+
+ This file is part of swgOSG.
+
+ swgOSG is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ swgOSG is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with swgOSG; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osg/CopyOp>
+#include <osg/Node>
+#include <osg/PrimitiveSet>
+#include <osg/State>
+
+#ifndef SWGZONEDELEMENTS_HPP
+#define SWGZONEDELEMENTS_HPP
+
+/**
+ * Triangle list of a skinned mesh split into ranges by occlusion zone, all
+ * in one index buffer. Worn items occlude the zones of the body they cover;
+ * a range is left out of drawing once every zone it lies in is occluded,
+ * and the ranges still drawn are issued as few contiguous draws as
+ * possible. Every node sharing the primitive set sees the same zones, so
+ * characters wearing different items need their own copies, which
+ * cloneZones provides.
+ */
+class swgZonedElements : public osg::DrawElementsUShort {
+public:
+    swgZonedElements();
+    swgZonedElements(const swgZonedElements& other,
+                     const osg::CopyOp&      copyop = osg::CopyOp::SHALLOW_COPY);
+
+    META_Object(swgOSG, swgZonedElements);
+
+    // Name a zone, returns its index.
+    unsigned int       addZone(const std::string& name);
+    unsigned int       getNumZones() const { return zoneNames.size(); }
+    const std::string& getZoneName(unsigned int zone) const { return zoneNames[zone]; }
+
+    // Index of the zone called name, -1 when there is none.
+    int findZone(const std::string& name) const;
+
+    // Append triangles hidden once all of zones are occluded. Triangles in
+    // no zone are always drawn.
+    void addRange(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& zones);
+
+    unsigned int getNumRanges() const { return ranges.size(); }
+
+    void setZoneOccluded(unsigned int zone, bool occluded);
+    bool isZoneOccluded(unsigned int zone) const { return occludedZones[zone]; }
+
+    // Triangles left after occlusion.
+    unsigned int getNumDrawnTriangles() const;
+
+    // Copy with the same zones and ranges, vertices renamed through remap
+    // and triangles that collapse dropped.
+    osg::ref_ptr<swgZonedElements> reduce(const std::vector<unsigned int>& remap) const;
+
+    virtual void draw(osg::State& state, bool useVertexBufferObjects) const;
+
+    // Occlude or reveal the zone called name on every zoned primitive set
+    // under node, returns how many were changed.
+    static unsigned int setZoneOccluded(osg::Node& node, const std::string& name, bool occluded);
+
+    /**
+     * Copy of the graph under node for one character, down to copies of
+     * its zoned primitive sets so zones occluded on it leave node and
+     * other copies alone. Other primitive sets, arrays and state stay
+     * shared.
+     */
+    static osg::ref_ptr<osg::Node> cloneZones(const osg::Node& node);
+
+protected:
+    virtual ~swgZonedElements() {}
+
+    struct range {
+        unsigned int              first;
+        unsigned int              count;
+        std::vector<unsigned int> zones;
+    };
+
+    bool isVisible(const range& current) const;
+
+    // Merge the visible ranges into runs of indices to draw.
+    void updateRuns();
+
+    std::vector<std::string>                           zoneNames;
+    std::vector<bool>                                  occludedZones;
+    std::vector<range>                                 ranges;
+    std::vector<std::pair<unsigned int, unsigned int>> runs;
+};
+
+#endif